@@ -0,0 +1,71 @@
+#include "artcache.h"
+#include "artstore.h"
+#include <QtConcurrent/QtConcurrentRun>
+
+// One thread is enough, art is requested a track at a time
+// 32 MiB holds a few hundred 150 px covers
+ArtCache::ArtCache(QObject *parent)
+    : QObject{parent}, cache(32 * 1024), pool(this)
+{
+    pool.setMaxThreadCount(1);
+}
+
+// Waits for a running load so it does not outlive the cache
+ArtCache::~ArtCache()
+{
+    pool.waitForDone();
+}
+
+// Returns the art loaded for image at size, or a null pixmap if it is not cached
+QPixmap ArtCache::find(const QString &image, int size)
+{
+    QPixmap *art = cache.object(key(image, size));
+    return art ? *art : QPixmap();
+}
+
+// Loads the thumbnail of image at size and emits artLoaded once it is ready
+// A request for art that is already being loaded is answered by the same load
+void ArtCache::request(const QString &image, int size)
+{
+    QString artKey = key(image, size);
+    if (loading.contains(artKey)) { return; }
+
+    QPixmap *cached = cache.object(artKey);
+    if (cached) { emit artLoaded(image, size, *cached); return; }
+
+    loading.insert(artKey);
+
+    // QImage can be read on any thread, the pixmap is made on the GUI thread
+    QtConcurrent::run(&pool, [image, size]() { return ArtStore::loadThumbnail(image, size); })
+        .then(this, [this, image, size, artKey](const QImage &loaded) {
+            loading.remove(artKey);
+
+            QPixmap art = QPixmap::fromImage(loaded);
+            if (!art.isNull())
+            {
+                cache.insert(artKey, new QPixmap(art), qMax<qsizetype>(1, loaded.sizeInBytes() / 1024));
+            }
+            emit artLoaded(image, size, art);
+        });
+}
+
+// Sets how many kilobytes of pixmaps are kept, the least recently used are dropped first
+void ArtCache::setMaxCost(int kilobytes)
+{
+    cache.setMaxCost(kilobytes);
+}
+
+int ArtCache::maxCost()
+{
+    return cache.maxCost();
+}
+
+void ArtCache::clear()
+{
+    cache.clear();
+}
+
+QString ArtCache::key(const QString &image, int size)
+{
+    return QString::number(size) + ':' + image;
+}
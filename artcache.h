@@ -0,0 +1,40 @@
+#ifndef ARTCACHE_H
+#define ARTCACHE_H
+
+#include <QObject>
+#include <QCache>
+#include <QSet>
+#include <QPixmap>
+#include <QThreadPool>
+
+// Album art for the views, decoded off the GUI thread
+//
+// request reads the thumbnail of an image on a worker thread and hands it back through
+// artLoaded, find returns art that was loaded before without touching the disk.
+// Pixmaps are kept in a least recently used cache bounded by their size in kilobytes.
+class ArtCache : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ArtCache(QObject *parent = nullptr);
+    ~ArtCache();
+
+    QPixmap find(const QString &image, int size);
+    void request(const QString &image, int size);
+    void setMaxCost(int kilobytes);
+    int maxCost();
+    void clear();
+
+signals:
+    // art is null if the image could not be read
+    void artLoaded(const QString &image, int size, const QPixmap &art);
+
+private:
+    static QString key(const QString &image, int size);
+
+    QCache<QString, QPixmap> cache;
+    QSet<QString> loading;
+    QThreadPool pool;
+};
+
+#endif // ARTCACHE_H
@@ -0,0 +1,252 @@
+#include "artstore.h"
+#include "xxhash.h"
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QPainter>
+#include <QDebug>
+
+// Number of albums whose art is kept for comparing against the next tracks
+static const int recentAlbums = 32;
+
+ArtStore::ArtStore()
+{
+}
+
+// Sets the folder art is written to, it is created if it does not exist
+void ArtStore::setDirectory(const QString &directory)
+{
+    QMutexLocker locker(&lock);
+    if (directory == artDirectory) { return; }
+
+    artDirectory = directory;
+    stored.clear();
+    recent.clear();
+    QDir().mkpath(artDirectory);
+}
+
+QString ArtStore::directory()
+{
+    QMutexLocker locker(&lock);
+    return artDirectory;
+}
+
+// Returns the path of the image file holding data, writing it if it is not stored yet
+// artist and album are only used to recognise repeats without hashing
+// Returns an empty string if data is empty or could not be written
+QString ArtStore::store(const QString &artist, const QString &album, const QByteArray &data, const QString &mimeType)
+{
+    if (data.isEmpty()) { return QString(); }
+
+    QString albumKey = artist + QChar(0x1f) + album;
+    QString path = lookupRecent(albumKey, data);
+    if (!path.isEmpty()) { return path; }
+
+    quint64 key = hash(data);
+
+    QString directory;
+    {
+        QMutexLocker locker(&lock);
+        path = stored.value(key);
+        directory = artDirectory;
+    }
+
+    if (path.isEmpty())
+    {
+        path = directory + QString("/%1.%2").arg(key, 16, 16, QChar('0')).arg(suffix(data, mimeType));
+
+        // Left by an earlier scan
+        if (!QFile::exists(path))
+        {
+            // Written to a temporary file and renamed, a worker storing the same art at the same time
+            // replaces it with identical bytes and nobody reads a partial file
+            QSaveFile file(path);
+            if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+            {
+                qDebug() << "Could not write album art" << path << file.errorString();
+                return QString();
+            }
+
+            writeThumbnails(path);
+
+            QMutexLocker locker(&lock);
+            written++;
+            bytes += data.size();
+        }
+
+        QMutexLocker locker(&lock);
+        stored.insert(key, path);
+    }
+
+    addRecent(albumKey, data, path);
+    return path;
+}
+
+// Returns the path stored for album if its art is the same as data
+QString ArtStore::lookupRecent(const QString &album, const QByteArray &data)
+{
+    QMutexLocker locker(&lock);
+    for (const RecentArt &art : std::as_const(recent))
+    {
+        // Sizes differ for almost every other image, so the byte comparison rarely runs to the end for a mismatch
+        if (art.album == album && art.data.size() == data.size() && art.data == data) { return art.path; }
+    }
+    return QString();
+}
+
+// Remembers the art of an album, the oldest album is dropped once recentAlbums are kept
+void ArtStore::addRecent(const QString &album, const QByteArray &data, const QString &path)
+{
+    QMutexLocker locker(&lock);
+    for (qsizetype i = 0; i < recent.size(); i++)
+    {
+        if (recent[i].album == album) { recent.removeAt(i); break; }
+    }
+
+    recent.prepend(RecentArt {album, data, path});
+    if (recent.size() > recentAlbums) recent.removeLast();
+}
+
+// Clears the counters reported by filesWritten and bytesWritten
+void ArtStore::resetStats()
+{
+    QMutexLocker locker(&lock);
+    written = 0;
+    bytes = 0;
+}
+
+// Number of image files written since resetStats
+int ArtStore::filesWritten()
+{
+    QMutexLocker locker(&lock);
+    return written;
+}
+
+// Size of the image files written since resetStats
+qint64 ArtStore::bytesWritten()
+{
+    QMutexLocker locker(&lock);
+    return bytes;
+}
+
+// XXH64 of data, see xxHash64
+quint64 ArtStore::hash(const QByteArray &data)
+{
+    return xxHash64(data.constData(), data.size());
+}
+
+// Returns the file suffix for an image, from its signature or else the tagged mime type
+QString ArtStore::suffix(const QByteArray &data, const QString &mimeType)
+{
+    if (data.startsWith("\xFF\xD8\xFF")) { return "jpg"; }
+    if (data.startsWith("\x89PNG")) { return "png"; }
+    if (data.startsWith("GIF8")) { return "gif"; }
+    if (data.startsWith("BM")) { return "bmp"; }
+    if (data.startsWith("RIFF") && data.mid(8, 4) == "WEBP") { return "webp"; }
+
+    if (mimeType.endsWith("png")) { return "png"; }
+    if (mimeType.endsWith("bmp")) { return "bmp"; }
+    return "jpg";
+}
+
+// Edge lengths of the thumbnails written for every image
+// 64 for lists, 150 for the now playing panel and 512 for MPRIS clients
+QList<int> ArtStore::thumbnailSizes()
+{
+    return {64, 150, 512};
+}
+
+// Returns where the thumbnail of an image is stored, whether or not it exists
+QString ArtStore::thumbnailPath(const QString &image, int size)
+{
+    QFileInfo info(image);
+    return info.path() + QString("/%1/").arg(size) + info.completeBaseName() + ".jpg";
+}
+
+// Returns the thumbnail of an image if it exists, the image itself otherwise
+QString ArtStore::thumbnail(const QString &image, int size)
+{
+    if (image.isEmpty()) { return image; }
+
+    QString path = thumbnailPath(image, size);
+    return QFile::exists(path) ? path : image;
+}
+
+// Writes the thumbnails of an image
+// The image is decoded once at the largest size, the reader can skip most of the work
+// for JPEG, and the smaller sizes are scaled from that
+bool ArtStore::writeThumbnails(const QString &image)
+{
+    QList<int> sizes = thumbnailSizes();
+
+    QImageReader reader(image);
+    reader.setAutoTransform(true);
+    QSize full = reader.size();
+    if (full.isValid() && (full.width() > sizes.last() || full.height() > sizes.last()))
+    {
+        reader.setScaledSize(full.scaled(sizes.last(), sizes.last(), Qt::KeepAspectRatio));
+    }
+
+    QImage art = reader.read();
+    if (art.isNull())
+    {
+        qDebug() << "Could not read album art" << image << reader.errorString();
+        return false;
+    }
+
+    // JPEG has no alpha channel, transparent art is put on white instead of black
+    if (art.hasAlphaChannel())
+    {
+        QImage opaque(art.size(), QImage::Format_RGB32);
+        opaque.fill(Qt::white);
+        QPainter(&opaque).drawImage(0, 0, art);
+        art = opaque;
+    }
+
+    for (qsizetype i = sizes.size() - 1; i >= 0; i--)
+    {
+        int size = sizes[i];
+        if (art.width() > size || art.height() > size)
+        {
+            art = art.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        }
+
+        QString path = thumbnailPath(image, size);
+        QDir().mkpath(QFileInfo(path).path());
+
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly) || !art.save(&file, "JPG", 90) || !file.commit())
+        {
+            qDebug() << "Could not write thumbnail" << path << file.errorString();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Reads the thumbnail of an image at one of thumbnailSizes
+// Art stored before thumbnails existed gets them written on first use
+// Returns a null image if the image cannot be read
+QImage ArtStore::loadThumbnail(const QString &image, int size)
+{
+    if (image.isEmpty()) { return QImage(); }
+
+    QString path = thumbnailPath(image, size);
+    if (!QFile::exists(path)) writeThumbnails(image);
+
+    QImage art(path);
+    if (!art.isNull()) { return art; }
+
+    // Sizes without thumbnails and images that could not be written are scaled from the original
+    QImageReader reader(image);
+    reader.setAutoTransform(true);
+    QSize full = reader.size();
+    if (full.isValid() && (full.width() > size || full.height() > size))
+    {
+        reader.setScaledSize(full.scaled(size, size, Qt::KeepAspectRatio));
+    }
+    return reader.read();
+}
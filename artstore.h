@@ -0,0 +1,64 @@
+#ifndef ARTSTORE_H
+#define ARTSTORE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QImage>
+
+// Stores embedded album art as the image files they were tagged with
+//
+// The bytes from the tag are written unchanged under a 64 bit hash of their contents,
+// so a cover shared by many tracks or albums is stored once and never decoded.
+// The tracks of an album are usually read one after another, the art of recently seen
+// albums is kept so a repeat is recognised by comparing bytes before anything is hashed.
+//
+// Each new image also gets thumbnails of thumbnailSizes pixels in subfolders named by size,
+// so views and MPRIS never have to decode and scale a full size cover.
+//
+// All functions may be called from any thread
+class ArtStore
+{
+public:
+    ArtStore();
+
+    void setDirectory(const QString &directory);
+    QString directory();
+    QString store(const QString &artist, const QString &album, const QByteArray &data, const QString &mimeType);
+
+    void resetStats();
+    int filesWritten();
+    qint64 bytesWritten();
+
+    static quint64 hash(const QByteArray &data);
+    static QString suffix(const QByteArray &data, const QString &mimeType);
+
+    static QList<int> thumbnailSizes();
+    static QString thumbnailPath(const QString &image, int size);
+    static QString thumbnail(const QString &image, int size);
+    static bool writeThumbnails(const QString &image);
+    static QImage loadThumbnail(const QString &image, int size);
+
+private:
+    // Art of an album seen recently, data is implicitly shared with the tag it came from
+    struct RecentArt
+    {
+        QString album;
+        QByteArray data;
+        QString path;
+    };
+
+    QString lookupRecent(const QString &album, const QByteArray &data);
+    void addRecent(const QString &album, const QByteArray &data, const QString &path);
+
+    QMutex lock;
+    QString artDirectory;
+    QHash<quint64, QString> stored;
+    QList<RecentArt> recent;
+    int written = 0;
+    qint64 bytes = 0;
+};
+
+#endif // ARTSTORE_H
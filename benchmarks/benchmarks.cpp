@@ -0,0 +1,74 @@
+#include "benchmarks.h"
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QTextStream>
+#include <algorithm>
+
+// Times run, calling setup untimed before every run
+// Runs at least once and at most repeat times, fewer if the budget is used up
+void Benchmarks::measure(const QString &name, const QString &backend, int rows,
+                         const std::function<void()> &setup, const std::function<void()> &run)
+{
+    QString key = name + '/' + backend;
+
+    QJsonObject result;
+    result["benchmark"] = name;
+    result["backend"] = backend;
+    result["rows"] = rows;
+
+    if (skipped.contains(key))
+    {
+        result["skipped"] = skipped.value(key);
+        results.append(result);
+        return;
+    }
+
+    QList<qint64> samples;
+    qint64 total = 0;
+    QElapsedTimer timer;
+
+    while (samples.size() < settings.repeat && (samples.isEmpty() || total < settings.budgetNs))
+    {
+        if (setup) setup();
+
+        timer.start();
+        run();
+        qint64 elapsed = timer.nsecsElapsed();
+
+        samples.append(elapsed);
+        total += elapsed;
+
+        if (elapsed > settings.timeoutNs)
+        {
+            skipped.insert(key, QString("a run took longer than the timeout at %1 rows").arg(rows));
+            break;
+        }
+    }
+
+    QList<qint64> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    QJsonArray runs;
+    for (qint64 sample : std::as_const(samples)) runs.append(sample);
+
+    result["iterations"] = samples.size();
+    result["min_ns"] = sorted.first();
+    result["median_ns"] = sorted[sorted.size() / 2];
+    result["mean_ns"] = total / samples.size();
+    result["runs_ns"] = runs;
+    results.append(result);
+
+    QTextStream(stderr) << QString("%1 %2 %3 rows: median %4 ms over %5 runs\n")
+                           .arg(name, -16).arg(backend, -8).arg(rows, 8)
+                           .arg(sorted[sorted.size() / 2] / 1e6, 0, 'f', 3).arg(samples.size());
+}
+
+// Adds field to the last result, for numbers a benchmark counts besides its time
+void Benchmarks::annotate(const QString &field, const QJsonValue &value)
+{
+    if (results.isEmpty()) return;
+
+    QJsonObject result = results.last().toObject();
+    result[field] = value;
+    results.replace(results.size() - 1, result);
+}
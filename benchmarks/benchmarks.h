@@ -0,0 +1,38 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <QString>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonValue>
+#include <functional>
+
+struct BenchmarkSettings
+{
+    int repeat = 5;
+    qint64 budgetNs = 2000000000;   // runs of one benchmark stop once they took this long
+    qint64 timeoutNs = 30000000000; // a single run longer than this skips the larger sizes
+};
+
+// Times benchmarks and collects their results as JSON
+//
+// Every result names the benchmark, backend and rows with the timings of every run in
+// nanoseconds. A benchmark whose run took longer than the timeout is listed as skipped
+// at every later size.
+class Benchmarks
+{
+public:
+    explicit Benchmarks(const BenchmarkSettings &settings) : settings(settings) {}
+
+    void measure(const QString &name, const QString &backend, int rows,
+                 const std::function<void()> &setup, const std::function<void()> &run);
+    void annotate(const QString &field, const QJsonValue &value);
+
+    QJsonArray results;
+
+private:
+    BenchmarkSettings settings;
+    QHash<QString, QString> skipped;
+};
+
+#endif // BENCHMARKS_H
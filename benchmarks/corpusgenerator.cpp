@@ -0,0 +1,393 @@
+#include "corpusgenerator.h"
+#include "librarygenerator.h"
+#include <QImage>
+#include <QBuffer>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+// Titles outside Latin-1, so the UTF-16 and UTF-8 paths of the tag reader are taken
+static const char *const foreignWords[] = {
+    "Café", "Noël", "Straße", "Ночь", "夜明け", "바다", "Ωμέγα",
+};
+static const int foreignWordCount = sizeof(foreignWords) / sizeof(foreignWords[0]);
+
+static QByteArray be16(quint32 value)
+{
+    QByteArray ret(2, '\0');
+    ret[0] = char(value >> 8);
+    ret[1] = char(value);
+    return ret;
+}
+
+static QByteArray be24(quint32 value)
+{
+    QByteArray ret(3, '\0');
+    ret[0] = char(value >> 16);
+    ret[1] = char(value >> 8);
+    ret[2] = char(value);
+    return ret;
+}
+
+static QByteArray be32(quint32 value)
+{
+    return be16(value >> 16) + be16(value);
+}
+
+static QByteArray be64(quint64 value)
+{
+    return be32(quint32(value >> 32)) + be32(quint32(value));
+}
+
+static QByteArray le32(quint32 value)
+{
+    QByteArray ret(4, '\0');
+    for (int i = 0; i < 4; i++) ret[i] = char(value >> (8 * i));
+    return ret;
+}
+
+// ID3v2 sizes are stored as four 7 bit bytes
+static QByteArray syncsafe(quint32 value)
+{
+    QByteArray ret(4, '\0');
+    for (int i = 0; i < 4; i++) ret[3 - i] = char((value >> (7 * i)) & 0x7F);
+    return ret;
+}
+
+static QByteArray id3Frame(const QByteArray &id, const QByteArray &body, int version)
+{
+    return id + (version == 4 ? syncsafe(body.size()) : be32(body.size())) + QByteArray(2, '\0') + body;
+}
+
+// v2.4 text is written as UTF-8, v2.3 as UTF-16 with a byte order mark like most taggers do
+static QByteArray id3Text(const QByteArray &id, const QString &text, int version)
+{
+    QByteArray body;
+    if (version == 4)
+    {
+        body.append(char(3));
+        body.append(text.toUtf8());
+    }
+    else
+    {
+        body.append(char(1));
+        body.append("\xFF\xFE", 2);
+        for (QChar c : text)
+        {
+            body.append(char(c.unicode() & 0xFF));
+            body.append(char(c.unicode() >> 8));
+        }
+    }
+    return id3Frame(id, body, version);
+}
+
+static QByteArray mp4Atom(const QByteArray &type, const QByteArray &body)
+{
+    return be32(8 + body.size()) + type + body;
+}
+
+static QByteArray mp4Item(const QByteArray &type, int dataType, const QByteArray &value)
+{
+    return mp4Atom(type, mp4Atom("data", be32(dataType) + be32(0) + value));
+}
+
+static QByteArray flacBlock(int type, const QByteArray &body, bool last)
+{
+    return QByteArray(1, char((last ? 0x80 : 0) | type)) + be24(body.size()) + body;
+}
+
+// CRC-8 of FLAC frame headers, polynomial x^8 + x^2 + x + 1
+static quint8 crc8(const QByteArray &data)
+{
+    quint8 crc = 0;
+    for (char byte : data)
+    {
+        crc ^= quint8(byte);
+        for (int i = 0; i < 8; i++) crc = (crc & 0x80) ? quint8((crc << 1) ^ 0x07) : quint8(crc << 1);
+    }
+    return crc;
+}
+
+// CRC-16 of FLAC frames, polynomial x^16 + x^15 + x^2 + 1
+static quint16 crc16(const QByteArray &data)
+{
+    quint16 crc = 0;
+    for (char byte : data)
+    {
+        crc ^= quint16(quint8(byte)) << 8;
+        for (int i = 0; i < 8; i++) crc = (crc & 0x8000) ? quint16((crc << 1) ^ 0x8005) : quint16(crc << 1);
+    }
+    return crc;
+}
+
+// FLAC frame numbers are coded like UTF-8
+static QByteArray flacNumber(quint32 number)
+{
+    if (number < 0x80) { return QByteArray(1, char(number)); }
+
+    int length = number < 0x800 ? 2 : number < 0x10000 ? 3 : number < 0x200000 ? 4 : number < 0x4000000 ? 5 : 6;
+    QByteArray ret(length, '\0');
+    for (int i = length - 1; i > 0; i--)
+    {
+        ret[i] = char(0x80 | (number & 0x3F));
+        number >>= 6;
+    }
+    ret[0] = char((0xFF00 >> length) | number);
+    return ret;
+}
+
+// A file name without the characters most file systems reject
+static QString fileName(const QString &name)
+{
+    QString ret = name;
+    for (QChar &c : ret)
+    {
+        if (QString("/\\:*?\"<>|").contains(c)) c = '_';
+    }
+    return ret;
+}
+
+CorpusGenerator::CorpusGenerator(quint32 seed)
+    : seed(seed), random(seed)
+{
+}
+
+// Sets the edge length of the embedded covers in pixels
+void CorpusGenerator::setArtSize(int size)
+{
+    artSize = qMax(1, size);
+}
+
+// Sets the length of the silent audio in every file
+void CorpusGenerator::setSeconds(int length)
+{
+    seconds = qMax(1, length);
+}
+
+// Writes files tracks into directory, see the class comment for what they hold
+// Returns false if a file could not be written
+bool CorpusGenerator::generate(const QString &directory, int files)
+{
+    LibraryGenerator library(seed);
+    QList<Song> songs = library.songs(files);
+    bytes = 0;
+
+    QByteArray art;
+    QString artMime;
+    bool png = false;
+    int format = 0;
+    int id3Version = 3;
+    bool id3v1 = false;
+    bool moovFirst = true;
+    bool albumArtist = true;
+    bool trackTags = true;
+
+    for (qsizetype i = 0; i < songs.size(); i++)
+    {
+        const Song &song = songs[i];
+
+        // A new album, its format and tags are chosen once for all of its tracks
+        if (i == 0 || song.album != songs[i - 1].album || song.albumArtist != songs[i - 1].albumArtist)
+        {
+            int artKind = random.bounded(20);
+            png = artKind == 0;
+            art = artKind >= 18 ? QByteArray() : cover(png);
+            artMime = png ? "image/png" : "image/jpeg";
+
+            int formatKind = random.bounded(20);
+            format = formatKind < 10 ? 0 : (formatKind < 17 ? 1 : 2);
+            id3Version = random.bounded(2) ? 4 : 3;
+            id3v1 = random.bounded(3) == 0;
+            moovFirst = random.bounded(2);
+            albumArtist = random.bounded(20) >= 3;
+            trackTags = random.bounded(20) != 0;
+        }
+
+        Tags tags {song, song.artist, albumArtist, trackTags};
+        if (random.bounded(10) == 0) tags.song.title += " " + QString::fromUtf8(foreignWords[random.bounded(foreignWordCount)]);
+        if (random.bounded(10) == 0) tags.artist += " feat. " + songs[random.bounded(int(songs.size()))].albumArtist;
+
+        QString folder = directory + "/" + fileName(song.albumArtist) + "/" + fileName(song.album);
+        QDir().mkpath(folder);
+
+        static const char *const suffixes[] = {"mp3", "flac", "m4a"};
+        QString path = folder + QString("/%1 %2.%3").arg(song.track, 2, 10, QChar('0')).arg(fileName(tags.song.title), suffixes[format]);
+
+        QByteArray data = format == 0 ? mp3(tags, art, artMime, id3Version, id3v1)
+                        : format == 1 ? flac(tags, art, artMime)
+                                      : m4a(tags, art, png, moovFirst);
+
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size())
+        {
+            qDebug() << "Could not write" << path << file.errorString();
+            return false;
+        }
+        bytes += data.size();
+    }
+
+    return true;
+}
+
+// Size of the files written by the last generate
+qint64 CorpusGenerator::bytesWritten()
+{
+    return bytes;
+}
+
+// Returns an encoded cover, a gradient in random colours with some noise so it compresses
+// about as well as a photo
+QByteArray CorpusGenerator::cover(bool png)
+{
+    QImage image(artSize, artSize, QImage::Format_RGB32);
+    QRgb from = random.generate() | 0xFF000000;
+    QRgb to = random.generate() | 0xFF000000;
+
+    for (int y = 0; y < artSize; y++)
+    {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < artSize; x++)
+        {
+            int t = (x + y) * 255 / (2 * artSize);
+            int noise = int(random.bounded(25)) - 12;
+            auto mix = [t, noise](int a, int b) { return qBound(0, (a * (255 - t) + b * t) / 255 + noise, 255); };
+            line[x] = qRgb(mix(qRed(from), qRed(to)), mix(qGreen(from), qGreen(to)), mix(qBlue(from), qBlue(to)));
+        }
+    }
+
+    QByteArray ret;
+    QBuffer buffer(&ret);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer, png ? "PNG" : "JPG", 85);
+    return ret;
+}
+
+// MPEG1 Layer III, 128 kbps, 44.1 kHz mono
+// A frame of zeros after the header has no main data and decodes to silence
+QByteArray CorpusGenerator::mp3(const Tags &tags, const QByteArray &art, const QString &artMime, int version, bool id3v1)
+{
+    const Song &song = tags.song;
+
+    QByteArray frames;
+    frames += id3Text("TIT2", song.title, version);
+    frames += id3Text("TPE1", tags.artist, version);
+    if (tags.albumArtist) frames += id3Text("TPE2", song.albumArtist, version);
+    frames += id3Text("TALB", song.album, version);
+    if (tags.track) frames += id3Text("TRCK", QString::number(song.track), version);
+    if (!art.isEmpty())
+    {
+        frames += id3Frame("APIC", QByteArray(1, '\0') + artMime.toLatin1() + '\0' + char(3) + '\0' + art, version);
+    }
+
+    // Taggers leave padding so the tag can grow without rewriting the file
+    const int padding = 1024;
+    QByteArray ret = "ID3" + QByteArray(1, char(version)) + QByteArray(2, '\0') + syncsafe(frames.size() + padding);
+    ret += frames;
+    ret += QByteArray(padding, '\0');
+
+    const int frameLength = 144 * 128000 / 44100;
+    QByteArray frame = QByteArray("\xFF\xFB\x90\xC0", 4) + QByteArray(frameLength - 4, '\0');
+    int frameCount = (seconds * 44100 + 1151) / 1152;
+    for (int i = 0; i < frameCount; i++) ret += frame;
+
+    if (id3v1)
+    {
+        auto field = [](const QString &value, int length) { return value.toLatin1().left(length).leftJustified(length, '\0'); };
+        QByteArray tag = "TAG" + field(song.title, 30) + field(tags.artist, 30) + field(song.album, 30) + "2020";
+        tag += QByteArray(28, '\0');
+        tag += '\0';
+        tag += char(tags.track ? song.track : 0);
+        tag += char(255);
+        ret += tag;
+    }
+
+    return ret;
+}
+
+// 16 bit stereo at 44.1 kHz in blocks of 4096 samples
+// Every frame holds one CONSTANT subframe of zero per channel
+QByteArray CorpusGenerator::flac(const Tags &tags, const QByteArray &art, const QString &artMime)
+{
+    const Song &song = tags.song;
+    const int blockSize = 4096;
+    const int channels = 2;
+    const int bitsPerSample = 16;
+    int frameCount = (seconds * 44100 + blockSize - 1) / blockSize;
+    quint64 totalSamples = quint64(frameCount) * blockSize;
+
+    QByteArray streamInfo = be16(blockSize) + be16(blockSize) + be24(0) + be24(0);
+    streamInfo += be64((quint64(44100) << 44) | (quint64(channels - 1) << 41) | (quint64(bitsPerSample - 1) << 36) | totalSamples);
+    streamInfo += QByteArray(16, '\0');
+
+    QStringList comments = {
+        "TITLE=" + song.title,
+        "ARTIST=" + tags.artist,
+        "ALBUM=" + song.album,
+    };
+    if (tags.albumArtist) comments << "ALBUMARTIST=" + song.albumArtist;
+    if (tags.track) comments << "TRACKNUMBER=" + QString::number(song.track);
+
+    QByteArray vendor = "librarybench";
+    QByteArray vorbisComment = le32(vendor.size()) + vendor + le32(comments.size());
+    for (const QString &comment : std::as_const(comments))
+    {
+        QByteArray utf8 = comment.toUtf8();
+        vorbisComment += le32(utf8.size()) + utf8;
+    }
+
+    QByteArray ret = "fLaC";
+    ret += flacBlock(0, streamInfo, false);
+    ret += flacBlock(4, vorbisComment, false);
+    if (!art.isEmpty())
+    {
+        QByteArray mime = artMime.toLatin1();
+        QByteArray picture = be32(3) + be32(mime.size()) + mime + be32(0);
+        picture += be32(artSize) + be32(artSize) + be32(24) + be32(0);
+        picture += be32(art.size()) + art;
+        ret += flacBlock(6, picture, false);
+    }
+    ret += flacBlock(1, QByteArray(1024, '\0'), true);
+
+    // Block size code 12 is 4096 samples, sample rate code 9 is 44.1 kHz,
+    // channel assignment 1 is independent stereo and sample size code 4 is 16 bits
+    for (int i = 0; i < frameCount; i++)
+    {
+        QByteArray frame = QByteArray("\xFF\xF8\xC9\x18", 4) + flacNumber(i);
+        frame += char(crc8(frame));
+        frame += QByteArray(channels * 3, '\0');
+        ret += frame + be16(crc16(frame));
+    }
+
+    return ret;
+}
+
+// ftyp, moov with mvhd and the iTunes style ilst, and an mdat of zeros
+// Encoders put moov before or after mdat, the reader has to handle both
+QByteArray CorpusGenerator::m4a(const Tags &tags, const QByteArray &art, bool png, bool moovFirst)
+{
+    const Song &song = tags.song;
+
+    QByteArray ftyp = mp4Atom("ftyp", QByteArray("M4A ") + be32(0) + "M4A mp42isom");
+
+    // Version 0, times, timescale of 1000, duration in milliseconds, rate, volume,
+    // reserved, unity matrix, pre-defined and next track id
+    QByteArray mvhd = be32(0) + be32(0) + be32(0) + be32(1000) + be32(seconds * 1000);
+    mvhd += be32(0x00010000) + be16(0x0100) + QByteArray(10, '\0');
+    for (quint32 value : {0x00010000u, 0u, 0u, 0u, 0x00010000u, 0u, 0u, 0u, 0x40000000u}) mvhd += be32(value);
+    mvhd += QByteArray(24, '\0') + be32(2);
+
+    QByteArray ilst;
+    ilst += mp4Item("\xA9nam", 1, song.title.toUtf8());
+    ilst += mp4Item("\xA9" "ART", 1, tags.artist.toUtf8());
+    if (tags.albumArtist) ilst += mp4Item("aART", 1, song.albumArtist.toUtf8());
+    ilst += mp4Item("\xA9" "alb", 1, song.album.toUtf8());
+    if (tags.track) ilst += mp4Item("trkn", 0, be16(0) + be16(song.track) + be16(0) + be16(0));
+    if (!art.isEmpty()) ilst += mp4Item("covr", png ? 14 : 13, art);
+
+    QByteArray hdlr = mp4Atom("hdlr", be32(0) + be32(0) + "mdir" + "appl" + QByteArray(9, '\0'));
+    QByteArray meta = mp4Atom("meta", be32(0) + hdlr + mp4Atom("ilst", ilst));
+    QByteArray moov = mp4Atom("moov", mp4Atom("mvhd", mvhd) + mp4Atom("udta", meta));
+    QByteArray mdat = mp4Atom("mdat", QByteArray(seconds * 16000, '\0'));
+
+    return moovFirst ? ftyp + moov + mdat : ftyp + mdat + moov;
+}
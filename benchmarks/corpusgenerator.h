@@ -0,0 +1,50 @@
+#ifndef CORPUSGENERATOR_H
+#define CORPUSGENERATOR_H
+
+#include <QString>
+#include <QByteArray>
+#include <QRandomGenerator>
+#include "song.h"
+
+// Writes a folder of small tagged audio files for the scanner benchmark
+//
+// The tracks come from LibraryGenerator and are laid out as Artist/Album/NN Title.ext.
+// Every album is one format: MP3 with ID3v2.3 or ID3v2.4 and sometimes ID3v1, FLAC with
+// Vorbis comments or M4A with an ilst, so every path of TagReader is taken.
+// Most albums carry the same embedded cover in every track, as ripped albums do,
+// some have none, some a PNG, and some lack album artist or track number tags.
+//
+// The audio is a few seconds of silence. MP3 and FLAC files hold valid silent frames,
+// M4A files only hold the tags and an empty mdat since the scanner never reads past moov.
+class CorpusGenerator
+{
+public:
+    explicit CorpusGenerator(quint32 seed);
+
+    void setArtSize(int size);
+    void setSeconds(int seconds);
+    bool generate(const QString &directory, int files);
+    qint64 bytesWritten();
+
+private:
+    struct Tags
+    {
+        Song song;
+        QString artist;       // track artist, song.artist is the album artist
+        bool albumArtist;     // write the album artist tag
+        bool track;           // write the track number tag
+    };
+
+    QByteArray cover(bool png);
+    QByteArray mp3(const Tags &tags, const QByteArray &art, const QString &artMime, int version, bool id3v1);
+    QByteArray flac(const Tags &tags, const QByteArray &art, const QString &artMime);
+    QByteArray m4a(const Tags &tags, const QByteArray &art, bool png, bool moovFirst);
+
+    quint32 seed;
+    QRandomGenerator random;
+    int artSize = 600;
+    int seconds = 1;
+    qint64 bytes = 0;
+};
+
+#endif // CORPUSGENERATOR_H
@@ -0,0 +1,244 @@
+// Benchmark of the DSP kernels of the playback path
+//
+// Every kernel processes the same generated stereo audio with each instruction set the CPU
+// supports, scalar first. Besides the time every result has the share of one core the kernel
+// needs to keep up with 96 kHz stereo in core_percent, and in max_error the largest difference
+// of its output from the scalar output, which checks the SIMD versions against the scalar ones.
+//
+//   dspbench --seconds 10 --output dsp.json
+//
+// The chain benchmark runs what the decoder thread of PcmPlayer does with a 44.1 kHz 16 bit
+// file played at 96 kHz: conversion, resampling and a ten band equalizer, then the volume.
+// The loudness benchmark measures the 44.1 kHz audio as the loudness analysis does, its output
+// is the integrated loudness and true peak so max_error is the difference in LU and dB.
+
+#include "benchmarks.h"
+#include "dspkernels.h"
+#include "dspchain.h"
+#include "equalizer.h"
+#include "resampler.h"
+#include "loudnessmeter.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QRandomGenerator>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDateTime>
+#include <QSysInfo>
+#include <QFile>
+#include <QTextStream>
+#include <cmath>
+#include <cstring>
+#include <functional>
+
+static const int outputRate = 96000;
+
+// Ten bands an octave apart from 31 Hz, shelves at both ends
+static QList<EqualizerBand> tenBands()
+{
+    QList<EqualizerBand> bands;
+    for (int i = 0; i < 10; i++)
+    {
+        EqualizerBand band;
+        band.type = i == 0 ? EqualizerBand::LowShelf : i == 9 ? EqualizerBand::HighShelf : EqualizerBand::Peak;
+        band.frequency = 31.25 * (1 << i);
+        band.gain = (i % 2 ? 3.0 : -2.0) + i * 0.5;
+        band.q = 1.41;
+        bands.append(band);
+    }
+    return bands;
+}
+
+// Interleaved stereo of a few tones and some noise, below full scale
+static QList<float> generate(qsizetype frames, int rate, quint32 seed)
+{
+    const double pi = 3.14159265358979323846;
+    QRandomGenerator random(seed);
+
+    QList<float> ret(frames * 2);
+    for (qsizetype i = 0; i < frames; i++)
+    {
+        double t = double(i) / rate;
+        double tones = 0.3 * std::sin(2 * pi * 440 * t) + 0.2 * std::sin(2 * pi * 3520 * t) + 0.1 * std::sin(2 * pi * 13000 * t);
+        ret[2 * i] = float(tones + 0.05 * (random.generateDouble() - 0.5));
+        ret[2 * i + 1] = float(tones * 0.8 + 0.05 * (random.generateDouble() - 0.5));
+    }
+    return ret;
+}
+
+static double maxError(const QList<float> &reference, const QList<float> &output)
+{
+    if (reference.size() != output.size()) return INFINITY;
+
+    double ret = 0;
+    for (qsizetype i = 0; i < reference.size(); i++) ret = qMax(ret, double(std::abs(reference[i] - output[i])));
+    return ret;
+}
+
+// Times kernel on a copy of input with every instruction set, frames is the output at 96 kHz
+static void benchmarkKernel(Benchmarks &benchmarks, const QString &name, const QList<float> &input, qsizetype frames,
+                            const std::function<void(const DspKernels &, QList<float> &)> &kernel)
+{
+    QList<float> reference;
+
+    for (DspKernels::Isa isa : {DspKernels::Scalar, DspKernels::Sse, DspKernels::Avx2})
+    {
+        const DspKernels &kernels = DspKernels::get(isa);
+        if (kernels.isa != isa)
+        {
+            QJsonObject skipped;
+            skipped["benchmark"] = name;
+            skipped["backend"] = QString(isa == DspKernels::Sse ? "sse" : "avx2");
+            skipped["rows"] = int(frames);
+            skipped["skipped"] = "not supported by the CPU";
+            benchmarks.results.append(skipped);
+            continue;
+        }
+
+        QList<float> buffer;
+        benchmarks.measure(name, kernels.name, int(frames), [&]() { buffer = input; }, [&]() { kernel(kernels, buffer); });
+
+        double median = benchmarks.results.last().toObject()["median_ns"].toDouble();
+        benchmarks.annotate("core_percent", median / (double(frames) / outputRate * 1e9) * 100);
+
+        if (isa == DspKernels::Scalar) reference = buffer;
+        benchmarks.annotate("max_error", maxError(reference, buffer));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("dspbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times the DSP kernels of the playback path with every instruction set");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"seconds", "Seconds of 96 kHz stereo audio every kernel processes.", "seconds", "10"},
+        {"repeat", "Runs of every benchmark.", "count", "5"},
+        {"budget", "Seconds after which a benchmark stops repeating.", "seconds", "2"},
+        {"seed", "Seed of the generated noise.", "seed", "1"},
+        {"output", "File the JSON results are written to, standard output by default.", "file"},
+    });
+    parser.process(app);
+
+    BenchmarkSettings settings;
+    settings.repeat = qMax(1, parser.value("repeat").toInt());
+    settings.budgetNs = qint64(parser.value("budget").toDouble() * 1e9);
+    double seconds = qMax(0.1, parser.value("seconds").toDouble());
+    quint32 seed = parser.value("seed").toUInt();
+
+    const qsizetype frames = qsizetype(seconds * outputRate);
+    const QList<float> audio = generate(frames, outputRate, seed);
+
+    const int inputRate = 44100;
+    const qsizetype inputFrames = qsizetype(seconds * inputRate);
+    const QList<float> source = generate(inputFrames, inputRate, seed);
+
+    QList<qint16> pcm(source.size());
+    for (qsizetype i = 0; i < source.size(); i++) pcm[i] = qint16(std::lrint(source[i] * 32767));
+
+    Benchmarks benchmarks(settings);
+
+    benchmarkKernel(benchmarks, "gain_ramp", audio, frames, [frames](const DspKernels &kernels, QList<float> &buffer) {
+        kernels.gain(buffer.data(), frames, 2, 0.25f, 0.75f);
+    });
+
+    benchmarkKernel(benchmarks, "biquad_10_bands", audio, frames, [](const DspKernels &kernels, QList<float> &buffer) {
+        Equalizer equalizer(kernels);
+        equalizer.configure(outputRate, 2);
+        equalizer.setBands(tenBands());
+        equalizer.process(buffer.data(), buffer.size() / 2);
+    });
+
+    // Sliding dot products of the length of the resampler filter, two per frame as the resampler does for stereo
+    benchmarkKernel(benchmarks, "dot_128", audio, frames, [](const DspKernels &kernels, QList<float> &buffer) {
+        const int taps = Resampler::taps;
+        QList<float> filter(taps);
+        for (int j = 0; j < taps; j++) filter[j] = float(std::sin(j * 0.1) / taps);
+
+        QList<float> out(buffer.size() - taps);
+        for (qsizetype i = 0; i < out.size(); i++) out[i] = kernels.dot(filter.constData(), buffer.constData() + i, taps);
+        buffer = out;
+    });
+
+    benchmarkKernel(benchmarks, "resample_44100_96000", source, frames, [](const DspKernels &kernels, QList<float> &buffer) {
+        Resampler resampler(kernels);
+        resampler.configure(inputRate, outputRate, 2);
+
+        qsizetype in = buffer.size() / 2;
+        QList<float> out(resampler.maxOutput(in) * 2);
+        out.resize(resampler.process(buffer.constData(), in, out.data()) * 2);
+        buffer = out;
+    });
+
+    benchmarkKernel(benchmarks, "chain_44100_96000", source, frames, [&pcm](const DspKernels &kernels, QList<float> &buffer) {
+        QAudioFormat format;
+        format.setSampleRate(inputRate);
+        format.setChannelCount(2);
+        format.setSampleFormat(QAudioFormat::Int16);
+
+        DspChain chain(kernels);
+        chain.start(outputRate, 2);
+        chain.setEqualizer(tenBands());
+
+        GainRamp gain(kernels);
+        gain.configure(outputRate, 2);
+        gain.setGain(0.5f);
+
+        // In buffers of 4096 frames like a decoder hands them over
+        QByteArray out;
+        const char *data = reinterpret_cast<const char *>(pcm.constData());
+        const qsizetype block = 4096 * format.bytesPerFrame();
+        const qsizetype size = pcm.size() * qsizetype(sizeof(qint16));
+        for (qsizetype at = 0; at < size; at += block) out.append(chain.process(data + at, qMin(block, size - at), format));
+        out.append(chain.flush());
+
+        buffer.resize(out.size() / qsizetype(sizeof(float)));
+        std::memcpy(buffer.data(), out.constData(), size_t(out.size()));
+        gain.process(buffer.data(), buffer.size() / 2);
+    });
+
+    benchmarkKernel(benchmarks, "loudness_44100", source, frames, [](const DspKernels &kernels, QList<float> &buffer) {
+        LoudnessMeter meter(kernels);
+        meter.start(inputRate, 2);
+
+        const qsizetype block = 4096;
+        const qsizetype size = buffer.size() / 2;
+        for (qsizetype at = 0; at < size; at += block) meter.process(buffer.constData() + at * 2, qMin(block, size - at));
+
+        buffer = {float(meter.integrated()), float(meter.truePeak())};
+    });
+
+    QJsonObject report;
+    report["version"] = QString(RHINO_VERSION);
+    report["qt"] = QString(qVersion());
+    report["cpu"] = QSysInfo::currentCpuArchitecture();
+    report["os"] = QSysInfo::prettyProductName();
+    report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["best"] = QString(DspKernels::best().name);
+    report["seconds"] = seconds;
+    report["seed"] = qint64(seed);
+    report["repeat"] = settings.repeat;
+    report["results"] = benchmarks.results;
+
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet("output"))
+    {
+        QFile file(parser.value("output"));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size())
+        {
+            qCritical() << "Could not write" << file.fileName() << file.errorString();
+            return 1;
+        }
+    }
+    else
+    {
+        QTextStream(stdout) << json;
+    }
+
+    return 0;
+}
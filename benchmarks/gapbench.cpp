@@ -0,0 +1,259 @@
+// Benchmark of the gap between tracks
+//
+// A few short WAV files are generated and played back to back through a PlaybackEngine the
+// way MusicPlayer drives it: the next track is announced with setNext and started with
+// setSource once the current one reports EndOfMedia. Every track change reports the time from
+// the end of a track to the first audio of the next, see PlaybackEngine::gapMeasured.
+//
+// The queue is played with GaplessPlayer once with preloading and once with a preload time
+// of 0, which opens every track only after the last one ended as a single QMediaPlayer does,
+// and once with PcmPlayer. PcmPlayer then plays a queue that repeats two of the tracks, the
+// way a repeated song or album is played, and reports the hit rate and memory of the cache
+// of decoded sources, see PcmCache. Results are written as JSON with the gap of every change
+// in nanoseconds.
+//
+//   gapbench --tracks 10 --seconds 2 --output gaps.json
+//
+// Playback needs an audio output device, without one every run is reported as skipped.
+
+#include "gaplessplayer.h"
+#include "pcmplayer.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QMediaDevices>
+#include <QTemporaryDir>
+#include <QEventLoop>
+#include <QTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDateTime>
+#include <QSysInfo>
+#include <QFile>
+#include <QDir>
+#include <QUrl>
+#include <QtEndian>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+
+// Writes a 16 bit stereo 44.1 kHz WAV file holding a tone of frequency for seconds
+static bool writeTone(const QString &path, double seconds, double frequency)
+{
+    const double pi = 3.14159265358979323846;
+    const int rate = 44100;
+    const int channels = 2;
+    const quint32 frames = quint32(seconds * rate);
+    const quint32 dataBytes = frames * channels * 2;
+
+    QByteArray wav;
+    wav.reserve(44 + dataBytes);
+
+    auto put16 = [&wav](quint16 value) { value = qToLittleEndian(value); wav.append(reinterpret_cast<const char *>(&value), 2); };
+    auto put32 = [&wav](quint32 value) { value = qToLittleEndian(value); wav.append(reinterpret_cast<const char *>(&value), 4); };
+
+    wav.append("RIFF");
+    put32(36 + dataBytes);
+    wav.append("WAVEfmt ");
+    put32(16);
+    put16(1);                       // PCM
+    put16(channels);
+    put32(rate);
+    put32(rate * channels * 2);
+    put16(channels * 2);
+    put16(16);
+    wav.append("data");
+    put32(dataBytes);
+
+    for (quint32 i = 0; i < frames; i++)
+    {
+        qint16 sample = qint16(std::sin(2 * pi * frequency * i / rate) * 8000);
+        for (int c = 0; c < channels; c++) put16(quint16(sample));
+    }
+
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(wav) == wav.size();
+}
+
+// Plays tracks back to back and returns the gap of every track change, empty if playback failed
+static QList<qint64> playQueue(PlaybackEngine &player, const QList<QUrl> &tracks, qint64 timeoutMsecs)
+{
+    player.setVolume(0.05f);
+
+    QList<qint64> gaps;
+    int idx = 0;
+    QEventLoop loop;
+
+    QObject::connect(&player, &PlaybackEngine::gapMeasured, &loop, [&gaps](qint64 gap) { gaps.append(gap); });
+    QObject::connect(&player, &PlaybackEngine::mediaStatusChanged, &loop, [&](QMediaPlayer::MediaStatus status) {
+        switch (status)
+        {
+        case QMediaPlayer::LoadedMedia:
+            player.play();
+            break;
+        case QMediaPlayer::EndOfMedia:
+            if (++idx >= tracks.size())
+            {
+                loop.quit();
+                break;
+            }
+            player.setSource(tracks[idx]);
+            player.setNext(idx + 1 < tracks.size() ? tracks[idx + 1] : QUrl());
+            break;
+        case QMediaPlayer::InvalidMedia:
+            gaps.clear();
+            loop.quit();
+            break;
+        default:
+            break;
+        }
+    });
+
+    QTimer::singleShot(timeoutMsecs, &loop, [&]() {
+        gaps.clear();
+        loop.quit();
+    });
+
+    player.setSource(tracks.first());
+    player.setNext(tracks.size() > 1 ? tracks[1] : QUrl());
+    loop.exec();
+
+    player.stop();
+    return gaps;
+}
+
+static QJsonObject result(const QString &name, qint64 preloadMsecs, const QList<qint64> &gaps, int tracks)
+{
+    QJsonObject ret;
+    ret["benchmark"] = name;
+    if (preloadMsecs >= 0) ret["preload_ms"] = preloadMsecs;
+    ret["tracks"] = tracks;
+
+    if (gaps.isEmpty())
+    {
+        ret["skipped"] = "playback failed or timed out";
+        QTextStream(stderr) << QString("%1: playback failed or timed out\n").arg(name);
+        return ret;
+    }
+
+    QList<qint64> sorted = gaps;
+    std::sort(sorted.begin(), sorted.end());
+
+    QJsonArray all;
+    for (qint64 gap : gaps) all.append(gap);
+
+    ret["changes"] = gaps.size();
+    ret["min_ns"] = sorted.first();
+    ret["median_ns"] = sorted[sorted.size() / 2];
+    ret["max_ns"] = sorted.last();
+    ret["gaps_ns"] = all;
+
+    QTextStream(stderr) << QString("%1: median gap %2 ms, max %3 ms over %4 changes\n")
+                           .arg(name, -10).arg(sorted[sorted.size() / 2] / 1e6, 0, 'f', 2)
+                           .arg(sorted.last() / 1e6, 0, 'f', 2).arg(gaps.size());
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("gapbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the gap between tracks of the playback engines");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"tracks", "Number of tracks played back to back.", "count", "10"},
+        {"seconds", "Length of every track.", "seconds", "2"},
+        {"preload", "Milliseconds before the end of a track the next one is loaded.", "msecs", "5000"},
+        {"output", "File the JSON results are written to, standard output by default.", "file"},
+    });
+    parser.process(app);
+
+    int count = qMax(2, parser.value("tracks").toInt());
+    double seconds = qMax(0.5, parser.value("seconds").toDouble());
+    qint64 preload = qMax<qint64>(1, parser.value("preload").toLongLong());
+
+    QTemporaryDir directory;
+    QList<QUrl> tracks;
+    for (int i = 0; i < count; i++)
+    {
+        QString path = QDir(directory.path()).filePath(QString("track%1.wav").arg(i, 2, 10, QChar('0')));
+        if (!writeTone(path, seconds, 220.0 * (1 + i % 4)))
+        {
+            qCritical() << "Could not write" << path;
+            return 1;
+        }
+        tracks.append(QUrl::fromLocalFile(path));
+    }
+
+    // Each run may take twice the length of the queue before it counts as failed
+    qint64 timeout = qint64(count * seconds * 2000) + 10000;
+
+    QJsonArray results;
+    if (QMediaDevices::audioOutputs().isEmpty())
+    {
+        QTextStream(stderr) << "No audio output device\n";
+        for (const QString &name : {QString("preload"), QString("reopen"), QString("pcm"), QString("pcm_repeat")})
+        {
+            QJsonObject skipped;
+            skipped["benchmark"] = name;
+            skipped["skipped"] = "no audio output device";
+            results.append(skipped);
+        }
+    }
+    else
+    {
+        GaplessPlayer preloading;
+        preloading.setPreloadTime(preload);
+        results.append(result("preload", preload, playQueue(preloading, tracks, timeout), count));
+
+        GaplessPlayer reopening;
+        reopening.setPreloadTime(0);
+        results.append(result("reopen", 0, playQueue(reopening, tracks, timeout), count));
+
+        PcmPlayer pcm;
+        results.append(result("pcm", -1, playQueue(pcm, tracks, timeout), count));
+
+        QList<QUrl> repeated;
+        for (int i = 0; i < count; i++) repeated.append(tracks[i % 2]);
+
+        PcmPlayer repeating;
+        QJsonObject repeat = result("pcm_repeat", -1, playQueue(repeating, repeated, timeout), count);
+        PcmCacheStats stats = repeating.cacheStats();
+        repeat["cache_hits"] = stats.hits;
+        repeat["cache_misses"] = stats.misses;
+        repeat["cache_hit_rate"] = stats.hitRate();
+        repeat["cache_bytes"] = stats.residentBytes;
+        QTextStream(stderr) << QString("%1: cache hit rate %2, %3 MiB resident\n").arg(QString("pcm_repeat"), -10)
+                               .arg(stats.hitRate(), 0, 'f', 2).arg(stats.residentBytes / 1048576.0, 0, 'f', 1);
+        results.append(repeat);
+    }
+
+    QJsonObject report;
+    report["version"] = QString(RHINO_VERSION);
+    report["qt"] = QString(qVersion());
+    report["cpu"] = QSysInfo::currentCpuArchitecture();
+    report["os"] = QSysInfo::prettyProductName();
+    report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["seconds"] = seconds;
+    report["results"] = results;
+
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet("output"))
+    {
+        QFile file(parser.value("output"));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size())
+        {
+            qCritical() << "Could not write" << file.fileName() << file.errorString();
+            return 1;
+        }
+    }
+    else
+    {
+        QTextStream(stdout) << json;
+    }
+
+    return 0;
+}
@@ -0,0 +1,401 @@
+// Benchmarks of the library browsers and the queue on generated libraries
+//
+// For every size a library of that many tracks is generated, see LibraryGenerator, and the
+// MusicDatabase getters are timed against SQLite, the in-memory library index and the
+// memory mapped snapshot. The SongQueueModel operations are timed on a queue of the same size
+// and the heap memory per queued track is reported as queue_memory.
+//
+// Results are written as JSON, one entry per benchmark, backend and size with the timings
+// of every run in nanoseconds, so runs of different releases can be compared by a script.
+//
+//   librarybench --sizes 1000,10000,100000,1000000 --output results.json
+//
+// A benchmark that takes longer than --timeout for one run is not run at the larger sizes,
+// it is listed with the reason instead.
+
+#include "benchmarks.h"
+#include "librarygenerator.h"
+#include "musicdatabase.h"
+#include "librarysnapshot.h"
+#include "songqueuemodel.h"
+#include "songhandle.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDateTime>
+#include <QSysInfo>
+#include <QFile>
+#include <QDir>
+#include <QHash>
+#include <QTextStream>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <cstdlib>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Opens the generated library of rows tracks in directory, generating it if it does not exist
+static bool openLibrary(MusicDatabase &database, const QString &directory, int rows, quint32 seed)
+{
+    QString path = QDir(directory).filePath(QString("library-%1-%2.db").arg(rows).arg(seed));
+    if (QFile::exists(path) && database.connectToDatabase(path)) { return true; }
+
+    QTextStream(stderr) << QString("Generating a library of %1 tracks\n").arg(rows);
+
+    if (!database.createDatabase(path)) { return false; }
+
+    LibraryGenerator generator(seed);
+    return generator.generate(QSqlDatabase::database(), rows);
+}
+
+// The browser getters at one library size, through SQLite and then through the library index
+static void benchmarkDatabase(Benchmarks &benchmarks, MusicDatabase &database, const QString &snapshotPath, int rows)
+{
+    database.setLibraryIndexEnabled(false);
+    database.setArtist();
+    database.setAlbum();
+
+    // The artist with the most songs and its first album, the largest filtered views
+    QSqlQuery query;
+    query.exec("SELECT Artists.Name FROM Artists "
+               "JOIN Albums ON Albums.ArtistID = Artists.ArtistID "
+               "JOIN Songs ON Songs.AlbumID = Albums.AlbumID "
+               "GROUP BY Artists.ArtistID ORDER BY COUNT(*) DESC LIMIT 1;");
+    QString artist = query.next() ? query.value(0).toString() : QString();
+    query.finish();
+
+    database.setArtist(artist);
+    QString album = database.getAlbums().value(0);
+    database.setArtist();
+
+    QList<QPair<QString, QString>> filters = {
+        {"", ""},
+        {artist, ""},
+        {artist, album},
+    };
+    QStringList filterNames = {"", "_artist", "_album"};
+
+    for (const QString &backend : {QString("sqlite"), QString("index")})
+    {
+        if (backend == "index")
+        {
+            benchmarks.measure("index_load", backend, rows,
+                               [&database]() { database.setLibraryIndexEnabled(false); },
+                               [&database]() { database.setLibraryIndexEnabled(true); });
+        }
+
+        benchmarks.measure("getArtists", backend, rows, nullptr, [&database]() { database.getArtists(); });
+
+        for (int i = 0; i < filters.size(); i++)
+        {
+            database.setArtist(filters[i].first);
+            database.setAlbum(filters[i].second);
+
+            if (i < 2)
+            {
+                benchmarks.measure("getAlbums" + filterNames[i], backend, rows, nullptr, [&database]() { database.getAlbums(); });
+            }
+            benchmarks.measure("getSongNames" + filterNames[i], backend, rows, nullptr, [&database]() { database.getSongNames(); });
+
+            // The first page of the song list, see SongListModel
+            benchmarks.measure("getSongNames_page" + filterNames[i], backend, rows, nullptr,
+                               [&database, i, &filters]() { database.getSongNames(filters[i].first, filters[i].second, 0, 200); });
+        }
+
+        database.setArtist();
+        database.setAlbum();
+    }
+
+    database.setLibraryIndexEnabled(false);
+
+    // getSong and getSongs always read SQLite
+    int middle = rows / 2;
+    benchmarks.measure("getSong_first", "sqlite", rows, nullptr, [&database]() { database.getSong(0); });
+    benchmarks.measure("getSong_middle", "sqlite", rows, nullptr, [&database, middle]() { database.getSong(middle); });
+    benchmarks.measure("getSong_last", "sqlite", rows, nullptr, [&database, rows]() { database.getSong(rows - 1); });
+
+    for (int i = 0; i < filters.size(); i++)
+    {
+        database.setArtist(filters[i].first);
+        database.setAlbum(filters[i].second);
+        benchmarks.measure("getSongs" + filterNames[i], "sqlite", rows, nullptr, [&database]() { database.getSongs(); });
+    }
+    database.setArtist();
+    database.setAlbum();
+
+    // The snapshot the index wrote, read the way the browsers are filled at startup
+    LibrarySnapshot snapshot;
+    benchmarks.measure("snapshot_open", "snapshot", rows,
+                       [&snapshot]() { snapshot.close(); },
+                       [&snapshot, &snapshotPath]() { snapshot.open(snapshotPath); });
+
+    if (snapshot.isOpen())
+    {
+        benchmarks.measure("getArtists", "snapshot", rows, nullptr, [&snapshot]() { snapshot.artists(); });
+        benchmarks.measure("getAlbums", "snapshot", rows, nullptr, [&snapshot]() { snapshot.albums(QString()); });
+        benchmarks.measure("getAlbums_artist", "snapshot", rows, nullptr, [&snapshot, &artist]() { snapshot.albums(artist); });
+        benchmarks.measure("getSongNames", "snapshot", rows, nullptr, [&snapshot]() { snapshot.songNames(QString(), QString()); });
+        benchmarks.measure("getSongNames_artist", "snapshot", rows, nullptr, [&snapshot, &artist]() { snapshot.songNames(artist, QString()); });
+    }
+}
+
+// Heap memory in use in bytes, -1 where it cannot be measured
+static qint64 heapInUse()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return qint64(info.uordblks + info.hblkhd);
+#else
+    return -1;
+#endif
+}
+
+// Memory per queued track, for a list of Songs as the queue used to store them and for
+// a queue of SongHandles including the records they intern
+// ids are moved by idOffset so every size adds new records instead of updating earlier ones
+static void benchmarkQueueMemory(Benchmarks &benchmarks, const QList<Song> &generated, qint64 idOffset)
+{
+    const int rows = generated.size();
+
+    QJsonObject songs;
+    songs["benchmark"] = "queue_memory";
+    songs["backend"] = "song";
+    songs["rows"] = rows;
+    QJsonObject handles = songs;
+    handles["backend"] = "handle";
+
+    qint64 start = heapInUse();
+    if (start < 0)
+    {
+        songs["skipped"] = "heap usage is only measured with glibc";
+        handles["skipped"] = songs["skipped"];
+        benchmarks.results.append(songs);
+        benchmarks.results.append(handles);
+        return;
+    }
+
+    // Every string gets its own allocation, as rows read from the database do
+    auto detached = [](const QString &string) { return QString(string.constData(), string.size()); };
+
+    QList<Song> list;
+    list.reserve(rows);
+    for (Song song : generated)
+    {
+        song.artist = detached(song.artist);
+        song.albumArtist = detached(song.albumArtist);
+        song.album = detached(song.album);
+        song.title = detached(song.title);
+        song.file = detached(song.file);
+        song.image = detached(song.image);
+        song.id += idOffset;
+        list.append(song);
+    }
+    qint64 songBytes = heapInUse() - start;
+
+    SongQueueModel queue;
+    for (const SongHandle &song : SongHandle::intern(list)) queue.append(song);
+    list = QList<Song>();
+    qint64 handleBytes = heapInUse() - start;
+
+    songs["bytes_per_track"] = double(songBytes) / rows;
+    handles["bytes_per_track"] = double(handleBytes) / rows;
+    benchmarks.results.append(songs);
+    benchmarks.results.append(handles);
+
+    QTextStream(stderr) << QString("queue_memory %1 rows: %2 bytes per Song, %3 bytes per SongHandle\n")
+                           .arg(rows, 8).arg(songBytes / rows).arg(handleBytes / rows);
+}
+
+// The queue operations on a queue of rows songs
+// Edits touch a fixed number of rows so the cost per edit can be compared between sizes
+static void benchmarkQueue(Benchmarks &benchmarks, const QList<SongHandle> &songs)
+{
+    const int rows = songs.size();
+    const int edits = qMin(rows, 100);
+
+    // Every run gets a new queue, filled outside the timing
+    std::unique_ptr<SongQueueModel> queue;
+
+    auto empty = [&queue]() { queue.reset(new SongQueueModel); };
+
+    // Shuffles are seeded so every run shuffles the same way
+    auto fill = [&queue, &songs]() {
+        queue.reset(new SongQueueModel);
+        queue->setShuffleSeed(1);
+        for (const SongHandle &song : songs) queue->append(song);
+    };
+
+    auto fillShuffled = [&queue, &fill]() {
+        fill();
+        queue->shuffle(0);
+    };
+
+    auto emptyShuffled = [&queue, &songs]() {
+        queue.reset(new SongQueueModel);
+        queue->setShuffleSeed(1);
+        queue->append(songs.first());
+        queue->append(songs.last());
+        queue->shuffle(0);
+        queue->setPlayingIndex(0);
+    };
+
+    benchmarks.measure("queue_append", "queue", rows, empty,
+                       [&queue, &songs]() { for (const SongHandle &song : songs) queue->append(song); });
+
+    benchmarks.measure("queue_append_batch", "queue", rows, empty, [&queue, &songs]() { queue->append(songs); });
+
+    // Appending to a shuffled queue places every song at a random row after the playing one
+    benchmarks.measure("queue_append_shuffled", "queue", rows, emptyShuffled,
+                       [&queue, &songs]() { for (const SongHandle &song : songs) queue->append(song); });
+
+    benchmarks.measure("queue_append_shuffled_batch", "queue", rows, emptyShuffled, [&queue, &songs]() { queue->append(songs); });
+
+    // What the queue view asks for while scrolling, every row once
+    benchmarks.measure("queue_data", "queue", rows, fill, [&queue, rows]() {
+        for (int i = 0; i < rows; i++)
+        {
+            QModelIndex index = queue->index(i, 0);
+            queue->data(index, Qt::DisplayRole);
+            queue->data(index, Qt::FontRole);
+            queue->data(index, Qt::ForegroundRole);
+        }
+    });
+
+    benchmarks.measure("queue_insert", "queue", rows, fill, [&queue, &songs, edits]() {
+        for (int i = 0; i < edits; i++) queue->insert(songs[i], queue->rowCount() / 2);
+    });
+
+    benchmarks.measure("queue_insert_shuffled", "queue", rows, fillShuffled, [&queue, &songs, edits]() {
+        for (int i = 0; i < edits; i++) queue->insert(songs[i], queue->rowCount() / 2);
+    });
+
+    benchmarks.measure("queue_shuffle", "queue", rows, fill, [&queue]() { queue->shuffle(0); });
+
+    benchmarks.measure("queue_unshuffle", "queue", rows, fillShuffled, [&queue]() { queue->unshuffle(0); });
+
+    benchmarks.measure("queue_removeRows", "queue", rows, fill, [&queue, edits]() {
+        queue->removeRows(queue->rowCount() / 2 - edits / 2, edits);
+    });
+
+    benchmarks.measure("queue_removeRows_single", "queue", rows, fill, [&queue, edits]() {
+        for (int i = 0; i < edits; i++) queue->removeRows(queue->rowCount() / 2, 1);
+    });
+
+    benchmarks.measure("queue_removeRows_shuffled", "queue", rows, fillShuffled, [&queue, edits]() {
+        queue->removeRows(queue->rowCount() / 2 - edits / 2, edits);
+    });
+
+    benchmarks.measure("queue_removeRows_single_shuffled", "queue", rows, fillShuffled, [&queue, edits]() {
+        for (int i = 0; i < edits; i++) queue->removeRows(queue->rowCount() / 2, 1);
+    });
+
+    benchmarks.measure("queue_moveRows_shuffled", "queue", rows, fillShuffled, [&queue, edits]() {
+        for (int i = 0; i < edits; i++) queue->moveRows(QModelIndex(), queue->rowCount() / 2, 1, QModelIndex(), 1);
+    });
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("librarybench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times the library browsers and the queue on generated libraries");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"sizes", "Comma separated library sizes in tracks.", "sizes", "1000,10000,100000,1000000"},
+        {"repeat", "Runs of every benchmark.", "count", "5"},
+        {"budget", "Seconds after which a benchmark stops repeating.", "seconds", "2"},
+        {"timeout", "Seconds a run may take before the benchmark is skipped at larger sizes.", "seconds", "30"},
+        {"seed", "Seed of the generated libraries.", "seed", "1"},
+        {"data", "Folder the generated libraries are kept in and reused from.", "folder"},
+        {"output", "File the JSON results are written to, standard output by default.", "file"},
+        {"skip-queue", "Only run the database benchmarks."},
+        {"skip-database", "Only run the queue benchmarks."},
+    });
+    parser.process(app);
+
+    BenchmarkSettings settings;
+    settings.repeat = qMax(1, parser.value("repeat").toInt());
+    settings.budgetNs = qint64(parser.value("budget").toDouble() * 1e9);
+    settings.timeoutNs = qint64(parser.value("timeout").toDouble() * 1e9);
+    quint32 seed = parser.value("seed").toUInt();
+
+    QList<int> sizes;
+    for (const QString &size : parser.value("sizes").split(',', Qt::SkipEmptyParts))
+    {
+        bool ok = false;
+        int rows = size.trimmed().toInt(&ok);
+        if (!ok || rows <= 0) { qCritical() << "Invalid size" << size; return 1; }
+        sizes.append(rows);
+    }
+    std::sort(sizes.begin(), sizes.end());
+
+    QTemporaryDir temporary;
+    QString directory = parser.isSet("data") ? parser.value("data") : temporary.path();
+    QDir().mkpath(directory);
+
+    Benchmarks benchmarks(settings);
+    qint64 memoryIdOffset = 1LL << 40;
+
+    for (int rows : std::as_const(sizes))
+    {
+        if (!parser.isSet("skip-database"))
+        {
+            MusicDatabase database;
+            if (!openLibrary(database, directory, rows, seed))
+            {
+                qCritical() << "Could not generate a library of" << rows << "tracks";
+                return 1;
+            }
+
+            QString snapshotPath = QDir(directory).filePath(QString("library-%1-%2.db.snapshot").arg(rows).arg(seed));
+            benchmarkDatabase(benchmarks, database, snapshotPath, rows);
+        }
+
+        if (!parser.isSet("skip-queue"))
+        {
+            LibraryGenerator generator(seed);
+            QList<Song> songs = generator.songs(rows);
+            benchmarkQueueMemory(benchmarks, songs, memoryIdOffset);
+            memoryIdOffset += rows;
+            benchmarkQueue(benchmarks, SongHandle::intern(songs));
+        }
+    }
+
+    QJsonObject report;
+    report["version"] = QString(RHINO_VERSION);
+    report["qt"] = QString(qVersion());
+    report["cpu"] = QSysInfo::currentCpuArchitecture();
+    report["os"] = QSysInfo::prettyProductName();
+    report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["seed"] = qint64(seed);
+    report["repeat"] = settings.repeat;
+    report["results"] = benchmarks.results;
+
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet("output"))
+    {
+        QFile file(parser.value("output"));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size())
+        {
+            qCritical() << "Could not write" << file.fileName() << file.errorString();
+            return 1;
+        }
+    }
+    else
+    {
+        QTextStream(stdout) << json;
+    }
+
+    return 0;
+}
@@ -0,0 +1,244 @@
+#include "librarygenerator.h"
+#include <QtSql/QSqlQuery>
+#include <QtSql/QSqlError>
+#include <QVariant>
+#include <QSet>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+
+static const char *const wordList[] = {
+    "Amber", "Arrow", "Autumn", "Black", "Blue", "Broken", "Burning", "Cedar",
+    "City", "Cold", "Copper", "Crystal", "Dancing", "Dark", "Dawn", "Desert",
+    "Distant", "Dream", "Echo", "Electric", "Empty", "Ever", "Falling", "Fire",
+    "Flood", "Forest", "Ghost", "Glass", "Golden", "Gravity", "Harbor", "Heart",
+    "Hollow", "Horizon", "Iron", "Island", "Jade", "Last", "Light", "Lonely",
+    "Lost", "Midnight", "Mirror", "Moon", "Morning", "Neon", "Night", "Ocean",
+    "Paper", "Parade", "Quiet", "Rain", "Red", "River", "Rose", "Shadow",
+    "Silver", "Sky", "Stone", "Summer", "Thunder", "Velvet", "Wild", "Winter",
+};
+static const int wordCount = sizeof(wordList) / sizeof(wordList[0]);
+
+// Zipf exponent of the artist distribution, 1 is the usual fit for play and collection counts
+static const double zipfExponent = 1.0;
+
+LibraryGenerator::LibraryGenerator(quint32 seed)
+    : random(seed)
+{
+}
+
+// One artist for every hundred tracks, around ten albums each on average
+int LibraryGenerator::artistCount(int tracks)
+{
+    return qMax(1, tracks / 100);
+}
+
+// Writes tracks songs into the empty library of connection db in one transaction
+// db must have the schema of MusicDatabase::createDatabase
+// The search index is filled when the database has one and the generation is bumped,
+// as a scan would, so a library snapshot of the generated library is current.
+bool LibraryGenerator::generate(QSqlDatabase db, int tracks)
+{
+    QStringList artistNames = artists(artistCount(tracks));
+    QList<Album> albumList = albums(artistNames, tracks);
+    bool search = db.tables().contains("SongSearch");
+
+    if (!db.transaction())
+    {
+        qDebug() << db.lastError();
+        return false;
+    }
+
+    QSqlQuery artistInsert(db);
+    artistInsert.prepare("INSERT INTO Artists (ArtistID, Name) VALUES (:artistID, :name);");
+    QSqlQuery albumInsert(db);
+    albumInsert.prepare("INSERT INTO Albums (AlbumID, ArtistID, Name) VALUES (:albumID, :artistID, :name);");
+    QSqlQuery songInsert(db);
+    songInsert.prepare("INSERT INTO "
+                       "Songs  ( SongID,  File,  AlbumID,  ContributingArtist,  Track,  Title,  Image,  Duration,  Size,  MTime,  Inode) "
+                       "VALUES (:songID, :file, :albumID, :contributingArtist, :track, :title, :image, :duration, :size, :mtime, :inode);");
+    QSqlQuery searchInsert(db);
+    if (search)
+    {
+        searchInsert.prepare("INSERT INTO "
+                             "SongSearch (rowid, Title, Artist, Album, ContributingArtist) "
+                             "VALUES (:songID, :title, :artist, :album, :contributingArtist);");
+    }
+
+    auto failed = [&db](QSqlQuery &query) {
+        qDebug() << query.lastError();
+        qDebug () << query.lastQuery();
+        db.rollback();
+        return false;
+    };
+
+    for (int i = 0; i < artistNames.size(); i++)
+    {
+        artistInsert.bindValue(":artistID", i + 1);
+        artistInsert.bindValue(":name", artistNames[i]);
+        if (!artistInsert.exec()) { return failed(artistInsert); }
+    }
+
+    qint64 songId = 0;
+    for (int i = 0; i < albumList.size(); i++)
+    {
+        const Album &album = albumList[i];
+        const QString &artist = artistNames[album.artist];
+
+        albumInsert.bindValue(":albumID", i + 1);
+        albumInsert.bindValue(":artistID", album.artist + 1);
+        albumInsert.bindValue(":name", album.name);
+        if (!albumInsert.exec()) { return failed(albumInsert); }
+
+        QString folder = QString("/library/%1/%2/").arg(album.artist).arg(i);
+        for (int track = 1; track <= album.tracks; track++)
+        {
+            songId++;
+            QString title = words(1, 4);
+            QString contributingArtist = random.bounded(10) == 0 ? artistNames[zipf()] : artist;
+
+            songInsert.bindValue(":songID", songId);
+            songInsert.bindValue(":file", "file://" + folder + QString("%1.flac").arg(track, 2, 10, QChar('0')));
+            songInsert.bindValue(":albumID", i + 1);
+            songInsert.bindValue(":contributingArtist", contributingArtist);
+            songInsert.bindValue(":track", track);
+            songInsert.bindValue(":title", title);
+            songInsert.bindValue(":image", QString());
+            songInsert.bindValue(":duration", 120000 + random.bounded(300000));
+            songInsert.bindValue(":size", 4000000 + random.bounded(40000000));
+            songInsert.bindValue(":mtime", 1500000000 + random.bounded(200000000));
+            songInsert.bindValue(":inode", songId);
+            if (!songInsert.exec()) { return failed(songInsert); }
+
+            if (search)
+            {
+                searchInsert.bindValue(":songID", songId);
+                searchInsert.bindValue(":title", title);
+                searchInsert.bindValue(":artist", artist);
+                searchInsert.bindValue(":album", album.name);
+                searchInsert.bindValue(":contributingArtist", contributingArtist);
+                if (!searchInsert.exec()) { return failed(searchInsert); }
+            }
+        }
+    }
+
+    QSqlQuery query(db);
+    if (!query.exec("UPDATE Meta SET Value = Value + 1 WHERE Key = 'Generation';")) { return failed(query); }
+
+    if (!db.commit())
+    {
+        qDebug() << db.lastError();
+        return false;
+    }
+    return true;
+}
+
+// Returns count songs shaped like the ones generate writes, without a database
+// Used to fill the queue
+QList<Song> LibraryGenerator::songs(int count)
+{
+    QStringList artistNames = artists(artistCount(count));
+    QList<Album> albumList = albums(artistNames, count);
+
+    QList<Song> ret;
+    ret.reserve(count);
+
+    for (int i = 0; i < albumList.size(); i++)
+    {
+        const Album &album = albumList[i];
+        for (int track = 1; track <= album.tracks; track++)
+        {
+            Song song;
+            song.albumArtist = artistNames[album.artist];
+            song.artist = song.albumArtist;
+            song.album = album.name;
+            song.title = words(1, 4);
+            song.file = QString("file:///library/%1/%2/%3.flac").arg(album.artist).arg(i).arg(track, 2, 10, QChar('0'));
+            song.track = track;
+            song.duration = 120000 + random.bounded(300000);
+            song.id = ret.size() + 1;
+            ret.append(song);
+        }
+    }
+
+    return ret;
+}
+
+// Returns between min and max words from the word list, separated by spaces
+QString LibraryGenerator::words(int min, int max)
+{
+    int count = random.bounded(min, max + 1);
+    QString ret;
+    for (int i = 0; i < count; i++)
+    {
+        if (i > 0) ret += ' ';
+        ret += wordList[random.bounded(wordCount)];
+    }
+    return ret;
+}
+
+// Returns the index of an artist drawn from the Zipf distribution of the last call to artists
+int LibraryGenerator::zipf()
+{
+    if (artistWeights.isEmpty()) { return 0; }
+
+    double value = random.generateDouble() * artistWeights.constLast();
+    int artist = int(std::upper_bound(artistWeights.cbegin(), artistWeights.cend(), value) - artistWeights.cbegin());
+    return qMin(artist, int(artistWeights.size()) - 1);
+}
+
+// Returns count artist names, unique ignoring case like the Artists table
+// The first artists are the most popular ones, see zipf
+QStringList LibraryGenerator::artists(int count)
+{
+    QStringList ret;
+    QSet<QString> used;
+
+    artistWeights.clear();
+    artistWeights.reserve(count);
+    double total = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        QString name = words(1, 3);
+        if (used.contains(name.toLower())) name += QString(" %1").arg(i);
+        used.insert(name.toLower());
+        ret.append(name);
+
+        total += 1.0 / std::pow(i + 1, zipfExponent);
+        artistWeights.append(total);
+    }
+    return ret;
+}
+
+// Splits tracks songs into albums of 8 to 17 tracks, the last album takes what is left
+// artists must come from artists, album artists follow its Zipf distribution, every artist gets at least one
+// album while there are tracks for it
+QList<LibraryGenerator::Album> LibraryGenerator::albums(const QStringList &artists, int tracks)
+{
+    QList<Album> ret;
+    QSet<QString> used;
+    int remaining = tracks;
+
+    while (remaining > 0)
+    {
+        int artist = ret.size() < artists.size() ? int(ret.size()) : zipf();
+        int count = qMin(remaining, int(random.bounded(8, 18)));
+
+        QString name = words(1, 3);
+        QString key = QString::number(artist) + ':' + name.toLower();
+        if (used.contains(key)) { name += QString(" %1").arg(ret.size()); key = QString::number(artist) + ':' + name.toLower(); }
+        used.insert(key);
+
+        ret.append(Album {artist, name, count});
+        remaining -= count;
+    }
+
+    // Albums are written in a random order so ids do not follow the sort order of the browsers
+    for (qsizetype i = ret.size() - 1; i > 0; i--)
+    {
+        ret.swapItemsAt(i, random.bounded(int(i) + 1));
+    }
+
+    return ret;
+}
@@ -0,0 +1,43 @@
+#ifndef LIBRARYGENERATOR_H
+#define LIBRARYGENERATOR_H
+
+#include <QtSql/QSqlDatabase>
+#include <QRandomGenerator>
+#include <QStringList>
+#include <QList>
+#include "song.h"
+
+// Fills a library database with synthetic tracks for the benchmarks
+//
+// The shape follows a real collection rather than a uniform one: artists are drawn from a
+// Zipf distribution, so a few artists own most of the albums and most artists own one,
+// albums hold 8 to 17 tracks and a tenth of the tracks credit a guest artist.
+// Names are made from a fixed word list, the same seed always generates the same library.
+class LibraryGenerator
+{
+public:
+    explicit LibraryGenerator(quint32 seed);
+
+    bool generate(QSqlDatabase db, int tracks);
+    QList<Song> songs(int count);
+
+    int artistCount(int tracks);
+
+private:
+    struct Album
+    {
+        int artist;
+        QString name;
+        int tracks;
+    };
+
+    QString words(int min, int max);
+    int zipf();
+    QList<Album> albums(const QStringList &artists, int tracks);
+    QStringList artists(int count);
+
+    QRandomGenerator random;
+    QList<double> artistWeights;   // cumulative Zipf weights of the artists
+};
+
+#endif // LIBRARYGENERATOR_H
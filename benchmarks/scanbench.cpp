@@ -0,0 +1,229 @@
+// Benchmark of the library scan on a generated corpus of tagged audio files
+//
+// A folder of MP3, FLAC and M4A files is generated, see CorpusGenerator, and scanned into
+// a new database through MusicDatabase::scanFolder, the same path as adding a folder in the
+// player: directory walk, tag reading, album art and database writes. After the full scans
+// the folder is scanned once more without changes, which only walks and compares fingerprints.
+//
+// Every scan reports files per second, the time spent in each stage, see ScanSummary, and
+// the peak resident memory. Results are written as JSON.
+//
+//   scanbench --files 10000 --runs 3 --output scan.json
+//
+// The corpus is kept and reused with --corpus, generate it first with --generate-only so
+// its memory does not count towards the peak of the scans on systems that cannot reset it.
+// Scans after the first read the corpus from the page cache, drop caches for cold numbers.
+
+#include "corpusgenerator.h"
+#include "musicdatabase.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDateTime>
+#include <QSysInfo>
+#include <QThread>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+// Starts measuring the peak resident memory from the current usage
+// Only Linux can reset the peak, elsewhere the peak of the whole process is reported
+static void resetPeakMemory()
+{
+#ifdef Q_OS_LINUX
+    QFile clearRefs("/proc/self/clear_refs");
+    if (clearRefs.open(QIODevice::WriteOnly)) clearRefs.write("5");
+#endif
+}
+
+// Returns the peak resident memory in KiB since resetPeakMemory, -1 if it is not known
+static qint64 peakMemory()
+{
+#ifdef Q_OS_LINUX
+    QFile status("/proc/self/status");
+    if (status.open(QIODevice::ReadOnly))
+    {
+        for (const QByteArray &line : status.readAll().split('\n'))
+        {
+            if (line.startsWith("VmHWM:")) { return line.mid(6).trimmed().split(' ').first().toLongLong(); }
+        }
+    }
+#endif
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+#ifdef Q_OS_MACOS
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+#endif
+    return -1;
+}
+
+// Scans directory into database and waits for the scan to finish
+static ScanSummary scan(MusicDatabase &database, const QString &directory)
+{
+    QEventLoop loop;
+    QObject::connect(&database, &MusicDatabase::scanComplete, &loop, &QEventLoop::quit);
+    database.scanFolder(directory);
+    if (database.isScanning()) loop.exec();
+    return database.lastScanSummary();
+}
+
+static QJsonObject result(const QString &kind, int run, const ScanSummary &summary, qint64 peak)
+{
+    int files = summary.added + summary.changed + summary.unchanged + summary.failed;
+
+    QJsonObject stages;
+    stages["walk_ns"] = summary.walkNs;
+    stages["remove_ns"] = summary.removeNs;
+    stages["read_ns"] = summary.readNs;
+    stages["art_ns"] = summary.artNs;
+    stages["write_ns"] = summary.writeNs;
+
+    QJsonObject ret;
+    ret["kind"] = kind;
+    ret["run"] = run;
+    ret["files"] = files;
+    ret["written"] = summary.written;
+    ret["total_ns"] = summary.totalNs;
+    ret["files_per_s"] = files * 1e9 / qMax<qint64>(summary.totalNs, 1);
+    ret["stages"] = stages;
+    ret["art_files"] = summary.artWritten;
+    ret["art_bytes"] = summary.artBytes;
+    ret["peak_rss_kib"] = peak;
+
+    QTextStream(stderr) << QString("%1 scan %2: %3 files in %4 ms, %5 files/s, "
+                                   "walk %6 ms, read %7 ms, art %8 ms, write %9 ms, peak %10 MiB\n")
+                           .arg(kind).arg(run).arg(files).arg(summary.totalNs / 1000000)
+                           .arg(qint64(ret["files_per_s"].toDouble()))
+                           .arg(summary.walkNs / 1000000).arg(summary.readNs / 1000000)
+                           .arg(summary.artNs / 1000000).arg(summary.writeNs / 1000000)
+                           .arg(peak / 1024);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("scanbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times library scans of a generated corpus of tagged audio files");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"files", "Number of files in the corpus.", "count", "10000"},
+        {"runs", "Number of full scans.", "count", "3"},
+        {"seed", "Seed of the generated corpus.", "seed", "1"},
+        {"art-size", "Edge length of the embedded covers in pixels.", "pixels", "600"},
+        {"seconds", "Length of the silent audio in every file.", "seconds", "1"},
+        {"batch", "Rows committed per scan transaction.", "rows", "500"},
+        {"corpus", "Folder the corpus is kept in and reused from.", "folder"},
+        {"generate-only", "Generate the corpus and exit."},
+        {"output", "File the JSON results are written to, standard output by default.", "file"},
+    });
+    parser.process(app);
+
+    int files = qMax(1, parser.value("files").toInt());
+    int runs = qMax(1, parser.value("runs").toInt());
+    quint32 seed = parser.value("seed").toUInt();
+
+    QString output = parser.isSet("output") ? QFileInfo(parser.value("output")).absoluteFilePath() : QString();
+
+    // Every corpus gets its own folder, a folder given with --corpus is never cleared
+    QTemporaryDir temporary;
+    QString corpus = QDir(parser.isSet("corpus") ? parser.value("corpus") : temporary.path())
+                         .absoluteFilePath(QString("corpus-%1-%2").arg(files).arg(seed));
+    QString marker = QDir(corpus).filePath(".complete");
+
+    qint64 corpusBytes = -1;
+    if (!QFile::exists(marker))
+    {
+        QTextStream(stderr) << QString("Generating %1 files in %2\n").arg(files).arg(corpus);
+
+        CorpusGenerator generator(seed);
+        generator.setArtSize(parser.value("art-size").toInt());
+        generator.setSeconds(parser.value("seconds").toInt());
+        if (!generator.generate(corpus, files))
+        {
+            qCritical() << "Could not generate the corpus";
+            return 1;
+        }
+        corpusBytes = generator.bytesWritten();
+
+        QFile done(marker);
+        done.open(QIODevice::WriteOnly);
+    }
+
+    if (parser.isSet("generate-only")) { return 0; }
+
+    // The scanner stores album art next to the working directory, see LibraryScanner::scan
+    QTemporaryDir work;
+    QDir::setCurrent(work.path());
+    QString databasePath = work.filePath("scan.db");
+
+    QJsonArray results;
+    MusicDatabase database;
+    database.setScanBatchSize(parser.value("batch").toInt());
+
+    for (int run = 1; run <= runs; run++)
+    {
+        QDir(work.filePath(".images")).removeRecursively();
+        if (!database.createDatabase(databasePath))
+        {
+            qCritical() << "Could not create" << databasePath;
+            return 1;
+        }
+
+        resetPeakMemory();
+        ScanSummary summary = scan(database, corpus);
+        results.append(result("full", run, summary, peakMemory()));
+    }
+
+    resetPeakMemory();
+    ScanSummary summary = scan(database, corpus);
+    results.append(result("unchanged", 1, summary, peakMemory()));
+
+    QJsonObject report;
+    report["version"] = QString(RHINO_VERSION);
+    report["qt"] = QString(qVersion());
+    report["cpu"] = QSysInfo::currentCpuArchitecture();
+    report["os"] = QSysInfo::prettyProductName();
+    report["threads"] = QThread::idealThreadCount();
+    report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["seed"] = qint64(seed);
+    report["files"] = files;
+    if (corpusBytes >= 0) report["corpus_bytes"] = corpusBytes;
+    report["results"] = results;
+
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (!output.isEmpty())
+    {
+        QFile file(output);
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size())
+        {
+            qCritical() << "Could not write" << file.fileName() << file.errorString();
+            return 1;
+        }
+    }
+    else
+    {
+        QTextStream(stdout) << json;
+    }
+
+    return 0;
+}
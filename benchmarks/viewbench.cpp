@@ -0,0 +1,210 @@
+// Benchmark of the queue view updates on generated queues
+//
+// A QListView shows a SongQueueModel, as the queue of the player does, and every queue change
+// is timed until the view has processed it: the model call plus the events it posts to
+// relayout and repaint. Besides the time every result counts the notifications the model
+// sent, rows inserted or removed, data changed and layout changed, in notifications.
+//
+// Adding songs is timed one at a time, as the player used to, and as one batch, in the
+// original and in a shuffled queue. Track changes, removing a selection and removing a
+// range are timed on a filled queue. Results are written as JSON like librarybench.
+//
+//   viewbench --sizes 1000,10000,100000 --output view.json
+//
+// QT_QPA_PLATFORM defaults to offscreen when it is not set, so no display is needed.
+
+#include "benchmarks.h"
+#include "librarygenerator.h"
+#include "songqueuemodel.h"
+#include "songhandle.h"
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QListView>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDateTime>
+#include <QSysInfo>
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+// A queue shown in a view, with the notifications of the model counted
+class QueueView
+{
+public:
+    QueueView()
+    {
+        view.setModel(&queue);
+        view.resize(480, 720);
+        view.show();
+
+        QObject::connect(&queue, &QAbstractItemModel::rowsInserted, [this]() { notifications++; });
+        QObject::connect(&queue, &QAbstractItemModel::rowsRemoved, [this]() { notifications++; });
+        QObject::connect(&queue, &QAbstractItemModel::dataChanged, [this]() { notifications++; });
+        QObject::connect(&queue, &QAbstractItemModel::layoutChanged, [this]() { notifications++; });
+        QObject::connect(&queue, &QAbstractItemModel::modelReset, [this]() { notifications++; });
+    }
+
+    // Lets the view relayout and repaint everything the changes so far asked for
+    void settle()
+    {
+        QCoreApplication::processEvents();
+    }
+
+    SongQueueModel queue;
+    QListView view;
+    int notifications = 0;
+};
+
+static void benchmarkView(Benchmarks &benchmarks, const QList<SongHandle> &songs)
+{
+    const int rows = songs.size();
+    const int edits = qMin(rows, 100);
+
+    std::unique_ptr<QueueView> queue;
+
+    auto empty = [&queue]() {
+        queue.reset(new QueueView);
+        queue->settle();
+        queue->notifications = 0;
+    };
+
+    auto emptyShuffled = [&queue, &songs]() {
+        queue.reset(new QueueView);
+        queue->queue.setShuffleSeed(1);
+        queue->queue.append(QList<SongHandle> {songs.first(), songs.last()});
+        queue->queue.shuffle(0);
+        queue->queue.setPlayingIndex(0);
+        queue->settle();
+        queue->notifications = 0;
+    };
+
+    auto fill = [&queue, &songs]() {
+        queue.reset(new QueueView);
+        queue->queue.append(songs);
+        queue->queue.setPlayingIndex(0);
+        queue->settle();
+        queue->notifications = 0;
+    };
+
+    auto single = [&queue, &songs]() {
+        for (const SongHandle &song : songs) queue->queue.append(song);
+        queue->settle();
+    };
+
+    auto batch = [&queue, &songs]() {
+        queue->queue.append(songs);
+        queue->settle();
+    };
+
+    // Every benchmark counts the notifications of its last run
+    auto measure = [&benchmarks, &queue, rows](const QString &name, const std::function<void()> &setup,
+                                                const std::function<void()> &run) {
+        queue.reset();
+        benchmarks.measure(name, "view", rows, setup, run);
+        if (queue) benchmarks.annotate("notifications", queue->notifications);
+    };
+
+    measure("view_append_single", empty, single);
+    measure("view_append_batch", empty, batch);
+    measure("view_append_shuffled_single", emptyShuffled, single);
+    measure("view_append_shuffled_batch", emptyShuffled, batch);
+
+    // Track changes through the queue, the view settles after every one as it would while playing
+    measure("view_playing", fill, [&queue, rows, edits]() {
+        for (int i = 1; i <= edits; i++)
+        {
+            queue->queue.setPlayingIndex(int(qint64(i) * (rows - 1) / edits));
+            queue->settle();
+        }
+    });
+
+    // A selection of every other row in the middle of the queue, every row is a run of its own
+    measure("view_remove_selection", fill, [&queue, rows, edits]() {
+        int first = rows / 2 - edits;
+        for (int row = qMin(first + 2 * edits - 2, rows - 1); row >= qMax(first, 0); row -= 2) queue->queue.removeRows(row, 1);
+        queue->settle();
+    });
+
+    measure("view_remove_range", fill, [&queue, rows, edits]() {
+        queue->queue.removeRows(rows / 2 - edits / 2, edits);
+        queue->settle();
+    });
+}
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+    QApplication::setApplicationName("viewbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times the queue view updates on generated queues");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"sizes", "Comma separated queue sizes in tracks.", "sizes", "1000,10000,100000"},
+        {"repeat", "Runs of every benchmark.", "count", "5"},
+        {"budget", "Seconds after which a benchmark stops repeating.", "seconds", "2"},
+        {"timeout", "Seconds a run may take before the benchmark is skipped at larger sizes.", "seconds", "30"},
+        {"seed", "Seed of the generated songs.", "seed", "1"},
+        {"output", "File the JSON results are written to, standard output by default.", "file"},
+    });
+    parser.process(app);
+
+    BenchmarkSettings settings;
+    settings.repeat = qMax(1, parser.value("repeat").toInt());
+    settings.budgetNs = qint64(parser.value("budget").toDouble() * 1e9);
+    settings.timeoutNs = qint64(parser.value("timeout").toDouble() * 1e9);
+    quint32 seed = parser.value("seed").toUInt();
+
+    QList<int> sizes;
+    for (const QString &size : parser.value("sizes").split(',', Qt::SkipEmptyParts))
+    {
+        bool ok = false;
+        int rows = size.trimmed().toInt(&ok);
+        if (!ok || rows <= 0) { qCritical() << "Invalid size" << size; return 1; }
+        sizes.append(rows);
+    }
+    std::sort(sizes.begin(), sizes.end());
+
+    Benchmarks benchmarks(settings);
+
+    for (int rows : std::as_const(sizes))
+    {
+        LibraryGenerator generator(seed);
+        benchmarkView(benchmarks, SongHandle::intern(generator.songs(rows)));
+    }
+
+    QJsonObject report;
+    report["version"] = QString(RHINO_VERSION);
+    report["qt"] = QString(qVersion());
+    report["platform"] = QApplication::platformName();
+    report["cpu"] = QSysInfo::currentCpuArchitecture();
+    report["os"] = QSysInfo::prettyProductName();
+    report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["seed"] = qint64(seed);
+    report["repeat"] = settings.repeat;
+    report["results"] = benchmarks.results;
+
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet("output"))
+    {
+        QFile file(parser.value("output"));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size())
+        {
+            qCritical() << "Could not write" << file.fileName() << file.errorString();
+            return 1;
+        }
+    }
+    else
+    {
+        QTextStream(stdout) << json;
+    }
+
+    return 0;
+}
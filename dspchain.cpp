@@ -0,0 +1,210 @@
+#include "dspchain.h"
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Converts frames of interleaved T to float, scaled to -1 to 1
+// One output channel is the mix of all input channels, otherwise channel c is input channel c
+// modulo the input channels, which duplicates mono and keeps the front pair of surround
+template<typename T>
+void convertFrames(const char *data, qsizetype frames, int inChannels, float *to, int outChannels, float bias, float scale)
+{
+    const qsizetype frameBytes = qsizetype(inChannels) * sizeof(T);
+
+    for (qsizetype i = 0; i < frames; i++)
+    {
+        const char *frame = data + i * frameBytes;
+        float *out = to + i * outChannels;
+
+        auto sample = [frame, bias, scale](int c) {
+            T value;
+            std::memcpy(&value, frame + c * sizeof(T), sizeof(T));
+            return (float(value) - bias) * scale;
+        };
+
+        if (outChannels == 1)
+        {
+            float sum = 0;
+            for (int c = 0; c < inChannels; c++) sum += sample(c);
+            out[0] = sum / float(inChannels);
+        }
+        else
+        {
+            for (int c = 0; c < outChannels; c++) out[c] = sample(c % inChannels);
+        }
+    }
+}
+
+}
+
+DspChain::DspChain(const DspKernels &kernels)
+    : resampler(kernels), equalizing(kernels)
+{}
+
+// Prepares for a new source played at sampleRate with channels
+void DspChain::start(int sampleRate, int channels)
+{
+    this->sampleRate = sampleRate;
+    this->channels = channels;
+
+    equalizing.configure(sampleRate, channels);
+    equalizing.reset();
+    resampler.reset();
+
+    inputFrames = 0;
+    outputFrames = 0;
+    trim = 0;
+}
+
+// Takes effect with the next buffer, the filters keep their state
+void DspChain::setEqualizer(const QList<EqualizerBand> &bands)
+{
+    equalizing.setBands(bands);
+}
+
+QList<EqualizerBand> DspChain::equalizer() const
+{
+    return equalizing.bands();
+}
+
+// Returns the processed audio of a decoded buffer as float frames, empty if its format is not supported
+QByteArray DspChain::process(const char *data, qsizetype size, const QAudioFormat &format)
+{
+    if (sampleRate <= 0 || channels <= 0 || format.sampleRate() <= 0 || format.bytesPerFrame() <= 0) return QByteArray();
+
+    qsizetype frames = size / format.bytesPerFrame();
+    if (frames == 0 || !convert(data, frames, format)) return QByteArray();
+
+    if (inputFrames == 0)
+    {
+        resampler.configure(format.sampleRate(), sampleRate, channels);
+        trim = qRound64(resampler.latency()) + equalizing.latency();
+    }
+
+    inputFrames += frames;
+    return run(frames);
+}
+
+// Returns what the filters still hold once the source has ended
+// Silence is pushed through until the output has as many frames as the input asked for
+QByteArray DspChain::flush()
+{
+    if (inputFrames == 0) return QByteArray();
+
+    const qsizetype frameBytes = qsizetype(channels) * sizeof(float);
+    const qint64 expected = qRound64(inputFrames * resampler.ratio());
+
+    QByteArray ret;
+    for (int i = 0; i < 4 && outputFrames < expected; i++)
+    {
+        qsizetype frames = Resampler::taps + equalizing.latency() + 1;
+        input = QList<float>(frames * channels, 0);
+        ret.append(run(frames));
+    }
+
+    if (outputFrames > expected)
+    {
+        ret.chop(qMin<qsizetype>(ret.size(), (outputFrames - expected) * frameBytes));
+        outputFrames = expected;
+    }
+    return ret;
+}
+
+// Fills input with frames of data, false for a sample format that cannot be converted
+bool DspChain::convert(const char *data, qsizetype frames, const QAudioFormat &format)
+{
+    input.resize(frames * channels);
+    return toFloat(data, frames, format, input.data(), channels);
+}
+
+// Converts frames of data to float frames of channels at to, see convertFrames
+// Returns false for a sample format that cannot be converted
+bool DspChain::toFloat(const char *data, qsizetype frames, const QAudioFormat &format, float *to, int channels)
+{
+    const int inChannels = format.channelCount();
+
+    switch (format.sampleFormat())
+    {
+    case QAudioFormat::UInt8:
+        convertFrames<quint8>(data, frames, inChannels, to, channels, 128.0f, 1.0f / 128);
+        return true;
+    case QAudioFormat::Int16:
+        convertFrames<qint16>(data, frames, inChannels, to, channels, 0.0f, 1.0f / 32768);
+        return true;
+    case QAudioFormat::Int32:
+        convertFrames<qint32>(data, frames, inChannels, to, channels, 0.0f, 1.0f / 2147483648.0f);
+        return true;
+    case QAudioFormat::Float:
+        convertFrames<float>(data, frames, inChannels, to, channels, 0.0f, 1.0f);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Resamples and equalizes frames of input, cutting what is left of the delay at the start
+QByteArray DspChain::run(qsizetype frames)
+{
+    const qsizetype frameBytes = qsizetype(channels) * sizeof(float);
+
+    QByteArray ret(resampler.maxOutput(frames) * frameBytes, Qt::Uninitialized);
+    float *samples = reinterpret_cast<float *>(ret.data());
+
+    qsizetype written = resampler.process(input.constData(), frames, samples);
+    if (equalizing.isActive()) equalizing.process(samples, written);
+
+    qsizetype cut = qsizetype(qMin<qint64>(trim, written));
+    trim -= cut;
+    ret.truncate(written * frameBytes);
+    ret.remove(0, cut * frameBytes);
+
+    outputFrames += written - cut;
+    return ret;
+}
+
+GainRamp::GainRamp(const DspKernels &kernels)
+    : kernels(&kernels)
+{}
+
+void GainRamp::configure(int sampleRate, int channels)
+{
+    this->channels = qMax(channels, 1);
+    rampFrames = qMax<qsizetype>(qsizetype(sampleRate) * rampMSecs / 1000, 1);
+}
+
+// Sets the gain, linear from 0, the samples reach it over the next rampMSecs
+void GainRamp::setGain(float gain)
+{
+    target.store(qMax(gain, 0.0f), std::memory_order_relaxed);
+}
+
+float GainRamp::gain() const
+{
+    return target.load(std::memory_order_relaxed);
+}
+
+// Applies the gain to frames of interleaved samples in place
+void GainRamp::process(float *samples, qsizetype frames)
+{
+    float goal = target.load(std::memory_order_relaxed);
+    if (goal != rampTarget)
+    {
+        rampTarget = goal;
+        rampLeft = rampFrames;
+    }
+
+    if (rampLeft > 0)
+    {
+        qsizetype n = qMin(frames, rampLeft);
+        float end = current + (rampTarget - current) * float(n) / float(rampLeft);
+        kernels->gain(samples, n, channels, current, end);
+
+        rampLeft -= n;
+        current = rampLeft > 0 ? end : rampTarget;
+        samples += n * channels;
+        frames -= n;
+    }
+
+    if (frames > 0 && current != 1) kernels->gain(samples, frames, channels, current, current);
+}
@@ -0,0 +1,74 @@
+#ifndef DSPCHAIN_H
+#define DSPCHAIN_H
+
+#include "dspkernels.h"
+#include "equalizer.h"
+#include "resampler.h"
+#include <QAudioFormat>
+#include <QByteArray>
+#include <QList>
+#include <atomic>
+
+// Processing between QAudioDecoder and the ring of PcmPlayer, runs on the decoder thread
+//
+// Decoded buffers in whatever format the file has are converted to float with the channels
+// of the output, resampled to the output rate and equalized. The delay of the resampler and
+// the equalizer is cut from the start of a source and flush plays out their tail, so the
+// output has as many frames as the input at the other rate and positions stay exact.
+class DspChain
+{
+public:
+    explicit DspChain(const DspKernels &kernels = DspKernels::best());
+
+    void start(int sampleRate, int channels);
+    void setEqualizer(const QList<EqualizerBand> &bands);
+    QList<EqualizerBand> equalizer() const;
+
+    QByteArray process(const char *data, qsizetype size, const QAudioFormat &format);
+    QByteArray flush();
+
+    static bool toFloat(const char *data, qsizetype frames, const QAudioFormat &format, float *to, int channels);
+
+private:
+    bool convert(const char *data, qsizetype frames, const QAudioFormat &format);
+    QByteArray run(qsizetype frames);
+
+    Resampler resampler;
+    Equalizer equalizing;
+    int sampleRate = 0;
+    int channels = 0;
+
+    QList<float> input;         // the last buffer as float with the output channels
+    qint64 inputFrames = 0;     // since start
+    qint64 outputFrames = 0;
+    qint64 trim = 0;            // frames still to cut from the start
+};
+
+// Volume applied where the samples leave the ring, so a change is heard within one buffer
+//
+// A new gain is reached with a linear ramp over rampMSecs instead of a step, which would
+// click, the zipper noise of a volume slider. setGain may be called from any thread.
+class GainRamp
+{
+public:
+    static const int rampMSecs = 10;
+
+    explicit GainRamp(const DspKernels &kernels = DspKernels::best());
+
+    void configure(int sampleRate, int channels);
+    void setGain(float gain);
+    float gain() const;
+    void process(float *samples, qsizetype frames);
+
+private:
+    const DspKernels *kernels;
+    std::atomic<float> target {1};
+    int channels = 2;
+    qsizetype rampFrames = 441;
+
+    float current = 1;
+    float rampTarget = 1;
+    qsizetype rampLeft = 0;
+};
+
+#endif // DSPCHAIN_H
@@ -0,0 +1,475 @@
+#include "dspkernels.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RHINO_DSP_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang compile a function for an instruction set the rest of the file may not assume,
+// MSVC emits any intrinsic without it
+#if defined(__GNUC__)
+#define RHINO_DSP_TARGET(isa) __attribute__((target(isa)))
+#else
+#define RHINO_DSP_TARGET(isa)
+#endif
+
+BiquadSection::BiquadSection()
+{
+    for (int band = 0; band < bands; band++) setBand(band, 1, 0, 0, 0, 0);
+    reset();
+}
+
+// Sets the coefficients of band, divided by a0 already
+void BiquadSection::setBand(int band, double b0, double b1, double b2, double a1, double a2)
+{
+    for (int lane = 2 * band; lane < 2 * band + 2; lane++)
+    {
+        this->b0[lane] = float(b0);
+        this->b1[lane] = float(b1);
+        this->b2[lane] = float(b2);
+        this->a1[lane] = float(a1);
+        this->a2[lane] = float(a2);
+    }
+}
+
+// Clears the state, the next frames are filtered as if silence came before them
+void BiquadSection::reset()
+{
+    for (int lane = 0; lane < lanes; lane++)
+    {
+        z1[lane] = 0;
+        z2[lane] = 0;
+        y[lane] = 0;
+    }
+}
+
+namespace {
+
+void gainScalar(float *samples, qsizetype frames, int channels, float from, float to)
+{
+    if (frames <= 0) return;
+    float step = (to - from) / float(frames);
+
+    for (qsizetype i = 0; i < frames; i++)
+    {
+        float gain = from + step * float(i);
+        for (int c = 0; c < channels; c++) samples[i * channels + c] *= gain;
+    }
+}
+
+// One frame steps every lane, see BiquadSection
+void biquadStereoScalar(float *samples, qsizetype frames, BiquadSection *sections, int count)
+{
+    const int lanes = BiquadSection::lanes;
+
+    for (int s = 0; s < count; s++)
+    {
+        BiquadSection &q = sections[s];
+
+        for (qsizetype i = 0; i < frames; i++)
+        {
+            float *frame = samples + 2 * i;
+
+            float x[lanes];
+            x[0] = frame[0];
+            x[1] = frame[1];
+            for (int lane = 2; lane < lanes; lane++) x[lane] = q.y[lane - 2];
+
+            for (int lane = 0; lane < lanes; lane++)
+            {
+                float out = q.b0[lane] * x[lane] + q.z1[lane];
+                q.z1[lane] = q.b1[lane] * x[lane] - q.a1[lane] * out + q.z2[lane];
+                q.z2[lane] = q.b2[lane] * x[lane] - q.a2[lane] * out;
+                q.y[lane] = out;
+            }
+
+            frame[0] = q.y[lanes - 2];
+            frame[1] = q.y[lanes - 1];
+        }
+    }
+}
+
+float dotScalar(const float *a, const float *b, qsizetype n)
+{
+    float sum = 0;
+    for (qsizetype i = 0; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+void multiplyAddScalar(float *to, const float *from, float factor, qsizetype n)
+{
+    for (qsizetype i = 0; i < n; i++) to[i] += factor * from[i];
+}
+
+float peakScalar(const float *samples, qsizetype n)
+{
+    float ret = 0;
+    for (qsizetype i = 0; i < n; i++) ret = std::max(ret, std::abs(samples[i]));
+    return ret;
+}
+
+#ifdef RHINO_DSP_X86
+
+// Vectors hold whole frames when the channels divide 4, other layouts take the scalar loop
+RHINO_DSP_TARGET("sse2")
+void gainSse(float *samples, qsizetype frames, int channels, float from, float to)
+{
+    if (frames <= 0) return;
+    if (4 % channels != 0) return gainScalar(samples, frames, channels, from, to);
+
+    float step = (to - from) / float(frames);
+    const qsizetype framesPerVector = 4 / channels;
+
+    // Frame index of every lane, the gain is computed as in the scalar loop
+    __m128 index = channels == 1 ? _mm_setr_ps(0, 1, 2, 3) : channels == 2 ? _mm_setr_ps(0, 0, 1, 1) : _mm_setzero_ps();
+    const __m128 advance = _mm_set1_ps(float(framesPerVector));
+    const __m128 base = _mm_set1_ps(from);
+    const __m128 slope = _mm_set1_ps(step);
+
+    qsizetype i = 0;
+    for (; i + framesPerVector <= frames; i += framesPerVector)
+    {
+        float *at = samples + i * channels;
+        __m128 gain = _mm_add_ps(base, _mm_mul_ps(slope, index));
+        _mm_storeu_ps(at, _mm_mul_ps(_mm_loadu_ps(at), gain));
+        index = _mm_add_ps(index, advance);
+    }
+
+    for (; i < frames; i++)
+    {
+        float gain = from + step * float(i);
+        for (int c = 0; c < channels; c++) samples[i * channels + c] *= gain;
+    }
+}
+
+// Lanes 0-3 in lo and 4-7 in hi, a frame enters lanes 0 and 1 and the rest shift up by two
+RHINO_DSP_TARGET("sse2")
+void biquadStereoSse(float *samples, qsizetype frames, BiquadSection *sections, int count)
+{
+    for (int s = 0; s < count; s++)
+    {
+        BiquadSection &q = sections[s];
+
+        const __m128 b0lo = _mm_loadu_ps(q.b0), b0hi = _mm_loadu_ps(q.b0 + 4);
+        const __m128 b1lo = _mm_loadu_ps(q.b1), b1hi = _mm_loadu_ps(q.b1 + 4);
+        const __m128 b2lo = _mm_loadu_ps(q.b2), b2hi = _mm_loadu_ps(q.b2 + 4);
+        const __m128 a1lo = _mm_loadu_ps(q.a1), a1hi = _mm_loadu_ps(q.a1 + 4);
+        const __m128 a2lo = _mm_loadu_ps(q.a2), a2hi = _mm_loadu_ps(q.a2 + 4);
+        __m128 z1lo = _mm_loadu_ps(q.z1), z1hi = _mm_loadu_ps(q.z1 + 4);
+        __m128 z2lo = _mm_loadu_ps(q.z2), z2hi = _mm_loadu_ps(q.z2 + 4);
+        __m128 ylo = _mm_loadu_ps(q.y), yhi = _mm_loadu_ps(q.y + 4);
+
+        for (qsizetype i = 0; i < frames; i++)
+        {
+            __m64 *frame = reinterpret_cast<__m64 *>(samples + 2 * i);
+
+            __m128 in = _mm_loadl_pi(_mm_setzero_ps(), frame);
+            __m128 xlo = _mm_movelh_ps(in, ylo);
+            __m128 xhi = _mm_shuffle_ps(ylo, yhi, _MM_SHUFFLE(1, 0, 3, 2));
+
+            ylo = _mm_add_ps(_mm_mul_ps(b0lo, xlo), z1lo);
+            yhi = _mm_add_ps(_mm_mul_ps(b0hi, xhi), z1hi);
+            z1lo = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1lo, xlo), _mm_mul_ps(a1lo, ylo)), z2lo);
+            z1hi = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1hi, xhi), _mm_mul_ps(a1hi, yhi)), z2hi);
+            z2lo = _mm_sub_ps(_mm_mul_ps(b2lo, xlo), _mm_mul_ps(a2lo, ylo));
+            z2hi = _mm_sub_ps(_mm_mul_ps(b2hi, xhi), _mm_mul_ps(a2hi, yhi));
+
+            _mm_storeh_pi(frame, yhi);
+        }
+
+        _mm_storeu_ps(q.z1, z1lo);
+        _mm_storeu_ps(q.z1 + 4, z1hi);
+        _mm_storeu_ps(q.z2, z2lo);
+        _mm_storeu_ps(q.z2 + 4, z2hi);
+        _mm_storeu_ps(q.y, ylo);
+        _mm_storeu_ps(q.y + 4, yhi);
+    }
+}
+
+RHINO_DSP_TARGET("sse2")
+float dotSse(const float *a, const float *b, qsizetype n)
+{
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+
+    qsizetype i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+
+    __m128 sum = _mm_add_ps(sum0, sum1);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+
+    float ret = _mm_cvtss_f32(sum);
+    for (; i < n; i++) ret += a[i] * b[i];
+    return ret;
+}
+
+RHINO_DSP_TARGET("sse2")
+void multiplyAddSse(float *to, const float *from, float factor, qsizetype n)
+{
+    const __m128 k = _mm_set1_ps(factor);
+
+    qsizetype i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(to + i, _mm_add_ps(_mm_loadu_ps(to + i), _mm_mul_ps(k, _mm_loadu_ps(from + i))));
+    for (; i < n; i++) to[i] += factor * from[i];
+}
+
+// The absolute value clears the sign bit
+RHINO_DSP_TARGET("sse2")
+float peakSse(const float *samples, qsizetype n)
+{
+    const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 max0 = _mm_setzero_ps();
+    __m128 max1 = _mm_setzero_ps();
+
+    qsizetype i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        max0 = _mm_max_ps(max0, _mm_and_ps(_mm_loadu_ps(samples + i), magnitude));
+        max1 = _mm_max_ps(max1, _mm_and_ps(_mm_loadu_ps(samples + i + 4), magnitude));
+    }
+
+    __m128 max = _mm_max_ps(max0, max1);
+    max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+    max = _mm_max_ss(max, _mm_shuffle_ps(max, max, _MM_SHUFFLE(1, 1, 1, 1)));
+
+    float ret = _mm_cvtss_f32(max);
+    for (; i < n; i++) ret = std::max(ret, std::abs(samples[i]));
+    return ret;
+}
+
+RHINO_DSP_TARGET("avx2")
+void gainAvx2(float *samples, qsizetype frames, int channels, float from, float to)
+{
+    if (frames <= 0) return;
+    if (8 % channels != 0) return gainScalar(samples, frames, channels, from, to);
+
+    float step = (to - from) / float(frames);
+    const qsizetype framesPerVector = 8 / channels;
+
+    __m256 index;
+    switch (channels)
+    {
+    case 1: index = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); break;
+    case 2: index = _mm256_setr_ps(0, 0, 1, 1, 2, 2, 3, 3); break;
+    case 4: index = _mm256_setr_ps(0, 0, 0, 0, 1, 1, 1, 1); break;
+    default: index = _mm256_setzero_ps(); break;
+    }
+    const __m256 advance = _mm256_set1_ps(float(framesPerVector));
+    const __m256 base = _mm256_set1_ps(from);
+    const __m256 slope = _mm256_set1_ps(step);
+
+    qsizetype i = 0;
+    for (; i + framesPerVector <= frames; i += framesPerVector)
+    {
+        float *at = samples + i * channels;
+        __m256 gain = _mm256_add_ps(base, _mm256_mul_ps(slope, index));
+        _mm256_storeu_ps(at, _mm256_mul_ps(_mm256_loadu_ps(at), gain));
+        index = _mm256_add_ps(index, advance);
+    }
+
+    for (; i < frames; i++)
+    {
+        float gain = from + step * float(i);
+        for (int c = 0; c < channels; c++) samples[i * channels + c] *= gain;
+    }
+}
+
+// All eight lanes in one register, the shift up by two lanes is a single permute
+RHINO_DSP_TARGET("avx2")
+void biquadStereoAvx2(float *samples, qsizetype frames, BiquadSection *sections, int count)
+{
+    const __m256i shift = _mm256_setr_epi32(0, 0, 0, 1, 2, 3, 4, 5);
+
+    for (int s = 0; s < count; s++)
+    {
+        BiquadSection &q = sections[s];
+
+        const __m256 b0 = _mm256_loadu_ps(q.b0);
+        const __m256 b1 = _mm256_loadu_ps(q.b1);
+        const __m256 b2 = _mm256_loadu_ps(q.b2);
+        const __m256 a1 = _mm256_loadu_ps(q.a1);
+        const __m256 a2 = _mm256_loadu_ps(q.a2);
+        __m256 z1 = _mm256_loadu_ps(q.z1);
+        __m256 z2 = _mm256_loadu_ps(q.z2);
+        __m256 y = _mm256_loadu_ps(q.y);
+
+        for (qsizetype i = 0; i < frames; i++)
+        {
+            __m64 *frame = reinterpret_cast<__m64 *>(samples + 2 * i);
+
+            __m128 in = _mm_loadl_pi(_mm_setzero_ps(), frame);
+            __m256 x = _mm256_permutevar8x32_ps(y, shift);
+            x = _mm256_blend_ps(x, _mm256_castps128_ps256(in), 0x03);
+
+            y = _mm256_add_ps(_mm256_mul_ps(b0, x), z1);
+            z1 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1, x), _mm256_mul_ps(a1, y)), z2);
+            z2 = _mm256_sub_ps(_mm256_mul_ps(b2, x), _mm256_mul_ps(a2, y));
+
+            _mm_storeh_pi(frame, _mm256_extractf128_ps(y, 1));
+        }
+
+        _mm256_storeu_ps(q.z1, z1);
+        _mm256_storeu_ps(q.z2, z2);
+        _mm256_storeu_ps(q.y, y);
+    }
+}
+
+RHINO_DSP_TARGET("avx2")
+float dotAvx2(const float *a, const float *b, qsizetype n)
+{
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+
+    qsizetype i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+    }
+
+    __m256 sum8 = _mm256_add_ps(sum0, sum1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+
+    float ret = _mm_cvtss_f32(sum);
+    for (; i < n; i++) ret += a[i] * b[i];
+    return ret;
+}
+
+RHINO_DSP_TARGET("avx2")
+void multiplyAddAvx2(float *to, const float *from, float factor, qsizetype n)
+{
+    const __m256 k = _mm256_set1_ps(factor);
+
+    qsizetype i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(to + i, _mm256_add_ps(_mm256_loadu_ps(to + i), _mm256_mul_ps(k, _mm256_loadu_ps(from + i))));
+    }
+    for (; i < n; i++) to[i] += factor * from[i];
+}
+
+RHINO_DSP_TARGET("avx2")
+float peakAvx2(const float *samples, qsizetype n)
+{
+    const __m256 magnitude = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 max0 = _mm256_setzero_ps();
+    __m256 max1 = _mm256_setzero_ps();
+
+    qsizetype i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        max0 = _mm256_max_ps(max0, _mm256_and_ps(_mm256_loadu_ps(samples + i), magnitude));
+        max1 = _mm256_max_ps(max1, _mm256_and_ps(_mm256_loadu_ps(samples + i + 8), magnitude));
+    }
+
+    __m256 max8 = _mm256_max_ps(max0, max1);
+    __m128 max = _mm_max_ps(_mm256_castps256_ps128(max8), _mm256_extractf128_ps(max8, 1));
+    max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+    max = _mm_max_ss(max, _mm_shuffle_ps(max, max, _MM_SHUFFLE(1, 1, 1, 1)));
+
+    float ret = _mm_cvtss_f32(max);
+    for (; i < n; i++) ret = std::max(ret, std::abs(samples[i]));
+    return ret;
+}
+
+bool cpuHasAvx2()
+{
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool osSavesAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    if (!osSavesAvx) return false;
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    return false;
+#endif
+}
+
+bool cpuHasSse2()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    return true;
+#elif defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return info[3] & (1 << 26);
+#else
+    return false;
+#endif
+}
+
+// Sets the flush to zero and denormals are zero bits of MXCSR
+RHINO_DSP_TARGET("sse2")
+void setFlushToZero()
+{
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+}
+
+#endif
+
+const DspKernels scalarKernels {DspKernels::Scalar, "scalar", gainScalar, biquadStereoScalar, dotScalar, multiplyAddScalar, peakScalar};
+#ifdef RHINO_DSP_X86
+const DspKernels sseKernels {DspKernels::Sse, "sse", gainSse, biquadStereoSse, dotSse, multiplyAddSse, peakSse};
+const DspKernels avx2Kernels {DspKernels::Avx2, "avx2", gainAvx2, biquadStereoAvx2, dotAvx2, multiplyAddAvx2, peakAvx2};
+#endif
+
+}
+
+bool DspKernels::isSupported(Isa isa)
+{
+    switch (isa)
+    {
+    case Scalar: return true;
+#ifdef RHINO_DSP_X86
+    case Sse: return cpuHasSse2();
+    case Avx2: return cpuHasAvx2();
+#endif
+    default: return false;
+    }
+}
+
+// Returns the kernels of isa, the scalar ones if the CPU does not support it
+const DspKernels &DspKernels::get(Isa isa)
+{
+    if (!isSupported(isa)) return scalarKernels;
+
+#ifdef RHINO_DSP_X86
+    if (isa == Avx2) return avx2Kernels;
+    if (isa == Sse) return sseKernels;
+#endif
+    return scalarKernels;
+}
+
+const DspKernels &DspKernels::best()
+{
+    static const DspKernels &kernels = get(isSupported(Avx2) ? Avx2 : Sse);
+    return kernels;
+}
+
+// Makes denormal floats count as zero on the calling thread
+// A filter ringing out into silence would otherwise slow down by orders of magnitude
+void DspKernels::flushDenormals()
+{
+#ifdef RHINO_DSP_X86
+    if (cpuHasSse2()) setFlushToZero();
+#endif
+}
@@ -0,0 +1,67 @@
+#ifndef DSPKERNELS_H
+#define DSPKERNELS_H
+
+#include <QtGlobal>
+
+// Four biquads run as a pipeline over interleaved stereo, see DspKernels::biquadStereo
+//
+// Lane 2 * band + channel holds the coefficients and the transposed direct form II state of
+// one channel of one band. Every frame all lanes step at once: band 0 takes the new frame and
+// every other band the output band - 1 had the frame before, so the section delays its input
+// by bands - 1 frames. Unused bands pass their input through.
+struct BiquadSection
+{
+    static const int bands = 4;
+    static const int lanes = 2 * bands;
+
+    float b0[lanes];
+    float b1[lanes];
+    float b2[lanes];
+    float a1[lanes];
+    float a2[lanes];
+    float z1[lanes];
+    float z2[lanes];
+    float y[lanes];     // outputs of the last frame
+
+    BiquadSection();
+    void setBand(int band, double b0, double b1, double b2, double a1, double a2);
+    void reset();
+};
+
+// Inner loops of the DSP chain, one table of function pointers per instruction set
+//
+// Every kernel has a scalar version and on x86 SSE and AVX2 versions. get returns the table of
+// an instruction set, best the fastest one the CPU supports. The versions of gain, biquadStereo,
+// multiplyAdd and peak do the same float operations in the same order, dot adds in a different
+// order and differs by rounding, see dspbench.
+class DspKernels
+{
+public:
+    enum Isa { Scalar, Sse, Avx2 };
+
+    static bool isSupported(Isa isa);
+    static const DspKernels &get(Isa isa);
+    static const DspKernels &best();
+    static void flushDenormals();
+
+    Isa isa;
+    const char *name;
+
+    // Multiplies frames of interleaved samples by a gain going linearly from "from" at the first
+    // frame toward "to", which the frame after the last one would get
+    void (*gain)(float *samples, qsizetype frames, int channels, float from, float to);
+
+    // Filters interleaved stereo frames in place through count sections in turn
+    void (*biquadStereo)(float *samples, qsizetype frames, BiquadSection *sections, int count);
+
+    // Returns the sum of a[i] * b[i]
+    float (*dot)(const float *a, const float *b, qsizetype n);
+
+    // Adds factor * from[i] to to[i]
+    void (*multiplyAdd)(float *to, const float *from, float factor, qsizetype n);
+
+    // Returns the largest absolute value of n samples, 0 for none
+    float (*peak)(const float *samples, qsizetype n);
+};
+
+#endif // DSPKERNELS_H
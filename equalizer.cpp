@@ -0,0 +1,162 @@
+#include "equalizer.h"
+#include <cmath>
+
+Equalizer::Equalizer(const DspKernels &kernels)
+    : kernels(&kernels)
+{}
+
+// Sets the format of the audio, clears the state when it changed
+void Equalizer::configure(int sampleRate, int channels)
+{
+    if (sampleRate == this->sampleRate && channels == this->channels) return;
+
+    this->sampleRate = sampleRate;
+    this->channels = channels;
+    update();
+}
+
+// Replaces the bands, the filters keep their state so playing audio changes without a click
+void Equalizer::setBands(const QList<EqualizerBand> &bands)
+{
+    bandList = bands;
+    update();
+}
+
+QList<EqualizerBand> Equalizer::bands() const
+{
+    return bandList;
+}
+
+bool Equalizer::isActive() const
+{
+    return !sections.isEmpty() || !filters.isEmpty();
+}
+
+// Frames the output lags behind the input
+int Equalizer::latency() const
+{
+    return int(sections.size()) * (BiquadSection::bands - 1);
+}
+
+// Filters frames of interleaved samples in place
+void Equalizer::process(float *samples, qsizetype frames)
+{
+    if (!sections.isEmpty())
+    {
+        kernels->biquadStereo(samples, frames, sections.data(), int(sections.size()));
+        return;
+    }
+
+    for (qsizetype f = 0; f < filters.size(); f++)
+    {
+        const Coefficients &k = filters[f];
+
+        for (int c = 0; c < channels; c++)
+        {
+            float &z1 = state[(f * channels + c) * 2];
+            float &z2 = state[(f * channels + c) * 2 + 1];
+
+            for (qsizetype i = 0; i < frames; i++)
+            {
+                float &sample = samples[i * channels + c];
+                float x = sample;
+                sample = k.b0 * x + z1;
+                z1 = k.b1 * x - k.a1 * sample + z2;
+                z2 = k.b2 * x - k.a2 * sample;
+            }
+        }
+    }
+}
+
+// Clears the state of every filter, for audio that does not continue what was filtered before
+void Equalizer::reset()
+{
+    for (BiquadSection &section : sections) section.reset();
+    state.fill(0);
+}
+
+// Rebuilds the filters of the bands that change the sound
+// Stereo sections that keep their band count keep their state
+void Equalizer::update()
+{
+    QList<Coefficients> active;
+    if (sampleRate > 0 && channels > 0)
+    {
+        for (const EqualizerBand &band : std::as_const(bandList))
+        {
+            if (band.gain != 0 && band.frequency > 0 && band.q > 0) active.append(coefficients(band));
+        }
+    }
+
+    if (channels != 2)
+    {
+        sections.clear();
+        if (active.size() != filters.size() || state.size() != active.size() * channels * 2) state = QList<float>(active.size() * channels * 2, 0);
+        filters = active;
+        return;
+    }
+
+    filters.clear();
+    state.clear();
+
+    qsizetype count = (active.size() + BiquadSection::bands - 1) / BiquadSection::bands;
+    sections.resize(count);
+
+    for (qsizetype s = 0; s < count; s++)
+    {
+        for (int band = 0; band < BiquadSection::bands; band++)
+        {
+            qsizetype i = s * BiquadSection::bands + band;
+            if (i < active.size())
+            {
+                const Coefficients &k = active[i];
+                sections[s].setBand(band, k.b0, k.b1, k.b2, k.a1, k.a2);
+            }
+            else sections[s].setBand(band, 1, 0, 0, 0, 0);
+        }
+    }
+}
+
+// Coefficients of band divided by a0
+Equalizer::Coefficients Equalizer::coefficients(const EqualizerBand &band) const
+{
+    const double pi = 3.14159265358979323846;
+
+    double frequency = qMin(band.frequency, sampleRate * 0.49);
+    double a = std::pow(10.0, band.gain / 40);
+    double w0 = 2 * pi * frequency / sampleRate;
+    double cosw0 = std::cos(w0);
+    double alpha = std::sin(w0) / (2 * band.q);
+    double shelf = 2 * std::sqrt(a) * alpha;
+
+    double b0, b1, b2, a0, a1, a2;
+    switch (band.type)
+    {
+    case EqualizerBand::LowShelf:
+        b0 = a * ((a + 1) - (a - 1) * cosw0 + shelf);
+        b1 = 2 * a * ((a - 1) - (a + 1) * cosw0);
+        b2 = a * ((a + 1) - (a - 1) * cosw0 - shelf);
+        a0 = (a + 1) + (a - 1) * cosw0 + shelf;
+        a1 = -2 * ((a - 1) + (a + 1) * cosw0);
+        a2 = (a + 1) + (a - 1) * cosw0 - shelf;
+        break;
+    case EqualizerBand::HighShelf:
+        b0 = a * ((a + 1) + (a - 1) * cosw0 + shelf);
+        b1 = -2 * a * ((a - 1) + (a + 1) * cosw0);
+        b2 = a * ((a + 1) + (a - 1) * cosw0 - shelf);
+        a0 = (a + 1) - (a - 1) * cosw0 + shelf;
+        a1 = 2 * ((a - 1) - (a + 1) * cosw0);
+        a2 = (a + 1) - (a - 1) * cosw0 - shelf;
+        break;
+    default:
+        b0 = 1 + alpha * a;
+        b1 = -2 * cosw0;
+        b2 = 1 - alpha * a;
+        a0 = 1 + alpha / a;
+        a1 = -2 * cosw0;
+        a2 = 1 - alpha / a;
+        break;
+    }
+
+    return Coefficients {float(b0 / a0), float(b1 / a0), float(b2 / a0), float(a1 / a0), float(a2 / a0)};
+}
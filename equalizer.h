@@ -0,0 +1,55 @@
+#ifndef EQUALIZER_H
+#define EQUALIZER_H
+
+#include "dspkernels.h"
+#include <QList>
+
+struct EqualizerBand
+{
+    enum Type { Peak, LowShelf, HighShelf };
+
+    Type type = Peak;
+    double frequency = 1000;    // Hz, the centre of a peak and the midpoint of a shelf
+    double gain = 0;            // dB
+    double q = 0.7071;
+};
+
+// Parametric equalizer of biquad bands, coefficients after the Audio EQ Cookbook
+//
+// Stereo runs through DspKernels::biquadStereo four bands at a time, which delays the audio
+// by latency frames. Other channel counts are filtered band by band without delay. Bands
+// with a gain of 0 dB are left out, so an equalizer without gain costs nothing.
+class Equalizer
+{
+public:
+    explicit Equalizer(const DspKernels &kernels = DspKernels::best());
+
+    void configure(int sampleRate, int channels);
+    void setBands(const QList<EqualizerBand> &bands);
+    QList<EqualizerBand> bands() const;
+    bool isActive() const;
+    int latency() const;
+
+    void process(float *samples, qsizetype frames);
+    void reset();
+
+private:
+    struct Coefficients
+    {
+        float b0, b1, b2, a1, a2;
+    };
+
+    void update();
+    Coefficients coefficients(const EqualizerBand &band) const;
+
+    const DspKernels *kernels;
+    QList<EqualizerBand> bandList;
+    int sampleRate = 0;
+    int channels = 0;
+
+    QList<BiquadSection> sections;  // stereo
+    QList<Coefficients> filters;    // other channel counts
+    QList<float> state;             // z1 and z2 of every channel of every filter
+};
+
+#endif // EQUALIZER_H
@@ -0,0 +1,215 @@
+#include "gaplessplayer.h"
+
+GaplessPlayer::GaplessPlayer(QObject *parent)
+    : PlaybackEngine{parent}
+{
+    players[0].setAudioOutput(&outputs[0]);
+    players[1].setAudioOutput(&outputs[1]);
+    active = &players[0];
+    standby = &players[1];
+
+    connectPlayer(&players[0]);
+    connectPlayer(&players[1]);
+}
+
+// Forwards the signals of player while it is the active one
+void GaplessPlayer::connectPlayer(QMediaPlayer *player)
+{
+    QObject::connect(player, &QMediaPlayer::mediaStatusChanged, this, [=](QMediaPlayer::MediaStatus status) { statusChanged(player, status); });
+    QObject::connect(player, &QMediaPlayer::positionChanged, this, [=](qint64 position) { progress(player, position); });
+    QObject::connect(player, &QMediaPlayer::playbackStateChanged, this, [=](QMediaPlayer::PlaybackState state) {
+        if (player == active) emit playbackStateChanged(state);
+    });
+    // A standby that failed keeps its source so it is not loaded again, setSource opens it the usual way
+    QObject::connect(player, &QMediaPlayer::errorOccurred, this, [=]() {
+        if (player == standby) standbyReady = false;
+    });
+}
+
+// Plays source, a preloaded source starts without reopening the file
+//
+// The switch to a preloaded source is reported as LoadedMedia like a new source
+void GaplessPlayer::setSource(const QUrl &source)
+{
+    if (active->mediaStatus() != QMediaPlayer::EndOfMedia) measuringGap = false;
+
+    if (source.isEmpty() || standby->source() != source || standby->mediaStatus() == QMediaPlayer::InvalidMedia)
+    {
+        active->setSource(source);
+        return;
+    }
+
+    QMediaPlayer *previous = active;
+    active = standby;
+    standby = previous;
+    standbyReady = false;
+
+    previous->stop();
+    previous->setSource(QUrl());
+
+    active->play();
+
+    // A standby still loading reports LoadedMedia itself once it is loaded
+    QMediaPlayer::MediaStatus status = active->mediaStatus();
+    if (status == QMediaPlayer::LoadedMedia || status == QMediaPlayer::BufferedMedia || status == QMediaPlayer::BufferingMedia)
+    {
+        QMetaObject::invokeMethod(this, [this, player = active]() {
+            if (player == active) emit mediaStatusChanged(QMediaPlayer::LoadedMedia);
+        }, Qt::QueuedConnection);
+    }
+}
+
+QUrl GaplessPlayer::source() const
+{
+    return active->source();
+}
+
+// Sets the source expected after the current one, an empty url preloads nothing
+void GaplessPlayer::setNext(const QUrl &source)
+{
+    if (source == nextSource) return;
+
+    nextSource = source;
+    if (!standby->source().isEmpty() && standby->source() != source) dropStandby();
+    preload();
+}
+
+QUrl GaplessPlayer::next() const
+{
+    return nextSource;
+}
+
+// Sets how long before the end of a track the next one is loaded, 0 turns preloading off
+void GaplessPlayer::setPreloadTime(qint64 msecs)
+{
+    preloadMsecs = qMax<qint64>(msecs, 0);
+    if (preloadMsecs == 0) dropStandby();
+}
+
+qint64 GaplessPlayer::preloadTime() const
+{
+    return preloadMsecs;
+}
+
+void GaplessPlayer::play()
+{
+    active->play();
+}
+
+void GaplessPlayer::pause()
+{
+    active->pause();
+}
+
+void GaplessPlayer::stop()
+{
+    active->stop();
+}
+
+bool GaplessPlayer::isPlaying() const
+{
+    return active->isPlaying();
+}
+
+QMediaPlayer::PlaybackState GaplessPlayer::playbackState() const
+{
+    return active->playbackState();
+}
+
+QMediaPlayer::MediaStatus GaplessPlayer::mediaStatus() const
+{
+    return active->mediaStatus();
+}
+
+qint64 GaplessPlayer::position() const
+{
+    return active->position();
+}
+
+void GaplessPlayer::setPosition(qint64 position)
+{
+    active->setPosition(position);
+}
+
+qint64 GaplessPlayer::duration() const
+{
+    return active->duration();
+}
+
+// Sets the volume of both players, 0 to 1
+void GaplessPlayer::setVolume(float volume)
+{
+    outputs[0].setVolume(volume);
+    outputs[1].setVolume(volume);
+}
+
+float GaplessPlayer::volume() const
+{
+    return outputs[0].volume();
+}
+
+// Returns the last gap in nanoseconds, -1 before the first track change
+qint64 GaplessPlayer::lastGap() const
+{
+    return gap;
+}
+
+// The standby player is paused once loaded so its first buffers are decoded before it plays
+void GaplessPlayer::statusChanged(QMediaPlayer *player, QMediaPlayer::MediaStatus status)
+{
+    if (player == standby)
+    {
+        if (status == QMediaPlayer::LoadedMedia && !standbyReady)
+        {
+            standbyReady = true;
+            standby->pause();
+        }
+        return;
+    }
+
+    if (status == QMediaPlayer::EndOfMedia)
+    {
+        endTimer.start();
+        measuringGap = true;
+    }
+
+    emit mediaStatusChanged(status);
+}
+
+// Starts the preload near the end of the active track and measures the gap after a track change
+// The first position after a change tells how long the audio has been running
+void GaplessPlayer::progress(QMediaPlayer *player, qint64 position)
+{
+    if (player != active) return;
+
+    if (measuringGap && position > 0)
+    {
+        measuringGap = false;
+        gap = qMax<qint64>(endTimer.nsecsElapsed() - position * 1000000, 0);
+        emit gapMeasured(gap);
+    }
+
+    preload();
+    emit positionChanged(position);
+}
+
+// Loads the next source into the standby player once the active one is within the preload time
+void GaplessPlayer::preload()
+{
+    if (nextSource.isEmpty() || preloadMsecs == 0 || standby->source() == nextSource) return;
+
+    qint64 length = active->duration();
+    if (length <= 0 || length - active->position() > preloadMsecs) return;
+
+    standbyReady = false;
+    standby->setSource(nextSource);
+}
+
+// Unloads the standby player
+void GaplessPlayer::dropStandby()
+{
+    standbyReady = false;
+    if (standby->source().isEmpty()) return;
+    standby->stop();
+    standby->setSource(QUrl());
+}
@@ -0,0 +1,66 @@
+#ifndef GAPLESSPLAYER_H
+#define GAPLESSPLAYER_H
+
+#include "playbackengine.h"
+#include <QMediaPlayer>
+#include <QAudioOutput>
+#include <QElapsedTimer>
+#include <QUrl>
+
+// Media player that opens the next track before the current one ends
+//
+// Two QMediaPlayers take turns, the active one plays and its signals are forwarded, the
+// standby one loads the source given with setNext once the active one is within the preload
+// time of its end. A loaded standby is paused, which opens its audio pipeline and decodes the
+// first buffers, so setSource with that source only swaps the players and starts playing.
+//
+// The gap between the end of a track and the first audio of the next one is measured when
+// the switch follows EndOfMedia and reported through gapMeasured.
+class GaplessPlayer : public PlaybackEngine
+{
+    Q_OBJECT
+public:
+    explicit GaplessPlayer(QObject *parent = nullptr);
+
+    void setSource(const QUrl &source) override;
+    QUrl source() const override;
+    void setNext(const QUrl &source) override;
+    QUrl next() const;
+    void setPreloadTime(qint64 msecs);
+    qint64 preloadTime() const;
+
+    void play() override;
+    void pause() override;
+    void stop() override;
+    bool isPlaying() const override;
+    QMediaPlayer::PlaybackState playbackState() const override;
+    QMediaPlayer::MediaStatus mediaStatus() const override;
+    qint64 position() const override;
+    void setPosition(qint64 position) override;
+    qint64 duration() const override;
+    void setVolume(float volume) override;
+    float volume() const override;
+    qint64 lastGap() const;
+
+private:
+    void connectPlayer(QMediaPlayer *player);
+    void statusChanged(QMediaPlayer *player, QMediaPlayer::MediaStatus status);
+    void progress(QMediaPlayer *player, qint64 position);
+    void preload();
+    void dropStandby();
+
+    QAudioOutput outputs[2];
+    QMediaPlayer players[2];
+    QMediaPlayer *active;
+    QMediaPlayer *standby;
+
+    QUrl nextSource;
+    qint64 preloadMsecs = 5000;
+    bool standbyReady = false;
+
+    QElapsedTimer endTimer;
+    bool measuringGap = false;
+    qint64 gap = -1;
+};
+
+#endif // GAPLESSPLAYER_H
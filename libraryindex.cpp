@@ -0,0 +1,513 @@
+#include "libraryindex.h"
+#include <QtSql/QSqlQuery>
+#include <QtSql/QSqlError>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <algorithm>
+
+// Every song row of the library with the fields needed for browsing
+static const QString indexSelect =
+    "SELECT Songs.SongID, Artists.Name, Albums.Name, Songs.Title, Songs.Track "
+    "FROM Artists "
+    "JOIN Albums ON Albums.ArtistID = Artists.ArtistID "
+    "JOIN Songs ON Songs.AlbumID = Albums.AlbumID ";
+
+// Folds ASCII letters to lower case, the same as SQLite's NOCASE collation
+static QString foldCase(const QString &name)
+{
+    QString ret = name;
+    QChar *data = ret.data();
+    for (qsizetype i = 0; i < ret.size(); i++)
+    {
+        if (data[i].unicode() >= 'A' && data[i].unicode() <= 'Z') data[i] = QChar(data[i].unicode() + ('a' - 'A'));
+    }
+    return ret;
+}
+
+LibraryIndex::LibraryIndex()
+{}
+
+// Loads every song in the database into the index, replacing its contents
+bool LibraryIndex::load(QSqlDatabase db)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    clear();
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+
+    if (!query.exec(indexSelect))
+    {
+        qDebug() << query.lastError();
+        qDebug () << query.lastQuery();
+        return false;
+    }
+
+    while (query.next())
+    {
+        addSong(query.value(0).toLongLong(), query.value(1).toString(), query.value(2).toString(),
+                query.value(3).toString(), query.value(4).toInt());
+    }
+
+    sort();
+    loaded = true;
+
+    qDebug() << "Library index loaded" << songCount() << "songs in" << timer.elapsed() << "ms,"
+             << memoryUsage() / 1024 << "KiB";
+    return true;
+}
+
+// Applies a change to the database without reloading everything
+// files are the File column values of songs that were added or rewritten
+// removedIds are the SongIDs of songs that were deleted
+bool LibraryIndex::update(QSqlDatabase db, const QStringList &files, const QList<qint64> &removedIds)
+{
+    // A snapshot cannot be changed, the database already holds the change
+    if (snapshot.isOpen()) { return load(db); }
+    if (!loaded) { return false; }
+
+    for (qint64 id : removedIds) removeSong(id);
+
+    QSqlQuery query(db);
+    query.prepare(indexSelect + "WHERE Songs.File = :file;");
+
+    for (const QString &file : files)
+    {
+        query.bindValue(":file", file);
+        if (!query.exec())
+        {
+            qDebug() << query.lastError();
+            qDebug () << query.lastQuery();
+            return false;
+        }
+        if (!query.next()) continue;
+
+        qint64 id = query.value(0).toLongLong();
+        removeSong(id);
+        addSong(id, query.value(1).toString(), query.value(2).toString(),
+                query.value(3).toString(), query.value(4).toInt());
+    }
+
+    if (titleGarbage > titlePool.size() / 2) compactTitles();
+    sort();
+    return true;
+}
+
+void LibraryIndex::clear()
+{
+    loaded = false;
+    snapshot.close();
+
+    artistNames.clear();
+    artistKeys.clear();
+    albumNames.clear();
+    albumArtists.clear();
+    albumKeys.clear();
+
+    songIds.clear();
+    songAlbums.clear();
+    songTracks.clear();
+    titleOffsets.clear();
+    titleLengths.clear();
+    titlePool.clear();
+    titleGarbage = 0;
+    songRows.clear();
+
+    artistOrder.clear();
+    albumOrder.clear();
+    songOrder.clear();
+    artistAlbumBegin.clear();
+    artistAlbumEnd.clear();
+    artistSongBegin.clear();
+    artistSongEnd.clear();
+    albumSongBegin.clear();
+    albumSongEnd.clear();
+}
+
+// Replaces the contents of the index with a snapshot file, see LibrarySnapshot
+// Returns false and leaves the index empty if the file is missing or not valid
+bool LibraryIndex::loadSnapshot(const QString &path)
+{
+    clear();
+    return snapshot.open(path);
+}
+
+// Writes the index to a snapshot file that loadSnapshot can map on the next start
+bool LibraryIndex::writeSnapshot(const QString &path, quint64 libraryId, quint64 generation) const
+{
+    return LibrarySnapshot::write(path, *this, libraryId, generation);
+}
+
+// Returns true while the index is served from a snapshot instead of memory
+bool LibraryIndex::isSnapshot() const
+{
+    return snapshot.isOpen();
+}
+
+quint64 LibraryIndex::snapshotLibraryId() const
+{
+    return snapshot.libraryId();
+}
+
+quint64 LibraryIndex::snapshotGeneration() const
+{
+    return snapshot.generation();
+}
+
+bool LibraryIndex::isLoaded() const
+{
+    return loaded || snapshot.isOpen();
+}
+
+int LibraryIndex::songCount() const
+{
+    if (snapshot.isOpen()) { return snapshot.songCount(); }
+    return songIds.count();
+}
+
+// Approximate heap usage of the index in bytes
+qint64 LibraryIndex::memoryUsage() const
+{
+    // QHash nodes hold the key and value plus a span entry
+    const qint64 hashOverhead = 2;
+
+    qint64 ret = 0;
+
+    for (const QString &name : artistNames) ret += name.capacity() * sizeof(QChar);
+    for (const QString &name : albumNames) ret += name.capacity() * sizeof(QChar);
+    ret += artistNames.capacity() * sizeof(QString) + albumNames.capacity() * sizeof(QString);
+    ret += artistKeys.capacity() * (sizeof(QString) + sizeof(quint32) + hashOverhead);
+    ret += albumKeys.capacity() * (sizeof(QPair<quint32, QString>) + sizeof(quint32) + hashOverhead);
+    ret += albumArtists.capacity() * sizeof(quint32);
+
+    ret += songIds.capacity() * sizeof(qint64);
+    ret += songAlbums.capacity() * sizeof(quint32);
+    ret += songTracks.capacity() * sizeof(qint32);
+    ret += titleOffsets.capacity() * sizeof(quint32);
+    ret += titleLengths.capacity() * sizeof(quint32);
+    ret += titlePool.capacity() * sizeof(QChar);
+    ret += songRows.capacity() * (sizeof(qint64) + sizeof(quint32) + hashOverhead);
+
+    for (const QList<quint32> *list : { &artistOrder, &albumOrder, &songOrder,
+                                        &artistAlbumBegin, &artistAlbumEnd, &artistSongBegin,
+                                        &artistSongEnd, &albumSongBegin, &albumSongEnd })
+    {
+        ret += list->capacity() * sizeof(quint32);
+    }
+
+    return ret;
+}
+
+// Returns every artist that has songs, in name order
+QStringList LibraryIndex::artists() const
+{
+    if (snapshot.isOpen()) { return snapshot.artists(); }
+
+    QStringList ret;
+    ret.reserve(artistOrder.count());
+    for (quint32 artist : artistOrder) ret << artistNames[artist];
+    return ret;
+}
+
+// Returns the albums of an artist, or every album as "Artist - Album" if artist is empty
+QStringList LibraryIndex::albums(const QString &artist) const
+{
+    if (snapshot.isOpen()) { return snapshot.albums(artist); }
+
+    QStringList ret;
+
+    if (artist.isEmpty())
+    {
+        ret.reserve(albumOrder.count());
+        for (quint32 album : albumOrder)
+        {
+            ret << QString("%1 - %2").arg(artistNames[albumArtists[album]], albumNames[album]);
+        }
+        return ret;
+    }
+
+    auto key = artistKeys.constFind(foldCase(artist));
+    if (key == artistKeys.constEnd()) { return ret; }
+
+    for (quint32 i = artistAlbumBegin[*key]; i < artistAlbumEnd[*key]; i++)
+    {
+        ret << albumNames[albumOrder[i]];
+    }
+    return ret;
+}
+
+// Returns the song names matching the artist and album filters, formatted like MusicDatabase::getSongNames
+// offset and limit select a page of the result the same way as SQL's LIMIT / OFFSET, -1 is no limit
+QStringList LibraryIndex::songNames(const QString &artist, const QString &album, QList<qint64> *ids,
+                                    int offset, int limit) const
+{
+    if (snapshot.isOpen()) { return snapshot.songNames(artist, album, ids, offset, limit); }
+
+    QStringList ret;
+    if (ids) ids->clear();
+    if (offset < 0 || limit == 0) { return ret; }
+
+    qsizetype skip = offset;
+    for (const QPair<quint32, quint32> &range : songRanges(artist, album))
+    {
+        // Whole ranges before the page are skipped without formatting anything
+        if (skip >= range.second - range.first) { skip -= range.second - range.first; continue; }
+
+        for (quint32 i = range.first + skip; i < range.second; i++)
+        {
+            if (limit >= 0 && ret.count() >= limit) { return ret; }
+
+            quint32 row = songOrder[i];
+            quint32 songAlbum = songAlbums[row];
+
+            QString song;
+            if (artist.isEmpty()) song.append(QString("%1 - ").arg(artistNames[albumArtists[songAlbum]]));
+            if (album.isEmpty()) song.append(QString("%1 - ").arg(albumNames[songAlbum]));
+            song.append(title(row));
+
+            ret << song;
+            if (ids) ids->append(songIds[row]);
+        }
+        skip = 0;
+    }
+
+    return ret;
+}
+
+// Looks up the album at row idx of albums(artist)
+bool LibraryIndex::albumAt(int idx, const QString &artist, QString *albumArtist, QString *album) const
+{
+    if (snapshot.isOpen()) { return snapshot.albumAt(idx, artist, albumArtist, album); }
+    if (idx < 0) { return false; }
+
+    quint32 begin = 0;
+    quint32 end = albumOrder.count();
+
+    if (!artist.isEmpty())
+    {
+        auto key = artistKeys.constFind(foldCase(artist));
+        if (key == artistKeys.constEnd()) { return false; }
+        begin = artistAlbumBegin[*key];
+        end = artistAlbumEnd[*key];
+    }
+
+    if (quint32(idx) >= end - begin) { return false; }
+
+    quint32 key = albumOrder[begin + idx];
+    *albumArtist = artistNames[albumArtists[key]];
+    *album = albumNames[key];
+    return true;
+}
+
+// Returns the key of an artist, adding it if it has not been seen before
+// The first spelling seen is kept, like the unique NOCASE name in the Artists table
+quint32 LibraryIndex::internArtist(const QString &name)
+{
+    QString folded = foldCase(name);
+    auto key = artistKeys.constFind(folded);
+    if (key != artistKeys.constEnd()) { return *key; }
+
+    quint32 ret = artistNames.count();
+    artistNames << name;
+    artistKeys.insert(folded, ret);
+    return ret;
+}
+
+quint32 LibraryIndex::internAlbum(quint32 artist, const QString &name)
+{
+    QPair<quint32, QString> folded(artist, foldCase(name));
+    auto key = albumKeys.constFind(folded);
+    if (key != albumKeys.constEnd()) { return *key; }
+
+    quint32 ret = albumNames.count();
+    albumNames << name;
+    albumArtists << artist;
+    albumKeys.insert(folded, ret);
+    return ret;
+}
+
+// Appends a song to the columns, sort() must be called before the next lookup
+void LibraryIndex::addSong(qint64 id, const QString &artist, const QString &album, const QString &title, int track)
+{
+    songRows.insert(id, songIds.count());
+    songIds << id;
+    songAlbums << internAlbum(internArtist(artist), album);
+    songTracks << track;
+    titleOffsets << quint32(titlePool.size());
+    titleLengths << quint32(title.size());
+    titlePool.append(title);
+}
+
+// Removes a song by moving the last row into its place
+// Its title stays in the pool until compactTitles runs
+void LibraryIndex::removeSong(qint64 id)
+{
+    auto found = songRows.find(id);
+    if (found == songRows.end()) { return; }
+
+    quint32 row = *found;
+    quint32 last = songIds.count() - 1;
+    songRows.erase(found);
+    titleGarbage += titleLengths[row];
+
+    if (row != last)
+    {
+        songIds[row]      = songIds[last];
+        songAlbums[row]   = songAlbums[last];
+        songTracks[row]   = songTracks[last];
+        titleOffsets[row] = titleOffsets[last];
+        titleLengths[row] = titleLengths[last];
+        songRows[songIds[row]] = row;
+    }
+
+    songIds.removeLast();
+    songAlbums.removeLast();
+    songTracks.removeLast();
+    titleOffsets.removeLast();
+    titleLengths.removeLast();
+}
+
+// Rebuilds the title pool without the titles of removed songs
+void LibraryIndex::compactTitles()
+{
+    QString pool;
+    pool.reserve(titlePool.size() - titleGarbage);
+
+    for (qsizetype row = 0; row < songIds.count(); row++)
+    {
+        quint32 offset = pool.size();
+        pool.append(QStringView(titlePool).mid(titleOffsets[row], titleLengths[row]));
+        titleOffsets[row] = offset;
+    }
+
+    titlePool = pool;
+    titleGarbage = 0;
+}
+
+QString LibraryIndex::title(quint32 row) const
+{
+    return titlePool.mid(titleOffsets[row], titleLengths[row]);
+}
+
+// Rebuilds the sorted views and ranges
+// Artists and albums without songs are left out, so removed songs drop out of the browsers
+void LibraryIndex::sort()
+{
+    const qsizetype artistCount = artistNames.count();
+    const qsizetype albumCount = albumNames.count();
+
+    QList<quint32> albumSongs(albumCount, 0);
+    for (quint32 album : songAlbums) albumSongs[album]++;
+
+    QList<bool> artistUsed(artistCount, false);
+    for (qsizetype album = 0; album < albumCount; album++)
+    {
+        if (albumSongs[album] > 0) artistUsed[albumArtists[album]] = true;
+    }
+
+    // Artists, ranked by folded name so later comparisons are on integers
+    QStringList foldedArtists;
+    foldedArtists.reserve(artistCount);
+    for (const QString &name : artistNames) foldedArtists << foldCase(name);
+
+    artistOrder.clear();
+    for (qsizetype artist = 0; artist < artistCount; artist++) { if (artistUsed[artist]) artistOrder << artist; }
+    std::sort(artistOrder.begin(), artistOrder.end(), [&](quint32 x, quint32 y) {
+        return foldedArtists[x] < foldedArtists[y];
+    });
+
+    QList<quint32> artistRank(artistCount, 0);
+    for (qsizetype i = 0; i < artistOrder.count(); i++) artistRank[artistOrder[i]] = i;
+
+    // Albums, by artist rank then folded name
+    QStringList foldedAlbums;
+    foldedAlbums.reserve(albumCount);
+    for (const QString &name : albumNames) foldedAlbums << foldCase(name);
+
+    albumOrder.clear();
+    for (qsizetype album = 0; album < albumCount; album++) { if (albumSongs[album] > 0) albumOrder << album; }
+    std::sort(albumOrder.begin(), albumOrder.end(), [&](quint32 x, quint32 y) {
+        if (albumArtists[x] != albumArtists[y]) return artistRank[albumArtists[x]] < artistRank[albumArtists[y]];
+        return foldedAlbums[x] < foldedAlbums[y];
+    });
+
+    QList<quint32> albumRank(albumCount, 0);
+    for (qsizetype i = 0; i < albumOrder.count(); i++) albumRank[albumOrder[i]] = i;
+
+    // Songs, by album rank then track, ties broken by id so the order is stable between runs
+    songOrder.resize(songIds.count());
+    for (qsizetype row = 0; row < songIds.count(); row++) songOrder[row] = row;
+    std::sort(songOrder.begin(), songOrder.end(), [&](quint32 x, quint32 y) {
+        if (songAlbums[x] != songAlbums[y]) return albumRank[songAlbums[x]] < albumRank[songAlbums[y]];
+        if (songTracks[x] != songTracks[y]) return songTracks[x] < songTracks[y];
+        return songIds[x] < songIds[y];
+    });
+
+    // Ranges, each artist and album is one contiguous run of the sorted arrays
+    artistAlbumBegin.fill(0, artistCount);
+    artistAlbumEnd.fill(0, artistCount);
+    artistSongBegin.fill(0, artistCount);
+    artistSongEnd.fill(0, artistCount);
+    albumSongBegin.fill(0, albumCount);
+    albumSongEnd.fill(0, albumCount);
+
+    for (qsizetype i = 0; i < albumOrder.count(); i++)
+    {
+        quint32 artist = albumArtists[albumOrder[i]];
+        if (i == 0 || albumArtists[albumOrder[i - 1]] != artist) artistAlbumBegin[artist] = i;
+        artistAlbumEnd[artist] = i + 1;
+    }
+
+    for (qsizetype i = 0; i < songOrder.count(); i++)
+    {
+        quint32 album = songAlbums[songOrder[i]];
+        quint32 artist = albumArtists[album];
+        bool newAlbum = i == 0 || songAlbums[songOrder[i - 1]] != album;
+        bool newArtist = i == 0 || albumArtists[songAlbums[songOrder[i - 1]]] != artist;
+
+        if (newAlbum) albumSongBegin[album] = i;
+        if (newArtist) artistSongBegin[artist] = i;
+        albumSongEnd[album] = i + 1;
+        artistSongEnd[artist] = i + 1;
+    }
+}
+
+// Returns the ranges of songOrder matching the artist and album filters, empty filters match everything
+QList<QPair<quint32, quint32>> LibraryIndex::songRanges(const QString &artist, const QString &album) const
+{
+    QList<QPair<quint32, quint32>> ret;
+
+    if (artist.isEmpty() && album.isEmpty())
+    {
+        ret << qMakePair(quint32(0), quint32(songOrder.count()));
+        return ret;
+    }
+
+    if (artist.isEmpty())
+    {
+        // Same album name by any artist, albumOrder keeps these in artist order
+        QString folded = foldCase(album);
+        for (quint32 key : albumOrder)
+        {
+            if (foldCase(albumNames[key]) == folded) ret << qMakePair(albumSongBegin[key], albumSongEnd[key]);
+        }
+        return ret;
+    }
+
+    auto artistKey = artistKeys.constFind(foldCase(artist));
+    if (artistKey == artistKeys.constEnd()) { return ret; }
+
+    if (album.isEmpty())
+    {
+        ret << qMakePair(artistSongBegin[*artistKey], artistSongEnd[*artistKey]);
+        return ret;
+    }
+
+    auto albumKey = albumKeys.constFind(qMakePair(*artistKey, foldCase(album)));
+    if (albumKey == albumKeys.constEnd()) { return ret; }
+
+    ret << qMakePair(albumSongBegin[*albumKey], albumSongEnd[*albumKey]);
+    return ret;
+}
@@ -0,0 +1,93 @@
+#ifndef LIBRARYINDEX_H
+#define LIBRARYINDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QStringList>
+#include <QtSql/QSqlDatabase>
+#include "librarysnapshot.h"
+
+// In-memory copy of the data used by the artist, album and song browsers
+//
+// Songs are stored as a struct of arrays, one column per field, with artist and album
+// names interned and titles packed into a single string. Sorted index arrays
+// and per artist / per album ranges into them are rebuilt after every change,
+// so browsing is a walk over a precomputed range instead of a database query.
+//
+// At startup the index can instead be served from a mapped LibrarySnapshot written
+// by an earlier run, it is loaded from the database on the first update.
+//
+// Name comparisons follow SQLite's NOCASE collation (ASCII case folding)
+class LibraryIndex
+{
+    friend class LibrarySnapshot;
+
+public:
+    LibraryIndex();
+
+    bool load(QSqlDatabase db);
+    bool update(QSqlDatabase db, const QStringList &files, const QList<qint64> &removedIds);
+    void clear();
+
+    bool loadSnapshot(const QString &path);
+    bool writeSnapshot(const QString &path, quint64 libraryId, quint64 generation) const;
+    bool isSnapshot() const;
+    quint64 snapshotLibraryId() const;
+    quint64 snapshotGeneration() const;
+
+    bool isLoaded() const;
+    int songCount() const;
+    qint64 memoryUsage() const;
+
+    QStringList artists() const;
+    QStringList albums(const QString &artist) const;
+    QStringList songNames(const QString &artist, const QString &album, QList<qint64> *ids = nullptr,
+                          int offset = 0, int limit = -1) const;
+    bool albumAt(int idx, const QString &artist, QString *albumArtist, QString *album) const;
+
+private:
+    quint32 internArtist(const QString &name);
+    quint32 internAlbum(quint32 artist, const QString &name);
+    void addSong(qint64 id, const QString &artist, const QString &album, const QString &title, int track);
+    void removeSong(qint64 id);
+    void compactTitles();
+    void sort();
+    QString title(quint32 row) const;
+    QList<QPair<quint32, quint32>> songRanges(const QString &artist, const QString &album) const;
+
+    bool loaded = false;
+    LibrarySnapshot snapshot;
+
+    // Artists, indexed by artist key
+    QStringList artistNames;
+    QHash<QString, quint32> artistKeys;
+
+    // Albums, indexed by album key
+    QStringList albumNames;
+    QList<quint32> albumArtists;
+    QHash<QPair<quint32, QString>, quint32> albumKeys;
+
+    // Songs, one entry per song in every column
+    QList<qint64> songIds;
+    QList<quint32> songAlbums;
+    QList<qint32> songTracks;
+    QList<quint32> titleOffsets;
+    QList<quint32> titleLengths;
+    QString titlePool;
+    qsizetype titleGarbage = 0;
+    QHash<qint64, quint32> songRows;
+
+    // Sorted views, rebuilt by sort()
+    QList<quint32> artistOrder;      // artist keys in name order
+    QList<quint32> albumOrder;       // album keys in artist, album order
+    QList<quint32> songOrder;        // song rows in artist, album, track order
+    QList<quint32> artistAlbumBegin; // by artist key, range of albumOrder
+    QList<quint32> artistAlbumEnd;
+    QList<quint32> artistSongBegin;  // by artist key, range of songOrder
+    QList<quint32> artistSongEnd;
+    QList<quint32> albumSongBegin;   // by album key, range of songOrder
+    QList<quint32> albumSongEnd;
+};
+
+#endif // LIBRARYINDEX_H
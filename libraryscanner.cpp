@@ -0,0 +1,180 @@
+#include "libraryscanner.h"
+#include "tagreader.h"
+#include <QtConcurrent/QtConcurrentMap>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QUrl>
+#include <QThread>
+#include <QDateTime>
+#include <QElapsedTimer>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+// The pool is sized to the core count, each worker reads and parses one file at a time
+LibraryScanner::LibraryScanner(QObject *parent)
+    : QObject{parent}, pool(this), watcher(this)
+{
+    pool.setMaxThreadCount(QThread::idealThreadCount());
+
+    QObject::connect(&watcher, &QFutureWatcher<ScanResult>::resultReadyAt, this, [=](int idx) {
+        emit fileScanned(watcher.resultAt(idx));
+    });
+    QObject::connect(&watcher, &QFutureWatcher<ScanResult>::finished, this, &LibraryScanner::finished);
+}
+
+// Waits for running workers so they do not outlive the scanner
+LibraryScanner::~LibraryScanner()
+{
+    watcher.cancel();
+    watcher.waitForFinished();
+}
+
+// Starts scanning the given files
+// Does nothing if a scan is already running
+void LibraryScanner::scan(const QStringList &files)
+{
+    if (isScanning()) { return; }
+
+    art.setDirectory(QDir::currentPath() + "/.images");
+    art.resetStats();
+
+    watcher.setFuture(QtConcurrent::mapped(&pool, files, [this](const QString &file) { return scanFile(file); }));
+}
+
+// Stops handing out files, files already being read still report their result
+// finished is emitted once they are done
+void LibraryScanner::cancel()
+{
+    watcher.cancel();
+}
+
+// Pauses or resumes the scan, files already being read are finished first
+void LibraryScanner::setPaused(bool paused)
+{
+    watcher.setSuspended(paused);
+}
+
+bool LibraryScanner::isScanning()
+{
+    return watcher.isRunning();
+}
+
+// Reads the tags of a file and fills in a Song the same way the database expects it
+// Runs on a worker thread
+ScanResult LibraryScanner::scanFile(const QString &file)
+{
+    ScanResult result;
+    result.file = file;
+    TagInfo tags;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Taken before reading so a file modified during the scan is picked up again next time
+    result.fingerprint = fingerprint(file);
+
+    bool read = TagReader::readFile(file, tags);
+    result.readNs = timer.nsecsElapsed();
+    if (!read) { return result; }
+
+    QFileInfo info(file);
+
+    // Uses album artist tag to prevent large lists of extranious artists from being displayed
+    // To Do: User Choice to use album artist tag or artist tag
+    QString artist = tags.albumArtist;
+    if (artist.isEmpty()) artist = "Unknown Artist";
+
+    QString album = tags.album;
+    if (album.isEmpty()) album = "Unknown Album";
+
+    // If no track number is tagged, it is read from whatever numbers are in front of the file name
+    int track = tags.track;
+    if (track == 0) {
+        QString fileName = info.fileName();
+        qsizetype digits = 0;
+        while (digits < fileName.size() && fileName[digits].isDigit()) digits++;
+        track = fileName.left(digits).toInt();
+    }
+
+    // If there is no title tag the filename without extention is used
+    QString title = tags.title;
+    if (title.isEmpty()) title = info.completeBaseName();
+    if (title.isEmpty()) title = info.fileName();
+
+    // Album art is stored as the image file embedded in the tag, see ArtStore
+    // the image path is then stored in the image column
+    timer.start();
+    QString filename = art.store(artist, album, tags.art, tags.artMimeType);
+    result.artNs = timer.nsecsElapsed();
+
+    result.song = Song {
+        artist,
+        "",
+        album,
+        title,
+        QUrl::fromLocalFile(file).toString(),
+        filename,
+        track,
+        int(tags.duration)
+    };
+    result.contributingArtist = tags.artist;
+    result.ok = true;
+
+    return result;
+}
+
+// Number of album art files written by the current or last scan
+int LibraryScanner::artFilesWritten()
+{
+    return art.filesWritten();
+}
+
+// Size of the album art files written by the current or last scan
+qint64 LibraryScanner::artBytesWritten()
+{
+    return art.bytesWritten();
+}
+
+// Returns the size, modification time in milliseconds and inode of a file
+// On unix this is a single stat call, elsewhere the inode is not available and stays -1
+FileFingerprint LibraryScanner::fingerprint(const QString &file)
+{
+    FileFingerprint ret;
+
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (::stat(QFile::encodeName(file).constData(), &st) != 0) { return ret; }
+
+    ret.size = st.st_size;
+#ifdef Q_OS_LINUX
+    ret.mtime = qint64(st.st_mtim.tv_sec) * 1000 + st.st_mtim.tv_nsec / 1000000;
+#else
+    ret.mtime = qint64(st.st_mtime) * 1000;
+#endif
+    ret.inode = st.st_ino;
+#else
+    QFileInfo info(file);
+    if (!info.exists()) { return ret; }
+
+    ret.size = info.size();
+    ret.mtime = info.lastModified().toMSecsSinceEpoch();
+#endif
+
+    return ret;
+}
+
+// File name patterns of the formats TagReader can read
+QStringList LibraryScanner::nameFilters()
+{
+    return {"*.mp3", "*.flac", "*.m4a"};
+}
+
+// Returns true if the file name matches nameFilters, the file itself is not opened
+bool LibraryScanner::isMediaFile(const QString &file)
+{
+    static const QStringList suffixes = {"mp3", "flac", "m4a"};
+    return suffixes.contains(QFileInfo(file).suffix(), Qt::CaseInsensitive);
+}
@@ -0,0 +1,69 @@
+#ifndef LIBRARYSCANNER_H
+#define LIBRARYSCANNER_H
+
+#include "song.h"
+#include "artstore.h"
+#include <QObject>
+#include <QFutureWatcher>
+#include <QThreadPool>
+
+// Size, modification time and inode of a file when it was scanned
+// A file whose fingerprint has not changed does not need to be read again
+struct FileFingerprint
+{
+    qint64 size = -1;
+    qint64 mtime = -1;
+    qint64 inode = -1;
+
+    bool operator==(const FileFingerprint &other) const
+    { return size == other.size && mtime == other.mtime && inode == other.inode; }
+    bool operator!=(const FileFingerprint &other) const { return !(*this == other); }
+};
+
+// Result of scanning a single file
+// contributingArtist is the track artist, song.artist holds the album artist used for browsing
+struct ScanResult
+{
+    QString file;
+    Song song;
+    QString contributingArtist;
+    FileFingerprint fingerprint;
+    bool ok = false;
+    qint64 readNs = 0;  // time spent reading the tags, on the worker thread
+    qint64 artNs = 0;   // time spent storing the album art
+};
+
+// Reads the tags of media files on a pool of worker threads
+// Results are handed back through fileScanned on the thread that owns the scanner
+// The pool and watcher are children of the scanner so moveToThread moves them along with it
+class LibraryScanner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LibraryScanner(QObject *parent = nullptr);
+    ~LibraryScanner();
+
+    void scan(const QStringList &files);
+    void cancel();
+    void setPaused(bool paused);
+    bool isScanning();
+    ScanResult scanFile(const QString &file);
+    int artFilesWritten();
+    qint64 artBytesWritten();
+
+    static FileFingerprint fingerprint(const QString &file);
+    static QStringList nameFilters();
+    static bool isMediaFile(const QString &file);
+
+signals:
+    void fileScanned(const ScanResult &result);
+    void finished();
+
+private:
+    QThreadPool pool;
+    QFutureWatcher<ScanResult> watcher;
+
+    ArtStore art;
+};
+
+#endif // LIBRARYSCANNER_H
@@ -0,0 +1,414 @@
+#include "librarysnapshot.h"
+#include "libraryindex.h"
+#include "xxhash.h"
+#include <QSaveFile>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <cstring>
+
+static const quint32 snapshotMagic = 0x534C4D52; // "RMLS"
+static const quint32 snapshotVersion = 1;
+
+// Folds an ASCII letter to lower case, the same as SQLite's NOCASE collation
+static inline ushort foldChar(ushort c)
+{
+    return (c >= 'A' && c <= 'Z') ? ushort(c + ('a' - 'A')) : c;
+}
+
+// Compares a name from the string table to a name that is already folded
+// Orders the same way as comparing the folded QStrings, which is how LibraryIndex sorts
+static int compareFolded(const QChar *name, quint32 length, const QString &folded)
+{
+    qsizetype count = qMin<qsizetype>(length, folded.size());
+    for (qsizetype i = 0; i < count; i++)
+    {
+        ushort x = foldChar(name[i].unicode());
+        ushort y = folded[i].unicode();
+        if (x != y) return x < y ? -1 : 1;
+    }
+    if (length == folded.size()) return 0;
+    return length < folded.size() ? -1 : 1;
+}
+
+static QString foldCase(const QString &name)
+{
+    QString ret = name;
+    QChar *chars = ret.data();
+    for (qsizetype i = 0; i < ret.size(); i++) chars[i] = QChar(foldChar(chars[i].unicode()));
+    return ret;
+}
+
+LibrarySnapshot::LibrarySnapshot()
+{}
+
+LibrarySnapshot::~LibrarySnapshot()
+{
+    close();
+}
+
+// Maps a snapshot file and checks it, returns false if it is missing or not valid
+bool LibrarySnapshot::open(const QString &path)
+{
+    close();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly)) { return false; }
+
+    qint64 size = file.size();
+    if (size < qint64(sizeof(Header))) { close(); return false; }
+
+    data = file.map(0, size);
+    if (!data) { close(); return false; }
+
+    const Header *h = reinterpret_cast<const Header *>(data);
+
+    // Every section must lie inside the file at its natural alignment
+    auto fits = [size](quint32 offset, quint64 count, quint64 recordSize, quint32 alignment) {
+        return offset % alignment == 0 && offset >= sizeof(Header) && offset + count * recordSize <= quint64(size);
+    };
+
+    if (h->magic != snapshotMagic || h->version != snapshotVersion ||
+        !fits(h->songsOffset, h->songCount, sizeof(SongRecord), alignof(SongRecord)) ||
+        !fits(h->artistsOffset, h->artistCount, sizeof(ArtistRecord), alignof(ArtistRecord)) ||
+        !fits(h->albumsOffset, h->albumCount, sizeof(AlbumRecord), alignof(AlbumRecord)) ||
+        !fits(h->stringsOffset, h->stringSize, sizeof(QChar), alignof(QChar)))
+    {
+        qDebug() << "Library snapshot" << path << "has an unknown format";
+        close();
+        return false;
+    }
+
+    const char *payload = reinterpret_cast<const char *>(data) + sizeof(Header);
+    if (xxHash64(payload, size - sizeof(Header)) != h->checksum)
+    {
+        qDebug() << "Library snapshot" << path << "is damaged";
+        close();
+        return false;
+    }
+
+    header = h;
+    songs = reinterpret_cast<const SongRecord *>(data + h->songsOffset);
+    artistRecords = reinterpret_cast<const ArtistRecord *>(data + h->artistsOffset);
+    albumRecords = reinterpret_cast<const AlbumRecord *>(data + h->albumsOffset);
+    strings = reinterpret_cast<const QChar *>(data + h->stringsOffset);
+
+    qDebug() << "Library snapshot mapped" << songCount() << "songs in" << timer.elapsed() << "ms";
+    return true;
+}
+
+void LibrarySnapshot::close()
+{
+    header = nullptr;
+    songs = nullptr;
+    artistRecords = nullptr;
+    albumRecords = nullptr;
+    strings = nullptr;
+
+    if (data) file.unmap(const_cast<uchar *>(data));
+    data = nullptr;
+    file.close();
+}
+
+bool LibrarySnapshot::isOpen() const
+{
+    return header != nullptr;
+}
+
+// Id of the library the snapshot was written from
+quint64 LibrarySnapshot::libraryId() const
+{
+    return header ? header->libraryId : 0;
+}
+
+// Generation of the library when the snapshot was written
+quint64 LibrarySnapshot::generation() const
+{
+    return header ? header->generation : 0;
+}
+
+int LibrarySnapshot::songCount() const
+{
+    return header ? int(header->songCount) : 0;
+}
+
+// Returns every artist, in name order, see LibraryIndex::artists
+QStringList LibrarySnapshot::artists() const
+{
+    QStringList ret;
+    if (!header) { return ret; }
+
+    ret.reserve(header->artistCount);
+    for (quint32 i = 0; i < header->artistCount; i++)
+    {
+        ret << string(artistRecords[i].name, artistRecords[i].nameLength);
+    }
+    return ret;
+}
+
+// Returns the albums of an artist, or every album as "Artist - Album" if artist is empty
+// See LibraryIndex::albums
+QStringList LibrarySnapshot::albums(const QString &artist) const
+{
+    QStringList ret;
+    if (!header) { return ret; }
+
+    if (artist.isEmpty())
+    {
+        ret.reserve(header->albumCount);
+        for (quint32 i = 0; i < header->albumCount; i++)
+        {
+            const AlbumRecord &album = albumRecords[i];
+            const ArtistRecord &albumArtist = artistRecords[album.artist];
+            ret << QString("%1 - %2").arg(string(albumArtist.name, albumArtist.nameLength),
+                                          string(album.name, album.nameLength));
+        }
+        return ret;
+    }
+
+    int key = findArtist(artist);
+    if (key < 0) { return ret; }
+
+    for (quint32 i = artistRecords[key].albumBegin; i < artistRecords[key].albumEnd; i++)
+    {
+        ret << string(albumRecords[i].name, albumRecords[i].nameLength);
+    }
+    return ret;
+}
+
+// Returns the song names matching the artist and album filters, see LibraryIndex::songNames
+QStringList LibrarySnapshot::songNames(const QString &artist, const QString &album, QList<qint64> *ids,
+                                       int offset, int limit) const
+{
+    QStringList ret;
+    if (ids) ids->clear();
+    if (!header || offset < 0 || limit == 0) { return ret; }
+
+    qsizetype skip = offset;
+    for (const QPair<quint32, quint32> &range : songRanges(artist, album))
+    {
+        if (skip >= range.second - range.first) { skip -= range.second - range.first; continue; }
+
+        for (quint32 i = range.first + skip; i < range.second; i++)
+        {
+            if (limit >= 0 && ret.count() >= limit) { return ret; }
+
+            const SongRecord &song = songs[i];
+            const AlbumRecord &songAlbum = albumRecords[song.album];
+
+            QString name;
+            if (artist.isEmpty())
+            {
+                const ArtistRecord &albumArtist = artistRecords[songAlbum.artist];
+                name.append(QString("%1 - ").arg(string(albumArtist.name, albumArtist.nameLength)));
+            }
+            if (album.isEmpty()) name.append(QString("%1 - ").arg(string(songAlbum.name, songAlbum.nameLength)));
+            name.append(string(song.title, song.titleLength));
+
+            ret << name;
+            if (ids) ids->append(song.id);
+        }
+        skip = 0;
+    }
+
+    return ret;
+}
+
+// Looks up the album at row idx of albums(artist), see LibraryIndex::albumAt
+bool LibrarySnapshot::albumAt(int idx, const QString &artist, QString *albumArtist, QString *album) const
+{
+    if (!header || idx < 0) { return false; }
+
+    quint32 begin = 0;
+    quint32 end = header->albumCount;
+
+    if (!artist.isEmpty())
+    {
+        int key = findArtist(artist);
+        if (key < 0) { return false; }
+        begin = artistRecords[key].albumBegin;
+        end = artistRecords[key].albumEnd;
+    }
+
+    if (quint32(idx) >= end - begin) { return false; }
+
+    const AlbumRecord &record = albumRecords[begin + idx];
+    *albumArtist = string(artistRecords[record.artist].name, artistRecords[record.artist].nameLength);
+    *album = string(record.name, record.nameLength);
+    return true;
+}
+
+// Writes the sorted arrays of a loaded index to path
+// The file is replaced in one rename, a snapshot mapped by another instance stays readable
+bool LibrarySnapshot::write(const QString &path, const LibraryIndex &index, quint64 libraryId, quint64 generation)
+{
+    if (!index.loaded) { return false; }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const qsizetype artistCount = index.artistOrder.count();
+    const qsizetype albumCount = index.albumOrder.count();
+    const qsizetype songCount = index.songOrder.count();
+
+    // Positions in the sorted arrays become the record indexes
+    QList<quint32> artistRank(index.artistNames.count(), 0);
+    for (qsizetype i = 0; i < artistCount; i++) artistRank[index.artistOrder[i]] = i;
+
+    QList<quint32> albumRank(index.albumNames.count(), 0);
+    for (qsizetype i = 0; i < albumCount; i++) albumRank[index.albumOrder[i]] = i;
+
+    QString table;
+    auto addString = [&table](QStringView text, quint32 *offset, quint32 *length) {
+        *offset = quint32(table.size());
+        *length = quint32(text.size());
+        table.append(text);
+    };
+
+    QList<SongRecord> songRecords(songCount);
+    for (qsizetype i = 0; i < songCount; i++)
+    {
+        quint32 row = index.songOrder[i];
+        SongRecord &record = songRecords[i];
+        record.id = index.songIds[row];
+        record.album = albumRank[index.songAlbums[row]];
+        record.reserved = 0;
+        addString(QStringView(index.titlePool).mid(index.titleOffsets[row], index.titleLengths[row]),
+                  &record.title, &record.titleLength);
+    }
+
+    QList<ArtistRecord> artists(artistCount);
+    for (qsizetype i = 0; i < artistCount; i++)
+    {
+        quint32 key = index.artistOrder[i];
+        ArtistRecord &record = artists[i];
+        addString(index.artistNames[key], &record.name, &record.nameLength);
+        record.albumBegin = index.artistAlbumBegin[key];
+        record.albumEnd = index.artistAlbumEnd[key];
+        record.songBegin = index.artistSongBegin[key];
+        record.songEnd = index.artistSongEnd[key];
+    }
+
+    QList<AlbumRecord> albums(albumCount);
+    for (qsizetype i = 0; i < albumCount; i++)
+    {
+        quint32 key = index.albumOrder[i];
+        AlbumRecord &record = albums[i];
+        addString(index.albumNames[key], &record.name, &record.nameLength);
+        record.artist = artistRank[index.albumArtists[key]];
+        record.songBegin = index.albumSongBegin[key];
+        record.songEnd = index.albumSongEnd[key];
+    }
+
+    Header h = {};
+    h.magic = snapshotMagic;
+    h.version = snapshotVersion;
+    h.libraryId = libraryId;
+    h.generation = generation;
+    h.songCount = songCount;
+    h.artistCount = artistCount;
+    h.albumCount = albumCount;
+    h.stringSize = table.size();
+    h.songsOffset = sizeof(Header);
+    h.artistsOffset = h.songsOffset + songCount * sizeof(SongRecord);
+    h.albumsOffset = h.artistsOffset + artistCount * sizeof(ArtistRecord);
+    h.stringsOffset = h.albumsOffset + albumCount * sizeof(AlbumRecord);
+
+    QByteArray buffer;
+    buffer.reserve(h.stringsOffset + table.size() * sizeof(QChar));
+    buffer.append(reinterpret_cast<const char *>(&h), sizeof(Header));
+    buffer.append(reinterpret_cast<const char *>(songRecords.constData()), songCount * sizeof(SongRecord));
+    buffer.append(reinterpret_cast<const char *>(artists.constData()), artistCount * sizeof(ArtistRecord));
+    buffer.append(reinterpret_cast<const char *>(albums.constData()), albumCount * sizeof(AlbumRecord));
+    buffer.append(reinterpret_cast<const char *>(table.constData()), table.size() * sizeof(QChar));
+
+    h.checksum = xxHash64(buffer.constData() + sizeof(Header), buffer.size() - sizeof(Header));
+    memcpy(buffer.data(), &h, sizeof(Header));
+
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly) || out.write(buffer) != buffer.size() || !out.commit())
+    {
+        qDebug() << "Could not write library snapshot" << path << out.errorString();
+        return false;
+    }
+
+    qDebug() << "Library snapshot written" << songCount << "songs," << buffer.size() / 1024 << "KiB in"
+             << timer.elapsed() << "ms";
+    return true;
+}
+
+QString LibrarySnapshot::string(quint32 offset, quint32 length) const
+{
+    return QString(strings + offset, length);
+}
+
+// Returns the record index of an artist, or -1 if it is not in the snapshot
+int LibrarySnapshot::findArtist(const QString &artist) const
+{
+    QString folded = foldCase(artist);
+
+    quint32 low = 0;
+    quint32 high = header->artistCount;
+    while (low < high)
+    {
+        quint32 mid = low + (high - low) / 2;
+        int cmp = compareFolded(strings + artistRecords[mid].name, artistRecords[mid].nameLength, folded);
+        if (cmp == 0) return int(mid);
+        if (cmp < 0) low = mid + 1;
+        else high = mid;
+    }
+    return -1;
+}
+
+// Returns the ranges of the song records matching the artist and album filters
+// See LibraryIndex::songRanges
+QList<QPair<quint32, quint32>> LibrarySnapshot::songRanges(const QString &artist, const QString &album) const
+{
+    QList<QPair<quint32, quint32>> ret;
+
+    if (artist.isEmpty() && album.isEmpty())
+    {
+        ret << qMakePair(quint32(0), header->songCount);
+        return ret;
+    }
+
+    QString foldedAlbum = foldCase(album);
+
+    if (artist.isEmpty())
+    {
+        for (quint32 i = 0; i < header->albumCount; i++)
+        {
+            const AlbumRecord &record = albumRecords[i];
+            if (compareFolded(strings + record.name, record.nameLength, foldedAlbum) == 0)
+            {
+                ret << qMakePair(record.songBegin, record.songEnd);
+            }
+        }
+        return ret;
+    }
+
+    int key = findArtist(artist);
+    if (key < 0) { return ret; }
+
+    const ArtistRecord &artistRecord = artistRecords[key];
+    if (album.isEmpty())
+    {
+        ret << qMakePair(artistRecord.songBegin, artistRecord.songEnd);
+        return ret;
+    }
+
+    // The albums of an artist are sorted by folded name
+    quint32 low = artistRecord.albumBegin;
+    quint32 high = artistRecord.albumEnd;
+    while (low < high)
+    {
+        quint32 mid = low + (high - low) / 2;
+        int cmp = compareFolded(strings + albumRecords[mid].name, albumRecords[mid].nameLength, foldedAlbum);
+        if (cmp == 0) { ret << qMakePair(albumRecords[mid].songBegin, albumRecords[mid].songEnd); break; }
+        if (cmp < 0) low = mid + 1;
+        else high = mid;
+    }
+    return ret;
+}
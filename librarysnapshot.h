@@ -0,0 +1,107 @@
+#ifndef LIBRARYSNAPSHOT_H
+#define LIBRARYSNAPSHOT_H
+
+#include <QFile>
+#include <QList>
+#include <QPair>
+#include <QStringList>
+
+class LibraryIndex;
+
+// Read only copy of a LibraryIndex in a memory mapped file
+//
+// The file holds the sorted artist, album and song arrays of the index as fixed size
+// records plus one UTF-16 string table, so it is used where it lies without parsing.
+// Lookups binary search the sorted records, nothing is allocated until names are returned.
+//
+// The header carries the id and generation of the library it was written from, see
+// MusicDatabase::libraryVersion, and a checksum of the rest of the file.
+// A file that is truncated, corrupted or from another format version does not open.
+//
+// File layout, native byte order:
+//   Header   64 bytes
+//   Songs    songCount records, in artist, album, track order
+//   Artists  artistCount records, in name order
+//   Albums   albumCount records, in artist, album order
+//   Strings  stringSize UTF-16 code units
+class LibrarySnapshot
+{
+public:
+    LibrarySnapshot();
+    ~LibrarySnapshot();
+
+    bool open(const QString &path);
+    void close();
+    bool isOpen() const;
+    quint64 libraryId() const;
+    quint64 generation() const;
+    int songCount() const;
+
+    QStringList artists() const;
+    QStringList albums(const QString &artist) const;
+    QStringList songNames(const QString &artist, const QString &album, QList<qint64> *ids = nullptr,
+                          int offset = 0, int limit = -1) const;
+    bool albumAt(int idx, const QString &artist, QString *albumArtist, QString *album) const;
+
+    static bool write(const QString &path, const LibraryIndex &index, quint64 libraryId, quint64 generation);
+
+private:
+    struct Header
+    {
+        quint32 magic;
+        quint32 version;
+        quint64 libraryId;
+        quint64 generation;
+        quint64 checksum;       // xxHash64 of everything after the header
+        quint32 songCount;
+        quint32 artistCount;
+        quint32 albumCount;
+        quint32 stringSize;
+        quint32 songsOffset;    // byte offsets from the start of the file
+        quint32 artistsOffset;
+        quint32 albumsOffset;
+        quint32 stringsOffset;
+    };
+
+    struct SongRecord
+    {
+        qint64 id;
+        quint32 album;          // index into the album records
+        quint32 title;          // offset into the string table
+        quint32 titleLength;
+        quint32 reserved;
+    };
+
+    struct ArtistRecord
+    {
+        quint32 name;
+        quint32 nameLength;
+        quint32 albumBegin;     // range of the album records
+        quint32 albumEnd;
+        quint32 songBegin;      // range of the song records
+        quint32 songEnd;
+    };
+
+    struct AlbumRecord
+    {
+        quint32 name;
+        quint32 nameLength;
+        quint32 artist;         // index into the artist records
+        quint32 songBegin;
+        quint32 songEnd;
+    };
+
+    QString string(quint32 offset, quint32 length) const;
+    int findArtist(const QString &artist) const;
+    QList<QPair<quint32, quint32>> songRanges(const QString &artist, const QString &album) const;
+
+    QFile file;
+    const uchar *data = nullptr;
+    const Header *header = nullptr;
+    const SongRecord *songs = nullptr;
+    const ArtistRecord *artistRecords = nullptr;
+    const AlbumRecord *albumRecords = nullptr;
+    const QChar *strings = nullptr;
+};
+
+#endif // LIBRARYSNAPSHOT_H
@@ -0,0 +1,391 @@
+#include "librarywatcher.h"
+#include "libraryscanner.h"
+#include <QSocketNotifier>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+// Files are picked up once they are closed after writing, not while they are still being copied
+static const uint32_t watchMask = IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                  IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+#endif
+
+// Returns true if path is directory or inside it
+static bool isUnder(const QString &path, const QString &directory)
+{
+    return path == directory || (path.startsWith(directory) && path.at(directory.size()) == '/');
+}
+
+// Opens the inotify instance, the watcher is unavailable if this fails
+LibraryWatcher::LibraryWatcher(QObject *parent)
+    : QObject{parent}
+{
+#ifdef Q_OS_LINUX
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) { qDebug() << "inotify not available:" << strerror(errno); }
+    else
+    {
+        notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+        QObject::connect(notifier, &QSocketNotifier::activated, this, &LibraryWatcher::readEvents);
+    }
+#endif
+
+    debounce.setSingleShot(true);
+    QObject::connect(&debounce, &QTimer::timeout, this, &LibraryWatcher::flush);
+}
+
+// Closing the inotify instance removes all of its watches
+LibraryWatcher::~LibraryWatcher()
+{
+#ifdef Q_OS_LINUX
+    if (notifier) notifier->setEnabled(false);
+    if (fd >= 0) ::close(fd);
+#endif
+}
+
+bool LibraryWatcher::isAvailable() const
+{
+    return fd >= 0;
+}
+
+// Starts watching a library folder and every folder below it
+// New subfolders are watched as they appear
+bool LibraryWatcher::addFolder(const QString &folder)
+{
+    if (!isAvailable() || folder.isEmpty()) { return false; }
+
+    QString path = QDir(folder).absolutePath();
+    if (!roots.contains(path))
+    {
+        roots << path;
+        watchTree(path);
+    }
+    return true;
+}
+
+// Stops watching a library folder
+void LibraryWatcher::removeFolder(const QString &folder)
+{
+    QString path = QDir(folder).absolutePath();
+    roots.removeAll(path);
+    unwatchTree(path);
+}
+
+// Stops watching every folder and drops any changes that have not been reported yet
+void LibraryWatcher::clear()
+{
+#ifdef Q_OS_LINUX
+    for (auto it = watchPaths.cbegin(); it != watchPaths.cend(); ++it) { inotify_rm_watch(fd, it.key()); }
+#endif
+    watchPaths.clear();
+    pathWatches.clear();
+    roots.clear();
+
+    debounce.stop();
+    pendingMoves.clear();
+    moved.clear();
+    removed.clear();
+    removedFolders.clear();
+    changed.clear();
+    rescan.clear();
+}
+
+QStringList LibraryWatcher::folders() const
+{
+    return roots;
+}
+
+// Sets how long the watcher waits for more events before reporting changes
+void LibraryWatcher::setDebounceInterval(int ms)
+{
+    interval = qMax(0, ms);
+    maxDelay = qMax(maxDelay, interval);
+}
+
+int LibraryWatcher::debounceInterval() const
+{
+    return interval;
+}
+
+// Adds a watch to directory and every folder below it that is not watched yet
+void LibraryWatcher::watchTree(const QString &directory)
+{
+#ifdef Q_OS_LINUX
+    QStringList directories = {directory};
+    QDirIterator ittr(directory, QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (ittr.hasNext()) { directories << ittr.next(); }
+
+    for (const QString &path : directories)
+    {
+        if (pathWatches.contains(path)) { continue; }
+
+        int wd = inotify_add_watch(fd, QFile::encodeName(path).constData(), watchMask);
+        if (wd < 0)
+        {
+            // The limit is per user, see /proc/sys/fs/inotify/max_user_watches
+            if (errno == ENOSPC && !watchLimitReported)
+            {
+                qDebug() << "inotify watch limit reached, changes below" << path << "are not picked up";
+                watchLimitReported = true;
+            }
+            continue;
+        }
+
+        watchPaths.insert(wd, path);
+        pathWatches.insert(path, wd);
+    }
+#else
+    Q_UNUSED(directory);
+#endif
+}
+
+// Removes the watches of directory and every folder below it
+void LibraryWatcher::unwatchTree(const QString &directory)
+{
+    for (auto it = pathWatches.begin(); it != pathWatches.end();)
+    {
+        if (!isUnder(it.key(), directory)) { ++it; continue; }
+
+#ifdef Q_OS_LINUX
+        inotify_rm_watch(fd, it.value());
+#endif
+        watchPaths.remove(it.value());
+        it = pathWatches.erase(it);
+    }
+}
+
+// Updates the paths of the watches below a folder that was renamed
+// inotify watches follow the folder, only the paths they are reported under change
+void LibraryWatcher::renameTree(const QString &from, const QString &to)
+{
+    QList<QPair<QString, int>> renamed;
+    for (auto it = pathWatches.begin(); it != pathWatches.end();)
+    {
+        if (!isUnder(it.key(), from)) { ++it; continue; }
+
+        renamed << qMakePair(to + it.key().mid(from.size()), it.value());
+        it = pathWatches.erase(it);
+    }
+
+    for (const QPair<QString, int> &watch : renamed)
+    {
+        pathWatches.insert(watch.first, watch.second);
+        watchPaths.insert(watch.second, watch.first);
+    }
+}
+
+// Reads every queued inotify event and records the changes they describe
+void LibraryWatcher::readEvents()
+{
+#ifdef Q_OS_LINUX
+    alignas(struct inotify_event) char buffer[64 * 1024];
+
+    for (;;)
+    {
+        ssize_t length = ::read(fd, buffer, sizeof(buffer));
+        if (length <= 0) { break; }
+
+        for (char *ptr = buffer; ptr < buffer + length;)
+        {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            // Events were lost, only a rescan can tell what changed
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                qDebug() << "inotify queue overflowed, rescanning library folders";
+                for (const QString &root : roots) { rescan.insert(root); }
+                schedule();
+                continue;
+            }
+
+            // The folder was deleted or its watch removed
+            if (event->mask & IN_IGNORED)
+            {
+                QString path = watchPaths.take(event->wd);
+                if (pathWatches.value(path, -1) == event->wd) { pathWatches.remove(path); }
+                continue;
+            }
+
+            QString directory = watchPaths.value(event->wd);
+            if (directory.isEmpty() || event->len == 0) { continue; }
+
+            QString path = directory + '/' + QFile::decodeName(event->name);
+            bool isDirectory = event->mask & IN_ISDIR;
+
+            if (event->mask & IN_MOVED_FROM)
+            {
+                // Paired with IN_MOVED_TO by cookie, unpaired sources left the watched folders
+                pendingMoves.insert(event->cookie, PendingMove {path, isDirectory});
+            }
+            else if (event->mask & IN_MOVED_TO)
+            {
+                auto source = pendingMoves.find(event->cookie);
+                if (source == pendingMoves.end())
+                {
+                    if (isDirectory) folderAdded(path);
+                    else fileChanged(path);
+                }
+                else
+                {
+                    PendingMove from = source.value();
+                    pendingMoves.erase(source);
+
+                    if (isDirectory) folderMoved(from.path, path);
+                    else fileMoved(from.path, path);
+                }
+            }
+            else if (event->mask & IN_CREATE)
+            {
+                // New files are reported by IN_CLOSE_WRITE once they are complete
+                if (isDirectory) folderAdded(path);
+            }
+            else if (event->mask & IN_CLOSE_WRITE)
+            {
+                fileChanged(path);
+            }
+            else if (event->mask & IN_DELETE)
+            {
+                // Files inside a deleted folder are reported on their own before it
+                if (!isDirectory) fileRemoved(path);
+            }
+
+            schedule();
+        }
+    }
+#endif
+}
+
+// A media file was created or written
+void LibraryWatcher::fileChanged(const QString &path)
+{
+    if (!LibraryScanner::isMediaFile(path)) { return; }
+
+    removed.remove(path);
+    changed.insert(path);
+}
+
+// A media file was deleted or moved out of the watched folders
+void LibraryWatcher::fileRemoved(const QString &path)
+{
+    if (!LibraryScanner::isMediaFile(path)) { return; }
+
+    changed.remove(path);
+    removed.insert(path);
+}
+
+// A file was renamed inside the watched folders
+void LibraryWatcher::fileMoved(const QString &from, const QString &to)
+{
+    bool fromMedia = LibraryScanner::isMediaFile(from);
+    bool toMedia = LibraryScanner::isMediaFile(to);
+
+    // Programs that save by writing a temporary file and renaming it over the original end up here
+    if (!fromMedia) { fileChanged(to); return; }
+    if (!toMedia) { fileRemoved(from); return; }
+
+    // A file written in this interval is scanned at its new name instead
+    if (changed.contains(from))
+    {
+        fileRemoved(from);
+        fileChanged(to);
+        return;
+    }
+
+    // The move replaces whatever was at the destination
+    removed.remove(to);
+    moved << LibraryMove {from, to, false};
+}
+
+// A folder was renamed inside the watched folders
+void LibraryWatcher::folderMoved(const QString &from, const QString &to)
+{
+    renameTree(from, to);
+
+    // Moves are applied before removals and scans, so the files written, deleted or moved out
+    // in this interval are reported at their new path
+    auto rebase = [&](QSet<QString> &paths) {
+        QSet<QString> renamed;
+        for (auto it = paths.begin(); it != paths.end();)
+        {
+            if (!isUnder(*it, from)) { ++it; continue; }
+            renamed.insert(to + it->mid(from.size()));
+            it = paths.erase(it);
+        }
+        paths.unite(renamed);
+    };
+    rebase(changed);
+    rebase(removed);
+    rebase(removedFolders);
+
+    moved << LibraryMove {from, to, true};
+}
+
+// A folder was moved out of the watched folders
+void LibraryWatcher::folderRemoved(const QString &path)
+{
+    unwatchTree(path);
+
+    for (auto it = changed.begin(); it != changed.end();)
+    {
+        if (isUnder(*it, path)) it = changed.erase(it);
+        else ++it;
+    }
+    removedFolders.insert(path);
+}
+
+// A folder was created or moved into the watched folders
+// Files can be added to it before the watch exists, so the whole folder is scanned
+void LibraryWatcher::folderAdded(const QString &path)
+{
+    watchTree(path);
+    rescan.insert(path);
+}
+
+// Restarts the debounce timer
+// While events keep arriving changes are still reported maxDelay after the first one
+void LibraryWatcher::schedule()
+{
+    if (!debounce.isActive()) { firstEvent.start(); }
+
+    qint64 remaining = maxDelay - firstEvent.elapsed();
+    debounce.start(int(qBound<qint64>(0, remaining, interval)));
+}
+
+// Reports the changes collected since the last flush
+void LibraryWatcher::flush()
+{
+    // Renames without a destination left the watched folders
+    for (const PendingMove &move : std::as_const(pendingMoves))
+    {
+        if (move.directory) folderRemoved(move.path);
+        else fileRemoved(move.path);
+    }
+    pendingMoves.clear();
+
+    LibraryChanges changes;
+    changes.moved = moved;
+    changes.removed = removed.values();
+    changes.removedFolders = removedFolders.values();
+    changes.changed = changed.values();
+    for (const QString &folder : std::as_const(rescan))
+    {
+        if (QFileInfo(folder).isDir()) changes.rescanFolders << folder;
+    }
+
+    moved.clear();
+    removed.clear();
+    removedFolders.clear();
+    changed.clear();
+    rescan.clear();
+
+    if (!changes.isEmpty()) emit changesReady(changes);
+}
@@ -0,0 +1,108 @@
+#ifndef LIBRARYWATCHER_H
+#define LIBRARYWATCHER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+#include <QElapsedTimer>
+
+class QSocketNotifier;
+
+// A file or folder that was renamed or moved inside the watched folders
+struct LibraryMove
+{
+    QString from;
+    QString to;
+    bool directory = false;
+};
+
+// Changes to the watched folders collected over one debounce interval
+// All paths are absolute local paths. Moves are listed in the order they happened
+// and are applied first, then removals, then the changed files are scanned
+struct LibraryChanges
+{
+    QList<LibraryMove> moved;
+    QStringList removed;         // media files deleted or moved out of the watched folders
+    QStringList removedFolders;  // folders moved out of the watched folders
+    QStringList changed;         // media files created, written or moved in
+    QStringList rescanFolders;   // folders that appeared, or every root after the event queue overflowed
+
+    bool isEmpty() const
+    {
+        return moved.isEmpty() && removed.isEmpty() && removedFolders.isEmpty() &&
+               changed.isEmpty() && rescanFolders.isEmpty();
+    }
+};
+
+// Watches library folders and everything below them for changes with inotify
+//
+// Events are collected until no new ones have arrived for the debounce interval
+// (or for at most maxDelay while events keep arriving) and handed out together
+// through changesReady. A file written several times in that window is reported once,
+// renames are paired through their inotify cookie and reported as moves.
+//
+// Only available on Linux, elsewhere isAvailable returns false and nothing is reported
+class LibraryWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LibraryWatcher(QObject *parent = nullptr);
+    ~LibraryWatcher();
+
+    bool isAvailable() const;
+    bool addFolder(const QString &folder);
+    void removeFolder(const QString &folder);
+    void clear();
+    QStringList folders() const;
+    void setDebounceInterval(int ms);
+    int debounceInterval() const;
+
+signals:
+    void changesReady(const LibraryChanges &changes);
+
+private slots:
+    void readEvents();
+    void flush();
+
+private:
+    // A rename source waiting for its destination, keyed by inotify cookie
+    struct PendingMove
+    {
+        QString path;
+        bool directory = false;
+    };
+
+    void watchTree(const QString &directory);
+    void unwatchTree(const QString &directory);
+    void renameTree(const QString &from, const QString &to);
+    void fileChanged(const QString &path);
+    void fileRemoved(const QString &path);
+    void fileMoved(const QString &from, const QString &to);
+    void folderMoved(const QString &from, const QString &to);
+    void folderRemoved(const QString &path);
+    void folderAdded(const QString &path);
+    void schedule();
+
+    int fd = -1;
+    QSocketNotifier *notifier = nullptr;
+    QHash<int, QString> watchPaths;
+    QHash<QString, int> pathWatches;
+    QStringList roots;
+    bool watchLimitReported = false;
+
+    QHash<quint32, PendingMove> pendingMoves;
+    QList<LibraryMove> moved;
+    QSet<QString> removed;
+    QSet<QString> removedFolders;
+    QSet<QString> changed;
+    QSet<QString> rescan;
+
+    QTimer debounce;
+    QElapsedTimer firstEvent;
+    int interval = 300;
+    int maxDelay = 2000;
+};
+
+#endif // LIBRARYWATCHER_H
@@ -0,0 +1,269 @@
+#include "loudnessmeter.h"
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Loudness of a weighted mean square, BS.1770 puts 0 LUFS at a full scale 997 Hz sine in one front channel
+double loudness(double energy)
+{
+    return -0.691 + 10 * std::log10(energy);
+}
+
+double energy(double loudness)
+{
+    return std::pow(10.0, (loudness + 0.691) / 10);
+}
+
+// Mean square of the blocks of a histogram above the relative gate, NAN if there are none
+double gatedEnergy(const QList<quint64> &counts)
+{
+    double total = 0;
+    quint64 blocks = 0;
+    for (int i = 0; i < counts.size(); i++)
+    {
+        total += counts[i] * energy(LoudnessMeter::absoluteGate + (i + 0.5) / 10);
+        blocks += counts[i];
+    }
+    if (blocks == 0) return NAN;
+
+    const double threshold = total / blocks * std::pow(10.0, LoudnessMeter::relativeGate / 10);
+
+    double gated = 0;
+    quint64 count = 0;
+    for (int i = 0; i < counts.size(); i++)
+    {
+        double binEnergy = energy(LoudnessMeter::absoluteGate + (i + 0.5) / 10);
+        if (binEnergy <= threshold) continue;
+        gated += counts[i] * binEnergy;
+        count += counts[i];
+    }
+    return count > 0 ? gated / count : NAN;
+}
+
+}
+
+LoudnessMeter::LoudnessMeter(const DspKernels &kernels)
+    : kernels(&kernels)
+{}
+
+// Starts measuring a new source, the filters are designed for sampleRate
+void LoudnessMeter::start(int sampleRate, int channels)
+{
+    const double pi = 3.14159265358979323846;
+
+    this->sampleRate = qMax(sampleRate, 1);
+    this->channels = qMax(channels, 1);
+
+    // The surround channels of 5.0 and 5.1 count 1.5 dB more, the LFE not at all
+    static const float fiveChannels[] = {1, 1, 1, 1.41f, 1.41f};
+    static const float sixChannels[] = {1, 1, 1, 0, 1.41f, 1.41f};
+    weights = QList<float>(this->channels, 1);
+    for (int c = 0; c < this->channels; c++)
+    {
+        if (this->channels == 5) weights[c] = std::sqrt(fiveChannels[c]);
+        if (this->channels == 6) weights[c] = std::sqrt(sixChannels[c]);
+    }
+
+    // K-weighting, the high shelf modelling the head then the RLB high-pass, for any rate
+    // after the analogue prototypes of the 48 kHz coefficients in BS.1770
+    QList<BiquadSection> kWeighting(1);
+    {
+        double k = std::tan(pi * 1681.974450955533 / this->sampleRate);
+        double q = 0.7071752369554196;
+        double vh = std::pow(10.0, 3.999843853973347 / 20);
+        double vb = std::pow(vh, 0.4996667741545416);
+        double a0 = 1 + k / q + k * k;
+        kWeighting[0].setBand(0, (vh + vb * k / q + k * k) / a0, 2 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0,
+                              2 * (k * k - 1) / a0, (1 - k / q + k * k) / a0);
+
+        k = std::tan(pi * 38.13547087602444 / this->sampleRate);
+        q = 0.5003270373238773;
+        a0 = 1 + k / q + k * k;
+        kWeighting[0].setBand(1, 1, -2, 1, 2 * (k * k - 1) / a0, (1 - k / q + k * k) / a0);
+    }
+    sections = QList<BiquadSection>((this->channels + 1) / 2, kWeighting[0]);
+
+    stepFrames = qMax<qsizetype>(this->sampleRate / 10, 1);
+    stepLeft = stepFrames;
+    stepEnergy = 0;
+    stepCount = 0;
+    blocks.clear();
+    bins = QList<quint32>(histogramBins, 0);
+
+    oversampling = this->sampleRate < 96000 ? 4 : this->sampleRate < 192000 ? 2 : 1;
+    design();
+    history = QList<float>(qsizetype(this->channels) * (taps - 1), 0);
+    peak = 0;
+}
+
+// Measures frames of interleaved samples with the channels given to start
+void LoudnessMeter::process(const float *samples, qsizetype frames)
+{
+    if (sections.isEmpty() || frames <= 0) return;
+
+    // Split where the steps end so each part adds to one step
+    const float *at = samples;
+    for (qsizetype left = frames; left > 0;)
+    {
+        qsizetype n = qMin(left, stepLeft);
+        weigh(at, n);
+        at += n * channels;
+        left -= n;
+        stepLeft -= n;
+        if (stepLeft > 0) break;
+
+        steps[stepCount % 4] = stepEnergy / stepFrames;
+        stepCount++;
+        stepEnergy = 0;
+        stepLeft = stepFrames;
+        if (stepCount < 4) continue;
+
+        double block = (steps[0] + steps[1] + steps[2] + steps[3]) / 4;
+        double blockLoudness = loudness(block);
+        if (!(blockLoudness > absoluteGate)) continue;
+
+        blocks.append(block);
+        bins[qBound(0, int((blockLoudness - absoluteGate) * 10), histogramBins - 1)]++;
+    }
+
+    interpolate(samples, frames);
+}
+
+// Integrated loudness in LUFS of the audio so far, NAN if no block is above the gates
+double LoudnessMeter::integrated() const
+{
+    if (blocks.isEmpty()) return NAN;
+
+    double total = 0;
+    for (double block : blocks) total += block;
+    const double threshold = total / blocks.size() * std::pow(10.0, relativeGate / 10);
+
+    double gated = 0;
+    qsizetype count = 0;
+    for (double block : blocks)
+    {
+        if (block <= threshold) continue;
+        gated += block;
+        count++;
+    }
+    return count > 0 ? loudness(gated / count) : NAN;
+}
+
+// True peak in dBTP of the audio so far, -infinity for silence
+double LoudnessMeter::truePeak() const
+{
+    return peak > 0 ? 20 * std::log10(double(peak)) : -INFINITY;
+}
+
+// Block counts of every bin as little endian 32 bit integers, compressed as most bins are empty
+QByteArray LoudnessMeter::histogram() const
+{
+    QByteArray raw(bins.size() * qsizetype(sizeof(quint32)), Qt::Uninitialized);
+    for (qsizetype i = 0; i < bins.size(); i++) qToLittleEndian(bins[i], raw.data() + i * sizeof(quint32));
+    return qCompress(raw);
+}
+
+// Integrated loudness in LUFS of the songs whose histograms are given, NAN if no block is above the gates
+// Within 0.05 LU of measuring the songs one after the other, invalid histograms are skipped
+double LoudnessMeter::integrated(const QList<QByteArray> &histograms)
+{
+    QList<quint64> counts(histogramBins, 0);
+
+    for (const QByteArray &histogram : histograms)
+    {
+        QByteArray raw = qUncompress(histogram);
+        if (raw.size() != histogramBins * qsizetype(sizeof(quint32))) continue;
+
+        for (int i = 0; i < histogramBins; i++) counts[i] += qFromLittleEndian<quint32>(raw.constData() + i * sizeof(quint32));
+    }
+
+    double gated = gatedEnergy(counts);
+    return std::isnan(gated) ? NAN : loudness(gated);
+}
+
+// Filters frames of every pair of channels and adds their weighted squares to the step
+void LoudnessMeter::weigh(const float *samples, qsizetype frames)
+{
+    pair.resize(frames * 2);
+    float *to = pair.data();
+
+    for (int c = 0; c < channels; c += 2)
+    {
+        const bool odd = c + 1 == channels;
+        const float left = weights[c];
+        const float right = odd ? 0 : weights[c + 1];
+
+        for (qsizetype i = 0; i < frames; i++)
+        {
+            const float *frame = samples + i * channels + c;
+            to[2 * i] = frame[0] * left;
+            to[2 * i + 1] = odd ? 0 : frame[1] * right;
+        }
+
+        kernels->biquadStereo(to, frames, &sections[c / 2], 1);
+        stepEnergy += kernels->dot(to, to, frames * 2);
+    }
+}
+
+// Upsamples every channel phase by phase and keeps the largest sample
+// A phase is the sum of the input shifted by each tap, so every step runs over a whole buffer
+void LoudnessMeter::interpolate(const float *samples, qsizetype frames)
+{
+    const qsizetype keep = taps - 1;
+    const qsizetype chunk = 4096;
+
+    for (qsizetype start = 0; start < frames; start += chunk)
+    {
+        const qsizetype n = qMin(chunk, frames - start);
+        planar.resize(keep + n);
+        upsampled.resize(n);
+
+        for (int c = 0; c < channels; c++)
+        {
+            float *channel = planar.data();
+            std::memcpy(channel, history.constData() + c * keep, size_t(keep) * sizeof(float));
+            for (qsizetype i = 0; i < n; i++) channel[keep + i] = samples[(start + i) * channels + c];
+
+            if (oversampling == 1) peak = std::max(peak, kernels->peak(channel + keep, n));
+
+            for (int p = 0; p < oversampling && oversampling > 1; p++)
+            {
+                std::fill(upsampled.begin(), upsampled.end(), 0.0f);
+                for (int j = 0; j < taps; j++) kernels->multiplyAdd(upsampled.data(), channel + j, interpolator[p * taps + j], n);
+                peak = std::max(peak, kernels->peak(upsampled.constData(), n));
+            }
+
+            std::memcpy(history.data() + c * keep, channel + n, size_t(keep) * sizeof(float));
+        }
+    }
+}
+
+// Hann windowed sinc at the input Nyquist frequency, centred on an input sample so phase 0 is the input itself
+void LoudnessMeter::design()
+{
+    interpolator.clear();
+    if (oversampling == 1) return;
+
+    const double pi = 3.14159265358979323846;
+    const int length = taps * oversampling;
+    const double centre = length / 2;
+    const double cutoff = 0.5 / oversampling;
+
+    QList<double> prototype(length);
+    for (int t = 0; t < length; t++)
+    {
+        double x = t - centre;
+        double sinc = x == 0 ? 2 * cutoff : std::sin(2 * pi * cutoff * x) / (pi * x);
+        double hann = 0.5 - 0.5 * std::cos(2 * pi * t / length);
+        prototype[t] = sinc * hann * oversampling;
+    }
+
+    // Tap j of phase p meets input n - (taps - 1) + j, as in Resampler::design
+    interpolator.resize(qsizetype(oversampling) * taps);
+    for (int p = 0; p < oversampling; p++)
+    {
+        for (int j = 0; j < taps; j++) interpolator[p * taps + j] = float(prototype[p + (taps - 1 - j) * oversampling]);
+    }
+}
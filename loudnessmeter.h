@@ -0,0 +1,80 @@
+#ifndef LOUDNESSMETER_H
+#define LOUDNESSMETER_H
+
+#include "dspkernels.h"
+#include <QByteArray>
+#include <QList>
+#include <cmath>
+
+// Loudness of a song and its album as stored by the loudness analysis, see MusicDatabase::getLoudness
+// Values that are not known, for songs not analysed yet or silent ones, are NAN
+struct TrackLoudness
+{
+    double integrated = NAN;        // LUFS
+    double truePeak = NAN;          // dBTP
+    double albumIntegrated = NAN;
+    double albumTruePeak = NAN;
+
+    bool isValid() const { return !std::isnan(integrated); }
+};
+
+// Integrated loudness and true peak after EBU R128 and ITU-R BS.1770-4
+//
+// Every pair of channels is K-weighted through DspKernels::biquadStereo, the high shelf and the
+// high-pass of the standard as two bands of one section, and its mean square summed with dot.
+// 400 ms blocks overlap by 75 %, blocks below the absolute gate are dropped and the integrated
+// loudness is the mean of the blocks above the relative gate.
+//
+// The true peak is the largest sample of the audio upsampled four times below 96 kHz, twice
+// below 192 kHz, by a Hann windowed sinc of 12 taps per phase run with multiplyAdd and peak.
+//
+// histogram counts the blocks above the absolute gate in 0.1 LU bins, the histograms of the
+// songs of an album give the loudness of the album as if it had been measured as one file.
+class LoudnessMeter
+{
+public:
+    static constexpr double absoluteGate = -70;     // LUFS
+    static constexpr double relativeGate = -10;     // LU below the loudness of the blocks above the absolute gate
+    static const int histogramBins = 750;           // from the absolute gate to +5 LUFS
+    static const int taps = 12;                     // of the true peak interpolator, per phase
+
+    explicit LoudnessMeter(const DspKernels &kernels = DspKernels::best());
+
+    void start(int sampleRate, int channels);
+    void process(const float *samples, qsizetype frames);
+
+    double integrated() const;
+    double truePeak() const;
+    QByteArray histogram() const;
+
+    static double integrated(const QList<QByteArray> &histograms);
+
+private:
+    void weigh(const float *samples, qsizetype frames);
+    void interpolate(const float *samples, qsizetype frames);
+    void design();
+
+    const DspKernels *kernels;
+    int sampleRate = 0;
+    int channels = 0;
+    QList<float> weights;           // square root of the weight of every channel, applied before squaring
+    QList<BiquadSection> sections;  // K-weighting of every pair of channels
+    QList<float> pair;              // the frames of one pair of channels
+
+    qsizetype stepFrames = 0;       // 100 ms, a quarter of a block
+    qsizetype stepLeft = 0;
+    double stepEnergy = 0;          // weighted sum of squares of the step so far
+    double steps[4] = {};           // mean squares of the last four steps
+    int stepCount = 0;
+    QList<double> blocks;           // mean square of every block above the absolute gate
+    QList<quint32> bins;
+
+    int oversampling = 1;
+    QList<float> interpolator;      // taps per phase, in the order of the input samples
+    QList<float> history;           // per channel the last taps - 1 samples
+    QList<float> planar;            // one channel, its history followed by the new samples
+    QList<float> upsampled;         // one phase of the upsampled channel
+    float peak = 0;
+};
+
+#endif // LOUDNESSMETER_H
@@ -0,0 +1,361 @@
+#include "loudnessworker.h"
+#include "dspchain.h"
+#include <QtSql/QSqlError>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QAudioDecoder>
+#include <QAudioBuffer>
+#include <QEventLoop>
+#include <QThread>
+#include <QTimer>
+#include <QUrl>
+#include <QDebug>
+
+static const QString connectionName = "LoudnessWorker";
+
+// Values that are not known are stored as NULL
+static QVariant real(double value)
+{
+    return std::isfinite(value) ? QVariant(value) : QVariant();
+}
+
+// Half the cores at low priority, the analysis runs while the library is browsed and music plays
+LoudnessWorker::LoudnessWorker(QObject *parent)
+    : QObject{parent}, pool(this), watcher(this), flushTimer(this)
+{
+    flushTimer.setSingleShot(true);
+    flushTimer.setInterval(flushMsecs);
+    QObject::connect(&flushTimer, &QTimer::timeout, this, &LoudnessWorker::commitBatch);
+
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 2));
+    pool.setThreadPriority(QThread::LowPriority);
+
+    QObject::connect(&watcher, &QFutureWatcher<LoudnessResult>::resultReadyAt, this, [=](int idx) {
+        writeResult(watcher.resultAt(idx));
+    });
+    QObject::connect(&watcher, &QFutureWatcher<LoudnessResult>::finished, this, &LoudnessWorker::finish);
+}
+
+// Runs on the worker thread when the thread finishes, see MusicDatabase
+LoudnessWorker::~LoudnessWorker()
+{
+    close();
+}
+
+// Stops the analysis, songs already being decoded are dropped and analysed again next time
+void LoudnessWorker::cancel()
+{
+    cancelled.storeRelease(1);
+    QMetaObject::invokeMethod(this, [this]() { again = false; watcher.cancel(); }, Qt::QueuedConnection);
+}
+
+// Opens the worker's own connection to the database
+bool LoudnessWorker::open(const QString &databasePath)
+{
+    close();
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(databasePath);
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+
+    if (!db.open())
+    {
+        qDebug() << "Loudness Database Error: " << db.lastError();
+        return false;
+    }
+
+    QSqlQuery query(db);
+    if (!query.exec("PRAGMA synchronous=NORMAL;")) { qDebug() << query.lastError(); }
+    return true;
+}
+
+// Closes the worker's connection, the database file can be removed afterwards
+// A running analysis is cancelled and the results not written yet are dropped
+void LoudnessWorker::close()
+{
+    if (watcher.isRunning())
+    {
+        cancelled.storeRelease(1);
+        watcher.cancel();
+        watcher.waitForFinished();
+    }
+    again = false;
+
+    insert = QSqlQuery();
+    pendingResults.clear();
+    albums.clear();
+    flushTimer.stop();
+    if (!QSqlDatabase::contains(connectionName)) { return; }
+
+    QSqlDatabase::database(connectionName, false).close();
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+QSqlDatabase LoudnessWorker::database()
+{
+    return QSqlDatabase::database(connectionName, false);
+}
+
+// Analyses the songs that have no loudness yet or changed since it was measured
+// Called again while running, another pass follows for the songs added in the meantime
+void LoudnessWorker::analyze()
+{
+    if (!database().isOpen()) { return; }
+    if (watcher.isRunning())
+    {
+        again = true;
+        return;
+    }
+
+    again = false;
+    cancelled.storeRelease(0);
+
+    QList<LoudnessJob> jobs = pendingSongs(database());
+    if (jobs.isEmpty()) { return; }
+
+    insert = QSqlQuery(database());
+    insert.prepare("INSERT OR REPLACE INTO Loudness (SongID, Size, MTime, Integrated, TruePeak, Histogram) "
+                   "SELECT SongID, :size, :mtime, :integrated, :truePeak, :histogram FROM Songs WHERE SongID = :songID;");
+    pendingResults.clear();
+    analysed = 0;
+    failed = 0;
+    decodeNs = 0;
+    albums.clear();
+    timer.start();
+
+    qDebug() << "Analysing the loudness of" << jobs.count() << "songs";
+    watcher.setFuture(QtConcurrent::mapped(&pool, jobs, [this](const LoudnessJob &job) { return analyzeSong(job); }));
+}
+
+// Decodes a song and measures it, runs on a pool thread
+// QAudioDecoder signals through the event loop of the thread it was created on, so the
+// thread runs one until the song is decoded, it fails or the analysis is cancelled
+LoudnessResult LoudnessWorker::analyzeSong(const LoudnessJob &job)
+{
+    LoudnessResult result;
+    result.job = job;
+    if (cancelled.loadAcquire()) { return result; }
+
+    QElapsedTimer clock;
+    clock.start();
+    DspKernels::flushDenormals();
+
+    LoudnessMeter meter;
+    QAudioFormat format;
+    QList<float> samples;
+    bool done = false;
+    bool ok = true;
+
+    QAudioDecoder decoder;
+    QEventLoop loop;
+    QTimer poll;
+    poll.setInterval(250);
+
+    auto stop = [&](bool success) {
+        ok = ok && success;
+        done = true;
+        decoder.stop();
+        loop.quit();
+    };
+
+    QObject::connect(&decoder, &QAudioDecoder::bufferReady, &loop, [&]() {
+        QAudioBuffer buffer = decoder.read();
+        if (done || !buffer.isValid()) return;
+
+        // A change of format part way through would measure two sources as one
+        if (format != buffer.format())
+        {
+            if (format.isValid()) { stop(false); return; }
+            format = buffer.format();
+            meter.start(format.sampleRate(), format.channelCount());
+        }
+
+        const qsizetype frames = buffer.frameCount();
+        samples.resize(frames * format.channelCount());
+        if (!DspChain::toFloat(buffer.constData<char>(), frames, format, samples.data(), format.channelCount()))
+        {
+            stop(false);
+            return;
+        }
+        meter.process(samples.constData(), frames);
+    });
+    QObject::connect(&decoder, &QAudioDecoder::finished, &loop, [&]() { stop(true); });
+    QObject::connect(&decoder, qOverload<QAudioDecoder::Error>(&QAudioDecoder::error), &loop, [&]() {
+        qDebug() << "Loudness analysis could not decode" << job.file << decoder.errorString();
+        stop(false);
+    });
+    QObject::connect(&poll, &QTimer::timeout, &loop, [&]() { if (cancelled.loadAcquire()) stop(false); });
+
+    // The format of the file, converted to float as the buffers arrive
+    decoder.setAudioFormat(QAudioFormat());
+    decoder.setSource(QUrl(job.file));
+    decoder.start();
+    poll.start();
+    if (!done) loop.exec();
+
+    result.ok = ok && format.isValid() && !cancelled.loadAcquire();
+    if (result.ok)
+    {
+        result.integrated = meter.integrated();
+        result.truePeak = meter.truePeak();
+        result.histogram = meter.histogram();
+    }
+    result.decodeNs = clock.nsecsElapsed();
+    return result;
+}
+
+// Returns the songs whose loudness is missing or was measured at another fingerprint, by album
+// so the albums are complete as early as possible
+QList<LoudnessJob> LoudnessWorker::pendingSongs(QSqlDatabase db)
+{
+    QList<LoudnessJob> ret;
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT Songs.SongID, Songs.AlbumID, Songs.File, Songs.Size, Songs.MTime FROM Songs "
+                    "LEFT JOIN Loudness ON Loudness.SongID = Songs.SongID "
+                    "WHERE Loudness.SongID IS NULL OR Loudness.Size IS NOT Songs.Size OR Loudness.MTime IS NOT Songs.MTime "
+                    "ORDER BY Songs.AlbumID, Songs.Track;"))
+    {
+        qDebug() << query.lastError();
+        qDebug () << query.lastQuery();
+        return ret;
+    }
+
+    while (query.next())
+    {
+        LoudnessJob job;
+        job.songId = query.value(0).toLongLong();
+        job.albumId = query.value(1).toLongLong();
+        job.file = query.value(2).toString();
+        job.size = query.value(3);
+        job.mtime = query.value(4);
+        ret.append(job);
+    }
+    return ret;
+}
+
+// Works out the loudness of albums from the histograms of their songs, the true peak is the largest of theirs
+// Songs that could not be decoded are left out
+bool LoudnessWorker::updateAlbums(QSqlDatabase db, const QSet<qint64> &albumIds)
+{
+    QSqlQuery select(db);
+    select.setForwardOnly(true);
+    select.prepare("SELECT Loudness.Histogram, Loudness.TruePeak FROM Songs "
+                   "JOIN Loudness ON Loudness.SongID = Songs.SongID "
+                   "WHERE Songs.AlbumID = :albumID AND Loudness.Histogram IS NOT NULL;");
+
+    QSqlQuery replace(db);
+    replace.prepare("INSERT OR REPLACE INTO AlbumLoudness (AlbumID, Integrated, TruePeak) VALUES (:albumID, :integrated, :truePeak);");
+
+    for (qint64 albumId : albumIds)
+    {
+        select.bindValue(":albumID", albumId);
+        if (!select.exec())
+        {
+            qDebug() << select.lastError();
+            return false;
+        }
+
+        QList<QByteArray> histograms;
+        double truePeak = -INFINITY;
+        while (select.next())
+        {
+            histograms.append(select.value(0).toByteArray());
+            if (!select.value(1).isNull()) truePeak = qMax(truePeak, select.value(1).toDouble());
+        }
+
+        replace.bindValue(":albumID", albumId);
+        replace.bindValue(":integrated", real(LoudnessMeter::integrated(histograms)));
+        replace.bindValue(":truePeak", real(truePeak));
+        if (!replace.exec())
+        {
+            qDebug() << replace.lastError();
+            return false;
+        }
+    }
+    return true;
+}
+
+// Takes the loudness of a song to be written with the next batch, written once the batch
+// holds batchSize songs or flushMsecs after its first song
+void LoudnessWorker::writeResult(const LoudnessResult &result)
+{
+    if (!result.ok && cancelled.loadAcquire()) { return; }
+    if (!database().isOpen()) { return; }
+
+    pendingResults.append(result);
+    if (result.ok) albums.insert(result.job.albumId);
+    else failed++;
+
+    analysed++;
+    decodeNs += result.decodeNs;
+    if (pendingResults.size() >= batchSize) commitBatch();
+    else if (!flushTimer.isActive()) flushTimer.start();
+}
+
+// Stores the loudness of a song, songs that could not be decoded get a row without values
+// so they are only tried again once their file changes
+bool LoudnessWorker::writeRow(const LoudnessResult &result)
+{
+    insert.bindValue(":songID", result.job.songId);
+    insert.bindValue(":size", result.job.size);
+    insert.bindValue(":mtime", result.job.mtime);
+    insert.bindValue(":integrated", real(result.integrated));
+    insert.bindValue(":truePeak", real(result.truePeak));
+    insert.bindValue(":histogram", result.ok ? QVariant(result.histogram) : QVariant());
+    if (!insert.exec())
+    {
+        qDebug() << insert.lastError();
+        return false;
+    }
+    return true;
+}
+
+// Writes the held results along with the loudness of their albums in one transaction
+// A batch that could not be committed is kept and tried again flushMsecs later
+bool LoudnessWorker::commitBatch()
+{
+    flushTimer.stop();
+    if (pendingResults.isEmpty() || !database().isOpen()) { return true; }
+
+    QSqlDatabase db = database();
+    bool ok = db.transaction();
+    for (const LoudnessResult &result : std::as_const(pendingResults))
+    {
+        if (!ok) break;
+        writeRow(result);
+    }
+
+    ok = ok && updateAlbums(db, albums) && db.commit();
+    if (!ok)
+    {
+        qDebug() << db.lastError();
+        db.rollback();
+        if (!cancelled.loadAcquire()) flushTimer.start();
+        return false;
+    }
+
+    pendingResults.clear();
+    albums.clear();
+    return true;
+}
+
+// Commits the last batch and reports the pass, starts another if analyze was called meanwhile
+void LoudnessWorker::finish()
+{
+    if (!commitBatch())
+    {
+        qDebug() << "Loudness analysis could not write" << pendingResults.count() << "songs";
+        pendingResults.clear();
+        albums.clear();
+        flushTimer.stop();
+    }
+    insert = QSqlQuery();
+
+    qDebug() << "Loudness analysis" << (cancelled.loadAcquire() ? "cancelled:" : "complete:")
+             << analysed << "songs," << failed << "could not be decoded, in" << timer.elapsed() << "ms, decoding"
+             << decodeNs / 1000000 << "ms";
+    emit finished(analysed);
+
+    if (again && !cancelled.loadAcquire()) analyze();
+}
@@ -0,0 +1,92 @@
+#ifndef LOUDNESSWORKER_H
+#define LOUDNESSWORKER_H
+
+#include "loudnessmeter.h"
+#include <QObject>
+#include <QSet>
+#include <QVariant>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QThreadPool>
+#include <QTimer>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+
+// A song waiting for its loudness, with the fingerprint it had when the analysis started
+struct LoudnessJob
+{
+    qint64 songId = -1;
+    qint64 albumId = -1;
+    QString file;
+    QVariant size;
+    QVariant mtime;
+};
+
+// Loudness of a decoded song, ok is false if it could not be decoded
+struct LoudnessResult
+{
+    LoudnessJob job;
+    double integrated = NAN;
+    double truePeak = NAN;
+    QByteArray histogram;
+    bool ok = false;
+    qint64 decodeNs = 0;    // time spent decoding and measuring, on the pool thread
+};
+
+// Measures the loudness of the library away from the GUI thread
+//
+// Lives on its own thread with its own database connection, like ScanWorker. analyze picks the
+// songs without a Loudness row or whose row was measured at another fingerprint, decodes them
+// on a pool of low priority threads through LoudnessMeter and writes the results in batched
+// transactions, each followed by the albums of its songs. Results are held in memory until a
+// batch is full or flushMsecs passed, so the write lock is only held while rows are written,
+// never while songs are decoded. Stopping at any point loses at most one batch, the next
+// analyze carries on with the songs that are still missing.
+//
+// cancel may be called from any thread, everything else must run on the worker's thread
+class LoudnessWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LoudnessWorker(QObject *parent = nullptr);
+    ~LoudnessWorker();
+
+    static const int batchSize = 50;
+    static const int flushMsecs = 250;
+
+    void cancel();
+    bool open(const QString &databasePath);
+    void close();
+    void analyze();
+
+    LoudnessResult analyzeSong(const LoudnessJob &job);
+    static QList<LoudnessJob> pendingSongs(QSqlDatabase db);
+    static bool updateAlbums(QSqlDatabase db, const QSet<qint64> &albumIds);
+
+signals:
+    void finished(int analysed);
+
+private:
+    QSqlDatabase database();
+    void writeResult(const LoudnessResult &result);
+    bool writeRow(const LoudnessResult &result);
+    void finish();
+    bool commitBatch();
+
+    QThreadPool pool;
+    QFutureWatcher<LoudnessResult> watcher;
+    QAtomicInt cancelled;
+    bool again = false;     // analyze was called while running
+
+    QSqlQuery insert;
+    QList<LoudnessResult> pendingResults;
+    QSet<qint64> albums;    // of the songs in pendingResults
+    QTimer flushTimer;
+    int analysed = 0;
+    int failed = 0;
+    qint64 decodeNs = 0;
+    QElapsedTimer timer;
+};
+
+#endif // LOUDNESSWORKER_H
@@ -8,25 +8,21 @@
 #include <QSlider>
 #include <QDir>
 #include <QFileDialog>
+#include <QTime>
+#include <QActionGroup>
 #include "musicdatabase.h"
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
+    , songModel(&db)
 {
     ui->setupUi(this);
 
-    // Connect to database as program starts up, if the database does not exist or is corrupted
-    // the program will automatically create a new one
-    if (db.connectToDatabase("songs.db"))
-    {
-        qDebug() << ("Database Opened");
-    }
-    else if (db.createDatabase("songs.db"))
-    {
-        qDebug() << ("Database Created and Opened");
-        //db.scanFolder("/home/rhino/Data/Media/Music"); // To Do Settings page. Hardcoded path bad.
-    }
+    // Browsing is served from memory once the library is loaded
+    // until the database is open it is served from the snapshot written by the last run
+    db.setLibraryIndexEnabled(true);
+    db.openSnapshot("songs.db");
 
     // Sets up all of the list views. These views are for song selection.
     ui->Artists->setModel(&artistModel);
@@ -34,10 +30,17 @@ MainWindow::MainWindow(QWidget *parent)
 
     ui->Albums->setModel(&albumModel);
 
+    // Songs are loaded in pages as the view scrolls, every row has the same height
+    // so the view does not need to measure them all
     ui->Songs->setModel(&songModel);
+    ui->Songs->setUniformItemSizes(true);
 
     ui->Playlist->setModel(&player.queue);
 
+    // Songs are played at the same loudness once the analysis has measured them, see MusicPlayer::songGain
+    // The lookup is one query on the primary key as a song loads, and only made while normalization is on
+    player.setLoudnessLookup([this](qint64 songId) { return db.getLoudness(songId); });
+
     artPlaceholder.load("://placeholderArt.png");
     ui->infoArt->setPixmap(artPlaceholder.scaled(150, 150));
 
@@ -48,7 +51,6 @@ MainWindow::MainWindow(QWidget *parent)
         if (deselected.count() > 0 && selected.count() < 1) {ui->Artists->selectionModel()->select(artistModel.index(0), QItemSelectionModel::Select);}
         else {
             showAlbums(selected.indexes().first());
-            ui->Albums->selectionModel()->select(albumModel.index(0), QItemSelectionModel::Select);
         };
     });
 
@@ -59,9 +61,23 @@ MainWindow::MainWindow(QWidget *parent)
             ui->Songs->clearSelection();
         }
     });
+
+    // Search as you type, the search runs once typing pauses
+    searchTimer.setSingleShot(true);
+    searchTimer.setInterval(150);
+    QObject::connect(ui->searchBox, &QLineEdit::textChanged, &searchTimer, qOverload<>(&QTimer::start));
+    QObject::connect(&searchTimer, &QTimer::timeout, this, &MainWindow::search);
+
+    // Enter adds every result of the search to the queue
+    QObject::connect(ui->searchBox, &QLineEdit::returnPressed, this, [=](){
+        QList<qint64> ids;
+        db.searchSongs(ui->searchBox->text(), 0, -1, &ids);
+        if (!ids.isEmpty()) player.addSongs(SongHandle::intern(db.getSongsByIds(ids)));
+    });
+
     QObject::connect(ui->Songs, &QAbstractItemView::doubleClicked, &player, [=](QModelIndex index)
                      {
-        player.addSong(db.getSong(index.row()), true);
+        player.addSong(SongHandle::intern(db.getSongById(songModel.songId(index.row()))), true);
         ui->Songs->clearSelection();
     });
     //QObject::connect(&player, &MusicPlayer::queueIndexChanged, this, [=](int index) {ui->Playlist->setCurrentIndex(ui->Playlist->model()->index(index, 0)); });
@@ -85,6 +101,7 @@ MainWindow::MainWindow(QWidget *parent)
     // Used for now playing information, see MainWindow::MediaLoaded for more information
     QObject::connect(&player, &MusicPlayer::mediaLoaded, this, &MainWindow::mediaLoaded);
     QObject::connect(&player, &MusicPlayer::noMedia, this, [=]() {
+        currentArt.clear();
         ui->infoArt->setPixmap(artPlaceholder.scaled(150, 150));
         ui->infoTitle->setText("No Media");
         ui->infoAlbum->setText("");
@@ -106,12 +123,35 @@ MainWindow::MainWindow(QWidget *parent)
 
     QObject::connect(&db, &MusicDatabase::scanComplete, this, [=](){
         ui->statusbar->clearMessage();
-        artistModel.setStringList(db.getArtists());
-        albumModel.setStringList(db.getAlbums());
-        songModel.setStringList(db.getSongNames());
+        pauseScan.setChecked(false);
+        refreshLibrary();
     });
+    QObject::connect(&db, &MusicDatabase::libraryChanged, this, &MainWindow::refreshLibrary);
+    QObject::connect(&artCache, &ArtCache::artLoaded, this, &MainWindow::showArt);
 
-    QObject::connect(&db, &MusicDatabase::scanStatus, this, [=](QString File){ui->statusbar->showMessage(File);});
+    QObject::connect(&db, &MusicDatabase::scanProgress, this, [=](const ScanProgress &progress){
+        QString message;
+        if (progress.searching) message = QString("Scanning: %1 files found").arg(progress.total);
+        else
+        {
+            message = QString("Scanning: %1 / %2 files, %3 files/s")
+                          .arg(progress.done).arg(progress.total).arg(qRound(progress.filesPerSecond));
+            if (progress.remainingMs >= 0)
+            {
+                QTime remaining = QTime(0, 0).addMSecs(progress.remainingMs);
+                message += QString(", %1 left").arg(remaining.toString(remaining.hour() > 0 ? "h:mm:ss" : "m:ss"));
+            }
+        }
+        if (progress.paused) message.replace(0, 8, "Scan paused");
+        ui->statusbar->showMessage(message);
+    });
+    QObject::connect(&db, &MusicDatabase::scanCancelled, this, [=](){ ui->statusbar->showMessage("Scan cancelled"); });
+    QObject::connect(&db, &MusicDatabase::scanSummary, this, [=](int added, int changed, int unchanged, int removed, int failed){
+        QString message = QString("Scan complete: %1 new, %2 changed, %3 unchanged, %4 removed")
+                              .arg(added).arg(changed).arg(unchanged).arg(removed);
+        if (failed > 0) message += QString(", %1 could not be read").arg(failed);
+        ui->statusbar->showMessage(message);
+    });
 
 
     // Keep models used for displaying and selecting songs from being edited
@@ -125,21 +165,24 @@ MainWindow::MainWindow(QWidget *parent)
     QObject::connect(&playSong, &QAction::triggered, this, [=](){
         QModelIndexList lst = ui->Songs->selectionModel()->selectedIndexes();
         std::sort(lst.begin(), lst.end(), [=](QModelIndex x, QModelIndex y) { return x.row() < y.row(); });
-        bool play = true;
-        for (QModelIndex idx : lst)
-        {
-            player.addSong(db.getSong(idx.row()), play);
-            if (play) play = false;
-        }
+
+        // The whole selection is fetched in one query
+        QList<qint64> ids;
+        for (QModelIndex idx : lst) ids << songModel.songId(idx.row());
+        QList<SongHandle> songs = SongHandle::intern(db.getSongsByIds(ids));
+        if (songs.isEmpty()) return;
+
+        player.addSong(songs.takeFirst(), true);
+        player.addSongs(songs);
     });
     ui->Songs->addAction(&playSong);
 
     insertSong.setText("Add to Queue");
-    QObject::connect(&insertSong, &QAction::triggered, this, [=](){player.addSong(db.getSong(ui->Songs->currentIndex().row()), false); });
+    QObject::connect(&insertSong, &QAction::triggered, this, [=](){player.addSong(SongHandle::intern(db.getSongById(songModel.songId(ui->Songs->currentIndex().row()))), false); });
     ui->Songs->addAction(&insertSong);
 
     playNext.setText("Play Next");
-    QObject::connect(&playNext, &QAction::triggered, this, [=](){player.insertNext(db.getSong(ui->Songs->currentIndex().row())); });
+    QObject::connect(&playNext, &QAction::triggered, this, [=](){player.insertNext(SongHandle::intern(db.getSongById(songModel.songId(ui->Songs->currentIndex().row())))); });
     ui->Songs->addAction(&playNext);
 
     insertArtist.setText("Add To Queue");
@@ -150,7 +193,7 @@ MainWindow::MainWindow(QWidget *parent)
         if (selectionIndex.row() < 1) db.setArtist();
         else db.setArtist(artistModel.data(selectionIndex).toString());
         db.setAlbum();
-        player.addSongs(db.getSongs());
+        player.addSongs(SongHandle::intern(db.getSongs()));
     });
     ui->Artists->addAction(&insertArtist);
 
@@ -162,7 +205,7 @@ MainWindow::MainWindow(QWidget *parent)
         if (selectionIndex.row() < 1) db.setAlbum();
         else db.setFiltersByAlbumID(ui->Albums->currentIndex().row() - 1, true);
 
-        player.addSongs(db.getSongs());
+        player.addSongs(SongHandle::intern(db.getSongs()));
     });
     ui->Albums->addAction(&insertAlbum);
 
@@ -185,10 +228,36 @@ MainWindow::MainWindow(QWidget *parent)
 
     scanFolder.setText("Scan Folder");
     QObject::connect(&scanFolder, &QAction::triggered, this, [=](){
-        db.scanFolder(QFileDialog::getExistingDirectory(this, "Select folder to scan", QDir::homePath()));
+        db.addFolder(QFileDialog::getExistingDirectory(this, "Select folder to scan", QDir::homePath()));
     });
     fileMenu.addAction(&scanFolder);
 
+    pauseScan.setText("Pause Scan");
+    pauseScan.setCheckable(true);
+    QObject::connect(&pauseScan, &QAction::toggled, this, [=](bool checked){ db.setScanPaused(checked); });
+    fileMenu.addAction(&pauseScan);
+
+    cancelScan.setText("Cancel Scan");
+    QObject::connect(&cancelScan, &QAction::triggered, this, [=](){ db.cancelScan(); });
+    fileMenu.addAction(&cancelScan);
+
+    // Loudness normalization, off until it is chosen here
+    playbackMenu.setTitle("Playback");
+    ui->menubar->addMenu(&playbackMenu);
+
+    QActionGroup *normalization = new QActionGroup(this);
+    auto addNormalization = [=](QAction *action, const QString &text, int mode) {
+        action->setText(text);
+        action->setCheckable(true);
+        action->setChecked(player.normalization() == mode);
+        normalization->addAction(action);
+        playbackMenu.addAction(action);
+        QObject::connect(action, &QAction::triggered, this, [=](){ player.setNormalization(mode); });
+    };
+    addNormalization(&normalizeOff, "No Loudness Normalization", NormalizationMode::NormalizeOff);
+    addNormalization(&normalizeTrack, "Normalize Songs", NormalizationMode::NormalizeTrack);
+    addNormalization(&normalizeAlbum, "Normalize Albums", NormalizationMode::NormalizeAlbum);
+
     resetDatabase.setText("Reset Database");
     QObject::connect(&resetDatabase, &QAction::triggered, this, [=](){
         db.createDatabase("songs.db");
@@ -199,13 +268,62 @@ MainWindow::MainWindow(QWidget *parent)
 
         albumModel.setStringList(QStringList());
         artistModel.setStringList(QStringList());
-        songModel.setStringList(QStringList());
+        songModel.clear();
     });
     fileMenu.addAction(&resetDatabase);
 
-    // Prefill views
-    showAlbums(artistModel.index(0));
+    // Prefill views, the albums follow once the artists are loaded, see showArtists
     showSongs();
+
+    // The database is opened once the window has been shown
+    QTimer::singleShot(0, this, &MainWindow::openDatabase);
+}
+
+// Opens the database after the views have been filled from the library snapshot
+// If the snapshot was stale the views are updated from the database
+void MainWindow::openDatabase()
+{
+    // Connect to database as program starts up, if the database does not exist or is corrupted
+    // the program will automatically create a new one
+    if (db.connectToDatabase("songs.db"))
+    {
+        qDebug() << ("Database Opened");
+    }
+    else if (db.createDatabase("songs.db"))
+    {
+        qDebug() << ("Database Created and Opened");
+        //db.scanFolder("/home/rhino/Data/Media/Music"); // To Do Settings page. Hardcoded path bad.
+    }
+
+    // Library folders are kept up to date as files are added, changed, moved or deleted
+    db.setWatchEnabled(true);
+
+    refreshLibrary();
+}
+
+// Replaces the rows of model with list
+// Only the rows between the unchanged start and end of the list are removed and inserted,
+// so the selection and scroll position outside of them are kept
+static void syncStringList(QStringListModel &model, const QStringList &list)
+{
+    QStringList old = model.stringList();
+
+    int prefix = 0;
+    while (prefix < old.count() && prefix < list.count() && old[prefix] == list[prefix]) prefix++;
+
+    int suffix = 0;
+    while (suffix < old.count() - prefix && suffix < list.count() - prefix &&
+           old[old.count() - 1 - suffix] == list[list.count() - 1 - suffix]) suffix++;
+
+    int removeCount = old.count() - prefix - suffix;
+    int insertCount = list.count() - prefix - suffix;
+
+    if (removeCount > 0) model.removeRows(prefix, removeCount);
+    if (insertCount > 0)
+    {
+        model.insertRows(prefix, insertCount);
+        for (int i = 0; i < insertCount; i++) model.setData(model.index(prefix + i), list[prefix + i]);
+    }
 }
 
 MainWindow::~MainWindow()
@@ -226,16 +344,27 @@ void MainWindow::showAlbums(QModelIndex indexOfArtist)
         filterSongsByArtists = true;
     }
 
-    albumModel.setStringList(db.getAlbums());
-    albumModel.insertRows(0, 1);
-    albumModel.setData(albumModel.index(0), QVariant("All Albums"));
+    // Loaded off the GUI thread, a result for an artist that is no longer selected is dropped
+    int request = ++albumsRequest;
+    db.getAlbumsAsync(db.artistFilter()).then(this, [=](const QStringList &albums) {
+        if (request != albumsRequest) { return; }
+
+        albumModel.setStringList(albums);
+        albumModel.insertRows(0, 1);
+        albumModel.setData(albumModel.index(0), QVariant("All Albums"));
+        ui->Albums->selectionModel()->select(albumModel.index(0), QItemSelectionModel::Select);
+    });
 }
 
+// Loaded off the GUI thread, the albums of all artists are shown once the list is filled
 void MainWindow::showArtists()
 {
-    artistModel.setStringList(db.getArtists());
-    artistModel.insertRows(0, 1);
-    artistModel.setData(artistModel.index(0), QVariant("All Artists"));
+    db.getArtistsAsync().then(this, [=](const QStringList &artists) {
+        artistModel.setStringList(artists);
+        artistModel.insertRows(0, 1);
+        artistModel.setData(artistModel.index(0), QVariant("All Artists"));
+        showAlbums(artistModel.index(0));
+    });
 }
 
 // Used to show songs of a particular album, it is expected that the artist
@@ -243,43 +372,64 @@ void MainWindow::showArtists()
 void MainWindow::showSongs(QString album)
 {
     db.setAlbum(album);
-    songModel.setStringList(db.getSongNames());
+    songModel.setFilter(db.artistFilter(), db.albumFilter());
 }
 
 // Shows a songlist based on the Row of the album selected. This is used due to limitations with the informaton
 // stored within the StringListModel used to show and select the album.
-// See MusicDatabase::getSongNamesByAlbumID for more information.
+// See MusicDatabase::setFiltersByAlbumID for more information.
 // the artist does not need to be filtered
 void MainWindow::showSongs(int idx)
 {
-    QStringList songList;
-    if (idx >= 0) { songList = db.getSongNamesByAlbumID(idx, filterSongsByArtists); }
-    else {
-        db.setAlbum();
-        songList = db.getSongNames();
+    // Picking an album leaves the search
+    if (!ui->searchBox->text().isEmpty())
+    {
+        QSignalBlocker blocker(ui->searchBox);
+        ui->searchBox->clear();
+        searchTimer.stop();
     }
-    songModel.setStringList(songList);
+
+    if (idx >= 0) {
+        if (!db.setFiltersByAlbumID(idx, filterSongsByArtists)) {
+            songModel.clear();
+            return;
+        }
+    }
+    else db.setAlbum();
+
+    songModel.setFilter(db.artistFilter(), db.albumFilter());
 }
 
 // Sets information for now playing media.
-void MainWindow::mediaLoaded(const Song &song, int dynPlstIdx)
+void MainWindow::mediaLoaded(const SongHandle &song, int dynPlstIdx)
 {
-    ui->infoTitle ->setText(song.title );
-    ui->infoAlbum ->setText(song.album );
-    ui->infoArtist->setText(song.artist);
-
-    if (!song.image.isEmpty())
-    {
-        QPixmap art;
-        art.load(song.image);
-        ui->infoArt->setPixmap(art.scaled({150, 150}, Qt::KeepAspectRatio, Qt::SmoothTransformation));
-    }
+    ui->infoTitle ->setText(song.title() );
+    ui->infoAlbum ->setText(song.album() );
+    ui->infoArtist->setText(song.artist());
+
+    // The 150 px thumbnail is decoded on the art cache's thread, see showArt
+    QString image = song.image();
+    currentArt = image;
+    QPixmap art = image.isEmpty() ? QPixmap() : artCache.find(image, 150);
+    if (!art.isNull()) { ui->infoArt->setPixmap(art); }
+    else if (image.isEmpty()) { ui->infoArt->setPixmap(artPlaceholder.scaled(150, 150)); }
+    else { artCache.request(image, 150); }
 
     playlistIdx = dynPlstIdx;
 
     //ui->Playlist->setCurrentIndex(ui->Playlist->model()->index(dynPlstIdx, 0));
 }
 
+// Shows art loaded by the art cache if it belongs to the song now playing
+// An image that could not be read falls back to the placeholder
+void MainWindow::showArt(const QString &image, int size, const QPixmap &art)
+{
+    if (image != currentArt || size != 150) { return; }
+
+    if (art.isNull()) ui->infoArt->setPixmap(artPlaceholder.scaled(150, 150));
+    else ui->infoArt->setPixmap(art);
+}
+
 // Changes the play button text depending on the state of the player
 void MainWindow::playbackStateChanged(QMediaPlayer::PlaybackState state)
 {
@@ -327,3 +477,21 @@ void MainWindow::volumeChanged(qint64 volume)
 {
     ui->volumeSlider->setValue(volume);
 }
+
+// Shows the results of the search box, or the songs of the selected artist and album when it is empty
+// See MusicDatabase::searchSongs for how the text is matched
+void MainWindow::search()
+{
+    QString text = ui->searchBox->text().trimmed();
+    if (text.isEmpty()) songModel.setFilter(db.artistFilter(), db.albumFilter());
+    else songModel.setSearch(text);
+}
+
+// Updates the artist, album and song views after the library changed
+// without resetting them, see syncStringList and SongListModel::refresh
+void MainWindow::refreshLibrary()
+{
+    syncStringList(artistModel, QStringList("All Artists") + db.getArtists());
+    syncStringList(albumModel, QStringList("All Albums") + db.getAlbums());
+    songModel.refresh();
+}
@@ -3,9 +3,12 @@
 
 #include "musicdatabase.h"
 #include "musicplayer.h"
+#include "songlistmodel.h"
+#include "artcache.h"
 #include <QMainWindow>
 #include <QtMultimedia/QMediaPlayer>
 #include <QStringListModel>
+#include <QTimer>
 #include <qmenu.h>
 
 QT_BEGIN_NAMESPACE
@@ -27,11 +30,15 @@ private:
     Ui::MainWindow *ui;
     QStringListModel artistModel;
     QStringListModel albumModel;
-    QStringListModel songModel;
+    SongListModel songModel;
+    QTimer searchTimer;
     QPixmap artPlaceholder;
+    ArtCache artCache;
+    QString currentArt;
     MusicPlayer player;
     int playlistIdx;
     bool filterSongsByArtists = false;
+    int albumsRequest = 0;
 
     QAction playSong;
     QAction insertSong;
@@ -46,6 +53,13 @@ private:
     QMenu fileMenu;
     QAction resetDatabase;
     QAction scanFolder;
+    QAction pauseScan;
+    QAction cancelScan;
+
+    QMenu playbackMenu;
+    QAction normalizeOff;
+    QAction normalizeTrack;
+    QAction normalizeAlbum;
 
 
 
@@ -55,8 +69,12 @@ private slots:
 
     void showSongs(QString album = "");
     void showSongs(int idx);
+    void search();
+    void refreshLibrary();
+    void openDatabase();
 
-    void mediaLoaded(const Song &song, int dynPlstIdx);
+    void mediaLoaded(const SongHandle &song, int dynPlstIdx);
+    void showArt(const QString &image, int size, const QPixmap &art);
     void playbackStateChanged(QMediaPlayer::PlaybackState state);
 
     void repeatModeChanged(int repeatMode);
@@ -2,6 +2,7 @@
 #include "QCoreApplication"
 #include "QDBusConnection"
 #include "musicplayer.h"
+#include "artstore.h"
 #include <QDBusMessage>
 #include <QMetaMethod>
 
@@ -81,16 +82,17 @@ void MprisController::propertiesChanged(QString interface, QString name, QVarian
     qDebug() << con.send(signal);
 }
 
-void MprisController::mediaLoaded(const Song &song, int dynPlstIdx) {
+void MprisController::mediaLoaded(const SongHandle &handle, int dynPlstIdx) {
     if (DBusUnreachable) { return; }
     QMap<QString, QVariant> newMetadata;
+    Song song = handle.song();
 
     newMetadata["mpris:trackid"]     = QVariant(QDBusObjectPath(QString("/com/RhinoMusic/track/%1").arg(QByteArray::fromStdString(song.title.toStdString() + "-" + song.file.toStdString()).toHex())));
-    newMetadata["mpris:artUrl"]      = QVariant(QUrl::fromLocalFile(song.image).toString());
+    newMetadata["mpris:artUrl"]      = QVariant(QUrl::fromLocalFile(ArtStore::thumbnail(song.image, 512)).toString());
     newMetadata["mpris:length"]      = (qlonglong)song.duration * 1000;
     newMetadata["xesam:title"]       = song.title;
     newMetadata["xesam:album"]       = song.album;
-    newMetadata["xesam:albumArtist"] = QList<QString> (song.artist);
+    newMetadata["xesam:albumArtist"] = QList<QString> (song.albumArtist);
     newMetadata["xesam:artist"]      = QList<QString> (song.artist);
 
     playerInterface->setMetadata(newMetadata);
@@ -5,7 +5,7 @@
 #include <QMediaPlayer>
 #include "mprisdbusinterface.h"
 #include "mprisdbusplayerinterface.h"
-#include "song.h"
+#include "songhandle.h"
 
 class MprisController : public QObject
 {
@@ -16,7 +16,7 @@ public:
     bool unreachable();
 
 public slots:
-    void mediaLoaded(const Song &song, int dynPlstIdx);
+    void mediaLoaded(const SongHandle &handle, int dynPlstIdx);
     void noMedia();
     void positionChanged(const qint64 position, const qint64 duration);
     void playbackStateChanged(QMediaPlayer::PlaybackState state);
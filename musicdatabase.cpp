@@ -6,11 +6,12 @@
 #include <QFile>
 #include <QDir>
 #include <QDirIterator>
-#include <QMediaMetaData>
-#include <QAudioOutput>
-#include <QImage>
-#include <QCryptographicHash>
-#include <qregularexpression.h>
+#include <QDebug>
+#include <QUrl>
+#include <QRegularExpression>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QPromise>
+#include <QRandomGenerator>
 
 
 // Default Constructor, database always stars as invalid.
@@ -21,38 +22,65 @@ MusicDatabase::MusicDatabase(QObject *parent)
 {
     valid = false;
 
-    QObject::connect(this, &MusicDatabase::scanComplete, this, [=](){
-        if (mp != nullptr)
-        {
-            delete mp;
-            mp = nullptr;
-        }
-    });
+    // Scans run on their own thread, the worker is deleted there when the thread stops
+    qRegisterMetaType<ScanSummary>();
+    worker = new ScanWorker;
+    worker->moveToThread(&scanThread);
+    QObject::connect(&scanThread, &QThread::finished, worker, &QObject::deleteLater);
+    QObject::connect(worker, &ScanWorker::finished, this, &MusicDatabase::scanFinished);
+    scanThread.setObjectName("Library Scan");
+    scanThread.start();
+
+    analyzer = new LoudnessWorker;
+    analyzer->moveToThread(&analysisThread);
+    QObject::connect(&analysisThread, &QThread::finished, analyzer, &QObject::deleteLater);
+    QObject::connect(analyzer, &LoudnessWorker::finished, this, &MusicDatabase::loudnessAnalyzed);
+    analysisThread.setObjectName("Loudness Analysis");
+    analysisThread.start();
+
+    // Async queries read through their own connections, two threads keep the browsers responsive
+    // while a long query runs. Threads are kept so their connections stay open
+    queryPool.setMaxThreadCount(2);
+    queryPool.setExpiryTimeout(-1);
+
+    snapshotTimer.setSingleShot(true);
+    snapshotTimer.setInterval(5000);
+    QObject::connect(&snapshotTimer, &QTimer::timeout, this, &MusicDatabase::saveSnapshot);
+
+    progressTimer.setInterval(250);
+    QObject::connect(&progressTimer, &QTimer::timeout, this, &MusicDatabase::reportProgress);
+
+    QObject::connect(&watcher, &LibraryWatcher::changesReady, this, &MusicDatabase::applyChanges);
 }
 
 // Destructor
-// As the scanner uses a temperary QMusicPlayer Object
-// the scanner must be deleted upon deletion of this object
-// The Scanner normally takes care of the deletion when scanning is complete
-// this destructor ensures its deletion provided it hasnt already been deleted.
+// Stops the scan and analysis threads, any running scan or analysis is cancelled
 MusicDatabase::~MusicDatabase()
 {
-    if (mp != nullptr)
-    {
-        delete mp;
-        mp = nullptr;
-    }
+    if (snapshotTimer.isActive()) saveSnapshot();
+    cancelQueries();
+    worker->cancel();
+    analyzer->cancel();
+    scanThread.quit();
+    analysisThread.quit();
+    scanThread.wait();
+    analysisThread.wait();
 }
 
 // Connects to and validates an existing database
-// The database must contain a tabel named 'Songs'
+// The database must contain the tables 'Artists', 'Albums' and 'Songs'
 // The 'Songs' table must contain columns:
-// 'Image', 'Artist', 'Album', 'Track', and 'File'
+// 'SongID', 'File', 'AlbumID', 'ContributingArtist', 'Track', 'Title', 'Image' and 'Duration'
+//
+// Databases using the old single 'Songs' table are migrated to the normalized schema
+// Fingerprint columns ('Size', 'MTime', 'Inode') are added to them first if missing
 bool MusicDatabase::connectToDatabase(QString databaseFilePath)
 {
     // Open Database connection on default connection
+    // the scan thread writes through its own connection, locks it holds are waited on
     QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE");
     db.setDatabaseName(databaseFilePath);
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
 
     // Begin Database Verification
     bool ok = db.open();
@@ -65,33 +93,69 @@ bool MusicDatabase::connectToDatabase(QString databaseFilePath)
         return false;
     }
 
+    configureConnection(db);
+
     // Verify songs table
     QStringList tables = db.tables();
 
     if (!tables.contains("Songs"))   { valid = false; db.close(); return false; };
     QSqlRecord verifyRecord = db.record("Songs");
 
-    // Magic Value Issue, To Be Removed
-    //if (verifyRecord.count() != 7) { valid = false; db.close(); return false; };
     QStringList verifyColumns;
 
     for (int i = verifyRecord.count(); i > 0; i--) { verifyColumns << verifyRecord.fieldName(i-1); }
 
-    if (!(verifyColumns.contains("Image" )  &&
-          verifyColumns.contains("Artist")  &&
-          verifyColumns.contains("ContributingArtist") &&
-          verifyColumns.contains("Album" )  &&
-          verifyColumns.contains("Track" )  &&
-          verifyColumns.contains("Title" )  &&
-          verifyColumns.contains("File"  )  &&
-          verifyColumns.contains("Duration")))
+    if (!verifyColumns.contains("SongID"))
+    {
+        if (!(verifyColumns.contains("Image" )  &&
+              verifyColumns.contains("Artist")  &&
+              verifyColumns.contains("ContributingArtist") &&
+              verifyColumns.contains("Album" )  &&
+              verifyColumns.contains("Track" )  &&
+              verifyColumns.contains("Title" )  &&
+              verifyColumns.contains("File"  )  &&
+              verifyColumns.contains("Duration")))
+        {
+            valid = false;
+            return false;
+        }
+
+        // Databases from before fingerprints were stored are upgraded in place
+        // their rows have no fingerprint and are all read again on the next scan
+        for (const QString &column : {"Size", "MTime", "Inode"})
+        {
+            if (!verifyColumns.contains(column)) QSqlQuery(QString("ALTER TABLE Songs ADD COLUMN %1 int").arg(column));
+        }
+
+        if (!migrateDatabase(db)) { valid = false; return false; }
+    }
+    else if (!(tables.contains("Artists") &&
+               tables.contains("Albums")  &&
+               verifyColumns.contains("File"   ) &&
+               verifyColumns.contains("AlbumID") &&
+               verifyColumns.contains("ContributingArtist") &&
+               verifyColumns.contains("Track"  ) &&
+               verifyColumns.contains("Title"  ) &&
+               verifyColumns.contains("Image"  ) &&
+               verifyColumns.contains("Duration")))
     {
         valid = false;
         return false;
     }
 
+    // Adds any indexes missing from older databases
+    if (!createSchema(db)) { valid = false; return false; }
+
     // Return True if DB validated
     valid = true;
+    databasePath = databaseFilePath;
+    connectionGeneration++;
+    openScanConnection(databaseFilePath);
+    if (indexEnabled) loadLibraryIndex();
+    if (watching) { for (const QString &folder : getFolders()) watcher.addFolder(folder); }
+
+    // Picks up where the last analysis stopped
+    analyzeLoudness();
     return true;
 }
 
@@ -100,12 +164,25 @@ bool MusicDatabase::connectToDatabase(QString databaseFilePath)
 // used to fix corrupted databases or make a non-existant one
 bool MusicDatabase::createDatabase(QString databaseFilePath)
 {
-    // Remove Old Database
-    if (QFile::exists(databaseFilePath)) { QFile::remove(databaseFilePath); }
+    // Remove Old Database, including the write-ahead log of the previous connections
+    watcher.clear();
+    cancelQueries();
+    cancelScan();
+    libraryIndex.clear();
+    snapshotTimer.stop();
+    QMetaObject::invokeMethod(worker, [scanWorker = worker]() { scanWorker->close(); }, Qt::BlockingQueuedConnection);
+    analyzer->cancel();
+    QMetaObject::invokeMethod(analyzer, [loudnessWorker = analyzer]() { loudnessWorker->close(); }, Qt::BlockingQueuedConnection);
+    QSqlDatabase::database(QSqlDatabase::defaultConnection, false).close();
+    for (const QString &suffix : {"", "-wal", "-shm", ".snapshot"})
+    {
+        if (QFile::exists(databaseFilePath + suffix)) { QFile::remove(databaseFilePath + suffix); }
+    }
 
     //Open Database
     QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE");
     db.setDatabaseName(databaseFilePath);
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
 
     bool ok = db.open();
     qDebug() << "Database Is Open: " << ok;
@@ -117,164 +194,849 @@ bool MusicDatabase::createDatabase(QString databaseFilePath)
         return false;
     }
 
+    configureConnection(db);
+
     // Create Tables
-    QSqlQuery("CREATE TABLE Songs (Image TEXT COLLATE NOCASE, Artist TEXT COLLATE NOCASE, ContributingArtist TEXT COLLATE NOCASE, Album TEXT COLLATE NOCASE, Track int, Title TEXT, File TEXT PRIMARY KEY, Duration int)");
+    if (!createSchema(db)) { valid = false; return false; }
 
     qDebug() << (db.tables());
 
     valid = true;
+    databasePath = databaseFilePath;
+    connectionGeneration++;
+    openScanConnection(databaseFilePath);
+    if (indexEnabled) loadLibraryIndex();
+    return true;
+}
+
+// Creates the tables and indexes of the library, skipping any that already exist
+//
+// Artists and albums are stored once and referenced by integer id
+// The indexes match the browse queries so they run as index range scans in
+// Artist, Album, Track order instead of sorting the whole library:
+//   Artists (Name)                   -- unique, getArtists
+//   Albums  (ArtistID, Name)         -- unique, getAlbums
+//   Songs   (AlbumID, Track, Title)  -- getSongNames, covering
+//
+// Folders holds the library folders added through addFolder, these are watched for changes
+// Meta holds the library's id and change generation, see libraryVersion
+//
+// Loudness holds the EBU R128 loudness of every analysed song with the fingerprint its file had,
+// AlbumLoudness that of every album, see LoudnessWorker. Triggers remove them with their song or album
+bool MusicDatabase::createSchema(QSqlDatabase db)
+{
+    const QStringList statements = {
+        "CREATE TABLE IF NOT EXISTS Artists ("
+            "ArtistID INTEGER PRIMARY KEY, "
+            "Name TEXT COLLATE NOCASE NOT NULL UNIQUE)",
+        "CREATE TABLE IF NOT EXISTS Albums ("
+            "AlbumID INTEGER PRIMARY KEY, "
+            "ArtistID INTEGER NOT NULL REFERENCES Artists (ArtistID), "
+            "Name TEXT COLLATE NOCASE NOT NULL, "
+            "UNIQUE (ArtistID, Name))",
+        "CREATE TABLE IF NOT EXISTS Songs ("
+            "SongID INTEGER PRIMARY KEY, "
+            "File TEXT NOT NULL UNIQUE, "
+            "AlbumID INTEGER NOT NULL REFERENCES Albums (AlbumID), "
+            "ContributingArtist TEXT COLLATE NOCASE, "
+            "Track int, Title TEXT, Image TEXT, Duration int, "
+            "Size int, MTime int, Inode int)",
+        "CREATE INDEX IF NOT EXISTS SongsByAlbum ON Songs (AlbumID, Track, Title)",
+        "CREATE TABLE IF NOT EXISTS Folders ("
+            "FolderID INTEGER PRIMARY KEY, "
+            "Path TEXT NOT NULL UNIQUE)",
+        "CREATE TABLE IF NOT EXISTS Meta ("
+            "Key TEXT PRIMARY KEY, "
+            "Value int NOT NULL)",
+        // Generation counts changes to the songs, LibraryID tells databases apart, see libraryVersion
+        "INSERT OR IGNORE INTO Meta (Key, Value) VALUES ('Generation', 0)",
+        QString("INSERT OR IGNORE INTO Meta (Key, Value) VALUES ('LibraryID', %1)")
+            .arg(qint64(QRandomGenerator::global()->generate64() >> 1)),
+        "CREATE TABLE IF NOT EXISTS Loudness ("
+            "SongID INTEGER PRIMARY KEY, "
+            "Size int, MTime int, "
+            "Integrated REAL, TruePeak REAL, Histogram BLOB)",
+        "CREATE TABLE IF NOT EXISTS AlbumLoudness ("
+            "AlbumID INTEGER PRIMARY KEY, "
+            "Integrated REAL, TruePeak REAL)",
+        "CREATE TRIGGER IF NOT EXISTS LoudnessDelete AFTER DELETE ON Songs BEGIN "
+            "DELETE FROM Loudness WHERE SongID = old.SongID; "
+            "END",
+        "CREATE TRIGGER IF NOT EXISTS AlbumLoudnessDelete AFTER DELETE ON Albums BEGIN "
+            "DELETE FROM AlbumLoudness WHERE AlbumID = old.AlbumID; "
+            "END",
+    };
+
+    QSqlQuery query(db);
+    for (const QString &statement : statements)
+    {
+        if (!query.exec(statement))
+        {
+            qDebug() << query.lastError();
+            qDebug () << query.lastQuery();
+            return false;
+        }
+    }
+
+    // Search is optional, the library still works with a LIKE search if FTS5 is not available
+    searchAvailable = createSearchIndex(db);
+    if (!searchAvailable) qDebug() << "Full text search not available, using LIKE search";
+
+    return true;
+}
+
+// Creates the full text search index of the library if it does not exist yet
+//
+// SongSearch holds one row per song, its rowid is the SongID. Rows are written by
+// the scanner alongside the song (see ScanWorker::writeResult) and removed by a trigger when the song is deleted.
+// A prefix index on the first two characters serves search as you type queries.
+// Matches are ranked by bm25 with the title weighted above the artist and album names
+//
+// A new index is filled from the songs already in the library
+bool MusicDatabase::createSearchIndex(QSqlDatabase db)
+{
+    bool exists = db.tables().contains("SongSearch");
+
+    QSqlQuery query(db);
+    if (!exists)
+    {
+        if (!query.exec("CREATE VIRTUAL TABLE SongSearch USING fts5 ("
+                        "Title, Artist, Album, ContributingArtist, "
+                        "tokenize = 'unicode61 remove_diacritics 2', prefix = '2');"))
+        {
+            qDebug() << query.lastError();
+            return false;
+        }
+
+        if (!query.exec("INSERT INTO SongSearch (SongSearch, rank) VALUES ('rank', 'bm25(10.0, 5.0, 5.0, 2.0)');") ||
+            !rebuildSearchIndex(db))
+        {
+            qDebug() << query.lastError();
+            query.exec("DROP TABLE IF EXISTS SongSearch;");
+            return false;
+        }
+    }
+
+    if (!query.exec("CREATE TRIGGER IF NOT EXISTS SongSearchDelete AFTER DELETE ON Songs BEGIN "
+                    "DELETE FROM SongSearch WHERE rowid = old.SongID; "
+                    "END;"))
+    {
+        qDebug() << query.lastError();
+        return false;
+    }
+
+    return true;
+}
+
+// Refills the search index from the Songs table
+// Used when the index is created and after songs are copied in without going through the scanner
+bool MusicDatabase::rebuildSearchIndex(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    if (!query.exec("DELETE FROM SongSearch;") ||
+        !query.exec("INSERT INTO SongSearch (rowid, Title, Artist, Album, ContributingArtist) "
+                    "SELECT Songs.SongID, Songs.Title, Artists.Name, Albums.Name, Songs.ContributingArtist "
+                    "FROM Artists "
+                    "JOIN Albums ON Albums.ArtistID = Artists.ArtistID "
+                    "JOIN Songs ON Songs.AlbumID = Albums.AlbumID;"))
+    {
+        qDebug() << query.lastError();
+        qDebug () << query.lastQuery();
+        return false;
+    }
     return true;
 }
 
+// Moves the rows of the old single table schema into Artists, Albums and Songs
+// Runs in one transaction, the old table is left untouched if anything fails
+bool MusicDatabase::migrateDatabase(QSqlDatabase db)
+{
+    static const QStringList statements = {
+        "ALTER TABLE Songs RENAME TO SongsLegacy",
+        "UPDATE SongsLegacy SET Artist = 'Unknown Artist' WHERE Artist IS NULL",
+        "UPDATE SongsLegacy SET Album = 'Unknown Album' WHERE Album IS NULL",
+    };
+
+    static const QStringList copyStatements = {
+        "INSERT OR IGNORE INTO Artists (Name) SELECT DISTINCT Artist FROM SongsLegacy",
+        "INSERT OR IGNORE INTO Albums (ArtistID, Name) "
+            "SELECT DISTINCT Artists.ArtistID, SongsLegacy.Album FROM SongsLegacy "
+            "JOIN Artists ON Artists.Name = SongsLegacy.Artist",
+        "INSERT OR IGNORE INTO Songs (File, AlbumID, ContributingArtist, Track, Title, Image, Duration, Size, MTime, Inode) "
+            "SELECT SongsLegacy.File, Albums.AlbumID, SongsLegacy.ContributingArtist, SongsLegacy.Track, SongsLegacy.Title, "
+                   "SongsLegacy.Image, SongsLegacy.Duration, SongsLegacy.Size, SongsLegacy.MTime, SongsLegacy.Inode "
+            "FROM SongsLegacy "
+            "JOIN Artists ON Artists.Name = SongsLegacy.Artist "
+            "JOIN Albums ON Albums.ArtistID = Artists.ArtistID AND Albums.Name = SongsLegacy.Album "
+            "ORDER BY SongsLegacy.Artist, SongsLegacy.Album, SongsLegacy.Track",
+        "DROP TABLE SongsLegacy",
+    };
+
+    qDebug() << "Migrating database to normalized schema";
+
+    db.transaction();
+    QSqlQuery query(db);
+
+    for (const QString &statement : statements)
+    {
+        if (!query.exec(statement)) { qDebug() << query.lastError(); db.rollback(); return false; }
+    }
+
+    if (!createSchema(db)) { db.rollback(); return false; }
+
+    for (const QString &statement : copyStatements)
+    {
+        if (!query.exec(statement)) { qDebug() << query.lastError(); db.rollback(); return false; }
+    }
+
+    if (searchAvailable && !rebuildSearchIndex(db)) { db.rollback(); return false; }
+
+    return db.commit();
+}
+
 // Scans a folder into the database
-// Uses a QMediaPlayer for metadata
+// The folder is walked and its files read and written on the scan thread, see ScanWorker
+//
+// Files are compared against the fingerprint stored when they were last scanned
+// only new and changed files are read, rows for files that no longer exist are removed
+// Progress is reported by scanProgress while the scan runs, the number of files
+// in each category by scanSummary once it completes
+//
 // If the database is not valid, returns without doing anything
+// If a scan is already running the folder is queued and scanned after it
 // Will Scan MP3, Flac, and M4A files
 void MusicDatabase::scanFolder(QString directory)
 {
-    if (!valid) { return; }
-    QDirIterator ittr(directory, {"*mp3", "*.flac", "*.m4a"}, QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    if (!valid || directory.isEmpty()) { return; }
+
+    // Only one scan runs at a time, the folder is scanned when the current scan finishes
+    if (scanRunning)
+    {
+        if (!pendingFolders.contains(directory)) pendingFolders << directory;
+        return;
+    }
+
+    startScan();
+    QMetaObject::invokeMethod(worker, [scanWorker = worker, directory]() { scanWorker->scanFolder(directory); }, Qt::QueuedConnection);
+}
 
+// Scans the given files, used for files reported by the library watcher
+// Files that no longer exist or that have not changed since they were stored are skipped
+void MusicDatabase::scanFiles(const QStringList &files)
+{
+    if (!valid || files.isEmpty()) { return; }
 
-    while (ittr.hasNext()) {
-        scanList << (ittr.next());
+    if (scanRunning)
+    {
+        pendingFiles << files;
+        return;
     }
 
-    if (mp == nullptr)
+    startScan();
+    QMetaObject::invokeMethod(worker, [scanWorker = worker, files]() { scanWorker->scanFiles(files); }, Qt::QueuedConnection);
+}
+
+// Starts reporting progress for a scan handed to the worker
+void MusicDatabase::startScan()
+{
+    scanRunning = true;
+    progressDone = 0;
+    progressTime = 0;
+    progressRate = 0;
+    progressClock.start();
+    progressTimer.start();
+}
+
+// Returns true while a scan is running on the scan thread
+bool MusicDatabase::isScanning()
+{
+    return scanRunning;
+}
+
+// Stops the running scan and drops any scans queued after it
+// Rows written before the scan was cancelled are kept
+void MusicDatabase::cancelScan()
+{
+    pendingFolders.clear();
+    pendingFiles.clear();
+    if (scanRunning) worker->cancel();
+}
+
+// Pauses or resumes the running scan, the scan thread waits without using any CPU while paused
+void MusicDatabase::setScanPaused(bool paused)
+{
+    worker->setPaused(paused);
+    if (scanRunning) reportProgress();
+}
+
+bool MusicDatabase::scanPaused()
+{
+    return worker->isPaused();
+}
+
+// Returns the summary of the last scan that finished, with the time spent in each stage
+ScanSummary MusicDatabase::lastScanSummary()
+{
+    return lastScan;
+}
+
+// Emits scanProgress, called at a fixed rate while a scan runs
+// files/s is smoothed over the last few reports so the estimate does not jump around
+void MusicDatabase::reportProgress()
+{
+    ScanProgress progress = worker->progress();
+
+    qint64 now = progressClock.elapsed();
+    if (now > progressTime && !progress.paused)
     {
-        mp = new QMediaPlayer();
-        QObject::connect(mp, &QMediaPlayer::mediaStatusChanged, this, &MusicDatabase::scanMedia);
+        double rate = (progress.done - progressDone) * 1000.0 / (now - progressTime);
+        progressRate = progressRate == 0 ? rate : progressRate * 0.75 + rate * 0.25;
     }
+    progressDone = progress.done;
+    progressTime = now;
 
+    progress.filesPerSecond = progressRate;
+    if (!progress.searching && progressRate > 0)
+    {
+        progress.remainingMs = qint64((progress.total - progress.done) * 1000 / progressRate);
+    }
 
+    emit scanProgress(progress);
+}
 
-    if (scanList.isEmpty()) { return; }
-    emit scanStatus(scanList.first());
-    mp->setSource(QUrl::fromLocalFile(scanList.first()));
+// Starts the next scan that was queued while the scanner was busy
+void MusicDatabase::startPendingScan()
+{
+    if (!pendingFolders.isEmpty()) { scanFolder(pendingFolders.takeFirst()); }
+    else if (!pendingFiles.isEmpty())
+    {
+        QStringList files = pendingFiles;
+        pendingFiles.clear();
+        scanFiles(files);
+    }
 }
 
-// Gets the media Metadata from loaded file and inserts it into the database
-// will continue scanning until "scanList" QStack is empty.
-// File scans are initiated by setting the source for the QMediaPlayer pointed to by mp
-void MusicDatabase::scanMedia(QMediaPlayer::MediaStatus status)
+// Adds a folder to the library, scans it and watches it for changes
+bool MusicDatabase::addFolder(QString directory)
 {
-    if (status != QMediaPlayer::LoadedMedia) {
-        return;
+    if (!valid || directory.isEmpty()) { return false; }
+
+    QString path = QDir(directory).absolutePath();
+
+    QSqlQuery query;
+    query.prepare("INSERT OR IGNORE INTO Folders (Path) VALUES (:path);");
+    query.bindValue(":path", path);
+    if (!query.exec())
+    {
+        qDebug() << query.lastError();
+        qDebug () << query.lastQuery();
+        return false;
     }
-    qDebug() << mp->source();
 
-    QMediaMetaData metaData = mp->metaData();
-    qDebug() << metaData.stringValue(metaData.Title) << metaData.stringValue(metaData.AlbumTitle) << metaData.stringValue(metaData.AlbumArtist);
+    if (watching) watcher.addFolder(path);
+    scanFolder(path);
+    return true;
+}
 
-    // use of Regex to get titles and track numbers from files if they exist
-    static QRegularExpression titleFromFile("(?<title>.*(?=\\..*$))");
-    static QRegularExpression trackFromFile("(?<track>^[0-9]*)");
-    QRegularExpressionMatch match;
+// Returns the folders added to the library
+QStringList MusicDatabase::getFolders()
+{
+    QStringList ret;
+    if (!valid) { return ret; }
 
-    // Prepare INSERT into database
     QSqlQuery query;
-    query.prepare("INSERT OR REPLACE INTO "
-                  "Songs  ( Image,  Artist,  ContributingArtist,  Album,  Track,  Title,  File,  Duration) "
-                  "VALUES (:image, :artist, :contributingArtist, :album, :track, :title, :file, :duration);");
+    if (!query.exec("SELECT Path FROM Folders ORDER BY Path;"))
+    {
+        qDebug() << query.lastError();
+        qDebug () << query.lastQuery();
+        return ret;
+    }
+
+    while (query.next()) { ret << query.value(0).toString(); }
+    return ret;
+}
+
+// Enables watching the library folders for changes
+// Changed files are scanned, deleted files removed and moved files updated as they happen
+void MusicDatabase::setWatchEnabled(bool enabled)
+{
+    watching = enabled;
+
+    watcher.clear();
+    if (enabled && valid) { for (const QString &folder : getFolders()) watcher.addFolder(folder); }
+}
 
-    // Album and artist cannot be determined from filename at the current moment in time
-    // Will likely support artist/album/## song.ext folder structure
-    // Uses album artist tag to prevent large lists of extranious artists from being displayed
-    // To Do: User Choice to use album artist tag or artist tag
-    QString artist = metaData.stringValue(metaData.AlbumArtist);
-    if (artist.isEmpty()) artist = "Unknown Artist";
-    query.bindValue(":artist", artist);
+bool MusicDatabase::watchEnabled()
+{
+    return watching && watcher.isAvailable();
+}
+
+// Applies the changes reported by the library watcher
+// Moves and removals are written immediately, changed files go through the scanner
+void MusicDatabase::applyChanges(const LibraryChanges &changes)
+{
+    if (!valid) { return; }
 
-    QString contribArtist = metaData.value(metaData.ContributingArtist).toStringList().join(",");
-    if (artist.isEmpty()) artist = "Unknown Artist";
-    query.bindValue(":contributingArtist", contribArtist);
+    bool modified = !changes.moved.isEmpty() || !changes.removed.isEmpty() || !changes.removedFolders.isEmpty();
 
-    QString album = metaData.stringValue(metaData.AlbumTitle);
-    if (album.isEmpty()) album = "Unknown Album";
-    query.bindValue(":album", album);
+    moveFiles(changes.moved);
+    removeFiles(changes.removed);
+    for (const QString &folder : changes.removedFolders) removeDirectory(folder);
 
-    // Limitations of the FFMpeg backend prevent mp3s from reporting their tracknumber in a way that QMediaMetadata can easily read
-    // in the case where track == 0, indicating error
-    // the track number is read from the file name usig whatever numbers are out front of the track title.
-    // as a result, if the track number is not read, and the file name cannot be read correctly, the track is set to zero.
-    int track = metaData.value(metaData.TrackNumber).toInt();
-    if (track == 0) {
-        match = trackFromFile.match(mp->source().fileName());
-        if ( match.hasCaptured("track")) {track = match.captured("track").toInt(); }
+    if (modified)
+    {
+        scheduleSnapshot();
+        emit libraryChanged();
     }
 
-    query.bindValue(":track", track);
+    for (const QString &folder : changes.rescanFolders) scanFolder(folder);
+    scanFiles(changes.changed);
+}
+
+// Enables the in-memory library index
+// While enabled the browse methods are answered from memory instead of the database
+// The index is loaded immediately if a database is connected, and kept up to date by scans
+void MusicDatabase::setLibraryIndexEnabled(bool enabled)
+{
+    indexEnabled = enabled;
+
+    if (enabled && valid) loadLibraryIndex();
+    else libraryIndex.clear();
+}
 
-    // Ensures that the title of the track is always read
-    // If the title is reported by QMediaMetadata, it is used
-    // otherwise the filename without extention is used
-    // if the REGEX match fails to report a filename, the filename with extention is used
-    QString title = metaData.stringValue(metaData.Title);
-    if(title.isEmpty()) {
-        match = titleFromFile.match(mp->source().fileName());
-        if (match.hasCaptured("title")) { title = match.captured("title"); }
-        else {title = mp->source().fileName(); }
+// Returns the path of the library snapshot kept next to a database
+static QString snapshotPath(const QString &databaseFilePath)
+{
+    return databaseFilePath + ".snapshot";
+}
+
+// Serves the browsers from the snapshot written for the database at databaseFilePath
+// Called before the database is opened so the views can be filled right away,
+// connectToDatabase keeps the snapshot if it is current and replaces it otherwise.
+// Does nothing if the library index is disabled or a database is already open
+bool MusicDatabase::openSnapshot(QString databaseFilePath)
+{
+    if (!indexEnabled || valid) { return false; }
+    return libraryIndex.loadSnapshot(snapshotPath(databaseFilePath));
+}
+
+// Reads the LibraryID and Generation of the open database from the Meta table
+// Every change to the songs increments the generation in the same transaction,
+// see ScanWorker::bumpGeneration, so a snapshot written at the same id and generation is current
+bool MusicDatabase::libraryVersion(quint64 *libraryId, quint64 *generation)
+{
+    QSqlQuery query;
+    if (!query.exec("SELECT Key, Value FROM Meta WHERE Key IN ('LibraryID', 'Generation');"))
+    {
+        qDebug() << query.lastError();
+        qDebug () << query.lastQuery();
+        return false;
     }
 
-    query.bindValue(":title", title);
+    int found = 0;
+    while (query.next())
+    {
+        if (query.value(0).toString() == "LibraryID") *libraryId = query.value(1).toULongLong();
+        else *generation = query.value(1).toULongLong();
+        found++;
+    }
+    return found == 2;
+}
+
+// Loads the library index for the open database
+// A snapshot opened by openSnapshot is kept if it is current, otherwise the index is
+// read from the database and a new snapshot written for the next start
+void MusicDatabase::loadLibraryIndex()
+{
+    quint64 libraryId = 0;
+    quint64 generation = 0;
+    bool versioned = libraryVersion(&libraryId, &generation);
+
+    if (versioned && libraryIndex.isSnapshot() &&
+        libraryIndex.snapshotLibraryId() == libraryId && libraryIndex.snapshotGeneration() == generation)
+    {
+        savedLibraryId = libraryId;
+        savedGeneration = generation;
+        return;
+    }
 
-    query.bindValue(":file", mp->source().toString());
+    if (libraryIndex.isSnapshot()) qDebug() << "Library snapshot is stale, loading the library index";
+    libraryIndex.load(QSqlDatabase::database());
+    saveSnapshot();
+}
 
-    // Saves the album art into a hidden folder as a hash of its data, artist, and album.
-    // the image path is then stored in the image column. this is to reduce storage cost of these files
-    QString hash = "";
-    QString filename = "";
+// Writes the library index to the snapshot file unless the file already matches the database
+void MusicDatabase::saveSnapshot()
+{
+    snapshotTimer.stop();
+    if (!valid || !indexEnabled || !libraryIndex.isLoaded() || libraryIndex.isSnapshot()) { return; }
 
-    if (metaData.value(metaData.ThumbnailImage).isValid())
+    quint64 libraryId = 0;
+    quint64 generation = 0;
+    if (!libraryVersion(&libraryId, &generation)) { return; }
+    if (libraryId == savedLibraryId && generation == savedGeneration) { return; }
+
+    if (libraryIndex.writeSnapshot(snapshotPath(databasePath), libraryId, generation))
     {
-        QImage art = metaData.value(metaData.ThumbnailImage).value<QImage>();
-        QByteArray arr(art.bits());
-        arr.append(QString("%1%2").arg(artist, album).toUtf8());
-        hash = QCryptographicHash::hash(arr, QCryptographicHash::Sha256).toHex();
+        savedLibraryId = libraryId;
+        savedGeneration = generation;
+    }
+}
 
-        QDir().mkpath(QDir::currentPath() + "/.images");
-        filename = QDir::currentPath() + QString("/.images/%1.png").arg(hash);;
-        if(!QFile::exists(filename))
-        { art.save(filename); }
+// Writes the snapshot once the library has been left alone for a while
+// so a stream of watcher changes does not rewrite it each time
+void MusicDatabase::scheduleSnapshot()
+{
+    if (indexEnabled) snapshotTimer.start();
+}
+
+bool MusicDatabase::libraryIndexEnabled()
+{
+    return indexEnabled;
+}
+
+// Sets the number of rows the scanner commits per transaction
+// Larger batches mean fewer fsyncs but a longer wait before rows become visible
+void MusicDatabase::setScanBatchSize(int size)
+{
+    worker->setBatchSize(size);
+}
+
+int MusicDatabase::scanBatchSize()
+{
+    return worker->batchSize();
+}
+
+// Opens the connections of the scan and analysis threads to the database
+// Called once the schema is in place so the worker sees the search index
+void MusicDatabase::openScanConnection(const QString &databaseFilePath)
+{
+    QMetaObject::invokeMethod(worker, [scanWorker = worker, databaseFilePath]() { scanWorker->open(databaseFilePath); },
+                              Qt::QueuedConnection);
+    QMetaObject::invokeMethod(analyzer, [loudnessWorker = analyzer, databaseFilePath]() { loudnessWorker->open(databaseFilePath); },
+                              Qt::QueuedConnection);
+}
+
+// Measures the loudness of the songs added or changed since the last analysis on the analysis thread
+// Runs after every scan that wrote songs and when a database is opened, so an analysis
+// that was stopped carries on. loudnessAnalyzed reports the songs measured once it finishes
+void MusicDatabase::analyzeLoudness()
+{
+    if (!valid) { return; }
+    QMetaObject::invokeMethod(analyzer, [loudnessWorker = analyzer]() { loudnessWorker->analyze(); }, Qt::QueuedConnection);
+}
+
+// Stops the running analysis, songs measured so far are kept
+void MusicDatabase::cancelLoudnessAnalysis()
+{
+    analyzer->cancel();
+}
+
+// Returns the loudness of a song and its album
+// Values measured before the file last changed are not returned, see LoudnessWorker
+TrackLoudness MusicDatabase::getLoudness(qint64 songId)
+{
+    TrackLoudness ret;
+    if (!valid || songId < 0) { return ret; }
+
+    QSqlQuery query;
+    query.prepare("SELECT Loudness.Integrated, Loudness.TruePeak, AlbumLoudness.Integrated, AlbumLoudness.TruePeak "
+                  "FROM Songs "
+                  "JOIN Loudness ON Loudness.SongID = Songs.SongID "
+                  "LEFT JOIN AlbumLoudness ON AlbumLoudness.AlbumID = Songs.AlbumID "
+                  "WHERE Songs.SongID = :songID AND Loudness.Size IS Songs.Size AND Loudness.MTime IS Songs.MTime;");
+    query.bindValue(":songID", songId);
+    if (!query.exec())
+    {
+        qDebug() << query.lastError();
+        qDebug () << query.lastQuery();
+        return ret;
     }
+    if (!query.next()) { return ret; }
 
-    query.bindValue(":image", filename);
+    auto real = [&query](int column) { return query.value(column).isNull() ? NAN : query.value(column).toDouble(); };
+    ret.integrated = real(0);
+    ret.truePeak = real(1);
+    ret.albumIntegrated = real(2);
+    ret.albumTruePeak = real(3);
+    return ret;
+}
 
-    query.bindValue(":duration", metaData.value(metaData.Duration).toInt());
+// WAL lets readers keep working while the scanner holds a write transaction
+// with WAL, synchronous=NORMAL only syncs at checkpoints and cannot corrupt the database
+void MusicDatabase::configureConnection(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    if (!query.exec("PRAGMA journal_mode=WAL;")) { qDebug() << query.lastError(); }
+    if (!query.exec("PRAGMA synchronous=NORMAL;")) { qDebug() << query.lastError(); }
+}
+
+// Removes the rows of the given local files from the database
+bool MusicDatabase::removeFiles(const QStringList &files)
+{
+    if (!valid) { return false; }
+    if (files.isEmpty()) { return true; }
 
-    qDebug() << query.boundValues();
-    qDebug() << query.boundValueNames();
+    QSqlDatabase db = QSqlDatabase::database();
+    db.transaction();
 
+    // The library index needs the ids of the deleted rows
+    QList<qint64> removedIds;
+    if (!ScanWorker::deleteFiles(db, files, libraryIndex.isLoaded() ? &removedIds : nullptr))
+    {
+        db.rollback();
+        return false;
+    }
+
+    ScanWorker::removeOrphans(db);
+    ScanWorker::bumpGeneration(db);
+
+    if (!db.commit()) { return false; }
+
+    if (libraryIndex.isLoaded()) libraryIndex.update(db, QStringList(), removedIds);
+    return true;
+}
+
+// Removes the rows of every file under a directory
+bool MusicDatabase::removeDirectory(const QString &directory)
+{
+    if (!valid || directory.isEmpty()) { return false; }
+
+    QString prefix;
+    QString prefixEnd;
+    ScanWorker::folderRange(directory, &prefix, &prefixEnd);
+
+    QSqlDatabase db = QSqlDatabase::database();
+    db.transaction();
+
+    QSqlQuery query;
+    QList<qint64> removedIds;
+    if (libraryIndex.isLoaded())
+    {
+        query.prepare("SELECT SongID FROM Songs WHERE File >= :prefix AND File < :prefixEnd;");
+        query.bindValue(":prefix", prefix);
+        query.bindValue(":prefixEnd", prefixEnd);
+        if (query.exec()) { while (query.next()) removedIds << query.value(0).toLongLong(); }
+    }
+
+    query.prepare("DELETE FROM Songs WHERE File >= :prefix AND File < :prefixEnd;");
+    query.bindValue(":prefix", prefix);
+    query.bindValue(":prefixEnd", prefixEnd);
     if (!query.exec())
     {
         qDebug() << query.lastError();
         qDebug () << query.lastQuery();
-        return;
+        db.rollback();
+        return false;
+    }
+
+    ScanWorker::removeOrphans(db);
+    ScanWorker::bumpGeneration(db);
+
+    if (!db.commit()) { return false; }
+
+    if (libraryIndex.isLoaded()) libraryIndex.update(db, QStringList(), removedIds);
+    return true;
+}
+
+// Points the rows of moved files at their new path, the songs keep their SongID and tags
+// A directory move updates every file under it, a file moved over another replaces its row
+bool MusicDatabase::moveFiles(const QList<LibraryMove> &moves)
+{
+    if (!valid) { return false; }
+    if (moves.isEmpty()) { return true; }
+
+    QSqlDatabase db = QSqlDatabase::database();
+    db.transaction();
+
+    QSqlQuery idQuery;
+    idQuery.prepare("SELECT SongID FROM Songs WHERE File = :file;");
+    QSqlQuery removeQuery;
+    removeQuery.prepare("DELETE FROM Songs WHERE File = :file;");
+    QSqlQuery fileQuery;
+    fileQuery.prepare("UPDATE Songs SET File = :to WHERE File = :from;");
+    QSqlQuery directoryQuery;
+    directoryQuery.prepare("UPDATE Songs SET File = :to || substr(File, length(:prefix) + 1) "
+                           "WHERE File >= :prefix AND File < :prefixEnd;");
+
+    QList<qint64> removedIds;
+    bool replaced = false;
+
+    for (const LibraryMove &move : moves)
+    {
+        QSqlQuery *query = &fileQuery;
+
+        if (move.directory)
+        {
+            QString prefix;
+            QString prefixEnd;
+            QString to;
+            ScanWorker::folderRange(move.from, &prefix, &prefixEnd);
+            ScanWorker::folderRange(move.to, &to, nullptr);
+
+            directoryQuery.bindValue(":to", to);
+            directoryQuery.bindValue(":prefix", prefix);
+            directoryQuery.bindValue(":prefixEnd", prefixEnd);
+            query = &directoryQuery;
+        }
+        else
+        {
+            QString to = QUrl::fromLocalFile(move.to).toString();
+
+            if (libraryIndex.isLoaded())
+            {
+                idQuery.bindValue(":file", to);
+                if (idQuery.exec() && idQuery.next()) removedIds << idQuery.value(0).toLongLong();
+                idQuery.finish();
+            }
+
+            removeQuery.bindValue(":file", to);
+            if (!removeQuery.exec())
+            {
+                qDebug() << removeQuery.lastError();
+                qDebug () << removeQuery.lastQuery();
+                db.rollback();
+                return false;
+            }
+            if (removeQuery.numRowsAffected() > 0) replaced = true;
+
+            fileQuery.bindValue(":to", to);
+            fileQuery.bindValue(":from", QUrl::fromLocalFile(move.from).toString());
+        }
+
+        if (!query->exec())
+        {
+            qDebug() << query->lastError();
+            qDebug () << query->lastQuery();
+            db.rollback();
+            return false;
+        }
     }
 
-    scanList.removeFirst();
-    //scanList.clear();
+    // A replaced row may have been the last song of its album, whether or not the index is loaded
+    if (replaced)
+    {
+        ScanWorker::removeOrphans(db);
+        ScanWorker::bumpGeneration(db);
+    }
 
-    //QList<QMediaMetaData::Key> keys = metaData.keys();
-    //foreach (QMediaMetaData::Key key, keys)
-    //{
-    //    qDebug() << key;
-    //}
+    if (!db.commit()) { return false; }
 
-    if (scanList.isEmpty()) { emit scanComplete(); return; }
-    else { emit scanStatus(scanList.first()); };
-    mp->setSource(QUrl::fromLocalFile(scanList.first()));
+    if (!removedIds.isEmpty()) libraryIndex.update(db, QStringList(), removedIds);
+    return true;
+}
+
+// Called when the scan thread has finished a scan
+// The rows are already committed, only the library index and the views are left to update
+void MusicDatabase::scanFinished(const ScanSummary &summary)
+{
+    progressTimer.stop();
+    scanRunning = false;
+    lastScan = summary;
+
+    // Large scans are cheaper to reload than to apply row by row
+    if (libraryIndex.isLoaded())
+    {
+        if (summary.writtenFiles.count() > libraryIndex.songCount() / 4) libraryIndex.load(QSqlDatabase::database());
+        else libraryIndex.update(QSqlDatabase::database(), summary.writtenFiles, summary.removedIds);
+        scheduleSnapshot();
+    }
+
+    qDebug() << (summary.cancelled ? "Scan cancelled:" : "Scan complete:")
+             << summary.added << "new," << summary.changed << "changed,"
+             << summary.unchanged << "unchanged," << summary.removed << "removed,"
+             << summary.failed << "could not be read";
+    if (summary.written > 0)
+    {
+        qDebug() << "Scan wrote" << summary.written << "rows in" << summary.writeNs / 1000000 << "ms ("
+                 << qint64(summary.written * 1e9 / qMax<qint64>(summary.writeNs, 1)) << "rows/s)";
+    }
+    if (summary.artWritten > 0)
+    {
+        qDebug() << "Scan stored" << summary.artWritten << "album art files," << summary.artBytes / 1024 << "KiB";
+    }
+    qDebug() << "Scan took" << summary.totalNs / 1000000 << "ms: walk" << summary.walkNs / 1000000
+             << "ms, remove" << summary.removeNs / 1000000 << "ms, read" << summary.readNs / 1000000
+             << "ms, art" << summary.artNs / 1000000 << "ms, write" << summary.writeNs / 1000000 << "ms";
+
+    emit scanComplete();
+
+    // Only the songs written by the scan have no loudness yet
+    if (summary.written > 0) analyzeLoudness();
+
+    // Scans queued by cancelScan's caller after cancelling still run
+    if (summary.cancelled) emit scanCancelled();
+    else emit scanSummary(summary.added, summary.changed, summary.unchanged, summary.removed, summary.failed);
+
+    startPendingScan();
+}
+
+// Joins songs to their album and artist, every song query selects these columns
+// The artist of the album is the album artist, the track artist is ContributingArtist
+static const QString songSelect =
+    "SELECT Songs.SongID, Artists.Name AS AlbumArtist, Albums.Name AS Album, Songs.Title, "
+    "Songs.File, Songs.Image, Songs.Track, Songs.Duration, Songs.ContributingArtist "
+    "FROM Artists "
+    "JOIN Albums ON Albums.ArtistID = Artists.ArtistID "
+    "JOIN Songs ON Songs.AlbumID = Albums.AlbumID ";
+
+// Matches the SongsByAlbum index, see createSchema
+static const QString songOrder = "ORDER BY Artists.Name, Albums.Name, Songs.Track";
+
+// Builds the WHERE clause for an artist and album filter, empty names are not filtered on
+// Artist and album names are compared case insensitively through their NOCASE collation
+QString MusicDatabase::filterClause(const QString &artist, const QString &album)
+{
+    QStringList conditions;
+    if (!artist.isEmpty()) conditions << "Artists.Name = :artist";
+    if (!album.isEmpty())  conditions << "Albums.Name = :album";
+
+    return conditions.isEmpty() ? QString() : "WHERE " + conditions.join(" AND ") + " ";
+}
+
+// Binds the values used by filterClause, must be called with the same arguments
+void MusicDatabase::bindFilters(QSqlQuery &query, const QString &artist, const QString &album)
+{
+    if (!artist.isEmpty()) query.bindValue(":artist", artist);
+    if (!album.isEmpty())  query.bindValue(":album", album);
+}
+
+// Returns the Song in the current row of a query built from songSelect
+// Songs without an artist tag are credited to the album artist
+static Song songFromQuery(const QSqlQuery &query)
+{
+    int track = query.value(6).toInt();
+    QString albumArtist = query.value(1).toString();
+    QString artist = query.value(8).toString();
+    return Song {
+        artist.isEmpty() ? albumArtist : artist,
+        albumArtist,
+        query.value(2).toString(),
+        query.value(3).toString(),
+        query.value(4).toString(),
+        query.value(5).toString(),
+        track < 0 ? 0 : track,
+        query.value(7).toInt(),
+        query.value(0).toLongLong()
+    };
 }
 
 // Returns a list of the artists in the database
 // as filtering is top down Artist->album->song no filtering takes place
 QStringList MusicDatabase::getArtists() {
 
+    if (libraryIndex.isLoaded()) { return libraryIndex.artists(); }
     if (!valid) { return QStringList(); }
 
-    QSqlQuery query;
-    query.prepare("SELECT DISTINCT Artist FROM 'Songs' "
-                  "ORDER BY Artist;");
+    return queryArtists(QSqlDatabase::database());
+}
+
+// Returns the artists in the database of connection db, see getArtists
+QStringList MusicDatabase::queryArtists(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    query.prepare("SELECT Name FROM Artists "
+                  "ORDER BY Name;");
 
     if (!query.exec())
     {
@@ -285,11 +1047,9 @@ QStringList MusicDatabase::getArtists() {
 
     QStringList ret;
 
-    int artistIndex = query.record().indexOf("Artist");
-
     while (query.next())
     {
-        ret << query.value(artistIndex).toString();
+        ret << query.value(0).toString();
     }
 
     return ret;
@@ -299,13 +1059,21 @@ QStringList MusicDatabase::getArtists() {
 // will filter by "filterArtist" QString if it is not empty
 // If not filtered, the string will report artist information
 QStringList MusicDatabase::getAlbums() {
+    if (libraryIndex.isLoaded()) { return libraryIndex.albums(filterArtist); }
     if (!valid) { return QStringList(); }
 
-    QSqlQuery query;
-    query.prepare("SELECT DISTINCT Artist, Album FROM 'Songs' "
-                  "WHERE Artist LIKE :artist "
-                  "ORDER BY Artist, Album;");
-    query.bindValue(":artist", filterArtist.isEmpty() ? "%" : filterArtist);
+    return queryAlbums(QSqlDatabase::database(), filterArtist);
+}
+
+// Returns the albums of artist, or of every artist if it is empty, see getAlbums
+QStringList MusicDatabase::queryAlbums(QSqlDatabase db, const QString &artist)
+{
+    QSqlQuery query(db);
+    query.prepare("SELECT Artists.Name, Albums.Name FROM Artists "
+                  "JOIN Albums ON Albums.ArtistID = Artists.ArtistID " +
+                  filterClause(artist, QString()) +
+                  "ORDER BY Artists.Name, Albums.Name;");
+    bindFilters(query, artist, QString());
 
     if (!query.exec())
     {
@@ -315,15 +1083,12 @@ QStringList MusicDatabase::getAlbums() {
     }
     QStringList ret;
 
-    int artistIndex = query.record().indexOf("Artist");
-    int albumIndex = query.record().indexOf("Album");
-
     while (query.next())
     {
-        ret << (filterArtist.isEmpty() ? QString("%1 - %2")
-                                             .arg(query.value(artistIndex).toString(),
-                                                  query.value(albumIndex).toString())
-                                       : query.value(albumIndex).toString());
+        ret << (artist.isEmpty() ? QString("%1 - %2")
+                                       .arg(query.value(0).toString(),
+                                            query.value(1).toString())
+                                 : query.value(1).toString());
     }
 
     return ret;
@@ -331,15 +1096,35 @@ QStringList MusicDatabase::getAlbums() {
 
 // Gets songs filtered via the filterArtist and filterAlbum strings
 // if not filtered, will report artist and album information along side the title
-QStringList MusicDatabase::getSongNames() {
-    if (!valid) { return QStringList(); }
+//
+// If ids is given it is filled with the SongID of each returned row
+// these can be passed to getSongsByIds to retrieve the songs
+QStringList MusicDatabase::getSongNames(QList<qint64> *ids) {
+    return getSongNames(filterArtist, filterAlbum, 0, -1, ids);
+}
 
-    QSqlQuery query;
-    query.prepare("SELECT * FROM 'Songs' "
-                  "WHERE Album LIKE :album AND Artist LIKE :artist "
-                  "ORDER BY Artist, Album, Track");
-    query.bindValue(":artist", filterArtist.isEmpty() ? "%" : filterArtist);
-    query.bindValue(":album" , filterAlbum.isEmpty() ? "%" : filterAlbum );
+// Returns limit song names starting at row offset of the songs matching artist and album,
+// a limit of -1 returns every row after offset. Names are formatted like getSongNames.
+// Used to load the song list one page at a time, see SongListModel
+QStringList MusicDatabase::getSongNames(const QString &artist, const QString &album, int offset, int limit, QList<qint64> *ids) {
+    if (ids) ids->clear();
+    if (libraryIndex.isLoaded()) { return libraryIndex.songNames(artist, album, ids, offset, limit); }
+    if (!valid || offset < 0) { return QStringList(); }
+
+    return querySongNames(QSqlDatabase::database(), artist, album, offset, limit, ids);
+}
+
+// Returns the song names matching artist and album in the database of connection db, see getSongNames
+QStringList MusicDatabase::querySongNames(QSqlDatabase db, const QString &artist, const QString &album, int offset, int limit, QList<qint64> *ids)
+{
+    QSqlQuery query(db);
+    query.prepare("SELECT Artists.Name, Albums.Name, Songs.Title, Songs.SongID FROM Artists "
+                  "JOIN Albums ON Albums.ArtistID = Artists.ArtistID "
+                  "JOIN Songs ON Songs.AlbumID = Albums.AlbumID " +
+                  filterClause(artist, album) + songOrder + " LIMIT :limit OFFSET :offset;");
+    bindFilters(query, artist, album);
+    query.bindValue(":limit", limit);
+    query.bindValue(":offset", offset);
 
     if (!query.exec())
     {
@@ -350,19 +1135,16 @@ QStringList MusicDatabase::getSongNames() {
 
     QStringList ret;
 
-    int artistIndex = query.record().indexOf("Artist");
-    int albumIndex = query.record().indexOf("Album");
-    int songIndex = query.record().indexOf("Title");
-
     QString song;
 
     while (query.next())
     {
         song = "";
-        if (filterArtist.isEmpty()) song.append(QString("%1 - ").arg(query.value(artistIndex).toString()));
-        if (filterAlbum.isEmpty()) song.append(QString("%1 - ").arg(query.value(albumIndex).toString()));
-        song.append(query.value(songIndex).toString());
+        if (artist.isEmpty()) song.append(QString("%1 - ").arg(query.value(0).toString()));
+        if (album.isEmpty()) song.append(QString("%1 - ").arg(query.value(1).toString()));
+        song.append(query.value(2).toString());
         ret << song;
+        if (ids) ids->append(query.value(3).toLongLong());
     }
 
     return ret;
@@ -376,13 +1158,31 @@ QStringList MusicDatabase::getSongNames() {
 // set by setFilterArtist(). If false, the list will be unfiltered
 bool MusicDatabase::setFiltersByAlbumID(int idx, bool filterByArtist)
 {
+    if (libraryIndex.isLoaded())
+    {
+        QString artist;
+        QString album;
+        if (!libraryIndex.albumAt(idx, filterByArtist ? filterArtist : QString(), &artist, &album))
+        {
+            qDebug() << "Album Index out of Range";
+            return false;
+        }
+
+        filterAlbum = album;
+        filterArtist = artist;
+        return true;
+    }
+
     if (!valid) { return false; }
 
     QSqlQuery query;
-    query.prepare("SELECT DISTINCT Artist, Album FROM 'Songs' "
-                  "WHERE Artist LIKE :artist "
-                  "ORDER BY Artist, Album;");
-    query.bindValue(":artist", filterArtist.isEmpty() || !filterByArtist ? "%" : filterArtist);
+    query.prepare("SELECT Artists.Name, Albums.Name FROM Artists "
+                  "JOIN Albums ON Albums.ArtistID = Artists.ArtistID " +
+                  filterClause(filterByArtist ? filterArtist : QString(), QString()) +
+                  "ORDER BY Artists.Name, Albums.Name "
+                  "LIMIT 1 OFFSET :idx;");
+    bindFilters(query, filterByArtist ? filterArtist : QString(), QString());
+    query.bindValue(":idx", idx);
 
     if (!query.exec())
     {
@@ -391,44 +1191,121 @@ bool MusicDatabase::setFiltersByAlbumID(int idx, bool filterByArtist)
         return false;
     }
 
-    if (!query.seek(idx))
+    if (idx < 0 || !query.next())
     {
         qDebug() << "Album Index out of Range";
         return false;
     }
 
-    int artistIndex = query.record().indexOf("Artist");
-    int albumIndex = query.record().indexOf("Album");
-
-    filterAlbum = query.value(albumIndex).toString();
-    filterArtist = query.value(artistIndex).toString();
+    filterAlbum = query.value(1).toString();
+    filterArtist = query.value(0).toString();
 
     return true;
 }
 
+// Returns the words of a search, split the same way the search index splits text
+// Single character words are dropped, as a prefix they match most of the library
+static QStringList searchWords(const QString &text)
+{
+    static const QRegularExpression separators("[^\\w]+", QRegularExpression::UseUnicodePropertiesOption);
+    QStringList words = text.split(separators, Qt::SkipEmptyParts);
+
+    words.removeIf([](const QString &word) { return word.size() < 2; });
+    return words;
+}
+
+// Searches titles, artists and albums for songs matching every word of text
+// Each word matches as a prefix so results update while the user types
+// Returns limit names starting at row offset formatted as "Artist - Album - Title", best match first.
+// a limit of -1 returns every match. If ids is given it is filled with the SongID of each row
+//
+// Single character words match too much of the library to rank quickly and are ignored, see searchWords
+// Uses the SongSearch full text index, or LIKE matching in library order when it is not available
+QStringList MusicDatabase::searchSongs(const QString &text, int offset, int limit, QList<qint64> *ids)
+{
+    if (ids) ids->clear();
+    if (!valid || offset < 0) { return QStringList(); }
+
+    QStringList words = searchWords(text);
+    if (words.isEmpty()) { return QStringList(); }
+
+    QSqlQuery query;
+    if (searchAvailable)
+    {
+        // "word"* is a prefix query, words are joined with an implicit AND
+        QStringList terms;
+        for (const QString &word : words) terms << QString("\"%1\"*").arg(word);
+
+        // Ranking runs inside the full text index, only the page is joined to the library
+        query.prepare("SELECT Artists.Name, Albums.Name, Songs.Title, Songs.SongID FROM "
+                      "(SELECT rowid, rank FROM SongSearch WHERE SongSearch MATCH :match "
+                      "ORDER BY rank LIMIT :limit OFFSET :offset) AS Hits "
+                      "JOIN Songs ON Songs.SongID = Hits.rowid "
+                      "JOIN Albums ON Albums.AlbumID = Songs.AlbumID "
+                      "JOIN Artists ON Artists.ArtistID = Albums.ArtistID "
+                      "ORDER BY Hits.rank;");
+        query.bindValue(":match", terms.join(" "));
+    }
+    else
+    {
+        QStringList conditions;
+        for (int i = 0; i < words.count(); i++)
+        {
+            conditions << QString("(Songs.Title LIKE :word%1 ESCAPE '\\' OR Artists.Name LIKE :word%1 ESCAPE '\\' OR "
+                                  "Albums.Name LIKE :word%1 ESCAPE '\\' OR Songs.ContributingArtist LIKE :word%1 ESCAPE '\\')").arg(i);
+        }
+
+        query.prepare("SELECT Artists.Name, Albums.Name, Songs.Title, Songs.SongID FROM Artists "
+                      "JOIN Albums ON Albums.ArtistID = Artists.ArtistID "
+                      "JOIN Songs ON Songs.AlbumID = Albums.AlbumID "
+                      "WHERE " + conditions.join(" AND ") + " " + songOrder + " LIMIT :limit OFFSET :offset;");
+        for (int i = 0; i < words.count(); i++)
+        {
+            query.bindValue(QString(":word%1").arg(i), "%" + QString(words[i]).replace("_", "\\_") + "%");
+        }
+    }
+    query.bindValue(":limit", limit);
+    query.bindValue(":offset", offset);
+
+    if (!query.exec())
+    {
+        qDebug() << query.lastError();
+        qDebug () << query.lastQuery();
+        return QStringList();
+    }
+
+    QStringList ret;
+    while (query.next())
+    {
+        ret << QString("%1 - %2 - %3").arg(query.value(0).toString(), query.value(1).toString(), query.value(2).toString());
+        if (ids) ids->append(query.value(3).toLongLong());
+    }
+
+    return ret;
+}
+
 // Sets the filters to match the selected album
 // Used when there is no artist filter for albums to use
 // calls getSongs when filters are set
 //
 // Internally uses setFiltersByAlbumID, see comments for details on filterByArtist feild
-QStringList MusicDatabase::getSongNamesByAlbumID(int idx, bool filterByArtist) {
+QStringList MusicDatabase::getSongNamesByAlbumID(int idx, bool filterByArtist, QList<qint64> *ids) {
 
-    if (setFiltersByAlbumID(idx, filterByArtist)) return getSongNames();
-    else return QStringList();
+    if (setFiltersByAlbumID(idx, filterByArtist)) return getSongNames(ids);
+    if (ids) ids->clear();
+    return QStringList();
 }
 
 // Returns information about a song at index Idx with current filters
 // this is used to pass information to the MusicPlayer class
 Song MusicDatabase::getSong(int idx)
 {
-    if (!valid) { return Song {"", "", "", "", "", "", -1}; }
+    if (!valid || idx < 0) { return Song {"", "", "", "", "", "", -1}; }
 
     QSqlQuery query;
-    query.prepare("SELECT * FROM 'Songs'"
-                  "WHERE Album LIKE :album AND Artist LIKE :artist "
-                  "ORDER BY Artist, Album, Track");
-    query.bindValue(":artist", filterArtist.isEmpty() ? "%" : filterArtist);
-    query.bindValue(":album" , filterAlbum.isEmpty() ? "%" : filterAlbum );
+    query.prepare(songSelect + filterClause(filterArtist, filterAlbum) + songOrder + " LIMIT 1 OFFSET :idx;");
+    bindFilters(query, filterArtist, filterAlbum);
+    query.bindValue(":idx", idx);
 
     if (!query.exec())
     {
@@ -437,28 +1314,9 @@ Song MusicDatabase::getSong(int idx)
         return Song {"", "", "", "", "", "", -1};
     }
 
-    int artistIndex = query.record().indexOf("Artist");
-    int albumArtistIndex = query.record().indexOf("AlbumArtist");
-    int albumIndex = query.record().indexOf("Album");
-    int titleIndex = query.record().indexOf("Title");
-    int fileIndex = query.record().indexOf("File");
-    int trackIndex = query.record().indexOf("Track");
-    int imageIndex = query.record().indexOf("Image");
-    int durationIndex = query.record().indexOf("Duration");
-
-    if (query.seek(idx))
-    {
-        int track = query.value(trackIndex).toInt();
-        return Song {
-            query.value(artistIndex).toString(),
-            query.value(albumArtistIndex).toString(),
-            query.value(albumIndex).toString(),
-            query.value(titleIndex).toString(),
-            query.value(fileIndex).toString(),
-            query.value(imageIndex).toString(),
-            track < 0 ? 0 : track,
-            query.value(durationIndex).toInt()
-        };
+    if (query.next())
+    {
+        return songFromQuery(query);
     }
     else
     {
@@ -466,18 +1324,70 @@ Song MusicDatabase::getSong(int idx)
     }
 }
 
-QList<Song> MusicDatabase::getSongs()
+// Returns the song with the given SongID
+Song MusicDatabase::getSongById(qint64 id)
+{
+    QList<Song> songs = getSongsByIds({id});
+    if (songs.isEmpty()) { return Song {"", "", "", "", "", "", -1}; }
+    return songs.first();
+}
+
+// Returns the songs with the given SongIDs in the same order as ids
+// All songs are fetched by a single primary key lookup query, ids that do not exist are skipped
+QList<Song> MusicDatabase::getSongsByIds(const QList<qint64> &ids)
 {
     QList<Song> ret;
 
-    if (!valid) { return ret; }
+    if (!valid || ids.isEmpty()) { return ret; }
+
+    // The ids are integers so they are written into the statement directly
+    // binding them would run into SQLite's limit on the number of parameters
+    QStringList idList;
+    idList.reserve(ids.count());
+    for (qint64 id : ids) idList << QString::number(id);
 
     QSqlQuery query;
-    query.prepare("SELECT * FROM 'Songs' "
-                  "WHERE Album LIKE :album AND Artist LIKE :artist "
-                  "ORDER BY Artist, Album, Track");
-    query.bindValue(":artist", filterArtist.isEmpty() ? "%" : filterArtist);
-    query.bindValue(":album" , filterAlbum.isEmpty() ? "%" : filterAlbum );
+    query.setForwardOnly(true);
+
+    if (!query.exec(songSelect + "WHERE Songs.SongID IN (" + idList.join(',') + ");"))
+    {
+        qDebug() << query.lastError();
+        return ret;
+    }
+
+    QHash<qint64, Song> songs;
+    songs.reserve(ids.count());
+    while (query.next())
+    {
+        Song song = songFromQuery(query);
+        songs.insert(song.id, song);
+    }
+
+    ret.reserve(ids.count());
+    for (qint64 id : ids)
+    {
+        auto song = songs.constFind(id);
+        if (song != songs.constEnd()) ret.append(*song);
+    }
+
+    return ret;
+}
+
+QList<Song> MusicDatabase::getSongs()
+{
+    if (!valid) { return QList<Song>(); }
+
+    return querySongs(QSqlDatabase::database(), filterArtist, filterAlbum);
+}
+
+// Returns the songs matching artist and album in the database of connection db, see getSongs
+QList<Song> MusicDatabase::querySongs(QSqlDatabase db, const QString &artist, const QString &album)
+{
+    QList<Song> ret;
+
+    QSqlQuery query(db);
+    query.prepare(songSelect + filterClause(artist, album) + songOrder);
+    bindFilters(query, artist, album);
 
     if (!query.exec())
     {
@@ -486,29 +1396,9 @@ QList<Song> MusicDatabase::getSongs()
         return ret;
     }
 
-    int artistIndex = query.record().indexOf("Artist");
-    int albumArtistIndex = query.record().indexOf("AlbumArtist");
-    int albumIndex = query.record().indexOf("Album");
-    int titleIndex = query.record().indexOf("Title");
-    int fileIndex = query.record().indexOf("File");
-    int trackIndex = query.record().indexOf("Track");
-    int imageIndex = query.record().indexOf("Image");
-    int durationIndex = query.record().indexOf("Duration");
-
     while (query.next())
     {
-        int track = query.value(trackIndex).toInt();
-        ret.append(
-            Song {
-                query.value(artistIndex).toString(),
-                query.value(albumArtistIndex).toString(),
-                query.value(albumIndex).toString(),
-                query.value(titleIndex).toString(),
-                query.value(fileIndex).toString(),
-                query.value(imageIndex).toString(),
-                track < 0 ? 0 : track,
-                query.value(durationIndex).toInt()
-        });
+        ret.append(songFromQuery(query));
     }
 
     return ret;
@@ -534,3 +1424,146 @@ bool MusicDatabase::filteredByAlbum()
     return !filterAlbum.isEmpty();
 }
 
+
+// Current artist filter, empty when not filtered
+QString MusicDatabase::artistFilter()
+{
+    return filterArtist;
+}
+
+// Current album filter, empty when not filtered
+QString MusicDatabase::albumFilter()
+{
+    return filterAlbum;
+}
+
+// Read only connection of a query thread
+// Removed when the thread exits, the query pool keeps its threads until it is destroyed
+struct ReadConnection
+{
+    QString name;
+    int generation = -1;
+
+    ~ReadConnection()
+    {
+        if (!name.isEmpty()) QSqlDatabase::removeDatabase(name);
+    }
+};
+
+// Returns the calling thread's read only connection to the database at path
+// The connection is reopened when generation changes, see connectionGeneration
+QSqlDatabase MusicDatabase::readConnection(const QString &path, int generation)
+{
+    static thread_local ReadConnection connection;
+
+    if (connection.generation != generation)
+    {
+        if (!connection.name.isEmpty()) QSqlDatabase::removeDatabase(connection.name);
+
+        connection.name = QString("Reader-%1").arg(quintptr(QThread::currentThreadId()));
+        connection.generation = generation;
+
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection.name);
+        db.setDatabaseName(path);
+        db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+        if (!db.open()) qDebug() << "Query Database Error: " << db.lastError();
+    }
+
+    return QSqlDatabase::database(connection.name, false);
+}
+
+// Runs query on a thread of the query pool with that thread's read only connection
+// The query still pending in pending is cancelled first, its result would be stale.
+// A cancelled query that has not started is skipped and its continuations never run
+template <typename T, typename Query>
+QFuture<T> MusicDatabase::runQuery(QFuture<T> &pending, Query query)
+{
+    pending.cancel();
+
+    QString path = databasePath;
+    int generation = connectionGeneration;
+    pending = QtConcurrent::run(&queryPool, [path, generation, query](QPromise<T> &promise) {
+        if (promise.isCanceled()) { return; }
+
+        QSqlDatabase db = readConnection(path, generation);
+        T result = db.isOpen() ? query(db) : T();
+
+        if (!promise.isCanceled()) promise.addResult(result);
+    });
+
+    return pending;
+}
+
+// Returns a future that already holds result, used when the library index answers without a query
+template <typename T>
+static QFuture<T> readyFuture(const T &result)
+{
+    QPromise<T> promise;
+    promise.start();
+    promise.addResult(result);
+    promise.finish();
+    return promise.future();
+}
+
+// Returns the artists like getArtists without blocking the calling thread
+// A previous getArtistsAsync that has not finished is cancelled
+QFuture<QStringList> MusicDatabase::getArtistsAsync()
+{
+    artistsQuery.cancel();
+    if (libraryIndex.isLoaded()) { return readyFuture(libraryIndex.artists()); }
+    if (!valid) { return readyFuture(QStringList()); }
+
+    return runQuery(artistsQuery, [](QSqlDatabase db) { return queryArtists(db); });
+}
+
+// Returns the albums of artist like getAlbums without blocking the calling thread
+// A previous getAlbumsAsync that has not finished is cancelled
+QFuture<QStringList> MusicDatabase::getAlbumsAsync(const QString &artist)
+{
+    albumsQuery.cancel();
+    if (libraryIndex.isLoaded()) { return readyFuture(libraryIndex.albums(artist)); }
+    if (!valid) { return readyFuture(QStringList()); }
+
+    return runQuery(albumsQuery, [artist](QSqlDatabase db) { return queryAlbums(db, artist); });
+}
+
+// Returns song names and their SongIDs like getSongNames without blocking the calling thread
+// A previous getSongNamesAsync that has not finished is cancelled
+QFuture<SongNames> MusicDatabase::getSongNamesAsync(const QString &artist, const QString &album, int offset, int limit)
+{
+    songNamesQuery.cancel();
+
+    SongNames ret;
+    if (libraryIndex.isLoaded())
+    {
+        ret.names = libraryIndex.songNames(artist, album, &ret.ids, offset, limit);
+        return readyFuture(ret);
+    }
+    if (!valid || offset < 0) { return readyFuture(ret); }
+
+    return runQuery(songNamesQuery, [artist, album, offset, limit](QSqlDatabase db) {
+        SongNames names;
+        names.names = querySongNames(db, artist, album, offset, limit, &names.ids);
+        return names;
+    });
+}
+
+// Returns the songs matching artist and album like getSongs without blocking the calling thread
+// A previous getSongsAsync that has not finished is cancelled
+QFuture<QList<Song>> MusicDatabase::getSongsAsync(const QString &artist, const QString &album)
+{
+    songsQuery.cancel();
+    if (!valid) { return readyFuture(QList<Song>()); }
+
+    return runQuery(songsQuery, [artist, album](QSqlDatabase db) { return querySongs(db, artist, album); });
+}
+
+// Cancels pending queries and waits for the running ones, used before the database is replaced
+void MusicDatabase::cancelQueries()
+{
+    artistsQuery.cancel();
+    albumsQuery.cancel();
+    songNamesQuery.cancel();
+    songsQuery.cancel();
+    queryPool.waitForDone();
+}
@@ -2,12 +2,29 @@
 #define MUSICDATABASE_H
 
 #include "song.h"
+#include "scanworker.h"
+#include "loudnessworker.h"
+#include "libraryindex.h"
+#include "librarywatcher.h"
 #include <QObject>
+#include <QHash>
 #include <QtSql/QSqlDatabase>
-#include <QMediaPlayer>
+#include <QtSql/QSqlQuery>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QTimer>
+#include <QFuture>
+#include <QThreadPool>
 
 
 
+// Song names with the SongID of each row, see MusicDatabase::getSongNamesAsync
+struct SongNames
+{
+    QStringList names;
+    QList<qint64> ids;
+};
+
 struct Album
 {
     QString artist;
@@ -26,33 +43,128 @@ public:
     bool connectToDatabase(QString databaseFilePath);
     bool createDatabase(QString databaseFilePath);
     void scanFolder(QString directory);
+    void scanFiles(const QStringList &files);
+    bool addFolder(QString directory);
+    QStringList getFolders();
+    bool removeFiles(const QStringList &files);
+    bool removeDirectory(const QString &directory);
+    bool moveFiles(const QList<LibraryMove> &moves);
+    void setScanBatchSize(int size);
+    int scanBatchSize();
+    bool isScanning();
+    void cancelScan();
+    void setScanPaused(bool paused);
+    bool scanPaused();
+    ScanSummary lastScanSummary();
+    void setLibraryIndexEnabled(bool enabled);
+    bool libraryIndexEnabled();
+    bool openSnapshot(QString databaseFilePath);
+    void setWatchEnabled(bool enabled);
+    bool watchEnabled();
+    void analyzeLoudness();
+    void cancelLoudnessAnalysis();
+    TrackLoudness getLoudness(qint64 songId);
 
     bool filteredByArtist();
     bool filteredByAlbum();
+    QString artistFilter();
+    QString albumFilter();
 
     QStringList getArtists();
     QStringList getAlbums();
-    QStringList getSongNames();
-    QStringList getSongNamesByAlbumID(int idx, bool filterByArtist = false);
+    QStringList getSongNames(QList<qint64> *ids = nullptr);
+    QStringList getSongNames(const QString &artist, const QString &album, int offset, int limit, QList<qint64> *ids = nullptr);
+    QStringList getSongNamesByAlbumID(int idx, bool filterByArtist = false, QList<qint64> *ids = nullptr);
     bool setFiltersByAlbumID(int idx, bool filterByArtist = false);
     Song getSong(int idx);
     Song getSong(QString title);
+    Song getSongById(qint64 id);
     QList<Song> getSongs();
+    QList<Song> getSongsByIds(const QList<qint64> &ids);
+    QStringList searchSongs(const QString &text, int offset = 0, int limit = -1, QList<qint64> *ids = nullptr);
 
-    QMediaPlayer* mp = nullptr;
+    QFuture<QStringList> getArtistsAsync();
+    QFuture<QStringList> getAlbumsAsync(const QString &artist);
+    QFuture<SongNames> getSongNamesAsync(const QString &artist, const QString &album, int offset = 0, int limit = -1);
+    QFuture<QList<Song>> getSongsAsync(const QString &artist, const QString &album);
 
 public slots:
     void setArtist(QString Artist = "");
     void setAlbum(QString Album = "");
-    void scanMedia(QMediaPlayer::MediaStatus status);
+    void applyChanges(const LibraryChanges &changes);
 
 signals:
     void songsFiltered();
     void scanComplete();
-    void scanStatus(QString File);
+    void scanProgress(const ScanProgress &progress);
+    void scanCancelled();
+    void scanSummary(int added, int changed, int unchanged, int removed, int failed);
+    void libraryChanged();
+    void loudnessAnalyzed(int songs);
 
 private:
-    QStringList scanList;
+    LibraryIndex libraryIndex;
+    LibraryWatcher watcher;
+    bool indexEnabled = false;
+    bool watching = false;
+    QStringList pendingFolders;
+    QStringList pendingFiles;
+    bool searchAvailable = false;
+
+    // Scans run on scanThread, progress is sampled from the worker every progressTimer tick
+    QThread scanThread;
+    ScanWorker *worker = nullptr;
+    bool scanRunning = false;
+    ScanSummary lastScan;
+    QTimer progressTimer;
+    QElapsedTimer progressClock;
+    int progressDone = 0;
+    qint64 progressTime = 0;
+    double progressRate = 0;
+
+    // Loudness is measured on analysisThread after scans, see LoudnessWorker
+    QThread analysisThread;
+    LoudnessWorker *analyzer = nullptr;
+
+    // Snapshot of the library index, written a while after the library changes
+    QTimer snapshotTimer;
+    quint64 savedLibraryId = 0;
+    quint64 savedGeneration = 0;
+
+    // Async queries run on queryPool, each thread reads through its own connection
+    // that is reopened when connectionGeneration changes
+    QThreadPool queryPool;
+    QString databasePath;
+    int connectionGeneration = 0;
+    QFuture<QStringList> artistsQuery;
+    QFuture<QStringList> albumsQuery;
+    QFuture<SongNames> songNamesQuery;
+    QFuture<QList<Song>> songsQuery;
+
+    void configureConnection(QSqlDatabase db);
+    bool createSchema(QSqlDatabase db);
+    bool createSearchIndex(QSqlDatabase db);
+    bool rebuildSearchIndex(QSqlDatabase db);
+    bool migrateDatabase(QSqlDatabase db);
+    void openScanConnection(const QString &databaseFilePath);
+    void startScan();
+    void startPendingScan();
+    void reportProgress();
+    void scanFinished(const ScanSummary &summary);
+    void cancelQueries();
+    bool libraryVersion(quint64 *libraryId, quint64 *generation);
+    void loadLibraryIndex();
+    void saveSnapshot();
+    void scheduleSnapshot();
+    template <typename T, typename Query>
+    QFuture<T> runQuery(QFuture<T> &pending, Query query);
+    static QSqlDatabase readConnection(const QString &path, int generation);
+    static QStringList queryArtists(QSqlDatabase db);
+    static QStringList queryAlbums(QSqlDatabase db, const QString &artist);
+    static QStringList querySongNames(QSqlDatabase db, const QString &artist, const QString &album, int offset, int limit, QList<qint64> *ids);
+    static QList<Song> querySongs(QSqlDatabase db, const QString &artist, const QString &album);
+    static QString filterClause(const QString &artist, const QString &album);
+    static void bindFilters(QSqlQuery &query, const QString &artist, const QString &album);
     QString filterArtist;
     QString filterAlbum;
 };
@@ -1,21 +1,32 @@
 #include "musicplayer.h"
-#include <QAudioOutput>
 #include <QDBusConnection>
 #include <QDBusMessage>
 #include <QCoreApplication>
+#include <algorithm>
+#include <functional>
+#include <cmath>
 
 MusicPlayer::MusicPlayer(QObject *parent)
-    : QObject{parent}
+    : QObject{parent}, player(PlaybackEngine::create())
 {
-    player.setAudioOutput(new QAudioOutput);
-
-    QObject::connect(&player, &QMediaPlayer::mediaStatusChanged, this, &MusicPlayer::mediaStatusChanged);
-    QObject::connect(&player, &QMediaPlayer::positionChanged, this, [=](qint64 position) { emit mediaProgress(position, player.duration()); });
-    QObject::connect(&player, &QMediaPlayer::playbackStateChanged, &mpris, &MprisController::playbackStateChanged);
+    QObject::connect(player.get(), &PlaybackEngine::mediaStatusChanged, this, &MusicPlayer::mediaStatusChanged);
+    QObject::connect(player.get(), &PlaybackEngine::positionChanged, this, [=](qint64 position) { emit mediaProgress(position, player->duration()); });
+    QObject::connect(player.get(), &PlaybackEngine::playbackStateChanged, &mpris, &MprisController::playbackStateChanged);
     queue.setPlayingIndex(-1);
     queueIdx = -1;
 
-    QObject::connect(&player, &QMediaPlayer::playbackStateChanged, this, &MusicPlayer::playbackStateChanged);
+    // Rows moved in the queue keep the playing song playing at its new row
+    // and may have put another song after it
+    QObject::connect(&queue, &QAbstractItemModel::rowsMoved, this, [=]() {
+        if (queueIdx != queue.playingRow())
+        {
+            queueIdx = queue.playingRow();
+            emit queueIndexChanged(queueIdx);
+        }
+        updateNext();
+    });
+
+    QObject::connect(player.get(), &PlaybackEngine::playbackStateChanged, this, &MusicPlayer::playbackStateChanged);
 
     QObject::connect(this, &MusicPlayer::mediaProgress, &mpris, &MprisController::positionChanged);
     QObject::connect(this, &MusicPlayer::mediaLoaded,   &mpris, &MprisController::mediaLoaded);
@@ -47,35 +58,38 @@ MusicPlayer::~MusicPlayer()
     QDBusConnection::disconnectFromBus(QString("org.mpris.MediaPlayer.RhinoMusic.pid%1").arg(proc));
 }
 
-// Adds a song to the queue
+// Adds a song to the queue, at a random row after the playing song when shuffled
 // if play is true, will play the song as well
-bool MusicPlayer::addSong(Song song, bool play)
+bool MusicPlayer::addSong(const SongHandle &song, bool play)
 {
-    queue.append(song);
+    int row = queue.append(song);
 
 
     if (play) {
-        queueIdx = queue.rowCount() - 1;
-        player.setSource(queue.data(queue.index(queueIdx, 0), Qt::UserRole).value<Song>().file);
+        queueIdx = row;
+        loadSong(queueIdx);
     }
 
+    updateNext();
     return true;
 }
 
 // inserts the song after the currently playing one
 // because queueIdx is set to -1 when not playing
 // this function will insert the song first in the queue when not playing
-bool MusicPlayer::insertNext(Song song)
+bool MusicPlayer::insertNext(const SongHandle &song)
 {
-    return queue.insert(song, queueIdx + 1);
+    bool ret = queue.insert(song, queueIdx + 1);
+    updateNext();
+    return ret;
 }
 
-bool MusicPlayer::addSongs(QList<Song> songs)
+// Adds songs to the queue in one batch, the view is updated once
+// or once per run of neighbouring rows when shuffled
+bool MusicPlayer::addSongs(const QList<SongHandle> &songs)
 {
-    for (Song &s : songs)
-    {
-        addSong(s, false);
-    }
+    queue.append(songs);
+    updateNext();
 
     return true;
 }
@@ -84,31 +98,31 @@ bool MusicPlayer::addSongs(QList<Song> songs)
 // if the queue is not empty and the player is stopped, will play song at top of the queue
 void MusicPlayer::playPause()
 {
-    if(player.playbackState() == QMediaPlayer::StoppedState)
+    if(player->playbackState() == QMediaPlayer::StoppedState)
     {
         if (!(queue.rowCount() != 0)) return;
         queueIdx = 0;
-        player.setSource(queue.data(queue.index(queueIdx, 0), Qt::UserRole).value<Song>().file);
+        loadSong(queueIdx);
     }
     else
     {
-        if (player.isPlaying()) player.pause();
+        if (player->isPlaying()) player->pause();
         else
         {
-            player.play();
-            player.setPosition(player.position());
+            player->play();
+            player->setPosition(player->position());
         }
     }
 }
 
 void MusicPlayer::pause()
 {
-    if (player.isPlaying()) playPause();
+    if (player->isPlaying()) playPause();
 }
 
 void MusicPlayer::play()
 {
-    if (!player.isPlaying()) playPause();
+    if (!player->isPlaying()) playPause();
 }
 
 void MusicPlayer::stop()
@@ -116,7 +130,8 @@ void MusicPlayer::stop()
     queueIdx = -1;
     emit queueIndexChanged(-1);
     queue.setPlayingIndex(-1);
-    player.setSource(QUrl());
+    player->setSource(QUrl());
+    updateNext();
 }
 
 // Handles the player states
@@ -128,9 +143,10 @@ void MusicPlayer::mediaStatusChanged(QMediaPlayer::MediaStatus status)
     {
     case QMediaPlayer::LoadedMedia:
         if (queue.rowCount() < 1 || queueIdx < 0) break;
-        emit mediaLoaded(queue.data(queue.index(queueIdx, 0), Qt::UserRole).value<Song>(), queueIdx);
+        emit mediaLoaded(queue.song(queueIdx), queueIdx);
         queue.setPlayingIndex(queueIdx);
-        player.play();
+        player->play();
+        updateNext();
         break;
     case QMediaPlayer::EndOfMedia:
         next();
@@ -170,8 +186,8 @@ void MusicPlayer::next()
     default:
         if (queueIdx < queue.rowCount()) break;
         queueIdx = -1;
-        player.stop();
-        player.setSource(QUrl());
+        player->stop();
+        player->setSource(QUrl());
         endOfQueue = true;
 
     }
@@ -180,7 +196,35 @@ void MusicPlayer::next()
 
     queue.setPlayingIndex(queueIdx);
 
-    if (!endOfQueue) player.setSource(queue.data(queue.index(queueIdx, 0), Qt::UserRole).value<Song>().file);
+    if (!endOfQueue) loadSong(queueIdx);
+    updateNext();
+}
+
+// Returns the queue index next() will play, following Repeat
+// -1 at the end of the queue, and when repeating shuffled as the next song is picked by the reshuffle
+int MusicPlayer::nextIndex()
+{
+    if (queueIdx < 0) return -1;
+
+    switch (repeat)
+    {
+    case RepeatMode::RepeatSong:
+        return queueIdx;
+    case RepeatMode::RepeatPlaylist:
+        return queueIdx + 1 < queue.rowCount() ? queueIdx + 1 : 0;
+    case RepeatMode::RepeatShuffle:
+    case RepeatMode::RepeatOff:
+    default:
+        return queueIdx + 1 < queue.rowCount() ? queueIdx + 1 : -1;
+    }
+}
+
+// Tells the player which song follows so it is loaded before the current one ends
+// Called whenever the queue, the queue index or the repeat mode change
+void MusicPlayer::updateNext()
+{
+    int idx = nextIndex();
+    player->setNext(idx < 0 ? QUrl() : QUrl(queue.song(idx).file()));
 }
 
 // Cycles the repeat type, and returns the number corrisponding to the new value;
@@ -206,6 +250,7 @@ int MusicPlayer::cycleRepeat()
     }
 
     emit repeatModeChanged(repeat);
+    updateNext();
     return repeat;
 }
 
@@ -225,6 +270,7 @@ int MusicPlayer::setRepeat(int repeatMode)
     }
 
     emit repeatModeChanged(repeat);
+    updateNext();
     return repeat;
 }
 
@@ -234,16 +280,16 @@ int MusicPlayer::setRepeat(int repeatMode)
 void MusicPlayer::prev()
 {
     if (queueIdx < 0) { return; }
-    if (player.position() < player.duration() * 0.01)
+    if (player->position() < player->duration() * 0.01)
     {
         queueIdx -= 1;
         if (queueIdx < 0) queueIdx = 0;
-        player.setSource(queue.data(queue.index(queueIdx, 0), Qt::UserRole).value<Song>().file);
+        loadSong(queueIdx);
         queue.setPlayingIndex(queueIdx);
     }
     else
     {
-        player.setSource(queue.data(queue.index(queueIdx, 0), Qt::UserRole).value<Song>().file);
+        loadSong(queueIdx);
     }
 }
 
@@ -254,26 +300,26 @@ void MusicPlayer::playSong(int plstIdx)
     if(plstIdx < 0 || plstIdx >= queue.rowCount()) return;
 
     queueIdx = plstIdx;
-    player.setSource(queue.data(queue.index(queueIdx, 0), Qt::UserRole).value<Song>().file);
+    loadSong(queueIdx);
     queue.setPlayingIndex(queueIdx);
 }
 
 // sets the playing position, calls internal player function
 void MusicPlayer::seek(qint64 position)
 {
-    player.setPosition(position);
-    emit seeked(player.position());
+    player->setPosition(position);
+    emit seeked(player->position());
 }
 
 void MusicPlayer::relSeek(qint64 offset)
 {
-    if (player.position() + offset < 0)
-    { player.setPosition(0); }
-    else if (player.position() + offset > player.duration())
+    if (player->position() + offset < 0)
+    { player->setPosition(0); }
+    else if (player->position() + offset > player->duration())
     { next(); }
-    else { player.setPosition(player.position() + offset); }
+    else { player->setPosition(player->position() + offset); }
 
-    emit seeked(player.position());
+    emit seeked(player->position());
 }
 
 // Returns the shuffle state of the player
@@ -305,28 +351,44 @@ void MusicPlayer::setShuffle(bool _shuffle)
 
     emit shuffleChanged(shuffle);
     emit queueIndexChanged(queueIdx);
+    updateNext();
 }
 
-// Removes the specified songs from the queue, Reorders and removes them one at a time
-// This is needed as the QAbstractListModel and by extention SongQueueModel
-// does not have the capabillity to remove arbitrary groups of items
+// Removes the specified songs from the queue
+// The selection is sorted and split into runs of neighbouring rows, each run is removed
+// with one removeRows from the bottom up so the rows above it keep their index
 bool MusicPlayer::removeSongsFromQueue(QModelIndexList indexes)
 {
-    std::sort(indexes.begin(), indexes.end(), [](QModelIndex x, QModelIndex y) {return x.row() > y.row(); });
-    for (auto index : indexes)
+    QList<int> rows;
+    for (const QModelIndex &index : indexes) rows.append(index.row());
+    std::sort(rows.begin(), rows.end(), std::greater<int>());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+    int i = 0;
+    while (i < rows.count())
     {
-        queue.removeRows(index.row(), 1);
-        if (index.row() < queueIdx) {
-            queueIdx-=1;
-            queue.setPlayingIndex(queueIdx);
+        int last = rows[i];
+        int first = last;
+        while (i + 1 < rows.count() && rows[i + 1] == first - 1)
+        {
+            first--;
+            i++;
         }
-        else if (index.row() == queueIdx)
+        i++;
+
+        int count = last - first + 1;
+        queue.removeRows(first, count);
+
+        if (last < queueIdx) queueIdx -= count;
+        else if (first <= queueIdx)
         {
-            queueIdx=-1;
-            queue.setPlayingIndex(-1);
-            player.setSource(QUrl());
+            queueIdx = -1;
+            player->setSource(QUrl());
         }
     }
+
+    queue.setPlayingIndex(queueIdx);
+    updateNext();
     return true;
 }
 
@@ -336,19 +398,92 @@ bool MusicPlayer::clearQueue()
     queueIdx = -1;
     queue.clear();
     emit queueIndexChanged(-1);
-    player.setSource(QUrl());
+    player->setSource(QUrl());
+    updateNext();
     return true;
 }
 
 // returns the playing state of the player
 bool MusicPlayer::playing()
 {
-    return player.isPlaying();
+    return player->isPlaying();
 }
 
 // Sets the volume of the internal music player
+// The player plays at the volume times the gain of the song, see songGain
 void MusicPlayer::setVolume(int newVolume)
 {
-    player.audioOutput()->setVolume(newVolume / 100.0);
+    volume = newVolume / 100.0f;
+    applyVolume();
     emit volumeChanged(newVolume);
 }
+
+// Sets where the loudness of songs comes from, usually MusicDatabase::getLoudness
+void MusicPlayer::setLoudnessLookup(const std::function<TrackLoudness(qint64)> &lookup)
+{
+    loudnessLookup = lookup;
+}
+
+// Sets whether songs are played at the reference loudness by their own loudness or that of their album
+// Takes effect right away for the loaded song, off by default
+// GaplessPlayer cannot boost, songs quieter than referenceLoudness are only brought up by PcmPlayer
+int MusicPlayer::setNormalization(int mode)
+{
+    switch (mode)
+    {
+    case NormalizationMode::NormalizeOff:
+    case NormalizationMode::NormalizeTrack:
+    case NormalizationMode::NormalizeAlbum:
+        normalizationMode = mode;
+        break;
+
+    default:
+        break;
+    }
+
+    trackGain = queueIdx >= 0 && queueIdx < queue.rowCount() ? songGain(queue.song(queueIdx)) : 1;
+    applyVolume();
+    return normalizationMode;
+}
+
+int MusicPlayer::normalization()
+{
+    return normalizationMode;
+}
+
+// Loads the song at queue index idx at its gain
+void MusicPlayer::loadSong(int idx)
+{
+    const SongHandle song = queue.song(idx);
+    trackGain = songGain(song);
+    applyVolume();
+    player->setSource(song.file());
+}
+
+// Returns the linear gain that brings a song to referenceLoudness, 1 if its loudness is not known
+// In album mode the loudness of the album is used when there is one, so the songs keep their
+// levels relative to each other. Boosts are limited so the true peak stays below peakCeiling
+float MusicPlayer::songGain(const SongHandle &song)
+{
+    if (normalizationMode == NormalizationMode::NormalizeOff || !loudnessLookup || song.id() < 0) return 1;
+
+    TrackLoudness loudness = loudnessLookup(song.id());
+    double integrated = loudness.integrated;
+    double truePeak = loudness.truePeak;
+    if (normalizationMode == NormalizationMode::NormalizeAlbum && !std::isnan(loudness.albumIntegrated))
+    {
+        integrated = loudness.albumIntegrated;
+        truePeak = loudness.albumTruePeak;
+    }
+    if (std::isnan(integrated)) return 1;
+
+    double gain = referenceLoudness - integrated;
+    if (!std::isnan(truePeak)) gain = qMin(gain, peakCeiling - truePeak);
+    return float(std::pow(10.0, gain / 20));
+}
+
+// GaplessPlayer cannot play louder than the file, a boost only takes effect with PcmPlayer
+void MusicPlayer::applyVolume()
+{
+    player->setVolume(volume * trackGain);
+}
@@ -6,8 +6,12 @@
 #include <QStack>
 #include <QStringListModel>
 #include <QMediaPlayer>
-#include "song.h"
+#include "songhandle.h"
 #include "songqueuemodel.h"
+#include "playbackengine.h"
+#include "loudnessmeter.h"
+#include <memory>
+#include <functional>
 #include "mpriscontroller.h"
 
 struct RepeatMode
@@ -18,6 +22,14 @@ struct RepeatMode
     static const int RepeatShuffle = 3;
 };
 
+// Which loudness a song is played at, see MusicPlayer::setNormalization
+struct NormalizationMode
+{
+    static const int NormalizeOff = 0;
+    static const int NormalizeTrack = 1;
+    static const int NormalizeAlbum = 2;
+};
+
 // This Class is responsible for controlling the internal media player as well as managing the queue
 class MusicPlayer : public QObject
 {
@@ -25,9 +37,9 @@ class MusicPlayer : public QObject
 public:
     explicit MusicPlayer(QObject *parent = nullptr);
     ~MusicPlayer();
-    bool addSong(Song song, bool play);
-    bool addSongs(QList<Song> songs);
-    bool insertNext(Song song);
+    bool addSong(const SongHandle &song, bool play);
+    bool addSongs(const QList<SongHandle> &songs);
+    bool insertNext(const SongHandle &song);
     bool isQueueEmpty();
     bool isPlaylistEmpty();
     bool isShuffled();
@@ -38,21 +50,38 @@ public:
     int cycleRepeat();
     int setRepeat(int repeatMode);
 
+    static constexpr double referenceLoudness = -18;    // LUFS songs are normalized to
+    static constexpr double peakCeiling = -1;           // dBTP the gain keeps the true peak below
+
+    void setLoudnessLookup(const std::function<TrackLoudness(qint64)> &lookup);
+    int setNormalization(int mode);
+    int normalization();
+
     SongQueueModel queue;
 
 private:
-    QList<Song> dynamicPlaylist;
+    int nextIndex();
+    void updateNext();
+    void loadSong(int idx);
+    float songGain(const SongHandle &song);
+    void applyVolume();
+
+    QList<SongHandle> dynamicPlaylist;
     int queueIdx = -1;
     int repeat = 0;
     bool shuffle;
-    QMediaPlayer player;
+    int normalizationMode = NormalizationMode::NormalizeOff;
+    std::function<TrackLoudness(qint64)> loudnessLookup;
+    float volume = 1;       // set by the user, 0 to 1
+    float trackGain = 1;    // of the loaded song
     MprisController mpris;
+    std::unique_ptr<PlaybackEngine> player;   // declared last so it goes first, its signals still reach the rest
 
     bool DBUS = false;
 
 
 signals:
-    void mediaLoaded(const Song &song, int dynPlstIdx);
+    void mediaLoaded(const SongHandle &song, int dynPlstIdx);
     void mediaProgress(qint64 position, qint64 duration);
     void seeked(qint64 position);
     void queueIndexChanged(int idx);
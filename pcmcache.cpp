@@ -0,0 +1,84 @@
+#include "pcmcache.h"
+
+// Sets the most memory the entries may take, the least recently used are dropped to fit
+void PcmCache::setBudget(qint64 bytes)
+{
+    limit.store(qMax<qint64>(bytes, 0), std::memory_order_relaxed);
+    evict(0);
+}
+
+qint64 PcmCache::budget() const
+{
+    return limit.load(std::memory_order_relaxed);
+}
+
+// Copies the entry of source to entry and marks it the most recently used, counted as a hit or a miss
+bool PcmCache::find(const QUrl &source, PcmCacheEntry *entry)
+{
+    auto it = entries.constFind(source);
+    if (it == entries.cend())
+    {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    hits.fetch_add(1, std::memory_order_relaxed);
+    *entry = it.value();
+    order.removeOne(source);
+    order.prepend(source);
+    return true;
+}
+
+// Returns whether source is cached without counting a lookup
+bool PcmCache::contains(const QUrl &source) const
+{
+    return entries.contains(source);
+}
+
+// Stores the entry of source as the most recently used, an entry larger than the budget is not stored
+void PcmCache::insert(const QUrl &source, const PcmCacheEntry &entry)
+{
+    if (entries.contains(source))
+    {
+        resident.fetch_sub(entries.take(source).bytes, std::memory_order_relaxed);
+        order.removeOne(source);
+    }
+
+    if (entry.bytes > budget()) { count.store(int(entries.size()), std::memory_order_relaxed); return; }
+
+    evict(entry.bytes);
+    entries.insert(source, entry);
+    order.prepend(source);
+    resident.fetch_add(entry.bytes, std::memory_order_relaxed);
+    count.store(int(entries.size()), std::memory_order_relaxed);
+}
+
+// Drops every entry, the hit and miss counts are kept
+void PcmCache::clear()
+{
+    entries.clear();
+    order.clear();
+    resident.store(0, std::memory_order_relaxed);
+    count.store(0, std::memory_order_relaxed);
+}
+
+PcmCacheStats PcmCache::stats() const
+{
+    PcmCacheStats ret;
+    ret.hits = hits.load(std::memory_order_relaxed);
+    ret.misses = misses.load(std::memory_order_relaxed);
+    ret.residentBytes = resident.load(std::memory_order_relaxed);
+    ret.budgetBytes = limit.load(std::memory_order_relaxed);
+    ret.entries = count.load(std::memory_order_relaxed);
+    return ret;
+}
+
+// Drops the least recently used entries until bytes more fit in the budget
+void PcmCache::evict(qint64 bytes)
+{
+    while (!order.isEmpty() && resident.load(std::memory_order_relaxed) + bytes > budget())
+    {
+        resident.fetch_sub(entries.take(order.takeLast()).bytes, std::memory_order_relaxed);
+    }
+    count.store(int(entries.size()), std::memory_order_relaxed);
+}
@@ -0,0 +1,67 @@
+#ifndef PCMCACHE_H
+#define PCMCACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QUrl>
+#include <atomic>
+
+// All of a source as PcmDecoder wrote it to the ring, float frames in the format of the sink
+// The chunks are the buffers of the decoder, shared with the ring's pending list rather than copied
+struct PcmCacheEntry
+{
+    QList<QByteArray> chunks;
+    qint64 bytes = 0;
+    qint64 duration = 0;    // milliseconds
+};
+
+// Lookups and memory of a PcmCache, see PcmCache::stats
+struct PcmCacheStats
+{
+    qint64 hits = 0;
+    qint64 misses = 0;
+    qint64 residentBytes = 0;
+    qint64 budgetBytes = 0;
+    int entries = 0;
+
+    double hitRate() const { return hits + misses > 0 ? double(hits) / (hits + misses) : 0; }
+};
+
+// Least recently used cache of decoded sources within a memory budget
+//
+// Keeps the sources PcmDecoder decoded completely, so starting one of them again, to restart
+// it, go back to it or repeat it, reads memory instead of decoding the file. The decoder
+// also fills it with the next source ahead of time. The default budget holds about ten
+// minutes of 48 kHz stereo, enough for the previous, current and next songs of the queue.
+//
+// Used on the decoder thread, stats may be called from any thread.
+class PcmCache
+{
+public:
+    static const qint64 defaultBudget = qint64(256) * 1024 * 1024;
+
+    void setBudget(qint64 bytes);
+    qint64 budget() const;
+
+    bool find(const QUrl &source, PcmCacheEntry *entry);
+    bool contains(const QUrl &source) const;
+    void insert(const QUrl &source, const PcmCacheEntry &entry);
+    void clear();
+
+    PcmCacheStats stats() const;
+
+private:
+    void evict(qint64 bytes);
+
+    QHash<QUrl, PcmCacheEntry> entries;
+    QList<QUrl> order;      // most recently used first
+
+    std::atomic<qint64> limit {defaultBudget};
+    std::atomic<qint64> resident {0};
+    std::atomic<qint64> hits {0};
+    std::atomic<qint64> misses {0};
+    std::atomic<int> count {0};
+};
+
+#endif // PCMCACHE_H
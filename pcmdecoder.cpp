@@ -0,0 +1,316 @@
+#include "pcmdecoder.h"
+
+PcmDecoder::PcmDecoder(PcmRingBuffer *ring, QObject *parent)
+    : QObject{parent}, ring(ring)
+{}
+
+// Decodes source into the ring as float frames of format starting at from milliseconds
+// The decoder is created on the first start so it lives on the thread of this object
+void PcmDecoder::start(int id, const QUrl &source, const QAudioFormat &format, qint64 from)
+{
+    if (!decoder)
+    {
+        DspKernels::flushDenormals();
+
+        decoder = new QAudioDecoder(this);
+        pumpTimer = new QTimer(this);
+        pumpTimer->setInterval(5);
+
+        QObject::connect(decoder, &QAudioDecoder::bufferReady, this, &PcmDecoder::bufferReady);
+        QObject::connect(decoder, &QAudioDecoder::finished, this, &PcmDecoder::decodingFinished);
+        QObject::connect(decoder, &QAudioDecoder::durationChanged, this, [=](qint64 duration) {
+            if (ahead) return;
+            length = duration;
+            if (this->id) emit durationChanged(this->id, duration);
+        });
+        QObject::connect(decoder, qOverload<QAudioDecoder::Error>(&QAudioDecoder::error), this, [=]() {
+            bool wasAhead = ahead;
+            QString error = decoder->errorString();
+            halt();
+            if (!wasAhead && this->id) emit failed(this->id, error);
+        });
+        QObject::connect(pumpTimer, &QTimer::timeout, this, &PcmDecoder::pump);
+    }
+
+    stop();
+
+    // Cached audio is in the format it was decoded for
+    if (format != this->format)
+    {
+        halt();
+        cache.clear();
+        this->format = format;
+    }
+
+    this->id = id;
+    skip = qMax<qint64>(from, 0) * 1000;
+    length = -1;
+    announced = false;
+    decoded = false;
+
+    // The source decoded ahead, what it decoded so far goes to the ring and the decode carries on
+    // It is not in the cache yet, so it is not looked up there and does not count as a miss
+    if (ahead && decoding == source && skip == 0)
+    {
+        ahead = false;
+        pending = filling.chunks;
+        pendingBytes = filling.bytes;
+        pump();
+        return;
+    }
+
+    PcmCacheEntry entry;
+    if (cache.find(source, &entry))
+    {
+        play(entry);
+        return;
+    }
+
+    decode(source, false);
+}
+
+// Stops writing to the ring and drops what has not reached it
+// A decode of the next source ahead of time keeps going
+void PcmDecoder::stop()
+{
+    id = 0;
+    pending.clear();
+    pendingOffset = 0;
+    pendingBytes = 0;
+    if (pumpTimer) pumpTimer->stop();
+    if (!ahead) halt();
+}
+
+// Decodes source into the cache once nothing else is decoded, so it starts without decoding
+void PcmDecoder::setNext(const QUrl &source)
+{
+    nextSource = source;
+    if (ahead && decoding != source) halt();
+    prefetch();
+}
+
+// Equalizes the audio decoded from now on
+// The cached audio was equalized with the old bands, it is dropped and the next source decoded again
+void PcmDecoder::setEqualizer(const QList<EqualizerBand> &bands)
+{
+    chain.setEqualizer(bands);
+    cache.clear();
+    caching = false;
+    filling = PcmCacheEntry();
+
+    if (ahead)
+    {
+        halt();
+        prefetch();
+    }
+}
+
+void PcmDecoder::setCacheBudget(qint64 bytes)
+{
+    cache.setBudget(bytes);
+    oversized.clear();
+    prefetch();
+}
+
+// May be called from any thread
+PcmCacheStats PcmDecoder::cacheStats() const
+{
+    return cache.stats();
+}
+
+// Starts decoding source, into the ring or ahead of time into the cache only
+// Sources decoded from their beginning are cached
+void PcmDecoder::decode(const QUrl &source, bool ahead)
+{
+    halt();
+
+    decoding = source;
+    this->ahead = ahead;
+    caching = ahead || skip == 0;
+    filling = PcmCacheEntry();
+
+    chain.start(format.sampleRate(), format.channelCount());
+
+    // The format of the file, the chain resamples it
+    decoder->setAudioFormat(QAudioFormat());
+    decoder->setSource(source);
+    decoder->start();
+}
+
+// Stops the decode in progress and drops what it decoded for the cache
+void PcmDecoder::halt()
+{
+    if (decoder && !decoding.isEmpty()) decoder->stop();
+    decoding.clear();
+    ahead = false;
+    caching = false;
+    filling = PcmCacheEntry();
+}
+
+// Hands the cached buffers from the start position on to pending, nothing is decoded
+void PcmDecoder::play(const PcmCacheEntry &entry)
+{
+    const qint64 frameBytes = format.channelCount() * qint64(sizeof(float));
+    qint64 offset = format.framesForDuration(skip) * frameBytes;
+
+    for (const QByteArray &chunk : entry.chunks)
+    {
+        if (offset >= chunk.size())
+        {
+            offset -= chunk.size();
+            continue;
+        }
+        pending.append(offset > 0 ? chunk.mid(offset) : chunk);
+        pendingBytes += pending.last().size();
+        offset = 0;
+    }
+
+    length = entry.duration;
+    decoded = true;
+    pump();
+    prefetch();
+}
+
+// Decodes the next source into the cache unless it is cached or something else is decoded
+void PcmDecoder::prefetch()
+{
+    if (!decoder || !decoding.isEmpty() || nextSource.isEmpty() || !format.isValid()) return;
+    if (nextSource == oversized || cache.contains(nextSource)) return;
+    decode(nextSource, true);
+}
+
+// Buffers are left with the decoder while pending is full, the decoder does not decode
+// the next one until this one is read, so the decode runs at most pendingRings ahead of the ring
+void PcmDecoder::bufferReady()
+{
+    if (throttled()) return;
+    readBuffers();
+    pump();
+}
+
+// Whether pending holds enough audio that the decoder has to wait, a decode ahead never waits
+bool PcmDecoder::throttled() const
+{
+    return !ahead && !decoding.isEmpty() && pendingBytes >= pendingRings * ring->capacity();
+}
+
+// Reads the buffers the decoder holds until pending is full
+void PcmDecoder::readBuffers()
+{
+    while (decoder->bufferAvailable() && !throttled()) consume(decoder->read());
+}
+
+// Converts a decoded buffer and hands it to pending, the cache or both
+void PcmDecoder::consume(const QAudioBuffer &buffer)
+{
+    if (decoding.isEmpty() || !buffer.isValid()) return;
+
+    const qint64 from = ahead ? 0 : skip;
+    qint64 end = buffer.startTime() + buffer.duration();
+    if (end <= from) return;
+
+    qsizetype offset = 0;
+    if (buffer.startTime() < from) offset = buffer.format().bytesForDuration(from - buffer.startTime());
+    if (offset >= buffer.byteCount()) return;
+
+    QByteArray data = chain.process(buffer.constData<char>() + offset, buffer.byteCount() - offset, buffer.format());
+    if (data.isEmpty()) return;
+
+    if (caching)
+    {
+        filling.chunks.append(data);
+        filling.bytes += data.size();
+
+        // A source larger than the budget would only be dropped once decoded, it stops being cached
+        // right away, and a decode ahead of it is not worth finishing
+        if (filling.bytes > cache.budget())
+        {
+            caching = false;
+            filling = PcmCacheEntry();
+            if (ahead)
+            {
+                oversized = decoding;
+                halt();
+                return;
+            }
+        }
+    }
+    if (ahead || id == 0) return;
+
+    pending.append(data);
+    pendingBytes += data.size();
+}
+
+// Caches a source decoded from its beginning, then decodes the next source ahead
+void PcmDecoder::decodingFinished()
+{
+    if (decoding.isEmpty()) return;
+
+    // Buffers held back by the throttle are still with the decoder
+    while (decoder->bufferAvailable()) consume(decoder->read());
+
+    QByteArray tail = chain.flush();
+    if (caching)
+    {
+        filling.chunks.append(tail);
+        filling.bytes += tail.size();
+        filling.duration = filling.bytes / (format.channelCount() * qint64(sizeof(float))) * 1000 / qMax(format.sampleRate(), 1);
+        cache.insert(decoding, filling);
+    }
+
+    const bool wasAhead = ahead;
+    decoding.clear();
+    ahead = false;
+    caching = false;
+    filling = PcmCacheEntry();
+
+    if (!wasAhead && id != 0)
+    {
+        if (!tail.isEmpty()) pending.append(tail);
+        pendingBytes += tail.size();
+        decoded = true;
+        pump();
+    }
+
+    prefetch();
+}
+
+// Writes pending buffers into the ring while it has room, retried by the pump timer
+// Once pending has room again the buffers the decoder held back are read
+void PcmDecoder::pump()
+{
+    if (id == 0) return;
+
+    while (!pending.isEmpty())
+    {
+        const QByteArray &data = pending.first();
+        qsizetype written = ring->write(data.constData() + pendingOffset, data.size() - pendingOffset);
+        pendingOffset += written;
+        pendingBytes -= written;
+        if (pendingOffset < data.size()) break;
+
+        pending.removeFirst();
+        pendingOffset = 0;
+    }
+
+    if (!throttled()) readBuffers();
+
+    if (!announced && (ring->readable() > 0 || decoded))
+    {
+        announced = true;
+        emit loaded(id, length > 0 ? length : decoder->duration());
+    }
+
+    if (!pending.isEmpty())
+    {
+        if (!pumpTimer->isActive()) pumpTimer->start();
+        return;
+    }
+
+    pumpTimer->stop();
+    if (decoded)
+    {
+        emit finished(id);
+        id = 0;
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef PCMDECODER_H
+#define PCMDECODER_H
+
+#include <QObject>
+#include <QAudioDecoder>
+#include <QAudioBuffer>
+#include <QAudioFormat>
+#include <QTimer>
+#include <QList>
+#include <QUrl>
+#include "pcmringbuffer.h"
+#include "pcmcache.h"
+#include "dspchain.h"
+
+// Decodes a source into a PcmRingBuffer, lives on the decoder thread of PcmPlayer
+//
+// QAudioDecoder hands over buffers in the format of the file as it decodes them, a
+// DspChain converts them to float at the rate and channels of the sink, and those that do not
+// fit in the ring wait in pending and are written as the sink drains it. Once pending holds
+// pendingRings of audio the next buffer is left with the decoder, which waits for it to be
+// read, so a long source is not held in memory as a whole. QAudioDecoder cannot seek,
+// starting at a position decodes from the beginning and drops the audio before it.
+//
+// A source decoded from its beginning is kept in a PcmCache, and once it is decoded the next
+// source is decoded into the cache while the ring drains. Starting a cached source, at any
+// position, hands its buffers to pending without decoding, starting the source being decoded
+// ahead takes over that decode. The cache is cleared when the equalizer changes.
+//
+// Every start carries an id that comes back with the signals, so PcmPlayer can tell
+// signals of an earlier source that were still queued when it moved on.
+class PcmDecoder : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PcmDecoder(PcmRingBuffer *ring, QObject *parent = nullptr);
+
+    static const int pendingRings = 4;
+
+    void start(int id, const QUrl &source, const QAudioFormat &format, qint64 from);
+    void stop();
+    void setNext(const QUrl &source);
+    void setEqualizer(const QList<EqualizerBand> &bands);
+    void setCacheBudget(qint64 bytes);
+    PcmCacheStats cacheStats() const;
+
+signals:
+    // the first audio is in the ring
+    void loaded(int id, qint64 duration);
+    void durationChanged(int id, qint64 duration);
+    // all of the source is in the ring
+    void finished(int id);
+    void failed(int id, const QString &error);
+
+private:
+    void decode(const QUrl &source, bool ahead);
+    void halt();
+    void play(const PcmCacheEntry &entry);
+    void prefetch();
+    void bufferReady();
+    bool throttled() const;
+    void readBuffers();
+    void consume(const QAudioBuffer &buffer);
+    void decodingFinished();
+    void pump();
+
+    PcmRingBuffer *ring;
+    QAudioDecoder *decoder = nullptr;
+    QTimer *pumpTimer = nullptr;
+    DspChain chain;
+    QAudioFormat format;
+    PcmCache cache;
+
+    QList<QByteArray> pending;
+    qsizetype pendingOffset = 0;
+    qsizetype pendingBytes = 0;     // not written to the ring yet
+
+    int id = 0;
+    qint64 skip = 0;        // microseconds dropped from the start
+    qint64 length = -1;     // milliseconds, reported with loaded
+    bool announced = false;
+    bool decoded = false;
+
+    // The decode in progress, of the source started or of nextSource ahead of it
+    QUrl decoding;
+    QUrl nextSource;
+    QUrl oversized;         // decoded ahead and found larger than the cache budget
+    bool ahead = false;
+    bool caching = false;
+    PcmCacheEntry filling;
+};
+
+#endif // PCMDECODER_H
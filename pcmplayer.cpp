@@ -0,0 +1,349 @@
+#include "pcmplayer.h"
+#include <QMediaDevices>
+#include <QAudioDevice>
+#include <QDebug>
+
+// Reads the equalizer bands of the RHINO_EQUALIZER environment variable
+// Bands are separated by commas, each is type:frequency:gain[:q] with type peak, low or high
+// for a low or high shelf, for example "low:100:3,peak:1000:-2:1.4". Bands that cannot be read are skipped
+static QList<EqualizerBand> environmentEqualizer()
+{
+    QList<EqualizerBand> ret;
+
+    const QStringList bands = qEnvironmentVariable("RHINO_EQUALIZER").split(',', Qt::SkipEmptyParts);
+    for (const QString &text : bands)
+    {
+        QStringList fields = text.trimmed().split(':');
+        EqualizerBand band;
+        bool frequencyOk = false;
+        bool gainOk = false;
+        bool qOk = true;
+
+        if (fields.size() >= 3)
+        {
+            band.frequency = fields[1].toDouble(&frequencyOk);
+            band.gain = fields[2].toDouble(&gainOk);
+            if (fields.size() > 3) band.q = fields[3].toDouble(&qOk);
+        }
+
+        QString type = fields.first().toLower();
+        if (type == "low") band.type = EqualizerBand::LowShelf;
+        else if (type == "high") band.type = EqualizerBand::HighShelf;
+        else if (type != "peak") frequencyOk = false;
+
+        if (!frequencyOk || !gainOk || !qOk || fields.size() > 4)
+        {
+            qDebug() << "RHINO_EQUALIZER: skipping band" << text;
+            continue;
+        }
+        ret.append(band);
+    }
+    return ret;
+}
+
+PcmPlayer::PcmPlayer(QObject *parent)
+    : PlaybackEngine{parent},
+      format(outputFormat()),
+      ring(format.framesForDuration(bufferUSecs) * format.channelCount() * qsizetype(sizeof(float))),
+      device(&ring, format)
+{
+    device.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+
+    sink = new QAudioSink(QMediaDevices::defaultAudioOutput(), format, this);
+    QObject::connect(sink, &QAudioSink::stateChanged, this, &PcmPlayer::sinkStateChanged);
+
+    decoder = new PcmDecoder(&ring);
+    decoder->moveToThread(&decoderThread);
+    QObject::connect(&decoderThread, &QThread::finished, decoder, &QObject::deleteLater);
+    QObject::connect(decoder, &PcmDecoder::loaded, this, &PcmPlayer::decoderLoaded);
+    QObject::connect(decoder, &PcmDecoder::finished, this, &PcmPlayer::decoderFinished);
+    QObject::connect(decoder, &PcmDecoder::failed, this, &PcmPlayer::decoderFailed);
+    QObject::connect(decoder, &PcmDecoder::durationChanged, this, [=](int id, qint64 duration) {
+        if (id == decodeId) length = duration;
+    });
+    decoderThread.setObjectName("PcmDecoder");
+    decoderThread.start();
+
+    progressTimer.setInterval(50);
+    QObject::connect(&progressTimer, &QTimer::timeout, this, &PcmPlayer::tick);
+
+    // There is no equalizer setting in the window yet, bands are taken from the environment
+    QList<EqualizerBand> bands = environmentEqualizer();
+    if (!bands.isEmpty()) setEqualizer(bands);
+}
+
+PcmPlayer::~PcmPlayer()
+{
+    sink->stop();
+    QMetaObject::invokeMethod(decoder, [=]() { decoder->stop(); }, Qt::BlockingQueuedConnection);
+    decoderThread.quit();
+    decoderThread.wait();
+}
+
+// Stereo float at the preferred rate of the default output, the preferred format if float is not supported
+QAudioFormat PcmPlayer::outputFormat()
+{
+    QAudioDevice output = QMediaDevices::defaultAudioOutput();
+    QAudioFormat ret = output.preferredFormat();
+    ret.setChannelCount(2);
+    ret.setSampleFormat(QAudioFormat::Float);
+    if (!output.isFormatSupported(ret)) ret = output.preferredFormat();
+    return ret;
+}
+
+QAudioFormat PcmPlayer::audioFormat() const
+{
+    return format;
+}
+
+// Sets the equalizer bands, heard once the audio decoded after the call reaches the sink
+void PcmPlayer::setEqualizer(const QList<EqualizerBand> &bands)
+{
+    this->bands = bands;
+    QMetaObject::invokeMethod(decoder, [=]() { decoder->setEqualizer(bands); }, Qt::QueuedConnection);
+}
+
+QList<EqualizerBand> PcmPlayer::equalizer() const
+{
+    return bands;
+}
+
+// Loads source, reported as LoadedMedia once its first audio is decoded
+void PcmPlayer::setSource(const QUrl &source)
+{
+    if (status != QMediaPlayer::EndOfMedia) measuringGap = false;
+
+    halt();
+    currentSource = source;
+    length = -1;
+
+    if (source.isEmpty())
+    {
+        setState(QMediaPlayer::StoppedState);
+        setStatus(QMediaPlayer::NoMedia);
+        return;
+    }
+
+    setState(QMediaPlayer::StoppedState);
+    setStatus(QMediaPlayer::LoadingMedia);
+    restart(0);
+}
+
+QUrl PcmPlayer::source() const
+{
+    return currentSource;
+}
+
+// The decoder decodes the next source into its cache once the current one is decoded,
+// so setSource of it starts from memory
+void PcmPlayer::setNext(const QUrl &source)
+{
+    nextSource = source;
+    QMetaObject::invokeMethod(decoder, [=]() { decoder->setNext(source); }, Qt::QueuedConnection);
+}
+
+// Sets the memory the decoder may keep decoded sources in, see PcmCache
+void PcmPlayer::setCacheBudget(qint64 bytes)
+{
+    QMetaObject::invokeMethod(decoder, [=]() { decoder->setCacheBudget(bytes); }, Qt::QueuedConnection);
+}
+
+PcmCacheStats PcmPlayer::cacheStats() const
+{
+    return decoder->cacheStats();
+}
+
+// Starts or resumes the sink, before the first audio is decoded it waits for it idle
+void PcmPlayer::play()
+{
+    if (currentSource.isEmpty() || status == QMediaPlayer::InvalidMedia) return;
+
+    if (status == QMediaPlayer::EndOfMedia)
+    {
+        halt();
+        setStatus(QMediaPlayer::LoadedMedia);
+        restart(0);
+    }
+
+    if (sink->state() == QAudio::SuspendedState) sink->resume();
+    else if (sink->state() == QAudio::StoppedState) sink->start(&device);
+
+    setState(QMediaPlayer::PlayingState);
+    progressTimer.start();
+}
+
+void PcmPlayer::pause()
+{
+    if (state != QMediaPlayer::PlayingState) return;
+
+    sink->suspend();
+    progressTimer.stop();
+    setState(QMediaPlayer::PausedState);
+}
+
+// Stops playback, play starts the source from the beginning again
+void PcmPlayer::stop()
+{
+    if (state == QMediaPlayer::StoppedState) return;
+
+    halt();
+    setState(QMediaPlayer::StoppedState);
+    if (!currentSource.isEmpty()) restart(0);
+}
+
+bool PcmPlayer::isPlaying() const
+{
+    return state == QMediaPlayer::PlayingState;
+}
+
+QMediaPlayer::PlaybackState PcmPlayer::playbackState() const
+{
+    return state;
+}
+
+QMediaPlayer::MediaStatus PcmPlayer::mediaStatus() const
+{
+    return status;
+}
+
+// Milliseconds from the start of the source, counted from the frames the sink has processed
+qint64 PcmPlayer::position() const
+{
+    if (sink->state() == QAudio::StoppedState) return offset;
+    return offset + sink->processedUSecs() / 1000;
+}
+
+// Seeks by decoding again from position, the sink keeps playing once the decoder caught up
+void PcmPlayer::setPosition(qint64 position)
+{
+    if (currentSource.isEmpty()) return;
+    position = qBound<qint64>(0, position, length > 0 ? length : position);
+
+    bool playing = state == QMediaPlayer::PlayingState;
+    halt();
+    if (status == QMediaPlayer::EndOfMedia) setStatus(QMediaPlayer::LoadedMedia);
+    restart(position);
+
+    if (playing)
+    {
+        sink->start(&device);
+        progressTimer.start();
+    }
+    else if (state == QMediaPlayer::PausedState)
+    {
+        sink->start(&device);
+        sink->suspend();
+    }
+}
+
+qint64 PcmPlayer::duration() const
+{
+    return qMax<qint64>(length, 0);
+}
+
+// Ramps to volume within milliseconds, see GainRamp
+void PcmPlayer::setVolume(float volume)
+{
+    device.setVolume(volume);
+}
+
+float PcmPlayer::volume() const
+{
+    return device.volume();
+}
+
+// Starts decoding the current source at from milliseconds into the empty ring
+void PcmPlayer::restart(qint64 from)
+{
+    offset = from;
+    decoded = false;
+    int id = ++decodeId;
+    QUrl source = currentSource;
+    QAudioFormat decodeFormat = format;
+    QMetaObject::invokeMethod(decoder, [=]() { decoder->start(id, source, decodeFormat, from); }, Qt::QueuedConnection);
+}
+
+// Stops the sink and the decoder and empties the ring
+// The decoder is stopped before this returns, so neither side of the ring is in use after it
+void PcmPlayer::halt()
+{
+    progressTimer.stop();
+    sink->stop();
+    decodeId++;
+    QMetaObject::invokeMethod(decoder, [=]() { decoder->stop(); }, Qt::BlockingQueuedConnection);
+    ring.reset();
+}
+
+void PcmPlayer::setStatus(QMediaPlayer::MediaStatus newStatus)
+{
+    if (status == newStatus) return;
+    status = newStatus;
+    emit mediaStatusChanged(status);
+}
+
+void PcmPlayer::setState(QMediaPlayer::PlaybackState newState)
+{
+    if (state == newState) return;
+    state = newState;
+    emit playbackStateChanged(state);
+}
+
+void PcmPlayer::decoderLoaded(int id, qint64 duration)
+{
+    if (id != decodeId) return;
+    if (duration > 0) length = duration;
+    if (status == QMediaPlayer::LoadingMedia) setStatus(QMediaPlayer::LoadedMedia);
+}
+
+void PcmPlayer::decoderFinished(int id)
+{
+    if (id != decodeId) return;
+    decoded = true;
+    checkEnd();
+}
+
+void PcmPlayer::decoderFailed(int id, const QString &error)
+{
+    if (id != decodeId) return;
+    qDebug() << "Could not decode" << currentSource << error;
+
+    halt();
+    setState(QMediaPlayer::StoppedState);
+    setStatus(QMediaPlayer::InvalidMedia);
+}
+
+// The sink goes idle when the ring runs dry, at the end of the source or when the decoder fell behind
+void PcmPlayer::sinkStateChanged(QAudio::State sinkState)
+{
+    if (sinkState == QAudio::IdleState) checkEnd();
+}
+
+// Ends playback once everything decoded has been played
+void PcmPlayer::checkEnd()
+{
+    if (!decoded || state != QMediaPlayer::PlayingState) return;
+    if (sink->state() != QAudio::IdleState || ring.readable() >= format.channelCount() * qsizetype(sizeof(float))) return;
+
+    halt();
+    offset = qMax(offset, length);
+    setState(QMediaPlayer::StoppedState);
+
+    endTimer.start();
+    measuringGap = true;
+    setStatus(QMediaPlayer::EndOfMedia);
+}
+
+// Reports the position while playing and measures the gap after a track change
+// The first position after a change tells how long the audio has been running
+void PcmPlayer::tick()
+{
+    qint64 now = position();
+
+    if (measuringGap && now > offset)
+    {
+        measuringGap = false;
+        emit gapMeasured(qMax<qint64>(endTimer.nsecsElapsed() - (now - offset) * 1000000, 0));
+    }
+
+    emit positionChanged(now);
+}
@@ -0,0 +1,93 @@
+#ifndef PCMPLAYER_H
+#define PCMPLAYER_H
+
+#include "playbackengine.h"
+#include "pcmringbuffer.h"
+#include "pcmdecoder.h"
+#include "equalizer.h"
+#include <QAudioFormat>
+#include <QAudioSink>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QTimer>
+
+// Playback engine with its own decode and output pipeline
+//
+// A PcmDecoder on its own thread decodes the source with QAudioDecoder into a lock-free
+// single producer single consumer ring, a QAudioSink on this thread pulls from it through a
+// PcmRingDevice. The ring holds bufferUSecs of audio, which bounds the latency between the
+// decoder and the speaker. Resampling and the equalizer run in the DspChain of the decoder,
+// the volume is applied by the device so it changes without waiting for the ring. The
+// equalizer bands are read from the RHINO_EQUALIZER environment variable, see pcmplayer.cpp.
+//
+// The position is counted from the frames the sink has processed since the last seek, so it
+// is exact to the sample. Seeking restarts the decoder, from its cache if the source was
+// decoded before, see PcmDecoder.
+class PcmPlayer : public PlaybackEngine
+{
+    Q_OBJECT
+public:
+    explicit PcmPlayer(QObject *parent = nullptr);
+    ~PcmPlayer();
+
+    static const qint64 bufferUSecs = 500000;
+
+    void setSource(const QUrl &source) override;
+    QUrl source() const override;
+    void setNext(const QUrl &source) override;
+
+    void play() override;
+    void pause() override;
+    void stop() override;
+    bool isPlaying() const override;
+    QMediaPlayer::PlaybackState playbackState() const override;
+    QMediaPlayer::MediaStatus mediaStatus() const override;
+    qint64 position() const override;
+    void setPosition(qint64 position) override;
+    qint64 duration() const override;
+    void setVolume(float volume) override;
+    float volume() const override;
+
+    QAudioFormat audioFormat() const;
+    void setEqualizer(const QList<EqualizerBand> &bands);
+    QList<EqualizerBand> equalizer() const;
+    void setCacheBudget(qint64 bytes);
+    PcmCacheStats cacheStats() const;
+
+private:
+    static QAudioFormat outputFormat();
+
+    void restart(qint64 from);
+    void halt();
+    void setStatus(QMediaPlayer::MediaStatus status);
+    void setState(QMediaPlayer::PlaybackState state);
+    void decoderLoaded(int id, qint64 duration);
+    void decoderFinished(int id);
+    void decoderFailed(int id, const QString &error);
+    void sinkStateChanged(QAudio::State sinkState);
+    void checkEnd();
+    void tick();
+
+    QAudioFormat format;
+    PcmRingBuffer ring;
+    PcmRingDevice device;
+    QAudioSink *sink;
+    QThread decoderThread;
+    PcmDecoder *decoder;
+    QTimer progressTimer;
+
+    QList<EqualizerBand> bands;
+    QUrl currentSource;
+    QUrl nextSource;
+    int decodeId = 0;
+    qint64 offset = 0;          // milliseconds of the source before the sink started
+    qint64 length = -1;
+    bool decoded = false;
+    QMediaPlayer::MediaStatus status = QMediaPlayer::NoMedia;
+    QMediaPlayer::PlaybackState state = QMediaPlayer::StoppedState;
+
+    QElapsedTimer endTimer;
+    bool measuringGap = false;
+};
+
+#endif // PCMPLAYER_H
@@ -0,0 +1,156 @@
+#include "pcmringbuffer.h"
+#include <cstring>
+
+namespace {
+
+// Converts float samples to T, clamped to -1 to 1
+template<typename T>
+void fromFloat(const float *samples, qsizetype count, char *data, float bias, float scale)
+{
+    for (qsizetype i = 0; i < count; i++)
+    {
+        T value = T(qBound(-1.0f, samples[i], 1.0f) * scale + bias);
+        std::memcpy(data + i * sizeof(T), &value, sizeof(T));
+    }
+}
+
+}
+
+PcmRingBuffer::PcmRingBuffer(qsizetype capacity)
+{
+    quint64 size = 4096;
+    while (size < quint64(capacity)) size <<= 1;
+
+    buffer = QByteArray(qsizetype(size), 0);
+    mask = size - 1;
+}
+
+// Copies up to size bytes into the ring, returns how many fit
+// Producer side
+qsizetype PcmRingBuffer::write(const char *data, qsizetype size)
+{
+    quint64 h = head.load(std::memory_order_relaxed);
+    quint64 t = tail.load(std::memory_order_acquire);
+    qsizetype n = qMin(size, qsizetype(buffer.size() - (h - t)));
+    if (n <= 0) return 0;
+
+    qsizetype at = qsizetype(h & mask);
+    qsizetype first = qMin(n, buffer.size() - at);
+    char *ring = buffer.data();
+    std::memcpy(ring + at, data, first);
+    std::memcpy(ring, data + first, n - first);
+
+    head.store(h + n, std::memory_order_release);
+    return n;
+}
+
+// Copies up to size bytes out of the ring, returns how many were there
+// Consumer side
+qsizetype PcmRingBuffer::read(char *data, qsizetype size)
+{
+    quint64 t = tail.load(std::memory_order_relaxed);
+    quint64 h = head.load(std::memory_order_acquire);
+    qsizetype n = qMin(size, qsizetype(h - t));
+    if (n <= 0) return 0;
+
+    qsizetype at = qsizetype(t & mask);
+    qsizetype first = qMin(n, buffer.size() - at);
+    const char *ring = buffer.constData();
+    std::memcpy(data, ring + at, first);
+    std::memcpy(data + first, ring, n - first);
+
+    tail.store(t + n, std::memory_order_release);
+    return n;
+}
+
+// Bytes the consumer can read
+qsizetype PcmRingBuffer::readable() const
+{
+    return qsizetype(head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire));
+}
+
+// Bytes the producer can write
+qsizetype PcmRingBuffer::writable() const
+{
+    return buffer.size() - readable();
+}
+
+qsizetype PcmRingBuffer::capacity() const
+{
+    return buffer.size();
+}
+
+// Empties the ring, see the class comment
+void PcmRingBuffer::reset()
+{
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+}
+
+PcmRingDevice::PcmRingDevice(PcmRingBuffer *ring, const QAudioFormat &format)
+    : ring(ring), format(format), ringFrameBytes(qMax(format.channelCount(), 1) * qsizetype(sizeof(float)))
+{
+    gain.configure(format.sampleRate(), format.channelCount());
+}
+
+// Sets the volume, linear from 0 to 1, see GainRamp
+void PcmRingDevice::setVolume(float volume)
+{
+    gain.setGain(volume);
+}
+
+float PcmRingDevice::volume() const
+{
+    return gain.gain();
+}
+
+bool PcmRingDevice::isSequential() const
+{
+    return true;
+}
+
+qint64 PcmRingDevice::bytesAvailable() const
+{
+    return ring->readable() / ringFrameBytes * format.bytesPerFrame() + QIODevice::bytesAvailable();
+}
+
+// Reads whole frames, 0 when the decoder has not caught up, which leaves the sink idle until it has
+qint64 PcmRingDevice::readData(char *data, qint64 maxSize)
+{
+    if (format.bytesPerFrame() <= 0) return 0;
+
+    qsizetype frames = qsizetype(qMin<qint64>(maxSize / format.bytesPerFrame(), ring->readable() / ringFrameBytes));
+    if (frames <= 0) return 0;
+
+    const qsizetype count = frames * format.channelCount();
+    bool direct = format.sampleFormat() == QAudioFormat::Float;
+    if (!direct && scratch.size() < count) scratch.resize(count);
+    float *samples = direct ? reinterpret_cast<float *>(data) : scratch.data();
+
+    ring->read(reinterpret_cast<char *>(samples), frames * ringFrameBytes);
+    gain.process(samples, frames);
+
+    switch (format.sampleFormat())
+    {
+    case QAudioFormat::UInt8:
+        fromFloat<quint8>(samples, count, data, 128.0f, 127.0f);
+        break;
+    case QAudioFormat::Int16:
+        fromFloat<qint16>(samples, count, data, 0.0f, 32767.0f);
+        break;
+    case QAudioFormat::Int32:
+        fromFloat<qint32>(samples, count, data, 0.0f, 2147483520.0f);
+        break;
+    default:
+        break;
+    }
+
+    return frames * format.bytesPerFrame();
+}
+
+qint64 PcmRingDevice::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
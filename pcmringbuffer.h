@@ -0,0 +1,62 @@
+#ifndef PCMRINGBUFFER_H
+#define PCMRINGBUFFER_H
+
+#include "dspchain.h"
+#include <QIODevice>
+#include <QByteArray>
+#include <QAudioFormat>
+#include <QList>
+#include <atomic>
+
+// Lock-free ring of PCM bytes between one producer and one consumer thread
+//
+// The producer only moves head and the consumer only moves tail, both count bytes since the
+// last reset so the fill level is head - tail without a lock. Capacity is a power of two.
+// reset must only be called while neither side is using the ring.
+class PcmRingBuffer
+{
+public:
+    explicit PcmRingBuffer(qsizetype capacity);
+
+    qsizetype write(const char *data, qsizetype size);
+    qsizetype read(char *data, qsizetype size);
+    qsizetype readable() const;
+    qsizetype writable() const;
+    qsizetype capacity() const;
+    void reset();
+
+private:
+    QByteArray buffer;
+    quint64 mask;
+    std::atomic<quint64> head {0};  // bytes written, moved by the producer
+    std::atomic<quint64> tail {0};  // bytes read, moved by the consumer
+};
+
+// Sequential device a QAudioSink pulls from, reads whole frames out of a PcmRingBuffer
+//
+// The ring holds float frames with the channels of format, the device applies the volume
+// and converts them to the sample format of the sink. The device is the consumer of the ring.
+class PcmRingDevice : public QIODevice
+{
+public:
+    PcmRingDevice(PcmRingBuffer *ring, const QAudioFormat &format);
+
+    void setVolume(float volume);
+    float volume() const;
+
+    bool isSequential() const override;
+    qint64 bytesAvailable() const override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    PcmRingBuffer *ring;
+    QAudioFormat format;
+    qsizetype ringFrameBytes;
+    GainRamp gain;
+    QList<float> scratch;       // frames on their way to a sink that does not take float
+};
+
+#endif // PCMRINGBUFFER_H
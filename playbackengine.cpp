@@ -0,0 +1,10 @@
+#include "playbackengine.h"
+#include "gaplessplayer.h"
+#include "pcmplayer.h"
+
+// Returns a new engine, see the class comment
+PlaybackEngine *PlaybackEngine::create(QObject *parent)
+{
+    if (qEnvironmentVariable("RHINO_PLAYBACK_ENGINE") == "pcm") return new PcmPlayer(parent);
+    return new GaplessPlayer(parent);
+}
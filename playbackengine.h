@@ -0,0 +1,48 @@
+#ifndef PLAYBACKENGINE_H
+#define PLAYBACKENGINE_H
+
+#include <QObject>
+#include <QMediaPlayer>
+#include <QUrl>
+
+// Plays the songs of MusicPlayer
+//
+// The interface is the part of QMediaPlayer MusicPlayer uses, plus setNext to announce the
+// source that follows the current one. GaplessPlayer plays through QMediaPlayer, PcmPlayer
+// decodes on a thread of its own and writes the samples to a QAudioSink.
+//
+// create picks the engine named by the RHINO_PLAYBACK_ENGINE environment variable,
+// "pcm" for PcmPlayer and GaplessPlayer otherwise. Only PcmPlayer has an equalizer.
+class PlaybackEngine : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PlaybackEngine(QObject *parent = nullptr) : QObject{parent} {}
+
+    static PlaybackEngine *create(QObject *parent = nullptr);
+
+    virtual void setSource(const QUrl &source) = 0;
+    virtual QUrl source() const = 0;
+    virtual void setNext(const QUrl &source) = 0;
+
+    virtual void play() = 0;
+    virtual void pause() = 0;
+    virtual void stop() = 0;
+    virtual bool isPlaying() const = 0;
+    virtual QMediaPlayer::PlaybackState playbackState() const = 0;
+    virtual QMediaPlayer::MediaStatus mediaStatus() const = 0;
+    virtual qint64 position() const = 0;
+    virtual void setPosition(qint64 position) = 0;
+    virtual qint64 duration() const = 0;
+    virtual void setVolume(float volume) = 0;
+    virtual float volume() const = 0;
+
+signals:
+    void mediaStatusChanged(QMediaPlayer::MediaStatus status);
+    void playbackStateChanged(QMediaPlayer::PlaybackState state);
+    void positionChanged(qint64 position);
+    // nanoseconds from the end of a track to the first audio of the next
+    void gapMeasured(qint64 gap);
+};
+
+#endif // PLAYBACKENGINE_H
@@ -0,0 +1,309 @@
+#include "queuetree.h"
+
+// Returns the number of songs
+int QueueTree::count() const
+{
+    return size(roots[Original], Original);
+}
+
+// Returns true if the play order has its own tree
+bool QueueTree::isShuffled() const
+{
+    return shuffled;
+}
+
+// Returns the song in row of order, a null handle if row is out of range
+SongHandle QueueTree::song(int row, Order order) const
+{
+    int node = at(row, tree(order));
+    return node < 0 ? SongHandle() : nodes[node].song;
+}
+
+// Returns the row in order to of the song in row of order from, -1 if row is out of range
+int QueueTree::mapRow(int row, Order from, Order to) const
+{
+    int node = at(row, tree(from));
+    return node < 0 ? -1 : rank(node, tree(to));
+}
+
+// Inserts song before playRow in the play order and before originalRow in the original order
+// Unshuffled playRow is ignored, rows past the end append
+void QueueTree::insert(int playRow, int originalRow, const SongHandle &song)
+{
+    int node = allocate(song);
+    int left, right;
+
+    split(roots[Original], qBound(0, originalRow, count()), Original, left, right);
+    setRoot(merge(merge(left, node, Original), right, Original), Original);
+
+    if (!shuffled) return;
+
+    split(roots[Play], qBound(0, playRow, count() - 1), Play, left, right);
+    setRoot(merge(merge(left, node, Play), right, Play), Play);
+}
+
+// Inserts songs as one block before playRow in the play order and before originalRow in the
+// original order, the block is built in linear time and joined to each tree in O(log n)
+void QueueTree::insert(int playRow, int originalRow, const QList<SongHandle> &songs)
+{
+    if (songs.isEmpty()) return;
+
+    QList<int> sequence;
+    sequence.reserve(songs.count());
+    for (const SongHandle &song : songs) sequence.append(allocate(song));
+
+    int left, right;
+
+    split(roots[Original], qBound(0, originalRow, count()), Original, left, right);
+    setRoot(merge(merge(left, build(sequence, Original), Original), right, Original), Original);
+
+    if (!shuffled) return;
+
+    split(roots[Play], qBound(0, playRow, count() - int(songs.count())), Play, left, right);
+    setRoot(merge(merge(left, build(sequence, Play), Play), right, Play), Play);
+}
+
+// Removes count rows starting at row of order from both orders
+void QueueTree::remove(int row, int count, Order order)
+{
+    int from = tree(order);
+    int left, middle, right;
+
+    split(roots[from], qMax(row, 0), from, left, right);
+    split(right, qMax(count, 0), from, middle, right);
+    setRoot(merge(left, right, from), from);
+
+    QList<int> removed;
+    collect(middle, from, removed);
+
+    for (int node : removed)
+    {
+        if (shuffled)
+        {
+            int other = from == Play ? Original : Play;
+            split(roots[other], rank(node, other), other, left, right);
+            split(right, 1, other, middle, right);
+            setRoot(merge(left, right, other), other);
+        }
+
+        nodes[node].song = SongHandle();
+        freeNodes.append(node);
+    }
+}
+
+// Moves count rows starting at row of order so the first of them ends up at destination
+// destination is a row of the order without the moved rows, the other order keeps its rows
+void QueueTree::move(int row, int count, int destination, Order order)
+{
+    int from = tree(order);
+    int left, middle, right;
+
+    split(roots[from], qMax(row, 0), from, left, right);
+    split(right, qMax(count, 0), from, middle, right);
+    int rest = merge(left, right, from);
+    setRoot(rest, from);
+
+    split(rest, qBound(0, destination, size(rest, from)), from, left, right);
+    setRoot(merge(merge(left, middle, from), right, from), from);
+}
+
+// Builds the play order, order[playRow] is the original row of the song played at playRow
+// order must hold every original row once
+void QueueTree::shuffle(const QList<int> &order)
+{
+    QList<int> original;
+    original.reserve(count());
+    collect(roots[Original], Original, original);
+
+    QList<int> sequence;
+    sequence.reserve(order.count());
+    for (int row : order) sequence.append(original[row]);
+
+    shuffled = true;
+    setRoot(build(sequence, Play), Play);
+}
+
+// Drops the play order, songs are played in the original order again
+void QueueTree::unshuffle()
+{
+    shuffled = false;
+    roots[Play] = -1;
+}
+
+// Removes every song
+void QueueTree::clear()
+{
+    nodes.clear();
+    freeNodes.clear();
+    roots[Original] = roots[Play] = -1;
+    shuffled = false;
+}
+
+// Returns the tree holding order, the original tree serves the play order when unshuffled
+int QueueTree::tree(Order order) const
+{
+    return shuffled ? order : Original;
+}
+
+// Returns a new node without links in either tree
+int QueueTree::allocate(const SongHandle &song)
+{
+    Node node;
+    node.song = song;
+    node.priority = random.generate();
+
+    if (freeNodes.isEmpty())
+    {
+        nodes.append(node);
+        return nodes.count() - 1;
+    }
+
+    int ret = freeNodes.takeLast();
+    nodes[ret] = node;
+    return ret;
+}
+
+int QueueTree::size(int node, int tree) const
+{
+    return node < 0 ? 0 : nodes[node].links[tree].size;
+}
+
+// Recounts the size of node and points its children back at it
+void QueueTree::update(int node, int tree)
+{
+    Link &link = nodes[node].links[tree];
+    link.size = 1 + size(link.left, tree) + size(link.right, tree);
+    if (link.left >= 0) nodes[link.left].links[tree].parent = node;
+    if (link.right >= 0) nodes[link.right].links[tree].parent = node;
+}
+
+// Splits the subtree of node into its first rows rows and the rest
+void QueueTree::split(int node, int rows, int tree, int &left, int &right)
+{
+    if (node < 0)
+    {
+        left = right = -1;
+        return;
+    }
+
+    Link &link = nodes[node].links[tree];
+    if (size(link.left, tree) >= rows)
+    {
+        split(link.left, rows, tree, left, link.left);
+        update(node, tree);
+        right = node;
+    }
+    else
+    {
+        split(link.right, rows - size(link.left, tree) - 1, tree, link.right, right);
+        update(node, tree);
+        left = node;
+    }
+}
+
+// Joins two subtrees, every row of left comes before every row of right
+int QueueTree::merge(int left, int right, int tree)
+{
+    if (left < 0) return right;
+    if (right < 0) return left;
+
+    if (nodes[left].priority > nodes[right].priority)
+    {
+        int child = merge(nodes[left].links[tree].right, right, tree);
+        nodes[left].links[tree].right = child;
+        update(left, tree);
+        return left;
+    }
+
+    int child = merge(left, nodes[right].links[tree].left, tree);
+    nodes[right].links[tree].left = child;
+    update(right, tree);
+    return right;
+}
+
+// Makes node the root of tree, rank stops at the node without a parent
+void QueueTree::setRoot(int node, int tree)
+{
+    roots[tree] = node;
+    if (node >= 0) nodes[node].links[tree].parent = -1;
+}
+
+// Returns the node in row of tree, -1 if row is out of range
+int QueueTree::at(int row, int tree) const
+{
+    int node = roots[tree];
+    while (node >= 0)
+    {
+        const Link &link = nodes[node].links[tree];
+        int left = size(link.left, tree);
+
+        if (row < left) node = link.left;
+        else if (row == left) return node;
+        else
+        {
+            row -= left + 1;
+            node = link.right;
+        }
+    }
+    return -1;
+}
+
+// Returns the row of node in tree
+int QueueTree::rank(int node, int tree) const
+{
+    int ret = size(nodes[node].links[tree].left, tree);
+    for (int parent = nodes[node].links[tree].parent; parent >= 0; parent = nodes[node].links[tree].parent)
+    {
+        if (nodes[parent].links[tree].right == node) ret += size(nodes[parent].links[tree].left, tree) + 1;
+        node = parent;
+    }
+    return ret;
+}
+
+// Appends the nodes of the subtree of node to out in order
+void QueueTree::collect(int node, int tree, QList<int> &out) const
+{
+    QList<int> stack;
+    while (node >= 0 || !stack.isEmpty())
+    {
+        while (node >= 0)
+        {
+            stack.append(node);
+            node = nodes[node].links[tree].left;
+        }
+
+        node = stack.takeLast();
+        out.append(node);
+        node = nodes[node].links[tree].right;
+    }
+}
+
+// Builds tree from nodes in order in O(n) and returns its root
+//
+// The right spine is kept on a stack, a node takes the spine nodes of lower priority as its
+// left subtree. A node is complete once it leaves the stack, which is when it is sized
+int QueueTree::build(const QList<int> &sequence, int tree)
+{
+    QList<int> stack;
+
+    for (int node : sequence)
+    {
+        nodes[node].links[tree] = Link();
+
+        int last = -1;
+        while (!stack.isEmpty() && nodes[stack.last()].priority < nodes[node].priority)
+        {
+            last = stack.takeLast();
+            update(last, tree);
+        }
+
+        nodes[node].links[tree].left = last;
+        if (!stack.isEmpty()) nodes[stack.last()].links[tree].right = node;
+        stack.append(node);
+    }
+
+    int root = stack.isEmpty() ? -1 : stack.first();
+    while (!stack.isEmpty()) update(stack.takeLast(), tree);
+
+    return root;
+}
@@ -0,0 +1,70 @@
+#ifndef QUEUETREE_H
+#define QUEUETREE_H
+
+#include "songhandle.h"
+#include <QList>
+#include <QRandomGenerator>
+
+// Stores the songs of the queue in their original order and, when shuffled, their play order
+//
+// Every song is one node in two implicit treaps, one per order, sized so a row is found by
+// walking down and parent linked so the row of a node in the other order is found by walking
+// up. Finding, mapping, inserting and removing a row take O(log n) expected, a range of k rows
+// O(k log n) when shuffled and O(log n + k) when not. Unshuffled the play order is the original
+// order and only the original tree is kept, shuffle builds the play tree in O(n).
+// A block of k songs inserted together is built into a subtree first, O(k + log n).
+class QueueTree
+{
+public:
+    enum Order { Original = 0, Play = 1 };
+
+    QueueTree() = default;
+
+    int count() const;
+    bool isShuffled() const;
+    SongHandle song(int row, Order order = Play) const;
+    int mapRow(int row, Order from, Order to) const;
+    void insert(int playRow, int originalRow, const SongHandle &song);
+    void insert(int playRow, int originalRow, const QList<SongHandle> &songs);
+    void remove(int row, int count, Order order = Play);
+    void move(int row, int count, int destination, Order order = Play);
+    void shuffle(const QList<int> &order);
+    void unshuffle();
+    void clear();
+
+private:
+    struct Link
+    {
+        int left = -1;
+        int right = -1;
+        int parent = -1;
+        int size = 1;
+    };
+
+    struct Node
+    {
+        SongHandle song;
+        quint32 priority = 0;
+        Link links[2];
+    };
+
+    int tree(Order order) const;
+    int allocate(const SongHandle &song);
+    int size(int node, int tree) const;
+    void update(int node, int tree);
+    void split(int node, int rows, int tree, int &left, int &right);
+    int merge(int left, int right, int tree);
+    void setRoot(int node, int tree);
+    int at(int row, int tree) const;
+    int rank(int node, int tree) const;
+    void collect(int node, int tree, QList<int> &out) const;
+    int build(const QList<int> &sequence, int tree);
+
+    QList<Node> nodes;
+    QList<int> freeNodes;
+    int roots[2] = {-1, -1};
+    bool shuffled = false;
+    QRandomGenerator random;
+};
+
+#endif // QUEUETREE_H
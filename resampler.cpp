@@ -0,0 +1,180 @@
+#include "resampler.h"
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+namespace {
+
+// Modified Bessel function of the first kind of order 0, for the Kaiser window
+double besselI0(double x)
+{
+    double sum = 1;
+    double term = 1;
+    for (int k = 1; k < 50; k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+}
+
+Resampler::Resampler(const DspKernels &kernels)
+    : kernels(&kernels)
+{}
+
+// Converts from inputRate to outputRate from now on, the filter is only designed again when the rates change
+void Resampler::configure(int inputRate, int outputRate, int channels)
+{
+    if (inputRate == fromRate && outputRate == toRate && channels == this->channels) return;
+
+    fromRate = qMax(inputRate, 1);
+    toRate = qMax(outputRate, 1);
+    this->channels = qMax(channels, 1);
+
+    int divisor = std::gcd(fromRate, toRate);
+    up = toRate / divisor;
+    down = fromRate / divisor;
+
+    // Continued fraction convergents of toRate / fromRate until the next one has too many phases
+    if (up > maxPhases)
+    {
+        qint64 p0 = 0, p1 = 1, q0 = 1, q1 = 0;
+        qint64 numerator = toRate, denominator = fromRate;
+        while (denominator != 0)
+        {
+            qint64 a = numerator / denominator;
+            qint64 p2 = a * p1 + p0, q2 = a * q1 + q0;
+            if (p2 > maxPhases) break;
+            p0 = p1; p1 = p2;
+            q0 = q1; q1 = q2;
+            qint64 remainder = numerator - a * denominator;
+            numerator = denominator;
+            denominator = remainder;
+        }
+        up = int(qMax<qint64>(p1, 1));
+        down = int(qMax<qint64>(q1, 1));
+    }
+
+    design();
+    reset();
+}
+
+int Resampler::inputRate() const
+{
+    return fromRate;
+}
+
+int Resampler::outputRate() const
+{
+    return toRate;
+}
+
+bool Resampler::isPassthrough() const
+{
+    return up == down;
+}
+
+// Output frames per input frame, up / down
+double Resampler::ratio() const
+{
+    return double(up) / down;
+}
+
+// Output frames the audio lags behind, half the filter
+double Resampler::latency() const
+{
+    if (isPassthrough()) return 0;
+    return (double(taps) * up - 1) / (2.0 * down);
+}
+
+// Most frames process writes for frames of input
+qsizetype Resampler::maxOutput(qsizetype frames) const
+{
+    if (isPassthrough()) return frames;
+    return (frames * up) / down + 2;
+}
+
+// Converts frames of interleaved input, returns the frames written to output
+// The output must have room for maxOutput(frames) frames
+qsizetype Resampler::process(const float *input, qsizetype frames, float *output)
+{
+    if (isPassthrough())
+    {
+        std::memcpy(output, input, size_t(frames) * channels * sizeof(float));
+        return frames;
+    }
+
+    const qsizetype keep = taps - 1;
+    const qsizetype span = keep + frames;
+
+    // Planar copy of the kept samples followed by the new ones
+    if (planar.size() < channels * span) planar.resize(channels * span);
+    float *next = planar.data();
+    for (int c = 0; c < channels; c++)
+    {
+        float *to = next + c * span;
+        std::memcpy(to, window.constData() + c * keep, size_t(keep) * sizeof(float));
+        for (qsizetype i = 0; i < frames; i++) to[keep + i] = input[i * channels + c];
+    }
+
+    qsizetype written = 0;
+    while (position < frames)
+    {
+        const float *filter = coefficients.constData() + qsizetype(phase) * taps;
+        for (int c = 0; c < channels; c++) output[written * channels + c] = kernels->dot(filter, next + c * span + position, taps);
+        written++;
+
+        phase += down;
+        position += phase / up;
+        phase %= up;
+    }
+    position -= frames;
+
+    for (int c = 0; c < channels; c++) std::memcpy(window.data() + c * keep, next + c * span + frames, size_t(keep) * sizeof(float));
+
+    return written;
+}
+
+// Forgets the input so far, the next input starts after silence
+void Resampler::reset()
+{
+    window = QList<float>(qsizetype(channels) * (taps - 1), 0);
+    position = 0;
+    phase = 0;
+}
+
+// Kaiser windowed sinc at up times the input rate, scaled by up for the gain lost to the zeros between the input samples
+void Resampler::design()
+{
+    coefficients.clear();
+    if (isPassthrough()) return;
+
+    const double pi = 3.14159265358979323846;
+    const double beta = 9.0;
+    const double rolloff = 0.95;
+
+    const int length = taps * up;
+    const double cutoff = 0.5 * rolloff * qMin(1.0, double(up) / down) / up;    // cycles per sample at the upsampled rate
+    const double centre = (length - 1) / 2.0;
+    const double norm = besselI0(beta);
+
+    QList<double> prototype(length);
+    for (int t = 0; t < length; t++)
+    {
+        double x = t - centre;
+        double sinc = x == 0 ? 2 * cutoff : std::sin(2 * pi * cutoff * x) / (pi * x);
+        double ratio = x / centre;
+        double kaiser = besselI0(beta * std::sqrt(qMax(0.0, 1 - ratio * ratio))) / norm;
+        prototype[t] = sinc * kaiser * up;
+    }
+
+    // Output m of phase p takes input n - k with coefficient h[p + k * up], stored so tap j meets input n - (taps - 1) + j
+    coefficients.resize(qsizetype(up) * taps);
+    for (int p = 0; p < up; p++)
+    {
+        for (int j = 0; j < taps; j++) coefficients[qsizetype(p) * taps + j] = float(prototype[p + (taps - 1 - j) * up]);
+    }
+}
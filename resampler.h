@@ -0,0 +1,51 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include "dspkernels.h"
+#include <QList>
+
+// Polyphase windowed sinc sample rate converter for interleaved float audio
+//
+// The output rate is the input rate times up / down, the ratio reduced to lowest terms. Every
+// output sample is the dot product of taps input samples with one of up phases of a Kaiser
+// windowed sinc low-pass at the lower Nyquist frequency of the two rates. Ratios with more than
+// maxPhases phases are approximated by the closest ratio that has at most that many.
+//
+// Input is kept per channel in planar order so every dot product reads contiguous samples.
+class Resampler
+{
+public:
+    static const int taps = 128;
+    static const int maxPhases = 2048;
+
+    explicit Resampler(const DspKernels &kernels = DspKernels::best());
+
+    void configure(int inputRate, int outputRate, int channels);
+    int inputRate() const;
+    int outputRate() const;
+    bool isPassthrough() const;
+    double ratio() const;
+    double latency() const;
+
+    qsizetype maxOutput(qsizetype frames) const;
+    qsizetype process(const float *input, qsizetype frames, float *output);
+    void reset();
+
+private:
+    void design();
+
+    const DspKernels *kernels;
+    int fromRate = 0;
+    int toRate = 0;
+    int channels = 0;
+    int up = 1;
+    int down = 1;
+
+    QList<float> coefficients;  // taps per phase, in the order of the input samples
+    QList<float> window;        // per channel the last taps - 1 input samples
+    QList<float> planar;        // per channel the window followed by the new input
+    qsizetype position = 0;     // input frame of the next output, counted from the new ones
+    int phase = 0;
+};
+
+#endif // RESAMPLER_H
@@ -0,0 +1,622 @@
+#include "scanworker.h"
+#include <QtSql/QSqlError>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QUrl>
+#include <QDir>
+#include <QDebug>
+
+static const QString connectionName = "ScanWorker";
+
+ScanWorker::ScanWorker(QObject *parent)
+    : QObject{parent}, scanner(this), flushTimer(this)
+{
+    flushTimer.setSingleShot(true);
+    flushTimer.setInterval(flushMsecs);
+    QObject::connect(&flushTimer, &QTimer::timeout, this, &ScanWorker::commitBatch);
+
+    QObject::connect(&scanner, &LibraryScanner::fileScanned, this, &ScanWorker::writeResult);
+    QObject::connect(&scanner, &LibraryScanner::finished,    this, &ScanWorker::finish);
+}
+
+// Runs on the worker thread when the thread finishes, see MusicDatabase
+ScanWorker::~ScanWorker()
+{
+    close();
+}
+
+// Stops the running scan, rows already written are kept
+void ScanWorker::cancel()
+{
+    cancelled.storeRelease(1);
+
+    {
+        QMutexLocker locker(&pauseLock);
+        resumed.wakeAll();
+    }
+
+    QMetaObject::invokeMethod(this, [this]() { scanner.cancel(); }, Qt::QueuedConnection);
+}
+
+// Pauses or resumes the running scan
+// The walk blocks before its next file and the reading pool stops starting new files
+void ScanWorker::setPaused(bool pause)
+{
+    {
+        QMutexLocker locker(&pauseLock);
+        paused = pause;
+        if (!pause) resumed.wakeAll();
+    }
+
+    QMetaObject::invokeMethod(this, [this, pause]() { scanner.setPaused(pause); }, Qt::QueuedConnection);
+}
+
+bool ScanWorker::isPaused()
+{
+    QMutexLocker locker(&pauseLock);
+    return paused;
+}
+
+// Returns the number of files read and to be read, rates are worked out by the caller
+ScanProgress ScanWorker::progress()
+{
+    ScanProgress ret;
+    ret.searching = searching.loadAcquire();
+    ret.paused = isPaused();
+    ret.done = done.loadAcquire();
+    ret.total = total.loadAcquire();
+    return ret;
+}
+
+// Sets the number of rows committed per transaction
+// Larger batches mean fewer fsyncs, rows wait at most flushMsecs before they are written
+void ScanWorker::setBatchSize(int size)
+{
+    batch.storeRelease(qMax(1, size));
+}
+
+int ScanWorker::batchSize()
+{
+    return batch.loadAcquire();
+}
+
+// Opens the worker's own connection to the database
+// A lock held by the GUI thread's connection is waited on for up to five seconds instead of failing
+bool ScanWorker::open(const QString &databasePath)
+{
+    close();
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(databasePath);
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+
+    if (!db.open())
+    {
+        qDebug() << "Scan Database Error: " << db.lastError();
+        return false;
+    }
+
+    // The journal mode is stored in the database, synchronous and foreign keys are per connection
+    // Foreign keys keep a song from being written against an album or artist that is not there
+    QSqlQuery query(db);
+    if (!query.exec("PRAGMA synchronous=NORMAL;")) { qDebug() << query.lastError(); }
+    if (!query.exec("PRAGMA foreign_keys=ON;")) { qDebug() << query.lastError(); }
+
+    searchAvailable = db.tables().contains("SongSearch");
+    return true;
+}
+
+// Closes the worker's connection, the database file can be removed afterwards
+// Results not written yet are dropped, this only happens once the scan was cancelled
+void ScanWorker::close()
+{
+    resetWriter();
+    pendingResults.clear();
+    flushTimer.stop();
+    if (!QSqlDatabase::contains(connectionName)) { return; }
+
+    QSqlDatabase::database(connectionName, false).close();
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+QSqlDatabase ScanWorker::database()
+{
+    return QSqlDatabase::database(connectionName, false);
+}
+
+// Scans a folder, see MusicDatabase::scanFolder
+// Files are compared against the fingerprint stored when they were last scanned
+// only new and changed files are read, rows for files that no longer exist are removed
+void ScanWorker::scanFolder(const QString &directory)
+{
+    begin();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QSqlDatabase db = database();
+    QHash<QString, FileFingerprint> known = getFingerprints(db, directory);
+
+    QStringList scanList;
+    QDirIterator ittr(directory, LibraryScanner::nameFilters(), QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (ittr.hasNext())
+    {
+        if (!waitWhilePaused()) { finish(); return; }
+
+        QString file = ittr.next();
+        auto entry = known.find(QUrl::fromLocalFile(file).toString());
+
+        if (entry == known.end())
+        {
+            summary.added++;
+            newFiles.insert(file);
+        }
+        else
+        {
+            bool unchanged = *entry == LibraryScanner::fingerprint(file);
+            known.erase(entry);
+            if (unchanged) { summary.unchanged++; continue; }
+            summary.changed++;
+        }
+
+        scanList << file;
+        total.fetchAndAddRelease(1);
+    }
+
+    // Whatever is left in known was not found on disk
+    QStringList removed;
+    for (auto it = known.cbegin(); it != known.cend(); ++it) { removed << QUrl(it.key()).toLocalFile(); }
+    summary.removed = removed.count();
+    summary.walkNs = timer.nsecsElapsed();
+
+    if (!removed.isEmpty())
+    {
+        timer.start();
+        db.transaction();
+        if (deleteFiles(db, removed, &summary.removedIds) && removeOrphans(db))
+        {
+            bumpGeneration(db);
+            db.commit();
+        }
+        else db.rollback();
+        summary.removeNs = timer.nsecsElapsed();
+    }
+
+    startReading(scanList);
+}
+
+// Scans the given files, see MusicDatabase::scanFiles
+// Files that no longer exist or that have not changed since they were stored are skipped
+void ScanWorker::scanFiles(const QStringList &files)
+{
+    begin();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QSqlQuery query(database());
+    query.prepare("SELECT Size, MTime, Inode FROM Songs WHERE File = :file;");
+
+    QStringList scanList;
+    QSet<QString> seen;
+    for (const QString &file : files)
+    {
+        if (!waitWhilePaused()) { finish(); return; }
+        if (seen.contains(file) || !LibraryScanner::isMediaFile(file)) { continue; }
+        seen.insert(file);
+
+        FileFingerprint current = LibraryScanner::fingerprint(file);
+        if (current.size < 0) { continue; }
+
+        query.bindValue(":file", QUrl::fromLocalFile(file).toString());
+        if (!query.exec())
+        {
+            qDebug() << query.lastError();
+            qDebug () << query.lastQuery();
+            break;
+        }
+
+        if (!query.next())
+        {
+            summary.added++;
+            newFiles.insert(file);
+        }
+        else
+        {
+            FileFingerprint stored;
+            if (!query.isNull(0)) stored.size  = query.value(0).toLongLong();
+            if (!query.isNull(1)) stored.mtime = query.value(1).toLongLong();
+            if (!query.isNull(2)) stored.inode = query.value(2).toLongLong();
+            if (stored == current) { summary.unchanged++; continue; }
+            summary.changed++;
+        }
+
+        scanList << file;
+        total.fetchAndAddRelease(1);
+    }
+    query.finish();
+    summary.walkNs = timer.nsecsElapsed();
+
+    startReading(scanList);
+}
+
+// Resets the counters and prepares the writer for a new scan
+void ScanWorker::begin()
+{
+    summary = ScanSummary();
+    newFiles.clear();
+    scanTimer.start();
+    cancelled.storeRelease(0);
+    done.storeRelease(0);
+    total.storeRelease(0);
+    searching.storeRelease(1);
+    prepareWriter();
+}
+
+// Hands the files found by the walk to the reading pool
+void ScanWorker::startReading(const QStringList &files)
+{
+    searching.storeRelease(0);
+
+    if (files.isEmpty() || cancelled.loadAcquire()) { finish(); return; }
+
+    scanner.scan(files);
+    if (isPaused()) scanner.setPaused(true);
+}
+
+// Blocks the walk while the scan is paused, returns false once the scan is cancelled
+bool ScanWorker::waitWhilePaused()
+{
+    QMutexLocker locker(&pauseLock);
+    while (paused && !cancelled.loadAcquire()) resumed.wait(&pauseLock);
+    return !cancelled.loadAcquire();
+}
+
+// Commits the last batch and reports the outcome of the scan
+// A last batch that cannot be committed is dropped, its files are read again by the next scan
+void ScanWorker::finish()
+{
+    if (!commitBatch())
+    {
+        qDebug() << "Scan could not write" << pendingResults.count() << "files";
+        pendingResults.clear();
+        flushTimer.stop();
+    }
+
+    // Changed files may have moved to another album
+    if (summary.changed > 0 && database().isOpen()) removeOrphans(database());
+
+    resetWriter();
+    newFiles.clear();
+    searching.storeRelease(0);
+    summary.cancelled = cancelled.loadAcquire();
+    summary.artWritten = scanner.artFilesWritten();
+    summary.artBytes = scanner.artBytesWritten();
+    summary.totalNs = scanTimer.nsecsElapsed();
+
+    emit finished(summary);
+}
+
+// Prepares the statements used to write scan results
+// Songs are upserted on File so a rescanned file keeps its SongID
+void ScanWorker::prepareWriter()
+{
+    QSqlDatabase db = database();
+
+    scanArtistInsert = QSqlQuery(db);
+    scanArtistInsert.prepare("INSERT OR IGNORE INTO Artists (Name) VALUES (:name);");
+    scanArtistSelect = QSqlQuery(db);
+    scanArtistSelect.prepare("SELECT ArtistID FROM Artists WHERE Name = :name;");
+
+    scanAlbumInsert = QSqlQuery(db);
+    scanAlbumInsert.prepare("INSERT OR IGNORE INTO Albums (ArtistID, Name) VALUES (:artistID, :name);");
+    scanAlbumSelect = QSqlQuery(db);
+    scanAlbumSelect.prepare("SELECT AlbumID FROM Albums WHERE ArtistID = :artistID AND Name = :name;");
+
+    scanInsert = QSqlQuery(db);
+    scanInsert.prepare("INSERT INTO "
+                       "Songs  ( File,  AlbumID,  ContributingArtist,  Track,  Title,  Image,  Duration,  Size,  MTime,  Inode) "
+                       "VALUES (:file, :albumID, :contributingArtist, :track, :title, :image, :duration, :size, :mtime, :inode) "
+                       "ON CONFLICT (File) DO UPDATE SET "
+                       "AlbumID = excluded.AlbumID, ContributingArtist = excluded.ContributingArtist, "
+                       "Track = excluded.Track, Title = excluded.Title, Image = excluded.Image, "
+                       "Duration = excluded.Duration, Size = excluded.Size, MTime = excluded.MTime, Inode = excluded.Inode "
+                       "RETURNING SongID;");
+
+    // Replaces the search row of a rescanned song
+    scanSearchInsert = QSqlQuery(db);
+    if (searchAvailable)
+    {
+        scanSearchInsert.prepare("INSERT OR REPLACE INTO "
+                                 "SongSearch (rowid, Title, Artist, Album, ContributingArtist) "
+                                 "VALUES (:songID, :title, :artist, :album, :contributingArtist);");
+    }
+
+    artistIds.clear();
+    albumIds.clear();
+    pendingResults.clear();
+}
+
+// Releases the prepared statements so the connection can be closed
+void ScanWorker::resetWriter()
+{
+    scanInsert = QSqlQuery();
+    scanSearchInsert = QSqlQuery();
+    scanArtistInsert = QSqlQuery();
+    scanArtistSelect = QSqlQuery();
+    scanAlbumInsert = QSqlQuery();
+    scanAlbumSelect = QSqlQuery();
+}
+
+// Returns the id of an artist, adding the artist if it does not exist yet
+// Ids are cached for the length of a scan, returns -1 on error
+qint64 ScanWorker::getArtistId(const QString &name)
+{
+    auto cached = artistIds.constFind(name);
+    if (cached != artistIds.constEnd()) { return *cached; }
+
+    scanArtistInsert.bindValue(":name", name);
+    scanArtistSelect.bindValue(":name", name);
+    if (!scanArtistInsert.exec() || !scanArtistSelect.exec() || !scanArtistSelect.next())
+    {
+        qDebug() << scanArtistInsert.lastError() << scanArtistSelect.lastError();
+        return -1;
+    }
+
+    qint64 id = scanArtistSelect.value(0).toLongLong();
+    scanArtistSelect.finish();
+    artistIds.insert(name, id);
+    return id;
+}
+
+// Returns the id of an album by an artist, adding the album if it does not exist yet
+qint64 ScanWorker::getAlbumId(qint64 artistId, const QString &name)
+{
+    QPair<qint64, QString> key(artistId, name);
+    auto cached = albumIds.constFind(key);
+    if (cached != albumIds.constEnd()) { return *cached; }
+
+    scanAlbumInsert.bindValue(":artistID", artistId);
+    scanAlbumInsert.bindValue(":name", name);
+    scanAlbumSelect.bindValue(":artistID", artistId);
+    scanAlbumSelect.bindValue(":name", name);
+    if (!scanAlbumInsert.exec() || !scanAlbumSelect.exec() || !scanAlbumSelect.next())
+    {
+        qDebug() << scanAlbumInsert.lastError() << scanAlbumSelect.lastError();
+        return -1;
+    }
+
+    qint64 id = scanAlbumSelect.value(0).toLongLong();
+    scanAlbumSelect.finish();
+    albumIds.insert(key, id);
+    return id;
+}
+
+// Takes the metadata of a scanned file to be written with the next batch
+// Called once for every file handed to the scanner, files that could not be read are skipped
+// and counted as failed instead of added or changed, they are read again by the next scan
+//
+// The batch is written once it holds batch rows or flushMsecs after its first row,
+// and once more when the scan finishes
+void ScanWorker::writeResult(const ScanResult &result)
+{
+    done.fetchAndAddRelease(1);
+    summary.readNs += result.readNs;
+    summary.artNs += result.artNs;
+    if (cancelled.loadAcquire()) { return; }
+    if (!result.ok)
+    {
+        countFailed(result.file);
+        return;
+    }
+
+    pendingResults.append(result);
+    if (pendingResults.size() >= batch.loadAcquire()) { commitBatch(); }
+    else if (!flushTimer.isActive()) { flushTimer.start(); }
+}
+
+// Counts a file that was not stored as failed instead of added or changed
+void ScanWorker::countFailed(const QString &file)
+{
+    summary.failed++;
+    if (newFiles.contains(file)) summary.added--;
+    else summary.changed--;
+}
+
+// Inserts the metadata of a scanned file, the caller handles the transaction
+// Returns false without writing if its artist or album could not be found or added,
+// a row without them would be hidden from every view and never read again
+bool ScanWorker::writeRow(const ScanResult &result)
+{
+    const Song &song = result.song;
+
+    qint64 artistId = getArtistId(song.artist);
+    if (artistId < 0) { return false; }
+    qint64 albumId = getAlbumId(artistId, song.album);
+    if (albumId < 0) { return false; }
+
+    scanInsert.bindValue(":albumID", albumId);
+    scanInsert.bindValue(":contributingArtist", result.contributingArtist);
+    scanInsert.bindValue(":track", song.track);
+    scanInsert.bindValue(":title", song.title);
+    scanInsert.bindValue(":file", song.file);
+    scanInsert.bindValue(":image", song.image);
+    scanInsert.bindValue(":duration", song.duration);
+    scanInsert.bindValue(":size", result.fingerprint.size);
+    scanInsert.bindValue(":mtime", result.fingerprint.mtime);
+    scanInsert.bindValue(":inode", result.fingerprint.inode);
+
+    bool ok = scanInsert.exec() && scanInsert.next();
+
+    if (!ok)
+    {
+        qDebug() << scanInsert.lastError();
+        qDebug () << scanInsert.lastQuery();
+    }
+    else if (searchAvailable)
+    {
+        scanSearchInsert.bindValue(":songID", scanInsert.value(0));
+        scanSearchInsert.bindValue(":title", song.title);
+        scanSearchInsert.bindValue(":artist", song.artist);
+        scanSearchInsert.bindValue(":album", song.album);
+        scanSearchInsert.bindValue(":contributingArtist", result.contributingArtist);
+        if (!scanSearchInsert.exec())
+        {
+            qDebug() << scanSearchInsert.lastError();
+            qDebug () << scanSearchInsert.lastQuery();
+        }
+    }
+    scanInsert.finish();
+    return ok;
+}
+
+// Writes the results held since the last batch in one transaction
+// The transaction only lasts as long as the inserts, no file is read while it is open
+// A batch that could not be committed is kept and tried again flushMsecs later
+// Rows that could not be written are counted as failed once the rest is committed
+bool ScanWorker::commitBatch()
+{
+    flushTimer.stop();
+    if (pendingResults.isEmpty() || !database().isOpen()) { return true; }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QSqlDatabase db = database();
+    bool ok = db.transaction();
+
+    QStringList written;
+    QStringList failedFiles;
+    for (const ScanResult &result : std::as_const(pendingResults))
+    {
+        if (!ok) break;
+        if (writeRow(result)) written << result.song.file;
+        else failedFiles << result.file;
+    }
+
+    ok = ok && bumpGeneration(db) && db.commit();
+    summary.writeNs += timer.nsecsElapsed();
+
+    if (!ok)
+    {
+        qDebug() << db.lastError();
+        db.rollback();
+
+        // Artists and albums added by the batch were rolled back with it
+        artistIds.clear();
+        albumIds.clear();
+        if (!cancelled.loadAcquire()) flushTimer.start();
+        return false;
+    }
+
+    pendingResults.clear();
+    summary.written += written.count();
+    summary.writtenFiles << written;
+    for (const QString &file : std::as_const(failedFiles)) countFailed(file);
+    return true;
+}
+
+// Files are stored as urls, everything under a directory sorts between "dir/" and "dir0"
+// Used to select the rows of a folder as a range of the File index
+void ScanWorker::folderRange(const QString &directory, QString *prefix, QString *prefixEnd)
+{
+    *prefix = QUrl::fromLocalFile(QDir(directory).absolutePath()).toString();
+    if (!prefix->endsWith('/')) prefix->append('/');
+    if (prefixEnd) *prefixEnd = prefix->left(prefix->size() - 1) + '0';
+}
+
+// Returns the stored fingerprints of every file under directory, keyed by the File column
+QHash<QString, FileFingerprint> ScanWorker::getFingerprints(QSqlDatabase db, const QString &directory)
+{
+    QHash<QString, FileFingerprint> ret;
+
+    QString prefix;
+    QString prefixEnd;
+    folderRange(directory, &prefix, &prefixEnd);
+
+    QSqlQuery query(db);
+    query.prepare("SELECT File, Size, MTime, Inode FROM Songs "
+                  "WHERE File >= :prefix AND File < :prefixEnd;");
+    query.bindValue(":prefix", prefix);
+    query.bindValue(":prefixEnd", prefixEnd);
+
+    if (!query.exec())
+    {
+        qDebug() << query.lastError();
+        qDebug () << query.lastQuery();
+        return ret;
+    }
+
+    while (query.next())
+    {
+        FileFingerprint fingerprint;
+        if (!query.isNull(1)) fingerprint.size  = query.value(1).toLongLong();
+        if (!query.isNull(2)) fingerprint.mtime = query.value(2).toLongLong();
+        if (!query.isNull(3)) fingerprint.inode = query.value(3).toLongLong();
+        ret.insert(query.value(0).toString(), fingerprint);
+    }
+
+    return ret;
+}
+
+// Deletes the rows of the given local files, the caller handles the transaction
+// If removedIds is given the SongIDs of the deleted rows are appended to it
+bool ScanWorker::deleteFiles(QSqlDatabase db, const QStringList &files, QList<qint64> *removedIds)
+{
+    QSqlQuery query(db);
+    query.prepare("DELETE FROM Songs WHERE File = :file;");
+
+    QSqlQuery idQuery(db);
+    idQuery.prepare("SELECT SongID FROM Songs WHERE File = :file;");
+
+    for (const QString &file : files)
+    {
+        QString url = QUrl::fromLocalFile(file).toString();
+
+        if (removedIds)
+        {
+            idQuery.bindValue(":file", url);
+            if (idQuery.exec() && idQuery.next()) removedIds->append(idQuery.value(0).toLongLong());
+            idQuery.finish();
+        }
+
+        query.bindValue(":file", url);
+        if (!query.exec())
+        {
+            qDebug() << query.lastError();
+            qDebug () << query.lastQuery();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Deletes albums without songs and artists without albums
+// Run after songs are removed or moved to another album
+bool ScanWorker::removeOrphans(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    if (!query.exec("DELETE FROM Albums WHERE NOT EXISTS (SELECT 1 FROM Songs WHERE Songs.AlbumID = Albums.AlbumID);") ||
+        !query.exec("DELETE FROM Artists WHERE NOT EXISTS (SELECT 1 FROM Albums WHERE Albums.ArtistID = Artists.ArtistID);"))
+    {
+        qDebug() << query.lastError();
+        return false;
+    }
+    return true;
+}
+
+// Counts a change to the songs, committed with the change itself
+// A library snapshot written at an older generation is stale, see MusicDatabase::libraryVersion
+bool ScanWorker::bumpGeneration(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    if (!query.exec("UPDATE Meta SET Value = Value + 1 WHERE Key = 'Generation';"))
+    {
+        qDebug() << query.lastError();
+        qDebug () << query.lastQuery();
+        return false;
+    }
+    return true;
+}
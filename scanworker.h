@@ -0,0 +1,142 @@
+#ifndef SCANWORKER_H
+#define SCANWORKER_H
+
+#include "libraryscanner.h"
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+
+// Progress of the running scan, see MusicDatabase::scanProgress
+struct ScanProgress
+{
+    bool searching = false;     // still walking the folder, total keeps growing
+    bool paused = false;
+    int done = 0;               // files read
+    int total = 0;              // files to read
+    double filesPerSecond = 0;
+    qint64 remainingMs = -1;    // -1 while unknown
+};
+
+// Outcome of a finished scan
+// writtenFiles and removedIds are used to update the library index
+struct ScanSummary
+{
+    int added = 0;
+    int changed = 0;
+    int unchanged = 0;
+    int removed = 0;
+    int failed = 0;     // could not be read, counted in neither added nor changed
+    int written = 0;
+
+    // Time spent in each stage of the scan, read and art are summed over the reading threads
+    // so together they can exceed totalNs
+    qint64 totalNs = 0;
+    qint64 walkNs = 0;      // walking the folder and comparing fingerprints
+    qint64 removeNs = 0;    // removing the rows of missing files
+    qint64 readNs = 0;
+    qint64 artNs = 0;
+    qint64 writeNs = 0;
+
+    int artWritten = 0;
+    qint64 artBytes = 0;
+    QStringList writtenFiles;
+    QList<qint64> removedIds;
+    bool cancelled = false;
+};
+
+// Runs the scan pipeline away from the GUI thread
+//
+// Lives on its own thread with its own database connection. Walks the folder,
+// compares fingerprints, removes rows of missing files, hands the files to the
+// LibraryScanner pool and writes its results in batched transactions. Results are held in
+// memory until a batch is full or flushMsecs passed, then written in one short transaction,
+// so the write lock is never held while files are read.
+// The GUI thread only sees progress and the summary sent through finished.
+//
+// cancel, setPaused, progress and setBatchSize may be called from any thread,
+// everything else must run on the worker's thread
+class ScanWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ScanWorker(QObject *parent = nullptr);
+    ~ScanWorker();
+
+    static const int flushMsecs = 250;
+
+    void cancel();
+    void setPaused(bool pause);
+    bool isPaused();
+    ScanProgress progress();
+    void setBatchSize(int size);
+    int batchSize();
+
+    bool open(const QString &databasePath);
+    void close();
+    void scanFolder(const QString &directory);
+    void scanFiles(const QStringList &files);
+
+    static void folderRange(const QString &directory, QString *prefix, QString *prefixEnd);
+    static QHash<QString, FileFingerprint> getFingerprints(QSqlDatabase db, const QString &directory);
+    static bool deleteFiles(QSqlDatabase db, const QStringList &files, QList<qint64> *removedIds = nullptr);
+    static bool removeOrphans(QSqlDatabase db);
+    static bool bumpGeneration(QSqlDatabase db);
+
+signals:
+    void finished(const ScanSummary &summary);
+
+private slots:
+    void writeResult(const ScanResult &result);
+    void finish();
+
+private:
+    QSqlDatabase database();
+    void begin();
+    void startReading(const QStringList &files);
+    bool waitWhilePaused();
+    void prepareWriter();
+    void resetWriter();
+    qint64 getArtistId(const QString &name);
+    qint64 getAlbumId(qint64 artistId, const QString &name);
+    void countFailed(const QString &file);
+    bool writeRow(const ScanResult &result);
+    bool commitBatch();
+
+    LibraryScanner scanner;
+    ScanSummary summary;
+    QSet<QString> newFiles;     // of the running scan, to tell added from changed files that fail
+    QElapsedTimer scanTimer;
+    bool searchAvailable = false;
+
+    // Shared with other threads
+    QAtomicInt cancelled;
+    QAtomicInt searching;
+    QAtomicInt done;
+    QAtomicInt total;
+    QAtomicInt batch = 500;
+    QMutex pauseLock;
+    QWaitCondition resumed;
+    bool paused = false;
+
+    // Writer state, rows are inserted through prepared statements
+    // and written in transactions of batch rows, or fewer once flushTimer fires
+    QSqlQuery scanInsert;
+    QSqlQuery scanSearchInsert;
+    QSqlQuery scanArtistInsert;
+    QSqlQuery scanArtistSelect;
+    QSqlQuery scanAlbumInsert;
+    QSqlQuery scanAlbumSelect;
+    QHash<QString, qint64> artistIds;
+    QHash<QPair<qint64, QString>, qint64> albumIds;
+    QList<ScanResult> pendingResults;
+    QTimer flushTimer;
+};
+
+#endif // SCANWORKER_H
@@ -0,0 +1,73 @@
+#include "shuffleengine.h"
+#include <algorithm>
+
+// Seeds every following shuffle with seed
+void ShuffleEngine::setSeed(quint32 seed)
+{
+    fixedSeed = seed;
+    seeded = true;
+}
+
+// Seeds every following shuffle from the global generator
+void ShuffleEngine::clearSeed()
+{
+    seeded = false;
+}
+
+// Returns the seed of the last shuffle
+quint32 ShuffleEngine::seed() const
+{
+    return lastSeed;
+}
+
+// Returns the numbers 0 to count-1 in random order
+//
+// If first is a valid row it is kept at the front and only the rest is shuffled,
+// the now playing song stays on top
+QList<int> ShuffleEngine::shuffle(int count, int first)
+{
+    lastSeed = seeded ? fixedSeed : QRandomGenerator::global()->generate();
+    random.seed(lastSeed);
+
+    QList<int> ret(qMax(count, 0));
+    for (int i = 0; i < ret.count(); i++) ret[i] = i;
+
+    int start = 0;
+    if (first >= 0 && first < ret.count())
+    {
+        ret.swapItemsAt(0, first);
+        start = 1;
+    }
+
+    for (int i = ret.count() - 1; i > start; i--)
+    {
+        ret.swapItemsAt(i, start + int(random.bounded(quint32(i - start + 1))));
+    }
+
+    return ret;
+}
+
+// Returns a random row in after+1 to count for a song added to a shuffled queue of count rows
+// after is the now playing row, -1 lets the song land anywhere
+int ShuffleEngine::insertPosition(int after, int count)
+{
+    after = qBound(-1, after, count - 1);
+    return after + 1 + int(random.bounded(quint32(count - after)));
+}
+
+// Returns random rows after the now playing row for added songs put into a shuffled queue of count rows
+//
+// ret[i] is the row of the i-th added song once all of them are in, no two songs share a row.
+// Each song picks a gap between the old rows past the playing one, songs in one gap are shuffled
+QList<int> ShuffleEngine::insertPositions(int after, int count, int added)
+{
+    QList<int> ret(qMax(added, 0));
+    for (int &row : ret) row = insertPosition(after, count);
+
+    std::sort(ret.begin(), ret.end());
+    for (int i = 0; i < ret.count(); i++) ret[i] += i;
+
+    for (int i = ret.count() - 1; i > 0; i--) ret.swapItemsAt(i, int(random.bounded(quint32(i + 1))));
+
+    return ret;
+}
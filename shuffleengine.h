@@ -0,0 +1,34 @@
+#ifndef SHUFFLEENGINE_H
+#define SHUFFLEENGINE_H
+
+#include <QList>
+#include <QRandomGenerator>
+
+// Builds the shuffled orders of the queue
+//
+// shuffle returns a random permutation of the queue rows in linear time (Fisher-Yates).
+// Every shuffle is seeded, from setSeed if one was given or else from the global generator,
+// and seed returns the seed of the last shuffle, so setSeed(seed()) repeats it.
+// insertPosition draws from the same generator, so a shuffle and the songs appended to it
+// afterwards are reproduced as a whole.
+class ShuffleEngine
+{
+public:
+    ShuffleEngine() = default;
+
+    void setSeed(quint32 seed);
+    void clearSeed();
+    quint32 seed() const;
+
+    QList<int> shuffle(int count, int first = -1);
+    int insertPosition(int after, int count);
+    QList<int> insertPositions(int after, int count, int added);
+
+private:
+    QRandomGenerator random;
+    quint32 lastSeed = 0;
+    quint32 fixedSeed = 0;
+    bool seeded = false;
+};
+
+#endif // SHUFFLEENGINE_H
@@ -13,6 +13,7 @@ struct Song
     QString image;
     int track;
     int duration;
+    qint64 id = -1; // SongID in the database, -1 if not from the database
 };
 
 #endif // SONG_H
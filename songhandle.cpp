@@ -0,0 +1,211 @@
+#include "songhandle.h"
+#include <QHash>
+#include <QReadWriteLock>
+
+namespace {
+
+// A song in the table, strings shared between songs are indexes into SongTable::strings
+// The file url is split into its folder, which is shared by an album, and the file name
+struct SongRecord
+{
+    qint64 id;
+    QString title;
+    QString fileName;
+    quint32 artist;
+    quint32 albumArtist;
+    quint32 album;
+    quint32 folder;
+    quint32 image;
+    int track;
+    int duration;
+};
+
+class SongTable
+{
+public:
+    SongTable();
+    quint32 add(const Song &song);
+
+    QReadWriteLock lock;
+    QList<SongRecord> records;          // records[0] is the null song
+    QList<QString> strings;             // strings[0] is the empty string
+
+private:
+    quint32 internString(const QString &string);
+
+    QHash<QString, quint32> stringIds;
+    QHash<qint64, quint32> idSlots;     // songs from the database
+    QHash<QString, quint32> fileSlots;  // songs without a SongID
+};
+
+SongTable::SongTable()
+{
+    strings.append(QString());
+    stringIds.insert(QString(), 0);
+    records.append(SongRecord {-1, QString(), QString(), 0, 0, 0, 0, 0, 0, 0});
+}
+
+// Returns the slot of song, adding it or updating the record it already has
+// Must be called with the lock held for writing
+quint32 SongTable::add(const Song &song)
+{
+    qsizetype split = song.file.lastIndexOf('/') + 1;
+
+    SongRecord record {
+        song.id,
+        song.title,
+        song.file.mid(split),
+        internString(song.artist),
+        internString(song.albumArtist),
+        internString(song.album),
+        internString(song.file.left(split)),
+        internString(song.image),
+        song.track,
+        song.duration
+    };
+
+    quint32 &slot = song.id >= 0 ? idSlots[song.id] : fileSlots[song.file];
+    if (slot == 0)
+    {
+        slot = quint32(records.size());
+        records.append(record);
+    }
+    else records[slot] = record;
+
+    return slot;
+}
+
+quint32 SongTable::internString(const QString &string)
+{
+    auto it = stringIds.constFind(string);
+    if (it != stringIds.constEnd()) { return it.value(); }
+
+    quint32 index = quint32(strings.size());
+    strings.append(string);
+    stringIds.insert(string, index);
+    return index;
+}
+
+SongTable &table()
+{
+    static SongTable songs;
+    return songs;
+}
+
+}
+
+// Returns the handle of song, see the class comment
+SongHandle SongHandle::intern(const Song &song)
+{
+    SongTable &songs = table();
+    QWriteLocker locker(&songs.lock);
+    return SongHandle(songs.add(song));
+}
+
+// Returns the handles of songs in the same order, the table is locked once for all of them
+QList<SongHandle> SongHandle::intern(const QList<Song> &songs)
+{
+    QList<SongHandle> ret;
+    ret.reserve(songs.size());
+
+    SongTable &records = table();
+    QWriteLocker locker(&records.lock);
+    for (const Song &song : songs) ret.append(SongHandle(records.add(song)));
+    return ret;
+}
+
+// Returns the number of songs in the table
+int SongHandle::internedCount()
+{
+    SongTable &songs = table();
+    QReadLocker locker(&songs.lock);
+    return int(songs.records.size()) - 1;
+}
+
+// SongID of the song, -1 if it is not from the database or the handle is null
+qint64 SongHandle::id() const
+{
+    SongTable &songs = table();
+    QReadLocker locker(&songs.lock);
+    return songs.records[slot].id;
+}
+
+// Album artist the song is browsed under, see Song::artist
+QString SongHandle::artist() const
+{
+    SongTable &songs = table();
+    QReadLocker locker(&songs.lock);
+    return songs.strings[songs.records[slot].artist];
+}
+
+QString SongHandle::albumArtist() const
+{
+    SongTable &songs = table();
+    QReadLocker locker(&songs.lock);
+    return songs.strings[songs.records[slot].albumArtist];
+}
+
+QString SongHandle::album() const
+{
+    SongTable &songs = table();
+    QReadLocker locker(&songs.lock);
+    return songs.strings[songs.records[slot].album];
+}
+
+QString SongHandle::title() const
+{
+    SongTable &songs = table();
+    QReadLocker locker(&songs.lock);
+    return songs.records[slot].title;
+}
+
+// File url of the song
+QString SongHandle::file() const
+{
+    SongTable &songs = table();
+    QReadLocker locker(&songs.lock);
+    const SongRecord &record = songs.records[slot];
+    return songs.strings[record.folder] + record.fileName;
+}
+
+QString SongHandle::image() const
+{
+    SongTable &songs = table();
+    QReadLocker locker(&songs.lock);
+    return songs.strings[songs.records[slot].image];
+}
+
+int SongHandle::track() const
+{
+    SongTable &songs = table();
+    QReadLocker locker(&songs.lock);
+    return songs.records[slot].track;
+}
+
+// Duration in milliseconds
+int SongHandle::duration() const
+{
+    SongTable &songs = table();
+    QReadLocker locker(&songs.lock);
+    return songs.records[slot].duration;
+}
+
+// Returns every field of the song at once
+Song SongHandle::song() const
+{
+    SongTable &songs = table();
+    QReadLocker locker(&songs.lock);
+    const SongRecord &record = songs.records[slot];
+
+    Song ret;
+    ret.artist = songs.strings[record.artist];
+    ret.albumArtist = songs.strings[record.albumArtist];
+    ret.album = songs.strings[record.album];
+    ret.title = record.title;
+    ret.file = songs.strings[record.folder] + record.fileName;
+    ret.image = songs.strings[record.image];
+    ret.track = record.track;
+    ret.duration = record.duration;
+    ret.id = record.id;
+    return ret;
+}
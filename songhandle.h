@@ -0,0 +1,50 @@
+#ifndef SONGHANDLE_H
+#define SONGHANDLE_H
+
+#include "song.h"
+#include <QString>
+#include <QList>
+#include <QMetaType>
+
+// Compact reference to a song for queues and models
+//
+// A handle is a 32 bit index into a process wide table of song records. Artist, album,
+// folder and image strings in the records are interned, every album stores them once,
+// so a queued track costs the handle plus one record however often it is queued.
+//
+// intern adds a Song to the table, a song that is already in it, by SongID or by file for
+// songs without one, keeps its record and handle with the fields updated. Records are kept
+// for the life of the process. Handles can be copied and read from any thread.
+class SongHandle
+{
+public:
+    SongHandle() = default;
+
+    static SongHandle intern(const Song &song);
+    static QList<SongHandle> intern(const QList<Song> &songs);
+    static int internedCount();
+
+    bool isNull() const { return slot == 0; }
+    qint64 id() const;
+    QString artist() const;
+    QString albumArtist() const;
+    QString album() const;
+    QString title() const;
+    QString file() const;
+    QString image() const;
+    int track() const;
+    int duration() const;
+    Song song() const;
+
+    bool operator==(const SongHandle &other) const { return slot == other.slot; }
+    bool operator!=(const SongHandle &other) const { return slot != other.slot; }
+
+private:
+    explicit SongHandle(quint32 slot) : slot(slot) {}
+
+    quint32 slot = 0;   // 0 is the null handle, records start at 1
+};
+
+Q_DECLARE_METATYPE(SongHandle)
+
+#endif // SONGHANDLE_H
@@ -0,0 +1,162 @@
+#include "songlistmodel.h"
+#include "musicdatabase.h"
+
+SongListModel::SongListModel(MusicDatabase *database, QObject *parent)
+    : QAbstractListModel{parent}, db(database)
+{}
+
+// Song List Data Function
+//
+// DisplayRole returns the formatted song name, UserRole returns the SongID
+// which can be passed to MusicDatabase::getSongById
+QVariant SongListModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= names.count()) return QVariant();
+
+    switch (role)
+    {
+    case Qt::DisplayRole:
+        return QVariant(names[index.row()]);
+    case Qt::UserRole:
+        return QVariant(ids[index.row()]);
+    default:
+        return QVariant();
+    }
+}
+
+// Returns the number of rows loaded so far, not the number of matching songs
+int SongListModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid()) return 0;
+    else return names.count();
+}
+
+// There are more rows to load until a page comes back short
+bool SongListModel::canFetchMore(const QModelIndex &parent) const
+{
+    if (parent.isValid()) return false;
+    return more;
+}
+
+// Loads the next page of songs after the rows already loaded
+// Called by the view when it scrolls near the end of the loaded rows
+void SongListModel::fetchMore(const QModelIndex &parent)
+{
+    if (parent.isValid() || !more) return;
+
+    QList<qint64> pageIds;
+    QStringList pageNames = loadRows(names.count(), page, &pageIds);
+    more = pageNames.count() == page;
+
+    if (pageNames.isEmpty()) return;
+
+    beginInsertRows(QModelIndex(), names.count(), names.count() + pageNames.count() - 1);
+    names.append(pageNames);
+    ids.append(pageIds);
+    endInsertRows();
+}
+
+// Reloads the rows loaded so far after the library changed
+// Only the rows between the unchanged start and end of the list are replaced,
+// so the scroll position and selection outside of them are kept
+void SongListModel::refresh()
+{
+    if (!active) return;
+
+    int count = qMax(int(names.count()), page);
+    QList<qint64> newIds;
+    QStringList newNames = loadRows(0, count, &newIds);
+    more = newNames.count() == count;
+
+    int oldCount = names.count();
+    int newCount = newNames.count();
+
+    int prefix = 0;
+    while (prefix < oldCount && prefix < newCount &&
+           ids[prefix] == newIds[prefix] && names[prefix] == newNames[prefix]) prefix++;
+
+    int suffix = 0;
+    while (suffix < oldCount - prefix && suffix < newCount - prefix &&
+           ids[oldCount - 1 - suffix] == newIds[newCount - 1 - suffix] &&
+           names[oldCount - 1 - suffix] == newNames[newCount - 1 - suffix]) suffix++;
+
+    if (oldCount - prefix - suffix > 0)
+    {
+        beginRemoveRows(QModelIndex(), prefix, oldCount - suffix - 1);
+        names.remove(prefix, oldCount - prefix - suffix);
+        ids.remove(prefix, oldCount - prefix - suffix);
+        endRemoveRows();
+    }
+
+    if (newCount - prefix - suffix > 0)
+    {
+        beginInsertRows(QModelIndex(), prefix, newCount - suffix - 1);
+        names = names.mid(0, prefix) + newNames.mid(prefix, newCount - prefix - suffix) + names.mid(prefix);
+        ids = ids.mid(0, prefix) + newIds.mid(prefix, newCount - prefix - suffix) + ids.mid(prefix);
+        endInsertRows();
+    }
+}
+
+// Replaces the list with the songs matching artist and album
+// An empty name matches every artist or album, the first page is loaded when the view asks for it
+void SongListModel::setFilter(const QString &filterArtist, const QString &filterAlbum)
+{
+    beginResetModel();
+    artist = filterArtist;
+    album = filterAlbum;
+    search.clear();
+    names.clear();
+    ids.clear();
+    active = true;
+    more = true;
+    endResetModel();
+}
+
+// Replaces the list with the results of a search, best match first
+// See MusicDatabase::searchSongs for how text is matched
+void SongListModel::setSearch(const QString &text)
+{
+    beginResetModel();
+    search = text;
+    names.clear();
+    ids.clear();
+    active = true;
+    more = !text.isEmpty();
+    endResetModel();
+}
+
+// Empties the list, nothing is loaded until setFilter is called again
+void SongListModel::clear()
+{
+    beginResetModel();
+    search.clear();
+    names.clear();
+    ids.clear();
+    active = false;
+    more = false;
+    endResetModel();
+}
+
+// Loads limit rows of the current list starting at offset
+QStringList SongListModel::loadRows(int offset, int limit, QList<qint64> *rowIds) const
+{
+    if (search.isEmpty()) return db->getSongNames(artist, album, offset, limit, rowIds);
+    else return db->searchSongs(search, offset, limit, rowIds);
+}
+
+// Returns the SongID of a loaded row, -1 if the row is not loaded
+qint64 SongListModel::songId(int row) const
+{
+    return ids.value(row, -1);
+}
+
+// Sets the number of rows loaded by each fetchMore
+void SongListModel::setPageSize(int size)
+{
+    if (size > 0) page = size;
+}
+
+int SongListModel::pageSize() const
+{
+    return page;
+}
@@ -0,0 +1,50 @@
+#ifndef SONGLISTMODEL_H
+#define SONGLISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QStringList>
+#include <QList>
+
+class MusicDatabase;
+
+// This class is used as the dataModel for the Songs View
+// Rows are loaded from the database a page at a time as the view scrolls to them
+// so only the songs that have been displayed are formatted and held in memory.
+//
+// The list shows either the songs of an artist / album filter or the results of a search.
+// Both are copied when the list is set, later changes to the database filters
+// do not affect pages loaded afterwards
+class SongListModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    explicit SongListModel(MusicDatabase *database, QObject *parent = nullptr);
+
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
+
+    void setFilter(const QString &filterArtist, const QString &filterAlbum);
+    void setSearch(const QString &text);
+    void refresh();
+    void clear();
+    qint64 songId(int row) const;
+    void setPageSize(int size);
+    int pageSize() const;
+
+private:
+    QStringList loadRows(int offset, int limit, QList<qint64> *rowIds) const;
+
+    MusicDatabase *db;
+    QString artist;
+    QString album;
+    QString search;
+    QStringList names;
+    QList<qint64> ids;
+    bool active = false;
+    bool more = false;
+    int page = 200;
+};
+
+#endif // SONGLISTMODEL_H
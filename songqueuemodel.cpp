@@ -1,5 +1,5 @@
 #include "songqueuemodel.h"
-#include <QRandomGenerator>
+#include <algorithm>
 #include <QMimeData>
 #include <QFont>
 #include <QBrush>
@@ -12,103 +12,133 @@ SongQueueModel::SongQueueModel(QObject *parent)
 //
 // Changes behavior dependong on role and if the queue is shuffled
 //
-// if unshuffled, returns data based on the Song under index.row()
-//
-// If shuffled, returns based on the Song under an index provided by ShuffleMap
-//
-// The shuffleMap must be empty to result in an unshuffled list
+// Rows are in play order, the shuffled order if shuffled
+// Qt::UserRole returns the SongHandle of the row
 QVariant SongQueueModel::data(const QModelIndex &index, int role) const
 {
-    Song song = songList[shuffleMap.isEmpty() ? index.row() : shuffleMap[index.row()]];
-    QFont font;
-    QBrush brush;
     switch (role)
     {
     case Qt::DisplayRole:
-        return QVariant(QString("%1 - %2 - %3").arg(song.artist, song.album, song.title));
-        break;
+    {
+        SongHandle song = songs.song(index.row());
+        return QVariant(QString("%1 - %2 - %3").arg(song.artist(), song.album(), song.title()));
+    }
     case Qt::UserRole:
-        return QVariant::fromValue(songList[shuffleMap.isEmpty() ? index.row() : shuffleMap[index.row()]]);
-        break;
+        return QVariant::fromValue(songs.song(index.row()));
     case Qt::FontRole:
+    {
         if (index.row() != playingIndex) return QVariant();
+        QFont font;
         font.setBold(true);
         font.setItalic(true);
         return QVariant(font);
-        break;
+    }
     case Qt::ForegroundRole:
         if (index.row() != playingIndex) return QVariant();
-        brush.setColor(QColor(85, 255, 0));
-        return QVariant(brush);
+        return QVariant(QBrush(QColor(85, 255, 0)));
     default:
         return QVariant();
     }
 }
 
+// Returns the song in a row of the queue, in shuffled order if shuffled
+// A null handle if row is out of range
+SongHandle SongQueueModel::song(int row) const
+{
+    return songs.song(row);
+}
+
 // returns the rowcount of the model
 int SongQueueModel::rowCount(const QModelIndex &parent) const
 {
     if (parent.isValid()) return 0;
-    else return songList.count();
+    else return songs.count();
 }
 
 // Append a Song object to the model
 //
-// This fuction will append to the end of the list
-// regardless of the state of ShuffleMap, adding the new index if nessesary
-void SongQueueModel::append(const Song &song)
+// Unshuffled the song goes to the end of the list, shuffled it is placed
+// at a random row after the now playing song, see insertShuffled
+// Returns the row of the song
+int SongQueueModel::append(const SongHandle &song)
 {
+    if (songs.isShuffled()) return insertShuffled(song);
 
     beginInsertRows(QModelIndex(), rowCount(), rowCount());
-    songList.append(song);
-    if (!shuffleMap.isEmpty()) shuffleMap.append(rowCount()-1);
+    songs.insert(rowCount(), rowCount(), song);
+    endInsertRows();
+
+    return rowCount()-1;
+}
+
+// Appends songs to the model as one block of rows, see append
+//
+// Shuffled the songs are spread over random rows after the now playing song, see insertShuffled
+void SongQueueModel::append(const QList<SongHandle> &added)
+{
+    if (added.isEmpty()) return;
+    if (songs.isShuffled())
+    {
+        insertShuffled(added);
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), rowCount(), rowCount() + added.count() - 1);
+    songs.insert(rowCount(), rowCount(), added);
     endInsertRows();
 }
 
 // The main shuffle algoritm
 //
 // Shuffles the now playing song to the top unless no song is playing
+// The order is built by the ShuffleEngine in linear time
 bool SongQueueModel::shuffle(int nowPlayingIdx)
 {
 
-    if (nowPlayingIdx < -1 || nowPlayingIdx >= songList.count() || songList.count() == 1) return false;
+    if (nowPlayingIdx < -1 || nowPlayingIdx >= songs.count() || songs.count() == 1) return false;
 
     emit layoutAboutToBeChanged();
 
-    shuffleMap.clear();
-
-    //int queueEndOffset = nowPlayingIdx == -1 ? -1 : 0;
+    // The permutation is over the unshuffled rows
+    int first = nowPlayingIdx;
+    if (first != -1) first = songs.mapRow(first, QueueTree::Play, QueueTree::Original);
 
-    for (int i = 0; i < songList.count(); i++)
-    {
-        if (i != nowPlayingIdx || nowPlayingIdx == -1) shuffleMap.append(i);
-    }
+    songs.shuffle(shuffler.shuffle(songs.count(), first));
 
-    int temp;
+    emit layoutChanged();
 
-    for (int i = 0; i < songList.count()*3; i++)
-    {
-        temp = shuffleMap.takeAt(QRandomGenerator::global()->bounded(shuffleMap.count()));
-        shuffleMap.insert(QRandomGenerator::global()->bounded(shuffleMap.count()+1), 1, temp);
-    }
+    return true;
+}
 
-    if (nowPlayingIdx != -1) shuffleMap.prepend(nowPlayingIdx);
+// Seeds the following shuffles, a queue shuffled with the same seed and songs gets the same order
+void SongQueueModel::setShuffleSeed(quint32 seed)
+{
+    shuffler.setSeed(seed);
+}
 
-    emit layoutChanged();
+// Seeds the following shuffles randomly again
+void SongQueueModel::clearShuffleSeed()
+{
+    shuffler.clearSeed();
+}
 
-    return true;
+// Returns the seed of the last shuffle
+quint32 SongQueueModel::shuffleSeed() const
+{
+    return shuffler.seed();
 }
 
-// This will clear the shuffleMap, unshuffling the songList
+// This will drop the play order, unshuffling the queue
 //
 // Returns the new index of the now playing song
 int SongQueueModel::unshuffle(int nowPlayingIdx)
 {
     emit layoutAboutToBeChanged();
 
-    int ret = shuffleMap.value(nowPlayingIdx, nowPlayingIdx);
+    int ret = nowPlayingIdx;
+    if (songs.isShuffled() && nowPlayingIdx >= 0) ret = songs.mapRow(nowPlayingIdx, QueueTree::Play, QueueTree::Original);
 
-    shuffleMap.clear();
+    songs.unshuffle();
 
     emit layoutChanged();
 
@@ -118,32 +148,92 @@ int SongQueueModel::unshuffle(int nowPlayingIdx)
 // inserts a song into a certain index
 //
 // if shuffled the song's unshuffled index will match it's shuffled index
-bool SongQueueModel::insert(const Song & song, int idx)
+bool SongQueueModel::insert(const SongHandle &song, int idx)
 {
-    if (idx < 0 || idx > songList.count()) return false;
+    if (idx < 0 || idx > songs.count()) return false;
     beginInsertRows(QModelIndex(), idx, idx);
+    songs.insert(idx, idx, song);
+    endInsertRows();
 
-    if (!shuffleMap.isEmpty())
-    {
-        for (int i = 0; i < shuffleMap.count(); i++)
-        {
-            if (shuffleMap[i] >= idx) shuffleMap[i] += 1;
-        }
-        shuffleMap.insert(idx, idx);
-    }
+    return true;
+}
 
-    songList.insert(idx, song);
+// inserts songs as one block of rows starting at index
+//
+// if shuffled the block lands at the same index in the unshuffled order
+bool SongQueueModel::insert(const QList<SongHandle> &added, int idx)
+{
+    if (idx < 0 || idx > songs.count()) return false;
+    if (added.isEmpty()) return true;
 
+    beginInsertRows(QModelIndex(), idx, idx + added.count() - 1);
+    songs.insert(idx, idx, added);
     endInsertRows();
 
     return true;
 }
 
-// Returns the queue index of the inserted song
-// Currently unused
-int insertShuffled(const Song & song)
+// Adds a song at a random row after the now playing song of a shuffled queue
+// the song is appended to the unshuffled order
+//
+// Returns the queue index of the inserted song, appends unshuffled queues
+int SongQueueModel::insertShuffled(const SongHandle &song)
 {
-    return -1;
+    if (!songs.isShuffled()) return append(song);
+
+    int row = shuffler.insertPosition(playingIndex, rowCount());
+    beginInsertRows(QModelIndex(), row, row);
+    songs.insert(row, songs.count(), song);
+    endInsertRows();
+
+    return row;
+}
+
+// Adds songs at random rows after the now playing song of a shuffled queue
+// the songs are appended to the unshuffled order in the order they are given
+//
+// The rows are inserted from the top, songs that land next to each other are announced
+// to the view together, appends unshuffled queues
+void SongQueueModel::insertShuffled(const QList<SongHandle> &added)
+{
+    if (!songs.isShuffled())
+    {
+        append(added);
+        return;
+    }
+
+    QList<int> rows = shuffler.insertPositions(playingIndex, rowCount(), added.count());
+
+    QList<int> byRow(added.count());
+    for (int i = 0; i < byRow.count(); i++) byRow[i] = i;
+    std::sort(byRow.begin(), byRow.end(), [&rows](int x, int y) { return rows[x] < rows[y]; });
+
+    // The unshuffled row of a song counts the songs before it in added that are already in,
+    // kept in a Fenwick tree over the indexes of added
+    int base = songs.count();
+    QList<int> inserted(added.count() + 1, 0);
+
+    int first = 0;
+    while (first < byRow.count())
+    {
+        int last = first;
+        while (last + 1 < byRow.count() && rows[byRow[last + 1]] == rows[byRow[last]] + 1) last++;
+
+        beginInsertRows(QModelIndex(), rows[byRow[first]], rows[byRow[last]]);
+        for (int j = first; j <= last; j++)
+        {
+            int i = byRow[j];
+
+            int before = 0;
+            for (int k = i; k > 0; k -= k & -k) before += inserted[k];
+            for (int k = i + 1; k < inserted.count(); k += k & -k) inserted[k]++;
+
+            songs.insert(rows[i], base + before, added[i]);
+        }
+        endInsertRows();
+
+        first = last + 1;
+    }
 }
 
 // Returns item flags
@@ -158,47 +248,64 @@ Qt::ItemFlags SongQueueModel::flags(const QModelIndex &index) const
 //
 // if a song matches this index
 // the color of the text is changed to green to indicate the playing song
+// Only the rows of the old and the new index are repainted
 void SongQueueModel::setPlayingIndex(int idx)
 {
-    emit layoutAboutToBeChanged();
+    int old = playingIndex;
     playingIndex = idx;
     qDebug() << idx;
-    emit layoutChanged();
+
+    if (old == idx) return;
+
+    const QList<int> roles {Qt::FontRole, Qt::ForegroundRole};
+    if (old >= 0 && old < rowCount()) emit dataChanged(index(old), index(old), roles);
+    if (idx >= 0 && idx < rowCount()) emit dataChanged(index(idx), index(idx), roles);
+}
+
+// Returns the now playing index, moveRows keeps it on the playing song
+int SongQueueModel::playingRow() const
+{
+    return playingIndex;
 }
 
 // Removes rows
-// Ineffient when shuffle is on
+// Each row costs O(log n) shuffled or not, see QueueTree
 bool SongQueueModel::removeRows(int row, int count, const QModelIndex &parent)
 {
-    if (parent.isValid()) return false;
-    beginRemoveRows(parent, row, row+count);
-
-    bool shuffled = !shuffleMap.isEmpty();
-    int takeAtRow = row;
+    if (parent.isValid() || row < 0 || count <= 0 || row + count > songs.count()) return false;
+    beginRemoveRows(parent, row, row+count-1);
+    songs.remove(row, count);
+    endRemoveRows();
+    return true;
+}
 
-    for (int i = 0; i < count; i++)
-    {
-        if (shuffled)
-        {
-            takeAtRow = shuffleMap.takeAt(row);
+// Moves rows in play order, the unshuffled order of a shuffled queue is kept
+//
+// destinationChild is the row the songs are moved before, counted before the move
+// The playing index follows the playing song, MusicPlayer picks it up from rowsMoved
+bool SongQueueModel::moveRows(const QModelIndex &sourceParent, int sourceRow, int count, const QModelIndex &destinationParent, int destinationChild)
+{
+    if (sourceParent.isValid() || destinationParent.isValid()) return false;
+    if (sourceRow < 0 || count <= 0 || sourceRow + count > songs.count()) return false;
+    if (destinationChild < 0 || destinationChild > songs.count()) return false;
+    if (!beginMoveRows(sourceParent, sourceRow, sourceRow+count-1, destinationParent, destinationChild)) return false;
 
-            for (int j = 0; j < shuffleMap.count(); j++)
-            {
-                if (shuffleMap[j] >= takeAtRow) shuffleMap[j]--;
-            }
-        }
+    int destination = destinationChild > sourceRow ? destinationChild - count : destinationChild;
+    songs.move(sourceRow, count, destination);
 
-        songList.takeAt(takeAtRow);
-    }
+    if (playingIndex >= sourceRow && playingIndex < sourceRow + count) playingIndex += destination - sourceRow;
+    else if (playingIndex > sourceRow && playingIndex < destinationChild) playingIndex -= count;
+    else if (playingIndex >= destinationChild && playingIndex < sourceRow) playingIndex += count;
 
-    endRemoveRows();
+    endMoveRows();
     return true;
 }
 
 // Clears the model
 void SongQueueModel::clear()
 {
-    beginRemoveRows(QModelIndex(), 0, songList.count()-1);
-    songList.clear();
+    if (songs.count() == 0) return;
+    beginRemoveRows(QModelIndex(), 0, songs.count()-1);
+    songs.clear();
     endRemoveRows();
 }
@@ -2,11 +2,12 @@
 #define SONGQUEUEMODEL_H
 
 #include <QAbstractListModel>
-#include "song.h"
-#include <QList>
+#include "songhandle.h"
+#include "shuffleengine.h"
+#include "queuetree.h"
 
 // This class is used as the dataModel for the Queue View and serves to store the order of the songs to be played
-// The queue can be shuffled without losing the order of the main queue
+// The queue can be shuffled without losing the order of the main queue, both orders are kept in a QueueTree
 class SongQueueModel : public QAbstractListModel
 {
 public:
@@ -15,18 +16,27 @@ public:
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
     int rowCount(const QModelIndex &parent = QModelIndex()) const;
     Qt::ItemFlags flags(const QModelIndex &index) const;
-    void append(const Song &song);
-    bool insert(const Song & song, int idx);
-    bool insertShuffled(const Song & song);
+    SongHandle song(int row) const;
+    int append(const SongHandle &song);
+    void append(const QList<SongHandle> &added);
+    bool insert(const SongHandle &song, int idx);
+    bool insert(const QList<SongHandle> &added, int idx);
+    int insertShuffled(const SongHandle &song);
+    void insertShuffled(const QList<SongHandle> &added);
     bool shuffle(int nowPlayingIdx);
+    void setShuffleSeed(quint32 seed);
+    void clearShuffleSeed();
+    quint32 shuffleSeed() const;
     int unshuffle(int nowPlayingIdx);
     void setPlayingIndex(int idx);
+    int playingRow() const;
     bool removeRows(int row, int count, const QModelIndex &parent = QModelIndex());
+    bool moveRows(const QModelIndex &sourceParent, int sourceRow, int count, const QModelIndex &destinationParent, int destinationChild);
     void clear();
 
 private:
-    QList<Song> songList;
-    QList<int> shuffleMap;
+    QueueTree songs;
+    ShuffleEngine shuffler;
     int playingIndex = -1;
 };
 
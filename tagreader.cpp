@@ -0,0 +1,645 @@
+#include "tagreader.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+
+// Tags larger than this are assumed to be corrupt and are not read
+static const qint64 maxTagSize = 64 * 1024 * 1024;
+
+static quint32 be32(const char *p)
+{
+    return (quint32(quint8(p[0])) << 24) | (quint32(quint8(p[1])) << 16) | (quint32(quint8(p[2])) << 8) | quint32(quint8(p[3]));
+}
+
+static quint64 be64(const char *p)
+{
+    return (quint64(be32(p)) << 32) | quint64(be32(p + 4));
+}
+
+static quint32 be24(const char *p)
+{
+    return (quint32(quint8(p[0])) << 16) | (quint32(quint8(p[1])) << 8) | quint32(quint8(p[2]));
+}
+
+static quint32 le32(const char *p)
+{
+    return quint32(quint8(p[0])) | (quint32(quint8(p[1])) << 8) | (quint32(quint8(p[2])) << 16) | (quint32(quint8(p[3])) << 24);
+}
+
+// ID3v2 sizes are stored as four 7 bit bytes
+static quint32 syncsafe(const char *p)
+{
+    return ((quint32(p[0]) & 0x7F) << 21) | ((quint32(p[1]) & 0x7F) << 14) | ((quint32(p[2]) & 0x7F) << 7) | (quint32(p[3]) & 0x7F);
+}
+
+// Reverses ID3v2 unsynchronisation, every 0xFF 0x00 pair becomes 0xFF
+static QByteArray removeUnsync(const QByteArray &data)
+{
+    QByteArray ret;
+    ret.reserve(data.size());
+    for (qsizetype i = 0; i < data.size(); i++)
+    {
+        ret.append(data[i]);
+        if (quint8(data[i]) == 0xFF && i + 1 < data.size() && data[i + 1] == 0) i++;
+    }
+    return ret;
+}
+
+static QString fromUtf16(const char *data, qsizetype bytes, bool bigEndian)
+{
+    QString ret(bytes / 2, Qt::Uninitialized);
+    QChar *out = ret.data();
+    for (qsizetype i = 0; i < bytes / 2; i++)
+    {
+        quint8 a = data[2 * i];
+        quint8 b = data[2 * i + 1];
+        out[i] = QChar(char16_t(bigEndian ? (a << 8) | b : (b << 8) | a));
+    }
+    return ret;
+}
+
+// Decodes an ID3v2 string in one of the four allowed encodings
+// Null separated values (ID3v2.4 multi value frames) are returned as separate entries
+static QStringList decodeId3Text(const QByteArray &data, int encoding)
+{
+    QString text;
+    switch (encoding)
+    {
+    case 1:
+        if (data.size() >= 2 && quint8(data[0]) == 0xFE && quint8(data[1]) == 0xFF)
+        { text = fromUtf16(data.constData() + 2, data.size() - 2, true); }
+        else if (data.size() >= 2 && quint8(data[0]) == 0xFF && quint8(data[1]) == 0xFE)
+        { text = fromUtf16(data.constData() + 2, data.size() - 2, false); }
+        else
+        { text = fromUtf16(data.constData(), data.size(), false); }
+        break;
+    case 2:
+        text = fromUtf16(data.constData(), data.size(), true);
+        break;
+    case 3:
+        text = QString::fromUtf8(data);
+        break;
+    case 0:
+    default:
+        text = QString::fromLatin1(data);
+        break;
+    }
+
+    // BOMs are repeated before every value of a UTF-16 multi value frame
+    text.remove(QChar(0xFEFF));
+
+    QStringList ret;
+    for (const QString &value : text.split(QChar(0), Qt::SkipEmptyParts))
+    {
+        QString trimmed = value.trimmed();
+        if (!trimmed.isEmpty()) ret << trimmed;
+    }
+    return ret;
+}
+
+// Returns the length of a null terminated string at pos, terminators for UTF-16 are two bytes wide
+static qsizetype terminatedLength(const QByteArray &data, qsizetype pos, int encoding)
+{
+    if (encoding == 1 || encoding == 2)
+    {
+        for (qsizetype i = pos; i + 1 < data.size(); i += 2)
+        {
+            if (data[i] == 0 && data[i + 1] == 0) return i - pos;
+        }
+        return -1;
+    }
+
+    qsizetype end = data.indexOf('\0', pos);
+    return end < 0 ? -1 : end - pos;
+}
+
+// Track numbers are commonly stored as "track/total"
+static int parseTrack(const QString &value)
+{
+    return value.section('/', 0, 0).trimmed().toInt();
+}
+
+// Reads the tags of a single file
+// The container is detected from the file header, with the extension as a fallback
+// returns false if the file could not be opened or is not a supported format
+bool TagReader::readFile(const QString &filePath, TagInfo &info)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) { return false; }
+
+    QByteArray head = file.peek(12);
+    if (head.size() < 12) { return false; }
+
+    if (head.mid(4, 4) == "ftyp") return readMp4(file, info);
+    if (head.startsWith("fLaC") || QFileInfo(filePath).suffix().compare("flac", Qt::CaseInsensitive) == 0) return readFlac(file, info);
+    return readMpeg(file, info);
+}
+
+// MP3: ID3v2 at the start of the file takes precedence
+// ID3v1 at the end of the file only fills in fields ID3v2 did not provide
+bool TagReader::readMpeg(QFile &file, TagInfo &info)
+{
+    qint64 audioStart = readId3v2(file, info);
+    qint64 audioEnd = file.size();
+
+    if (readId3v1(file, info)) audioEnd -= 128;
+
+    if (info.duration <= 0) info.duration = mpegDuration(file, audioStart, audioEnd);
+
+    return true;
+}
+
+// Parses an ID3v2 tag at the start of the file
+// returns the offset of the first byte after the tag, or 0 if there is no tag
+qint64 TagReader::readId3v2(QFile &file, TagInfo &info)
+{
+    if (!file.seek(0)) { return 0; }
+    QByteArray header = file.read(10);
+    if (header.size() < 10 || !header.startsWith("ID3")) { return 0; }
+
+    int version = quint8(header[3]);
+    quint8 flags = header[5];
+    qint64 size = syncsafe(header.constData() + 6);
+    qint64 end = 10 + size + ((flags & 0x10) ? 10 : 0);
+
+    if (version < 2 || version > 4 || size > maxTagSize) { return end; }
+
+    // ID3v2.2 compression was never defined, such tags cannot be read
+    if (version == 2 && (flags & 0x40)) { return end; }
+
+    QByteArray tag = file.read(size);
+
+    // Up to v2.3 unsynchronisation applies to the whole tag, v2.4 applies it per frame
+    bool unsyncFrames = false;
+    if (flags & 0x80)
+    {
+        if (version < 4) tag = removeUnsync(tag);
+        else unsyncFrames = true;
+    }
+
+    if (version > 2 && (flags & 0x40) && tag.size() >= 4)
+    {
+        qint64 extendedSize = version == 3 ? be32(tag.constData()) + 4 : syncsafe(tag.constData());
+        tag.remove(0, qMin<qint64>(extendedSize, tag.size()));
+    }
+
+    parseId3v2Frames(tag, version, unsyncFrames, info);
+
+    return end;
+}
+
+void TagReader::parseId3v2Frames(const QByteArray &tag, int version, bool unsyncFrames, TagInfo &info)
+{
+    const int headerSize = version == 2 ? 6 : 10;
+    bool haveFrontCover = false;
+    qsizetype pos = 0;
+
+    while (pos + headerSize <= tag.size())
+    {
+        const char *header = tag.constData() + pos;
+
+        // Reached the padding
+        if (header[0] == 0) break;
+
+        QByteArray id;
+        qint64 size = 0;
+        quint16 flags = 0;
+
+        if (version == 2)
+        {
+            id = QByteArray(header, 3);
+            size = be24(header + 3);
+        }
+        else
+        {
+            id = QByteArray(header, 4);
+            size = version == 4 ? syncsafe(header + 4) : be32(header + 4);
+            flags = (quint16(quint8(header[8])) << 8) | quint8(header[9]);
+        }
+
+        pos += headerSize;
+        if (size <= 0 || size > tag.size() - pos) break;
+
+        QByteArray data = tag.mid(pos, size);
+        pos += size;
+
+        if (version == 3)
+        {
+            // Compressed or encrypted frames are skipped
+            if (flags & 0x00C0) continue;
+            if (flags & 0x0020) data.remove(0, 1);
+        }
+        else if (version == 4)
+        {
+            if (flags & 0x000C) continue;
+            if (flags & 0x0040) data.remove(0, 1);
+            if (flags & 0x0001) data.remove(0, 4);
+            if ((flags & 0x0002) || unsyncFrames) data = removeUnsync(data);
+        }
+
+        if (data.isEmpty()) continue;
+
+        int encoding = quint8(data[0]);
+
+        if (id == "APIC" || id == "PIC")
+        {
+            // APIC: encoding, mime type, picture type, description, data
+            // PIC:  encoding, 3 character image format, picture type, description, data
+            QString mime;
+            qsizetype p = 1;
+            if (version == 2)
+            {
+                if (data.size() < 5) continue;
+                QByteArray format = data.mid(1, 3).toUpper();
+                mime = format == "PNG" ? "image/png" : "image/jpeg";
+                p = 4;
+            }
+            else
+            {
+                qsizetype mimeLength = terminatedLength(data, 1, 0);
+                if (mimeLength < 0) continue;
+                mime = QString::fromLatin1(data.mid(1, mimeLength));
+                p = 1 + mimeLength + 1;
+            }
+
+            if (p >= data.size()) continue;
+            int pictureType = quint8(data[p]);
+            p += 1;
+
+            qsizetype descriptionLength = terminatedLength(data, p, encoding);
+            if (descriptionLength < 0) continue;
+            p += descriptionLength + ((encoding == 1 || encoding == 2) ? 2 : 1);
+
+            if (p >= data.size()) continue;
+
+            // The first picture is used unless a front cover is found later on
+            if (info.art.isEmpty() || (!haveFrontCover && pictureType == 3))
+            {
+                info.art = data.mid(p);
+                info.artMimeType = mime;
+                haveFrontCover = pictureType == 3;
+            }
+            continue;
+        }
+
+        if (!id.startsWith('T')) continue;
+
+        QStringList values = decodeId3Text(data.mid(1), encoding);
+        if (values.isEmpty()) continue;
+
+        if      (id == "TIT2" || id == "TT2") info.title       = values.join(",");
+        else if (id == "TPE1" || id == "TP1") info.artist      = values.join(",");
+        else if (id == "TPE2" || id == "TP2") info.albumArtist = values.join(",");
+        else if (id == "TALB" || id == "TAL") info.album       = values.join(",");
+        else if (id == "TRCK" || id == "TRK") info.track       = parseTrack(values.first());
+        else if (id == "TLEN" || id == "TLE") info.duration    = values.first().toLongLong();
+    }
+}
+
+// Reads the fixed size ID3v1 tag at the end of the file
+// returns true if the tag exists
+bool TagReader::readId3v1(QFile &file, TagInfo &info)
+{
+    if (file.size() < 128 || !file.seek(file.size() - 128)) { return false; }
+
+    QByteArray tag = file.read(128);
+    if (tag.size() < 128 || !tag.startsWith("TAG")) { return false; }
+
+    auto field = [&tag](int offset, int length) {
+        return QString::fromLatin1(tag.mid(offset, length).split('\0').first()).trimmed();
+    };
+
+    if (info.title.isEmpty())  info.title  = field(3, 30);
+    if (info.artist.isEmpty()) info.artist = field(33, 30);
+    if (info.album.isEmpty())  info.album  = field(63, 30);
+
+    // ID3v1.1 stores the track number in the last byte of the comment
+    if (info.track == 0 && tag[125] == 0 && tag[126] != 0) info.track = quint8(tag[126]);
+
+    return true;
+}
+
+// Calculates the duration of an MPEG audio stream from its first frame
+// VBR files are expected to carry a Xing/Info or VBRI header with a frame count
+// otherwise the stream is assumed to be CBR and the length is derived from the bitrate
+qint64 TagReader::mpegDuration(QFile &file, qint64 audioStart, qint64 audioEnd)
+{
+    static const int bitrates[5][16] = {
+        { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 }, // MPEG1 Layer I
+        { 0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384, 0 }, // MPEG1 Layer II
+        { 0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 0 }, // MPEG1 Layer III
+        { 0, 32, 48, 56,  64,  80,  96, 112, 128, 144, 160, 176, 192, 224, 256, 0 }, // MPEG2/2.5 Layer I
+        { 0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160, 0 }, // MPEG2/2.5 Layer II & III
+    };
+    static const int sampleRates[3] = { 44100, 48000, 32000 };
+
+    if (!file.seek(audioStart)) { return 0; }
+    QByteArray buffer = file.read(64 * 1024);
+    const char *data = buffer.constData();
+
+    for (qsizetype i = 0; i + 4 <= buffer.size(); i++)
+    {
+        const quint8 *header = reinterpret_cast<const quint8 *>(data + i);
+        if (header[0] != 0xFF || (header[1] & 0xE0) != 0xE0) continue;
+
+        int versionBits  = (header[1] >> 3) & 3; // 0: MPEG2.5, 1: reserved, 2: MPEG2, 3: MPEG1
+        int layerBits    = (header[1] >> 1) & 3; // 1: Layer III, 2: Layer II, 3: Layer I
+        int bitrateIndex = header[2] >> 4;
+        int rateIndex    = (header[2] >> 2) & 3;
+        int padding      = (header[2] >> 1) & 1;
+        bool mono        = (header[3] >> 6) == 3;
+
+        if (versionBits == 1 || layerBits == 0 || bitrateIndex == 0 || bitrateIndex == 15 || rateIndex == 3) continue;
+
+        bool mpeg1 = versionBits == 3;
+        int layer = 4 - layerBits;
+        int table = mpeg1 ? layer - 1 : (layer == 1 ? 3 : 4);
+        qint64 bitrate = bitrates[table][bitrateIndex] * 1000;
+        int sampleRate = sampleRates[rateIndex] >> (mpeg1 ? 0 : (versionBits == 2 ? 1 : 2));
+        int samplesPerFrame = layer == 1 ? 384 : ((layer == 3 && !mpeg1) ? 576 : 1152);
+
+        qint64 frameLength = layer == 1 ? (12 * bitrate / sampleRate + padding) * 4
+                                        : (samplesPerFrame / 8) * bitrate / sampleRate + padding;
+
+        // Reject false syncs by checking the next frame header when it is in the buffer
+        if (i + frameLength + 2 <= buffer.size())
+        {
+            const quint8 *next = reinterpret_cast<const quint8 *>(data + i + frameLength);
+            if (next[0] != 0xFF || (next[1] & 0xE0) != 0xE0) continue;
+        }
+
+        qsizetype xing = i + 4 + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+        if (xing + 12 <= buffer.size())
+        {
+            QByteArray id(data + xing, 4);
+            if ((id == "Xing" || id == "Info") && (be32(data + xing + 4) & 0x1))
+            {
+                return qint64(be32(data + xing + 8)) * samplesPerFrame * 1000 / sampleRate;
+            }
+        }
+
+        qsizetype vbri = i + 4 + 32;
+        if (vbri + 18 <= buffer.size() && QByteArray(data + vbri, 4) == "VBRI")
+        {
+            return qint64(be32(data + vbri + 14)) * samplesPerFrame * 1000 / sampleRate;
+        }
+
+        qint64 audioBytes = audioEnd - (audioStart + i);
+        return audioBytes > 0 ? audioBytes * 8 * 1000 / bitrate : 0;
+    }
+
+    return 0;
+}
+
+// FLAC: walks the metadata blocks, reading STREAMINFO, VORBIS_COMMENT and PICTURE
+// and seeking over everything else
+bool TagReader::readFlac(QFile &file, TagInfo &info)
+{
+    // Some taggers put an ID3v2 tag in front of the stream marker
+    TagInfo ignored;
+    qint64 start = readId3v2(file, ignored);
+
+    if (!file.seek(start) || file.read(4) != "fLaC") { return false; }
+
+    bool haveFrontCover = false;
+    bool last = false;
+
+    while (!last)
+    {
+        QByteArray header = file.read(4);
+        if (header.size() < 4) break;
+
+        last = quint8(header[0]) & 0x80;
+        int type = quint8(header[0]) & 0x7F;
+        qint64 length = be24(header.constData() + 1);
+
+        if (type != 0 && type != 4 && type != 6)
+        {
+            if (!file.seek(file.pos() + length)) break;
+            continue;
+        }
+
+        QByteArray block = file.read(length);
+        if (block.size() < length) break;
+
+        if (type == 0 && block.size() >= 18)
+        {
+            // STREAMINFO: 20 bit sample rate followed by a 36 bit sample count
+            const char *p = block.constData();
+            quint32 sampleRate = (quint32(quint8(p[10])) << 12) | (quint32(quint8(p[11])) << 4) | (quint8(p[12]) >> 4);
+            quint64 totalSamples = (quint64(quint8(p[13]) & 0x0F) << 32) | be32(p + 14);
+            if (sampleRate > 0) info.duration = totalSamples * 1000 / sampleRate;
+        }
+        else if (type == 4)
+        {
+            parseVorbisComment(block, info);
+        }
+        else if (type == 6 && (info.art.isEmpty() || !haveFrontCover))
+        {
+            // The first picture is used unless a front cover is found later on
+            TagInfo picture;
+            int pictureType = parseFlacPicture(block, picture);
+            if (!picture.art.isEmpty() && (info.art.isEmpty() || pictureType == 3))
+            {
+                info.art = picture.art;
+                info.artMimeType = picture.artMimeType;
+                haveFrontCover = pictureType == 3;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Vorbis comments are little endian length prefixed "KEY=value" UTF-8 strings
+void TagReader::parseVorbisComment(const QByteArray &block, TagInfo &info)
+{
+    const char *p = block.constData();
+    qint64 size = block.size();
+
+    if (size < 8) return;
+    qint64 pos = 4 + qint64(le32(p));
+    if (pos + 4 > size) return;
+
+    quint32 count = le32(p + pos);
+    pos += 4;
+
+    QStringList artists;
+
+    for (quint32 i = 0; i < count && pos + 4 <= size; i++)
+    {
+        qint64 length = le32(p + pos);
+        pos += 4;
+        if (pos + length > size) break;
+
+        QString comment = QString::fromUtf8(p + pos, length);
+        pos += length;
+
+        qsizetype split = comment.indexOf('=');
+        if (split <= 0) continue;
+
+        QString key = comment.left(split).toUpper();
+        QString value = comment.mid(split + 1).trimmed();
+        if (value.isEmpty()) continue;
+
+        if      (key == "TITLE")                                 info.title = value;
+        else if (key == "ARTIST")                                artists << value;
+        else if (key == "ALBUMARTIST" || key == "ALBUM ARTIST")  info.albumArtist = value;
+        else if (key == "ALBUM")                                 info.album = value;
+        else if (key == "TRACKNUMBER")                           info.track = parseTrack(value);
+        else if (key == "METADATA_BLOCK_PICTURE" && info.art.isEmpty())
+        {
+            parseFlacPicture(QByteArray::fromBase64(value.toLatin1()), info);
+        }
+    }
+
+    if (!artists.isEmpty()) info.artist = artists.join(",");
+}
+
+// PICTURE block, all fields are big endian
+// returns the picture type so the caller can prefer front covers, or -1 if the block is invalid
+int TagReader::parseFlacPicture(const QByteArray &block, TagInfo &info)
+{
+    const char *p = block.constData();
+    qint64 size = block.size();
+
+    if (size < 8) return -1;
+    int pictureType = be32(p);
+    qint64 pos = 4;
+
+    qint64 mimeLength = be32(p + pos);
+    pos += 4;
+    if (pos + mimeLength + 4 > size) return -1;
+    QString mime = QString::fromLatin1(p + pos, mimeLength);
+    pos += mimeLength;
+
+    qint64 descriptionLength = be32(p + pos);
+    pos += 4 + descriptionLength;
+
+    // width, height, colour depth and palette size
+    pos += 16;
+    if (pos + 4 > size) return -1;
+
+    qint64 dataLength = be32(p + pos);
+    pos += 4;
+    if (pos + dataLength > size) return -1;
+
+    info.art = block.mid(pos, dataLength);
+    info.artMimeType = mime;
+    return pictureType;
+}
+
+// MP4: the tags are in moov/udta/meta/ilst and the duration in moov/mvhd
+// mdat can be several hundred megabytes and is skipped over, even when moov comes after it
+bool TagReader::readMp4(QFile &file, TagInfo &info)
+{
+    return parseMp4Atoms(file, 0, file.size(), QByteArray(), info);
+}
+
+bool TagReader::parseMp4Atoms(QFile &file, qint64 start, qint64 end, const QByteArray &path, TagInfo &info)
+{
+    qint64 pos = start;
+
+    while (pos + 8 <= end)
+    {
+        if (!file.seek(pos)) { return false; }
+        QByteArray header = file.read(8);
+        if (header.size() < 8) { return false; }
+
+        qint64 size = be32(header.constData());
+        QByteArray type = header.mid(4, 4);
+        qint64 headerSize = 8;
+
+        if (size == 1)
+        {
+            QByteArray largeSize = file.read(8);
+            if (largeSize.size() < 8) { return false; }
+            size = be64(largeSize.constData());
+            headerSize = 16;
+        }
+        else if (size == 0)
+        {
+            size = end - pos;
+        }
+
+        if (size < headerSize || size > end - pos) { return false; }
+
+        qint64 body = pos + headerSize;
+        qint64 bodyEnd = pos + size;
+        QByteArray childPath = path.isEmpty() ? type : path + "/" + type;
+
+        if (type == "moov" && path.isEmpty())
+        {
+            return parseMp4Atoms(file, body, bodyEnd, childPath, info);
+        }
+        else if ((type == "udta" && path == "moov") || (type == "meta" && path == "moov/udta"))
+        {
+            // meta is a full atom in ISO files but QuickTime writes it without the version field
+            if (type == "meta" && file.peek(8).mid(4, 4) != "hdlr") body += 4;
+            parseMp4Atoms(file, body, bodyEnd, childPath, info);
+        }
+        else if (type == "mvhd" && path == "moov")
+        {
+            QByteArray mvhd = file.read(32);
+            if (mvhd.size() >= 20 && mvhd[0] == 0)
+            {
+                quint32 timescale = be32(mvhd.constData() + 12);
+                if (timescale > 0) info.duration = qint64(be32(mvhd.constData() + 16)) * 1000 / timescale;
+            }
+            else if (mvhd.size() >= 32 && mvhd[0] == 1)
+            {
+                quint32 timescale = be32(mvhd.constData() + 20);
+                if (timescale > 0) info.duration = qint64(be64(mvhd.constData() + 24)) * 1000 / timescale;
+            }
+        }
+        else if (type == "ilst" && path == "moov/udta/meta" && size - headerSize <= maxTagSize)
+        {
+            parseIlst(file.read(size - headerSize), info);
+        }
+
+        pos += size;
+    }
+
+    return true;
+}
+
+// Each ilst item wraps a 'data' atom: size, "data", type indicator, locale, value
+void TagReader::parseIlst(const QByteArray &ilst, TagInfo &info)
+{
+    const char *p = ilst.constData();
+    qint64 pos = 0;
+
+    while (pos + 8 <= ilst.size())
+    {
+        qint64 itemSize = be32(p + pos);
+        if (itemSize < 8 || pos + itemSize > ilst.size()) break;
+
+        QByteArray type(p + pos + 4, 4);
+        qint64 dataPos = pos + 8;
+        qint64 itemEnd = pos + itemSize;
+        pos = itemEnd;
+
+        if (dataPos + 16 > itemEnd || QByteArray(p + dataPos + 4, 4) != "data") continue;
+
+        qint64 dataSize = be32(p + dataPos);
+        if (dataSize < 16 || dataPos + dataSize > itemEnd) continue;
+
+        int dataType = be32(p + dataPos + 8) & 0x00FFFFFF;
+        const char *value = p + dataPos + 16;
+        qint64 valueSize = dataSize - 16;
+
+        if      (type == "\xA9nam") info.title       = QString::fromUtf8(value, valueSize).trimmed();
+        else if (type == "\xA9" "ART") info.artist   = QString::fromUtf8(value, valueSize).trimmed();
+        else if (type == "aART")    info.albumArtist = QString::fromUtf8(value, valueSize).trimmed();
+        else if (type == "\xA9" "alb") info.album    = QString::fromUtf8(value, valueSize).trimmed();
+        else if (type == "trkn" && valueSize >= 4)
+        {
+            info.track = (quint8(value[2]) << 8) | quint8(value[3]);
+        }
+        else if (type == "covr" && info.art.isEmpty() && valueSize > 0)
+        {
+            info.art = QByteArray(value, valueSize);
+            info.artMimeType = dataType == 14 ? "image/png" : (dataType == 27 ? "image/bmp" : "image/jpeg");
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef TAGREADER_H
+#define TAGREADER_H
+
+#include <QString>
+#include <QByteArray>
+
+class QFile;
+
+// Metadata read directly from a file's tag blocks
+// Fields that are not present in the file are left empty / zero
+struct TagInfo
+{
+    QString title;
+    QString artist;
+    QString albumArtist;
+    QString album;
+    int track = 0;
+    qint64 duration = 0; // milliseconds
+    QByteArray art;
+    QString artMimeType;
+};
+
+// Reads ID3v2/ID3v1 (MP3), Vorbis comment/PICTURE (FLAC) and ilst (MP4/M4A) tags
+// without going through the media stack. Only the header blocks are read,
+// audio data is skipped over with seeks.
+//
+// All functions are reentrant and may be called from any thread
+class TagReader
+{
+public:
+    static bool readFile(const QString &filePath, TagInfo &info);
+
+private:
+    static bool readMpeg(QFile &file, TagInfo &info);
+    static bool readFlac(QFile &file, TagInfo &info);
+    static bool readMp4(QFile &file, TagInfo &info);
+
+    static qint64 readId3v2(QFile &file, TagInfo &info);
+    static bool readId3v1(QFile &file, TagInfo &info);
+    static qint64 mpegDuration(QFile &file, qint64 audioStart, qint64 audioEnd);
+
+    static void parseId3v2Frames(const QByteArray &tag, int version, bool unsyncFrames, TagInfo &info);
+    static void parseVorbisComment(const QByteArray &block, TagInfo &info);
+    static int parseFlacPicture(const QByteArray &block, TagInfo &info);
+    static bool parseMp4Atoms(QFile &file, qint64 start, qint64 end, const QByteArray &path, TagInfo &info);
+    static void parseIlst(const QByteArray &ilst, TagInfo &info);
+};
+
+#endif // TAGREADER_H
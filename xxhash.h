@@ -0,0 +1,9 @@
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include <QtGlobal>
+
+// 64 bit non-cryptographic hash of size bytes, used to name stored art and check snapshots
+quint64 xxHash64(const char *data, qsizetype size);
+
+#endif // XXHASH_H